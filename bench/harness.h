@@ -0,0 +1,135 @@
+/*
+ * harness: A minimal benchmark runner with machine-readable output.
+ *
+ * Author: Lain Supe (lainproliant)
+ * Date: Wednesday, Oct 14 2026
+ */
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "tinyformat/tinyformat.h"
+
+namespace bench {
+   using namespace std;
+
+   /**
+    * Keep the compiler from discarding the computation of a value
+    * whose result is otherwise unused.
+    */
+   template<class T>
+   inline void keep(const T& value) {
+#if defined(__GNUC__)
+      asm volatile("" : : "m"(value) : "memory");
+#else
+      static const void* volatile sink;
+      sink = &value;
+#endif
+   }
+
+   struct Result {
+      string name;
+      size_t items;
+      uint64_t iterations;
+      double nsPerIteration;
+
+      double get_ns_per_item() const {
+         return nsPerIteration / items;
+      }
+
+      double get_items_per_second() const {
+         return items * 1e9 / nsPerIteration;
+      }
+   };
+
+   /**
+    * Harness <concrete class>
+    *
+    * Times benchmark bodies, each of which processes a given number of
+    * items per call, e.g. inserts 1000 objects into a tree.
+    *
+    * USAGE:
+    * - Call run() for each benchmark.  The body is called repeatedly,
+    *   doubling the number of calls until a batch takes at least the
+    *   minimum time, and the fastest of several such batches is kept.
+    * - Call write_json() and write_table() to report the results.
+    * - Set a filter to run only benchmarks whose names contain it.
+    */
+   class Harness {
+   public:
+      typedef chrono::steady_clock Clock;
+
+      Harness(double minSeconds = 0.1, int batches = 3) :
+         minSeconds(minSeconds), batches(batches) { }
+
+      void set_filter(const string& filter) {
+         this->filter = filter;
+      }
+
+      template<class F>
+      void run(const string& name, size_t items, F body) {
+         if (! filter.empty() && name.find(filter) == string::npos) {
+            return;
+         }
+
+         uint64_t iterations = 1;
+         double elapsed = time(body, iterations);
+         while (elapsed < minSeconds && iterations < (1ull << 40)) {
+            iterations *= 2;
+            elapsed = time(body, iterations);
+         }
+
+         double best = elapsed;
+         for (int x = 1; x < batches; x++) {
+            best = min(best, time(body, iterations));
+         }
+
+         results.push_back(Result {name, items, iterations, best * 1e9 / iterations});
+      }
+
+      const vector<Result>& get_results() const {
+         return results;
+      }
+
+      void write_json(ostream& out) const {
+         out << "{\n  \"benchmarks\": [";
+         for (size_t x = 0; x < results.size(); x++) {
+            const Result& result = results[x];
+            out << (x > 0 ? "," : "") << "\n    {\"name\": \"" << result.name << "\""
+                << ", \"items\": " << result.items
+                << ", \"iterations\": " << result.iterations
+                << ", \"ns_per_iteration\": " << result.nsPerIteration
+                << ", \"ns_per_item\": " << result.get_ns_per_item()
+                << ", \"items_per_second\": " << result.get_items_per_second()
+                << "}";
+         }
+         out << "\n  ]\n}\n";
+      }
+
+      void write_table(ostream& out) const {
+         for (const Result& result : results) {
+            tfm::format(out, "%-40s %10d items %14.1f ns/iter %10.2f ns/item\n",
+               result.name, result.items, result.nsPerIteration, result.get_ns_per_item());
+         }
+      }
+
+   private:
+      template<class F>
+      static double time(F& body, uint64_t iterations) {
+         Clock::time_point start = Clock::now();
+         for (uint64_t x = 0; x < iterations; x++) {
+            body();
+         }
+         return chrono::duration<double>(Clock::now() - start).count();
+      }
+
+      double minSeconds;
+      int batches;
+      string filter;
+      vector<Result> results;
+   };
+}
@@ -0,0 +1,288 @@
+/*
+ * subsystems: Headless benchmarks of the engine's hot paths.
+ *
+ * Author: Lain Supe (lainproliant)
+ * Date: Wednesday, Oct 14 2026
+ */
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+
+#include "harness.h"
+#include "lost_levels/animation.h"
+#include "lost_levels/collision.h"
+#include "lost_levels/draw_list.h"
+#include "lost_levels/entity.h"
+#include "lost_levels/graphics_null.h"
+#include "lost_levels/resources.h"
+
+using namespace std;
+using namespace lost_levels;
+
+const Rect<float> WORLD_RECT = Rect<float>(0, 0, 4096, 4096);
+const Size<int> LOGICAL_SIZE = Size<int>(256, 224);
+
+unsigned int get_time() {
+   return 0;
+}
+
+vector<Rect<float>> random_rects(size_t count, const Rect<float>& area, float maxSize) {
+   mt19937 rng(count);
+   uniform_real_distribution<float> x(area.pt.x, area.pt.x + area.sz.width - maxSize),
+                                    y(area.pt.y, area.pt.y + area.sz.height - maxSize),
+                                    size(1, maxSize);
+   vector<Rect<float>> rects;
+
+   for (size_t n = 0; n < count; n++) {
+      rects.push_back(Rect<float>(x(rng), y(rng), size(rng), size(rng)));
+   }
+
+   return rects;
+}
+
+void bench_collision_tree(bench::Harness& harness) {
+   for (size_t count : {1000, 10000, 100000}) {
+      vector<Rect<float>> rects = random_rects(count, WORLD_RECT, 16);
+      CollisionTree<float, int> tree(WORLD_RECT);
+
+      // Clearing keeps the tree's pools, so this measures steady state
+      // inserts rather than allocation.
+      harness.run(tfm::format("collision_tree.insert/%d", count), count, [&]() {
+         tree.clear();
+         for (size_t x = 0; x < rects.size(); x++) {
+            tree.insert(x, rects[x]);
+         }
+      });
+
+      const size_t QUERIES = 1000;
+      vector<Rect<float>> queries = random_rects(QUERIES, WORLD_RECT, 64);
+      harness.run(tfm::format("collision_tree.visit_overlapping/%d", count), QUERIES, [&]() {
+         size_t found = 0;
+         for (const Rect<float>& query : queries) {
+            tree.visit_overlapping(query, [&](const pair<int, Rect<float>>& entry) {
+               found++;
+            });
+         }
+         bench::keep(found);
+      });
+
+      // Alternate between two offsets, so that every update moves its
+      // entry rather than finding it unchanged.
+      float offset = 0;
+      harness.run(tfm::format("collision_tree.update/%d", count), count, [&]() {
+         offset = offset == 0 ? 1 : 0;
+         for (size_t x = 0; x < rects.size(); x++) {
+            tree.update(x, rects[x].translate(Vector<float>(offset, offset)));
+         }
+      });
+   }
+}
+
+void bench_collider(bench::Harness& harness) {
+   const size_t COUNT = 100000;
+   vector<Rect<float>> rectsA = random_rects(COUNT, Rect<float>(0, 0, 64, 64), 16),
+                       rectsB = random_rects(COUNT + 1, Rect<float>(0, 0, 64, 64), 16);
+   RectArray<float> A, B;
+   for (size_t x = 0; x < COUNT; x++) {
+      A.push_back(rectsA[x]);
+      B.push_back(rectsB[x]);
+   }
+
+   Collider<float> collider;
+   vector<RectSide> results;
+
+   harness.run("collider.collide", COUNT, [&]() {
+      int hits = 0;
+      for (size_t x = 0; x < COUNT; x++) {
+         hits += collider.collide(rectsA[x], rectsB[x]) != NONE;
+      }
+      bench::keep(hits);
+   });
+
+   harness.run("collider.collide_batch", COUNT, [&]() {
+      collider.collide(A, B, results);
+      bench::keep(results[0]);
+   });
+
+   vector<pair<int, int>> pairs;
+   for (size_t x = 0; x < COUNT; x++) {
+      pairs.push_back(make_pair(x, (x * 7919) % COUNT));
+   }
+
+   harness.run("collider.collide_pairs", COUNT, [&]() {
+      collider.collide(A, pairs, results);
+      bench::keep(results[0]);
+   });
+}
+
+void bench_animation(bench::Harness& harness) {
+   auto image = make_shared<null::Image>(Rect<int>(0, 0, 64, 16));
+   auto def = make_shared<const AnimationDef>(image, Size<int>(16, 16),
+      vector<AnimationDef::Frame> {AnimationDef::Frame(0, 3), AnimationDef::Frame(1, 5),
+                                   AnimationDef::Frame(2, 2), AnimationDef::Frame(3, 7)}, true);
+
+   unsigned int ticks = 0;
+   shared_ptr<Timer<uint64_t>> timer = Timer<uint64_t>::create([&]() { return ticks; }, 1);
+   timer->start();
+
+   for (size_t count : {1000, 10000, 100000}) {
+      AnimationSystem animations;
+      vector<shared_ptr<Animation>> instances;
+      for (size_t x = 0; x < count; x++) {
+         animations.add(def, x % 8 != 0);
+         instances.push_back(Animation::create(def, timer));
+         if (x % 8 != 0) {
+            instances.back()->start();
+         }
+      }
+
+      harness.run(tfm::format("animation_system.advance/%d", count), count, [&]() {
+         animations.advance();
+      });
+
+      // The same animations as individual instances, each reading the
+      // timer, for comparison with the bulk system.
+      harness.run(tfm::format("animation.update/%d", count), count, [&]() {
+         ticks++;
+         timer->update();
+         for (auto& animation : instances) {
+            animation->update();
+         }
+      });
+   }
+}
+
+void bench_resources(bench::Harness& harness) {
+   const size_t COUNT = 1000;
+   ResourceManager rm(Timer<uint64_t>::create(get_time, 1), null::create_image_loader());
+   vector<string> names;
+   vector<ResourceHandle<Image>> handles;
+
+   for (size_t x = 0; x < COUNT; x++) {
+      names.push_back(tfm::format("image-%d", x));
+      rm.put(names.back(), make_shared<null::Image>(Rect<int>(0, 0, 16, 16)));
+   }
+
+   for (const string& name : names) {
+      handles.push_back(rm.resolve<Image>(name));
+   }
+
+   harness.run("resource_manager.get_by_name", COUNT, [&]() {
+      for (const string& name : names) {
+         bench::keep(rm.get<Image>(name));
+      }
+   });
+
+   harness.run("resource_manager.get_by_handle", COUNT, [&]() {
+      for (const ResourceHandle<Image>& handle : handles) {
+         bench::keep(rm.get(handle));
+      }
+   });
+}
+
+void bench_draw_commands(bench::Harness& harness) {
+   auto image = make_shared<null::Image>(Rect<int>(0, 0, 128, 64));
+   auto font = ImageFont::create(image, Size<int>(7, 8));
+   font->set_start_char('!');
+   Rect<int> tileRect(0, 0, 16, 16);
+   Rect<int> dstRect(Point<int>(), LOGICAL_SIZE);
+   DrawList list(LOGICAL_SIZE);
+   null::Renderer renderer(LOGICAL_SIZE);
+
+   // The scroll moves every frame, which is the worst case for the
+   // renderer's cached pattern layout.
+   int scroll = 0;
+   harness.run("draw_list.render_pattern", 1, [&]() {
+      scroll++;
+      list.reset();
+      list.render_pattern(image, Point<int>(scroll, scroll / 2), tileRect, dstRect);
+   });
+
+   PatternLayer layer(tileRect, dstRect);
+   harness.run("null_renderer.render_pattern_layer", 1, [&]() {
+      scroll++;
+      layer.set_scroll(Point<int>(scroll, scroll / 2));
+      renderer.render_pattern(image, layer);
+   });
+
+   const string TEXT = "Sprites: 1024\nPairs: 4096\nFPS: 60\n"
+                       "The quick brown fox jumps over the lazy dog.";
+   harness.run("draw_list.print_string", TEXT.size(), [&]() {
+      list.reset();
+      list.print_string(Point<int>(), font, TEXT);
+   });
+
+   // Changing the start char rebuilds the glyph table, so every print
+   // lays out the text again: the worst case for print_string.
+   int startChar = 0;
+   harness.run("draw_list.print_string_relayout", TEXT.size(), [&]() {
+      font->set_start_char(startChar++ % 2 == 0 ? ' ' : '!');
+      list.reset();
+      list.print_string(Point<int>(), font, TEXT);
+   });
+
+   TextRun run(font, TEXT);
+   harness.run("null_renderer.text_run", TEXT.size(), [&]() {
+      renderer.render(run, Point<int>(8, 8));
+   });
+}
+
+void bench_entities(bench::Harness& harness) {
+   const size_t COUNT = 50000;
+   vector<Rect<float>> rects = random_rects(COUNT, WORLD_RECT, 16);
+   EntityStore store;
+   store.reserve(COUNT);
+
+   for (const Rect<float>& rect : rects) {
+      store.create(rect, Vector<float>(0.5, -0.25));
+   }
+
+   harness.run(tfm::format("entity_store.integrate/%d", COUNT), COUNT, [&]() {
+      store.integrate();
+   });
+
+   JobSystem jobs;
+   harness.run(tfm::format("entity_store.integrate_parallel/%d", COUNT), COUNT, [&]() {
+      store.integrate(jobs);
+   });
+
+   SweepAndPrune<float> broadPhase;
+   vector<BroadPhase<float>::Pair> pairs;
+   harness.run(tfm::format("entity_store.broad_phase/%d", COUNT), COUNT, [&]() {
+      store.update_broad_phase(broadPhase);
+      broadPhase.find_pairs(pairs);
+   });
+}
+
+int main(int argc, char** argv) {
+   if (argc > 1 && string(argv[1]) == "--help") {
+      cerr << "usage: " << argv[0] << " [results.json] [filter]" << endl;
+      return 1;
+   }
+
+   bench::Harness harness;
+   if (argc > 2) {
+      harness.set_filter(argv[2]);
+   }
+
+   bench_collision_tree(harness);
+   bench_collider(harness);
+   bench_animation(harness);
+   bench_resources(harness);
+   bench_draw_commands(harness);
+   bench_entities(harness);
+
+   harness.write_table(cout);
+
+   if (argc > 1) {
+      ofstream out(argv[1]);
+      if (! out) {
+         cerr << "Could not open '" << argv[1] << "' for writing." << endl;
+         return 1;
+      }
+      harness.write_json(out);
+   }
+
+   return 0;
+}
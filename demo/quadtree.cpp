@@ -1,11 +1,12 @@
+#include "lost_levels/animation.h"
+#include "lost_levels/broadphase.h"
 #include "lost_levels/diag.h"
 #include "lost_levels/engine.h"
+#include "lost_levels/entity.h"
 #include "lost_levels/collision.h"
 #include "lost_levels/graphics_sdl2.h"
 #include "lost_levels/timer_sdl2.h"
 
-#include <set>
-
 #pragma clang diagnostic ignored "-Wswitch"
 
 using namespace std;
@@ -24,80 +25,28 @@ const Rect<float> LEVEL_RECT = Rect<float>(0, 0,
       LOGICAL_SIZE.width,
       LOGICAL_SIZE.height);
 
-class Block {
-public:
-   Block(int id, Point<float> location, Vector<float> velocity,
-         shared_ptr<Animation> animation) :
-      id(id), rect(Rect<float>(location, BLOCK_SIZE)),
-      velocity(velocity), animation(animation)
-   {
-      prevRect = rect;
-      animation->start();
-   }
-
-   const Rect<float>& get_rect() const {
-      return rect;
-   }
-   
-   shared_ptr<const Animation> get_animation() const {
-      return animation;
-   }
-
-   void update() {
-      prevRect = rect;
-      rect = rect.translate(velocity);
-      
-      if (rect.pt.x < 0 || rect.pt.x + rect.sz.width > LEVEL_RECT.sz.width) {
-         bounce_x();
-      }
-
-      if (rect.pt.y < 0 || rect.pt.y + rect.sz.height > LEVEL_RECT.sz.height) {
-         bounce_y();
-      }
-
-      animation->update();
-   }
-
-   void bounce_x() {
-      velocity.vx *= -1;
-   }
-
-   void bounce_y() {
-      velocity.vy *= -1;
-   }
-
-   int get_id() const {
-      return id;
-   }
-   
-private:
-   int id;
-   Rect<float> rect;
-   Rect<float> prevRect;
-   Vector<float> velocity;
-   shared_ptr<Animation> animation;
-};
-
 class InitialState : public State {
 public:
    InitialState(Engine& engine, const ResourceManager& rm) :
       State(engine), rm(rm), backgroundVelocity(Vector<float>(0.25, 0)),
       frameCalculator(sdl2::create_frame_calculator(engine.get_graphics_timer())),
-      collTree(LEVEL_RECT) { }
+      collTree(LEVEL_RECT), broadPhase(make_shared<SweepAndPrune<float>>()) { }
 
    void initialize() override {
-      diagTimer = sdl2::create_timer(5000);
-      diagTimer->start();
-
       statusFont = ImageFont::create(rm.get<Image>("font"), Size<int>(7, 8));
       statusFont->set_start_char('!');
       background = rm.get<Animation>("stars");
       background->start();
+      blockAnimation = rm.resolve<Animation>("question-block");
+      collTree.debug_split();
+      blocks.set_animation_system(animations);
+      blocks.set_broad_phase(*broadPhase);
+      blocks.set_tree(collTree);
    }
 
    void remove_block(int num = 1) {
-      for (int x = 0; x < num && ! blocks.empty(); x++) {
-         blocks.pop_back();
+      for (int x = 0; x < num && blocks.size() > 0; x++) {
+         blocks.destroy(blocks.get_entities().back());
       }
    }
 
@@ -110,18 +59,23 @@ public:
          Vector<float> velocity = Vector<float>(
             (float)(rand() % 100) / 100.0,
             (float)(rand() % 100) / 100.0);
-         Point<float> location = Point<float>();
-         
-         blocks.push_back(make_shared<Block>(blocks.size(),
-            location, velocity,
-            rm.get<Animation>("question-block")->copy()));
+         Rect<float> rect = Rect<float>(Point<float>(), BLOCK_SIZE);
+
+         Entity block = blocks.create(rect, velocity,
+            animations.add(rm.get(blockAnimation)->get_def()));
+         blocks.components<TextRun>().add(block,
+            TextRun(statusFont, tfm::format("%x", block.index)));
+         collTree.insert(block, rect);
+         broadPhase->set(block.index, rect);
       }
    }
 
    void input() override {
       SDL_Event e;
 
-      while (SDL_PollEvent(&e)) {
+      while (engine.poll_input(e, SDL_PollEvent)) {
+         inputReceived = true;
+
          switch(e.type) {
          case SDL_QUIT:
             engine.pop_state();
@@ -172,6 +126,14 @@ public:
             case SDL_SCANCODE_P:
                paused = !paused;
                break;
+
+            case SDL_SCANCODE_B:
+               toggle_broad_phase();
+               break;
+
+            case SDL_SCANCODE_T:
+               toggle_trace();
+               break;
             }
 
             break;
@@ -180,88 +142,149 @@ public:
    }
    
    void update() override {
-      bool diagPrint = false;
-      collTree.clear();
-      collTree.debug_split();
-      set<pair<int, int>> collisionPairs;
-
-      for (auto b : blocks) {
-         if (!paused) {
-            b->update();
-         }
-
-         collTree.insert(b, b->get_rect());
-      }
-      
-      if (diagTimer->update()) {
-         uint32_t graphicsFrames = engine.get_graphics_timer()->get_frames();
-         double fps = (double)(graphicsFrames - prevGraphicsFrames) / 5.0;
-         prevGraphicsFrames = graphicsFrames;
-         tfm::format(cout, "FPS: %f, Sprites: %d\n", fps, blocks.size());
-         tfm::format(cout, "backgroundVelocity = %s\n", backgroundVelocity);
-         tfm::format(cout, "backgroundPosition = %s\n", backgroundPosition);
-         diagPrint = true;
+      if (!paused) {
+         // Moving a block only touches that block, so fan it out.  The
+         // tree and broad phase are not thread safe, update them after.
+         blocks.integrate(engine.get_jobs(), 64);
+         bounce_blocks();
+         blocks.update_tree(collTree);
+         blocks.update_broad_phase(*broadPhase);
+
+         animations.advance();
+         background->update();
+         backgroundPosition += backgroundVelocity;
       }
 
-      background->update();
-      backgroundPosition += backgroundVelocity;
+      {
+         static const Profiler::ZoneId PAIRS_ZONE = Profiler::get_zone_id("pairs");
+         Profiler::Zone zone(engine.get_profiler(), PAIRS_ZONE);
+         broadPhase->find_pairs(collisionPairs);
+      }
 
       frameCalculator->update();
    }
 
+   void report_damage(Damage& damage) override {
+      // Nothing moves while paused, so only repaint after input.
+      if (! paused || inputReceived) {
+         damage.invalidate();
+      }
+      inputReceived = false;
+   }
+
    void paint() override {
       auto renderer = engine.get_renderer();
       
       Rect<int> bkgRect = Rect<int>(Point<int>(), Size<int>(LOGICAL_SIZE.width,
                background->get_size().height));
-      renderer->render_pattern(background, backgroundPosition.round(), bkgRect);
-
-      for (auto b : blocks) {
-         renderer->render(b->get_animation(), b->get_rect().pt.round());
-         renderer->print_string(b->get_rect().pt.round(), statusFont, tfm::format("%x", b->get_id()));
+      backgroundLayer.set_tile_rect(background->get_frame_rect());
+      backgroundLayer.set_dst_rect(bkgRect);
+      backgroundLayer.set_scroll(backgroundPosition.round());
+      renderer->render_pattern(background->get_image(), backgroundLayer);
+
+      // Sprites and their labels are drawn in separate layers so that
+      // the batching renderer can submit each as a single draw.
+      double alpha = paused ? 1.0 : engine.get_interpolation_alpha();
+      const ComponentPool<TextRun>& labels = blocks.components<TextRun>();
+      for (size_t x = 0; x < blocks.size(); x++) {
+         Entity block = blocks.get_entities()[x];
+         AnimationSystem::Id animation = blocks.get_animations()[x];
+         Point<int> pt = blocks.get_prev_bounds()[x].lerp(blocks.get_bounds()[x], alpha).pt.round();
+         renderer->set_layer(1);
+         renderer->render(animations.get_def(animation), animations.get_state(animation), pt);
+         renderer->set_layer(2);
+         renderer->render(labels.get(block), pt);
       }
+      renderer->set_layer(0);
 
-      render_coll_tree(collTree, COLL_TREE_COLOR);
+      render_coll_tree(COLL_TREE_COLOR);
       renderer->set_draw_color(BKG_RECT_COLOR);
       renderer->draw_rect(bkgRect);
       renderer->set_draw_color(CLEAR_COLOR);
 
-      renderer->print_string(Point<int>(0, LOGICAL_SIZE.height - statusFont->get_size().height * 2),
-                             statusFont,
-                             tfm::format("Sprites: %d\nFPS: %d", blocks.size(), frameCalculator->get_fps()));
+      statusText.set_font(statusFont);
+      statusText.set_text(tfm::format("Sprites: %d\nPairs: %d\nFPS: %d",
+         blocks.size(), collisionPairs.size(), frameCalculator->get_fps()));
+      renderer->render(statusText, Point<int>(0, LOGICAL_SIZE.height - statusText.get_size().height));
 
    }
 
-   void render_coll_tree(const CollisionTree<float, shared_ptr<Block>>& collTree, const Color& color) {
+   /**
+    * Reverse the velocity of blocks which left the level.
+    */
+   void bounce_blocks() {
+      const vector<Rect<float>>& bounds = blocks.get_bounds();
+      vector<Vector<float>>& velocities = blocks.get_velocities();
+
+      for (size_t x = 0; x < blocks.size(); x++) {
+         const Rect<float>& rect = bounds[x];
+
+         if (rect.pt.x < 0 || rect.pt.x + rect.sz.width > LEVEL_RECT.sz.width) {
+            velocities[x].vx *= -1;
+         }
+
+         if (rect.pt.y < 0 || rect.pt.y + rect.sz.height > LEVEL_RECT.sz.height) {
+            velocities[x].vy *= -1;
+         }
+      }
+   }
+
+   void render_coll_tree(const Color& color) {
       auto renderer = engine.get_renderer();
 
       renderer->set_draw_color(color);
-      renderer->draw_rect(collTree.get_rect().round());
+      collTree.visit_nodes([&](const Rect<float>& rect, int level) {
+         renderer->draw_rect(rect.round());
+      });
+   }
 
-      for (auto quad : collTree.get_quadrants()) {
-         render_coll_tree(*quad, color);
+   void toggle_broad_phase() {
+      if (dynamic_pointer_cast<SweepAndPrune<float>>(broadPhase) != nullptr) {
+         broadPhase = make_shared<SpatialHash<float>>(BLOCK_SIZE);
+         cout << "Broad phase: SpatialHash" << endl;
+
+      } else {
+         broadPhase = make_shared<SweepAndPrune<float>>();
+         cout << "Broad phase: SweepAndPrune" << endl;
       }
+
+      blocks.set_broad_phase(*broadPhase);
+      blocks.update_broad_phase(*broadPhase);
    }
 
-private:
-   pair<int, int> ordered_id_pair(int idA, int idB) {
-      return pair<int, int>(
-            idA < idB ? idA : idB,
-            idA < idB ? idB : idA);
+   void toggle_trace() {
+      Profiler& profiler = engine.get_profiler();
+
+      if (profiler.is_tracing()) {
+         profiler.stop_trace();
+         profiler.save_trace("quadtree-trace.json");
+         cout << "Trace saved to quadtree-trace.json" << endl;
+
+      } else {
+         profiler.start_trace();
+         cout << "Tracing..." << endl;
+      }
    }
 
+private:
+
    shared_ptr<Font> statusFont;
+   TextRun statusText;
    shared_ptr<Animation> background;
+   PatternLayer backgroundLayer;
+   ResourceHandle<Animation> blockAnimation;
    Point<float> backgroundPosition;
-   shared_ptr<Timer<uint32_t>> diagTimer;
-   vector<shared_ptr<Block>> blocks;
-   uint32_t prevGraphicsFrames = 0;
+   EntityStore blocks;
+   AnimationSystem animations;
    bool paused = false;
+   bool inputReceived = false;
 
    const ResourceManager& rm;
    Vector<float> backgroundVelocity;
-   shared_ptr<FrameCalculator<uint32_t>> frameCalculator;
-   CollisionTree<float, shared_ptr<Block>> collTree;
+   shared_ptr<FrameCalculator<uint64_t>> frameCalculator;
+   CollisionTree<float, Entity, Entity::Hash> collTree;
+   shared_ptr<BroadPhase<float>> broadPhase;
+   vector<BroadPhase<float>::Pair> collisionPairs;
 };
 
 class DemoEngine : public Engine {
@@ -271,32 +294,73 @@ public:
    void initialize() override {
       set_window(sdl2::create_window(Size<int>(1280, 720),
                  SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE));
-      set_renderer(sdl2::create_renderer(get_window()));
-      set_physics_timer(sdl2::create_timer(1000 / 100, true));
-      set_graphics_timer(sdl2::create_timer(1000 / 60));
+      auto renderer = sdl2::create_renderer(get_window());
+      static_pointer_cast<sdl2::Renderer>(renderer)->set_batching(true);
+      set_renderer(renderer);
+      set_physics_timer(sdl2::create_performance_timer(1000000 / 100, true));
+      set_max_catch_up_steps(5);
+      set_pipelined(true);
+      set_graphics_timer(sdl2::create_performance_timer(1000000 / 60));
 
       get_renderer()->set_logical_size(LOGICAL_SIZE);
       get_renderer()->set_draw_color(CLEAR_COLOR);
 
       rm = make_shared<ResourceManager>(get_physics_timer(),
-            sdl2::create_image_loader(get_renderer()));
+            sdl2::create_atlas_image_loader(get_renderer()));
       rm->load_file("simple-rc/resource.json");
 
       push_state<InitialState>(*rm);
+
+      diagFont = ImageFont::create(rm->get<Image>("font"), Size<int>(7, 8));
+      diagFont->set_start_char('!');
    }
 
-   void delay() override {
-      SDL_Delay(get_graphics_timer()->get_wait_time());
+   void diag_paint() override {
+      get_profiler().paint_overlay(*get_renderer(), diagFont,
+         Point<int>(LOGICAL_SIZE.width - 7 * 29, 0), CLEAR_COLOR);
    }
 
 private:
    shared_ptr<ResourceManager> rm;
+   shared_ptr<ImageFont> diagFont;
 };
 
-int main() {
+int main(int argc, char** argv) {
    DemoEngine engine;
-   srand(time(0));
+   string recordFile, replayFile;
+   bool paint = true;
+
+   for (int x = 1; x < argc; x++) {
+      string arg = argv[x];
+      if (arg == "--record" && x + 1 < argc) {
+         recordFile = argv[++x];
+      } else if (arg == "--replay" && x + 1 < argc) {
+         replayFile = argv[++x];
+      } else if (arg == "--no-paint") {
+         paint = false;
+      } else {
+         cerr << "usage: " << argv[0] << " [--record FILE | --replay FILE [--no-paint]]" << endl;
+         return 1;
+      }
+   }
+
+   // Recorded sessions must place the blocks the same way on replay.
+   if (! recordFile.empty() || ! replayFile.empty()) {
+      srand(1);
+   } else {
+      srand(time(0));
+   }
+
+   engine.set_recording(! recordFile.empty());
+   if (! replayFile.empty()) {
+      engine.set_replay(Recording::load(replayFile), paint);
+   }
 
-   return engine.run();
+   int result = engine.run();
+   if (! recordFile.empty()) {
+      engine.get_recording()->save(recordFile);
+   }
+   Metrics::global().save("quadtree-metrics.json");
+   return result;
 }
 
@@ -66,6 +66,7 @@ public:
       statusFont->set_start_char('!');
       background = rm.get<Animation>("stars");
       background->start();
+      blockAnimation = rm.resolve<Animation>("question-block");
    }
 
    void remove_block(int num = 1) {
@@ -83,14 +84,14 @@ public:
 
          blocks.push_back(make_shared<Block>(
             location, velocity,
-            rm.get<Animation>("question-block")->copy()));
+            rm.get(blockAnimation)->copy()));
       }
    }
 
    void input() override {
       SDL_Event e;
 
-      while (SDL_PollEvent(&e)) {
+      while (engine.poll_input(e, SDL_PollEvent)) {
          switch(e.type) {
          case SDL_QUIT:
             engine.pop_state();
@@ -138,7 +139,7 @@ public:
 
    void update() override {
       if (diagTimer->update()) {
-         uint32_t graphicsFrames = engine.get_graphics_timer()->get_frames();
+         uint64_t graphicsFrames = engine.get_graphics_timer()->get_frames();
          double fps = (double)(graphicsFrames - prevGraphicsFrames) / 5.0;
          prevGraphicsFrames = graphicsFrames;
          tfm::format(cout, "FPS: %f, Sprites: %d\n", fps, blocks.size());
@@ -175,14 +176,70 @@ public:
 private:
    shared_ptr<Font> statusFont;
    shared_ptr<Animation> background;
+   ResourceHandle<Animation> blockAnimation;
    Point<float> backgroundPosition;
    shared_ptr<Timer<uint32_t>> diagTimer;
    vector<shared_ptr<Block>> blocks;
-   uint32_t prevGraphicsFrames = 0;
+   uint64_t prevGraphicsFrames = 0;
 
    const ResourceManager& rm;
    Vector<float> backgroundVelocity;
-   shared_ptr<FrameCalculator<uint32_t>> frameCalculator;
+   shared_ptr<FrameCalculator<uint64_t>> frameCalculator;
+};
+
+/**
+ * Loads the demo's resources in the background while painting a
+ * progress bar, then hands off to InitialState.
+ */
+class LoadingState : public State {
+public:
+   LoadingState(Engine& engine, ResourceManager& rm) :
+      State(engine), rm(rm) { }
+
+   void initialize() override {
+      load = rm.load_file_async("simple-rc/resource.json");
+      load->set_progress_callback([](size_t done, size_t total) {
+         tfm::format(cout, "Loaded %d/%d images.\n", done, total);
+      });
+   }
+
+   void input() override {
+      SDL_Event e;
+
+      while (engine.poll_input(e, SDL_PollEvent)) {
+         if (e.type == SDL_QUIT) {
+            engine.pop_state();
+         }
+      }
+   }
+
+   void update() override {
+      if (started) {
+         // InitialState has been popped, we're done.
+         engine.pop_state();
+
+      } else if (load->update()) {
+         started = true;
+         engine.push_state<InitialState>(rm);
+      }
+   }
+
+   void paint() override {
+      auto renderer = engine.get_renderer();
+      Rect<int> bar = Rect<int>(LOGICAL_SIZE.width / 4, LOGICAL_SIZE.height / 2 - 4,
+                                LOGICAL_SIZE.width / 2, 8);
+
+      renderer->set_draw_color(Color(255, 255, 255));
+      renderer->draw_rect(bar);
+      bar.sz.width = (int)(bar.sz.width * load->get_progress());
+      renderer->fill_rect(bar);
+      renderer->set_draw_color(CLEAR_COLOR);
+   }
+
+private:
+   ResourceManager& rm;
+   shared_ptr<ResourceManager::AsyncLoad> load;
+   bool started = false;
 };
 
 class DemoEngine : public Engine {
@@ -192,21 +249,16 @@ public:
    void initialize() override {
       set_window(sdl2::create_window(Size<int>(1280, 720)));
       set_renderer(sdl2::create_renderer(get_window()));
-      set_physics_timer(sdl2::create_timer(1000 / 100, true));
-      set_graphics_timer(sdl2::create_timer(1000 / 60));
+      set_physics_timer(sdl2::create_performance_timer(1000000 / 100, true));
+      set_graphics_timer(sdl2::create_performance_timer(1000000 / 60));
 
       get_renderer()->set_logical_size(LOGICAL_SIZE);
       get_renderer()->set_draw_color(CLEAR_COLOR);
 
       rm = make_shared<ResourceManager>(get_physics_timer(),
-            sdl2::create_image_loader(get_renderer()));
-      rm->load_file("simple-rc/resource.json");
-
-      push_state<InitialState>(*rm);
-   }
+            sdl2::create_atlas_image_loader(get_renderer()));
 
-   void delay() override {
-      SDL_Delay(get_graphics_timer()->get_wait_time());
+      push_state<LoadingState>(*rm);
    }
 
 private:
@@ -0,0 +1,179 @@
+/*
+ * animation: Bulk playback of many animation instances.
+ *
+ * Author: Lain Supe (lainproliant)
+ * Date: Wednesday, Oct 14 2026
+ */
+#pragma once
+#include <memory>
+#include <vector>
+
+#include "lost_levels/graphics.h"
+
+namespace lost_levels {
+   using namespace std;
+
+   /**
+    * AnimationSystem <concrete class>
+    *
+    * Owns the playback state of many animation instances and advances
+    * them all in one pass, instead of each instance polling its own
+    * timer.  States are stored contiguously next to a pointer to their
+    * shared AnimationDef, so an advance is a tight loop of arithmetic.
+    *
+    * USAGE:
+    * - Call add() for each sprite, keeping the returned id.
+    * - Call advance() once per physics tick, or update() with the
+    *   physics timer's frame count.
+    * - Draw each sprite with Renderer::render(get_def(id),
+    *   get_state(id), pt).
+    * - Call remove() when the sprite is destroyed.  Ids of removed
+    *   instances may be reused by later calls to add().
+    */
+   class AnimationSystem {
+   public:
+      typedef int Id;
+
+      Id add(shared_ptr<const AnimationDef> def, bool playing = true) {
+         Id id;
+         if (freeIds.empty()) {
+            id = denseIndex.size();
+            denseIndex.push_back(-1);
+
+         } else {
+            id = freeIds.back();
+            freeIds.pop_back();
+         }
+
+         denseIndex[id] = ids.size();
+         ids.push_back(id);
+         defs.push_back(def.get());
+         owners.push_back(def);
+         states.push_back(AnimationState());
+         playingFlags.push_back(playing);
+
+         return id;
+      }
+
+      /**
+       * Remove the given instance.  The last instance is moved into
+       * its place, so removal is constant time.
+       */
+      void remove(Id id) {
+         int idx = denseIndex[id];
+         int last = ids.size() - 1;
+
+         ids[idx] = ids[last];
+         defs[idx] = defs[last];
+         owners[idx] = owners[last];
+         states[idx] = states[last];
+         playingFlags[idx] = playingFlags[last];
+         denseIndex[ids[idx]] = idx;
+
+         ids.pop_back();
+         defs.pop_back();
+         owners.pop_back();
+         states.pop_back();
+         playingFlags.pop_back();
+
+         denseIndex[id] = -1;
+         freeIds.push_back(id);
+      }
+
+      void clear() {
+         ids.clear();
+         defs.clear();
+         owners.clear();
+         states.clear();
+         playingFlags.clear();
+         denseIndex.clear();
+         freeIds.clear();
+      }
+
+      size_t size() const {
+         return ids.size();
+      }
+
+      /**
+       * Advance every playing instance by the given number of ticks.
+       */
+      void advance(uint32_t ticks = 1) {
+         const size_t count = states.size();
+
+         for (size_t x = 0; x < count; x++) {
+            if (playingFlags[x]) {
+               AnimationState& state = states[x];
+               const AnimationDef& def = *defs[x];
+
+               // Most ticks don't change frames, skip the general case.
+               if (state.elapsed + ticks < def.get_frame(state.frame).duration) {
+                  state.elapsed += ticks;
+               } else {
+                  state.advance(def, ticks);
+               }
+            }
+         }
+      }
+
+      /**
+       * Advance every playing instance to the given tick of a reference
+       * clock, e.g. the physics timer's get_frames().  The first call
+       * only records the tick.
+       */
+      void update(uint32_t tick) {
+         if (started) {
+            advance(tick - lastTick);
+         }
+
+         lastTick = tick;
+         started = true;
+      }
+
+      const AnimationDef& get_def(Id id) const {
+         return *defs[denseIndex[id]];
+      }
+
+      const AnimationState& get_state(Id id) const {
+         return states[denseIndex[id]];
+      }
+
+      const Rect<int>& get_frame_rect(Id id) const {
+         int idx = denseIndex[id];
+         return defs[idx]->get_frame_rect(states[idx].frame);
+      }
+
+      bool is_complete(Id id) const {
+         int idx = denseIndex[id];
+         return states[idx].is_complete(*defs[idx]);
+      }
+
+      bool is_playing(Id id) const {
+         return playingFlags[denseIndex[id]];
+      }
+
+      void play(Id id) {
+         playingFlags[denseIndex[id]] = true;
+      }
+
+      void pause(Id id) {
+         playingFlags[denseIndex[id]] = false;
+      }
+
+      void reset(Id id) {
+         states[denseIndex[id]].reset();
+      }
+
+   private:
+      vector<Id> ids;
+      vector<const AnimationDef*> defs;
+      vector<AnimationState> states;
+      vector<uint8_t> playingFlags;
+      vector<shared_ptr<const AnimationDef>> owners;
+
+      vector<int> denseIndex;
+      vector<Id> freeIds;
+
+      uint32_t lastTick = 0;
+      bool started = false;
+   };
+}
@@ -0,0 +1,341 @@
+/*
+ * broadphase: Candidate pair generation for collision detection.
+ *
+ * Author: Lain Supe (lainproliant)
+ * Date: Wednesday, Oct 14 2026
+ */
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include "lost_levels/geometry.h"
+
+namespace lost_levels {
+   using namespace std;
+
+   /**
+    * BroadPhase <abstract class>
+    *
+    * Produces the set of object pairs whose bounding rectangles overlap,
+    * to be passed on to narrow phase tests such as Collider.
+    *
+    * Objects are identified by small non-negative integer ids, which
+    * are used as indices into internal storage.  Keep ids dense, e.g.
+    * by using the index of the object in your own object array.
+    *
+    * USAGE:
+    * - Call set() for each object when it is created or moves.
+    * - Call remove() when an object is destroyed.
+    * - Call find_pairs() once per physics tick.  Each overlapping pair
+    *   is reported exactly once, with the lower id first.
+    */
+   template<class T>
+   class BroadPhase {
+   public:
+      typedef pair<int, int> Pair;
+
+      virtual ~BroadPhase() { }
+
+      /**
+       * Insert or update the bounding rectangle for the given id.
+       */
+      virtual void set(int id, const Rect<T>& rect) = 0;
+
+      /**
+       * Remove the given id.  Does nothing if the id is not present.
+       */
+      virtual void remove(int id) = 0;
+
+      /**
+       * Remove all ids.
+       */
+      virtual void clear() = 0;
+
+      /**
+       * Clear the given buffer and fill it with all overlapping pairs.
+       * The buffer is owned by the caller so that it may be reused
+       * between ticks without reallocating.
+       */
+      virtual void find_pairs(vector<Pair>& pairs) = 0;
+
+   protected:
+      /**
+       * An axis-aligned bounding box in min/max form.  Edges which touch
+       * are considered to overlap, as with Rect::intersects().
+       */
+      struct Bounds {
+         Bounds() { }
+         Bounds(int id, const Rect<T>& rect) :
+            minX(rect.pt.x), minY(rect.pt.y),
+            maxX(rect.pt.x + rect.sz.width),
+            maxY(rect.pt.y + rect.sz.height),
+            id(id) { }
+
+         bool overlaps(const Bounds& rhs) const {
+            return minX <= rhs.maxX && rhs.minX <= maxX &&
+                   minY <= rhs.maxY && rhs.minY <= maxY;
+         }
+
+         T minX = 0, minY = 0, maxX = 0, maxY = 0;
+         int id = -1;
+      };
+
+      static Pair ordered_pair(int idA, int idB) {
+         return idA < idB ? Pair(idA, idB) : Pair(idB, idA);
+      }
+   };
+
+   /**
+    * SweepAndPrune <concrete class>
+    *
+    * A sort and sweep broad phase along the x axis.  The sorted order
+    * is kept between calls to find_pairs() and repaired with an
+    * insertion sort, which is close to linear when objects move only
+    * a little between ticks.
+    *
+    * Best suited for moving objects of similar size.
+    */
+   template<class T>
+   class SweepAndPrune : public BroadPhase<T> {
+   public:
+      typedef typename BroadPhase<T>::Pair Pair;
+      typedef typename BroadPhase<T>::Bounds Bounds;
+
+      void set(int id, const Rect<T>& rect) override {
+         if (id >= (int)proxies.size()) {
+            proxies.resize(id + 1);
+         }
+
+         Proxy& proxy = proxies[id];
+         proxy.bounds = Bounds(id, rect);
+         proxy.live = true;
+
+         if (! proxy.sorted) {
+            proxy.sorted = true;
+            sorted.push_back(proxy.bounds);
+         }
+      }
+
+      void remove(int id) override {
+         if (id >= 0 && id < (int)proxies.size()) {
+            proxies[id].live = false;
+         }
+      }
+
+      void clear() override {
+         proxies.clear();
+         sorted.clear();
+      }
+
+      void find_pairs(vector<Pair>& pairs) override {
+         pairs.clear();
+         refresh();
+
+         for (size_t x = 0; x < sorted.size(); x++) {
+            const Bounds& A = sorted[x];
+
+            for (size_t y = x + 1; y < sorted.size() &&
+                 sorted[y].minX <= A.maxX; y++) {
+               const Bounds& B = sorted[y];
+
+               if (A.minY <= B.maxY && B.minY <= A.maxY) {
+                  pairs.push_back(this->ordered_pair(A.id, B.id));
+               }
+            }
+         }
+      }
+
+   private:
+      struct Proxy {
+         Bounds bounds;
+         bool live = false;
+         bool sorted = false;
+      };
+
+      /**
+       * Copy current bounds into the sorted array, drop removed ids,
+       * and restore the order by minX.
+       */
+      void refresh() {
+         size_t count = 0;
+
+         for (size_t x = 0; x < sorted.size(); x++) {
+            Proxy& proxy = proxies[sorted[x].id];
+
+            if (proxy.live) {
+               sorted[count++] = proxy.bounds;
+            } else {
+               proxy.sorted = false;
+            }
+         }
+         sorted.resize(count);
+
+         for (size_t x = 1; x < sorted.size(); x++) {
+            Bounds bounds = sorted[x];
+            size_t y = x;
+
+            for (; y > 0 && sorted[y - 1].minX > bounds.minX; y--) {
+               sorted[y] = sorted[y - 1];
+            }
+            sorted[y] = bounds;
+         }
+      }
+
+      vector<Proxy> proxies;
+      vector<Bounds> sorted;
+   };
+
+   /**
+    * SpatialHash <concrete class>
+    *
+    * A uniform grid broad phase.  Each object is binned into every cell
+    * of the given size that it touches, and the cells are hashed into a
+    * fixed number of buckets with a counting sort, so no per-cell
+    * storage is allocated.
+    *
+    * Best suited for dense tile maps, or many objects of similar size.
+    * Choose a cell size close to the size of a typical object.
+    */
+   template<class T>
+   class SpatialHash : public BroadPhase<T> {
+   public:
+      typedef typename BroadPhase<T>::Pair Pair;
+      typedef typename BroadPhase<T>::Bounds Bounds;
+
+      /**
+       * @param cellSize The width and height of each grid cell.
+       * @param numBuckets The number of hash buckets, rounded up to
+       *    a power of two.
+       */
+      SpatialHash(const Size<T>& cellSize, size_t numBuckets = 4096) :
+         cellSize(cellSize), bucketMask(1) {
+         util::assertTrue(cellSize.width > 0 && cellSize.height > 0,
+            "SpatialHash cell size must be greater than zero.");
+
+         while (bucketMask < numBuckets) {
+            bucketMask <<= 1;
+         }
+         bucketStart.resize(bucketMask + 1);
+         bucketMask --;
+      }
+
+      void set(int id, const Rect<T>& rect) override {
+         if (id >= (int)proxies.size()) {
+            proxies.resize(id + 1);
+         }
+
+         proxies[id] = Bounds(id, rect);
+      }
+
+      void remove(int id) override {
+         if (id >= 0 && id < (int)proxies.size()) {
+            proxies[id].id = -1;
+         }
+      }
+
+      void clear() override {
+         proxies.clear();
+      }
+
+      void find_pairs(vector<Pair>& pairs) override {
+         pairs.clear();
+         bin();
+
+         for (size_t bucket = 0; bucket <= bucketMask; bucket++) {
+            for (size_t x = bucketStart[bucket]; x < bucketStart[bucket + 1]; x++) {
+               const Cell& A = cells[x];
+
+               for (size_t y = x + 1; y < bucketStart[bucket + 1]; y++) {
+                  const Cell& B = cells[y];
+
+                  if (A.cx == B.cx && A.cy == B.cy &&
+                      A.id != B.id && is_reference_cell(A, B)) {
+                     pairs.push_back(this->ordered_pair(A.id, B.id));
+                  }
+               }
+            }
+         }
+      }
+
+   private:
+      struct Cell {
+         int cx = 0, cy = 0;
+         int id = -1;
+      };
+
+      int cell_x(T x) const {
+         return (int)floor((double)x / cellSize.width);
+      }
+
+      int cell_y(T y) const {
+         return (int)floor((double)y / cellSize.height);
+      }
+
+      size_t bucket_of(int cx, int cy) const {
+         return ((size_t)(unsigned int)cx * 73856093u ^
+                 (size_t)(unsigned int)cy * 19349663u) & bucketMask;
+      }
+
+      /**
+       * A pair of objects may share several cells.  It is only reported
+       * from the cell holding the top left corner of their intersection,
+       * so that each pair is found exactly once.
+       */
+      bool is_reference_cell(const Cell& A, const Cell& B) const {
+         const Bounds& a = proxies[A.id];
+         const Bounds& b = proxies[B.id];
+
+         return a.overlaps(b) &&
+                cell_x(max(a.minX, b.minX)) == A.cx &&
+                cell_y(max(a.minY, b.minY)) == A.cy;
+      }
+
+      /**
+       * Bin every live object into the cells it touches, grouped by
+       * bucket via a two pass counting sort.
+       */
+      void bin() {
+         fill(bucketStart.begin(), bucketStart.end(), 0);
+         scratch.clear();
+
+         for (const Bounds& bounds : proxies) {
+            if (bounds.id == -1) {
+               continue;
+            }
+
+            Cell cell;
+            cell.id = bounds.id;
+            int cxmin = cell_x(bounds.minX), cxmax = cell_x(bounds.maxX),
+                cymin = cell_y(bounds.minY), cymax = cell_y(bounds.maxY);
+
+            for (cell.cy = cymin; cell.cy <= cymax; cell.cy++) {
+               for (cell.cx = cxmin; cell.cx <= cxmax; cell.cx++) {
+                  scratch.push_back(cell);
+                  bucketStart[bucket_of(cell.cx, cell.cy) + 1] ++;
+               }
+            }
+         }
+
+         for (size_t bucket = 1; bucket < bucketStart.size(); bucket++) {
+            bucketStart[bucket] += bucketStart[bucket - 1];
+         }
+
+         cells.resize(scratch.size());
+         cursor.assign(bucketStart.begin(), bucketStart.end() - 1);
+         for (const Cell& cell : scratch) {
+            cells[cursor[bucket_of(cell.cx, cell.cy)]++] = cell;
+         }
+      }
+
+      Size<T> cellSize;
+      size_t bucketMask;
+
+      vector<Bounds> proxies;
+      vector<Cell> scratch;
+      vector<Cell> cells;
+      vector<size_t> bucketStart;
+      vector<size_t> cursor;
+   };
+}
@@ -0,0 +1,675 @@
+/*
+ * bundle: A packed binary format for levels and resources.
+ *
+ * Author: Lain Supe (lainproliant)
+ * Date: Wednesday, Oct 14 2026
+ */
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#  include <iterator>
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+#include "lain/exception.h"
+#include "tinyformat/tinyformat.h"
+#include "lost_levels/graphics.h"
+#include "lost_levels/level.h"
+
+namespace lost_levels {
+   using namespace std;
+   using namespace lain;
+
+   class BundleException : public Exception {
+      using Exception::Exception;
+   };
+
+   /**
+    * The on-disk layout of a bundle.  All values are in the byte order
+    * of the machine which wrote the bundle, so bundles should be built
+    * for the platform they will be loaded on.
+    *
+    * A bundle begins with a Header, followed by a table of Sections.
+    * Each section refers to a span of the file, aligned to ALIGNMENT
+    * bytes, holding either raw data (block map cells, atlas page
+    * pixels) or an array of records.  Names are offsets into the
+    * single STRINGS section, which holds NUL terminated strings.
+    */
+   namespace bundle_format {
+      const char MAGIC[8] = {'L', 'L', 'B', 'U', 'N', 'D', 'L', 'E'};
+      const uint32_t VERSION = 1;
+      const size_t ALIGNMENT = 16;
+
+      enum SectionType : uint32_t {
+         STRINGS = 1,
+
+         // An array of BlockRecords.
+         BLOCK_SET = 2,
+
+         // params: width, height, block width, block height in pixels.
+         // link: the name of the block set.  Data: width * height
+         // uint16_t block ids in row-major order.
+         BLOCK_MAP = 3,
+
+         // params: width, height, pitch in bytes.  Data: RGBA32 pixels,
+         // i.e. bytes in R, G, B, A order.
+         ATLAS_PAGE = 4,
+
+         // An array of ImageRecords.
+         IMAGES = 5,
+
+         // An array of AnimationRecords.
+         ANIMATIONS = 6,
+
+         // An array of FrameRecords, referred to by AnimationRecords.
+         FRAMES = 7
+      };
+
+      struct Header {
+         char magic[8];
+         uint32_t version;
+         uint32_t numSections;
+         uint64_t sectionTableOffset;
+      };
+
+      struct Section {
+         uint32_t type;
+         uint32_t name;
+         uint32_t link;
+         uint32_t reserved;
+         uint64_t offset;
+         uint64_t size;
+         uint32_t params[4];
+      };
+
+      enum BlockFlags : uint32_t {
+         SOLID = 1
+      };
+
+      struct BlockRecord {
+         uint32_t id;
+         uint32_t name;
+         uint32_t flags;
+      };
+
+      struct ImageRecord {
+         uint32_t name;
+         uint32_t page;
+         int32_t x, y, width, height;
+      };
+
+      struct AnimationRecord {
+         uint32_t name;
+         uint32_t image;
+         int32_t frameWidth, frameHeight;
+         uint32_t firstFrame;
+         uint32_t numFrames;
+         uint32_t looping;
+         uint32_t reserved;
+      };
+
+      struct FrameRecord {
+         int32_t tileNum;
+         uint32_t duration;
+      };
+   }
+
+   /**
+    * MappedFile <concrete class>
+    *
+    * A read-only view of a whole file.  The file is memory mapped, so
+    * its pages are only read from disk when they are first touched.
+    * Where mmap() is not available the file is read into memory.
+    */
+   class MappedFile {
+   public:
+      MappedFile(const string& filename) {
+#if defined(_WIN32)
+         ifstream in(filename, ios::binary);
+         if (! in) {
+            throw BundleException(tfm::format("Could not open '%s'.", filename));
+         }
+         buffer.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+         data = (const uint8_t*)buffer.data();
+         size = buffer.size();
+#else
+         int fd = ::open(filename.c_str(), O_RDONLY);
+         if (fd < 0) {
+            throw BundleException(tfm::format("Could not open '%s': %s", filename, string(strerror(errno))));
+         }
+
+         struct stat st;
+         if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            throw BundleException(tfm::format("Could not read '%s', or it is empty.", filename));
+         }
+
+         size = st.st_size;
+         void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+         ::close(fd);
+
+         if (addr == MAP_FAILED) {
+            throw BundleException(tfm::format("Could not map '%s': %s", filename, string(strerror(errno))));
+         }
+         data = (const uint8_t*)addr;
+#endif
+      }
+
+      ~MappedFile() {
+#if ! defined(_WIN32)
+         munmap((void*)data, size);
+#endif
+      }
+
+      MappedFile(const MappedFile&) = delete;
+      MappedFile& operator=(const MappedFile&) = delete;
+
+      const uint8_t* get_data() const {
+         return data;
+      }
+
+      size_t get_size() const {
+         return size;
+      }
+
+   private:
+      const uint8_t* data = nullptr;
+      size_t size = 0;
+#if defined(_WIN32)
+      vector<char> buffer;
+#endif
+   };
+
+   /**
+    * Bundle <concrete class>
+    *
+    * A bundle file opened for reading.  The file is validated when it
+    * is opened, after which its contents are used in place: block maps
+    * refer directly to their cells in the mapped file and atlas pages
+    * are uploaded straight from it, see ResourceManager::load_bundle().
+    *
+    * USAGE:
+    * - Build bundles with BundleWriter, or convert a resource file
+    *   with the make_bundle tool.
+    * - Call Bundle::open() to open a bundle.
+    *
+    * NOTE:
+    * - The file must not be modified while it is open.
+    */
+   class Bundle {
+   public:
+      struct Page {
+         Size<int> size;
+         int pitch;
+         const uint8_t* pixels;
+      };
+
+      struct ImageEntry {
+         string name;
+         int page;
+         Rect<int> rect;
+      };
+
+      struct AnimationEntry {
+         string name;
+         string image;
+         Size<int> szFrame;
+         vector<AnimationDef::Frame> frames;
+         bool looping;
+      };
+
+      /**
+       * Open and validate the bundle at the given location.
+       *
+       * @throws BundleException if the file can't be read or is not a
+       *    valid bundle.
+       */
+      static shared_ptr<Bundle> open(const string& filename) {
+         try {
+            return shared_ptr<Bundle>(new Bundle(make_shared<MappedFile>(filename)));
+
+         } catch (const BundleException& e) {
+            throw BundleException(tfm::format("Failed to open bundle '%s': %s",
+               filename, string(e.what())));
+         }
+      }
+
+      const vector<Page>& get_pages() const {
+         return pages;
+      }
+
+      const vector<ImageEntry>& get_images() const {
+         return images;
+      }
+
+      const vector<AnimationEntry>& get_animations() const {
+         return animations;
+      }
+
+      vector<string> get_block_map_names() const {
+         vector<string> names;
+         for (auto& kv : blockMaps) {
+            names.push_back(kv.first);
+         }
+         return names;
+      }
+
+      bool has_block_map(const string& name) const {
+         return blockMaps.find(name) != blockMaps.end();
+      }
+
+      /**
+       * @throws BundleException if there is no block set with this name.
+       */
+      shared_ptr<const BlockDataSet> get_block_set(const string& name) const {
+         auto iter = blockSets.find(name);
+         if (iter == blockSets.end()) {
+            throw BundleException(tfm::format("No block set named '%s' in bundle.", name));
+         }
+
+         return iter->second;
+      }
+
+      /**
+       * Create a BlockMap referring to its cells in the mapped file.  The
+       * map keeps the file mapped for as long as it refers to them.
+       *
+       * @throws BundleException if there is no block map with this name.
+       */
+      shared_ptr<BlockMap> get_block_map(const string& name) const {
+         auto iter = blockMaps.find(name);
+         if (iter == blockMaps.end()) {
+            throw BundleException(tfm::format("No block map named '%s' in bundle.", name));
+         }
+
+         const bundle_format::Section& section = *iter->second;
+         return make_shared<BlockMap>(get_block_set(get_string(section.link)),
+            Size<int>(section.params[0], section.params[1]),
+            Size<int>(section.params[2], section.params[3]),
+            (const BlockId*)(file->get_data() + section.offset), file);
+      }
+
+   private:
+      Bundle(shared_ptr<MappedFile> file) : file(file) {
+         using namespace bundle_format;
+         const uint8_t* data = file->get_data();
+         size_t size = file->get_size();
+
+         if (size < sizeof(Header) || memcmp(data, MAGIC, sizeof(MAGIC)) != 0) {
+            throw BundleException("Not a bundle file.");
+         }
+
+         const Header& header = *(const Header*)data;
+         if (header.version != VERSION) {
+            throw BundleException(tfm::format("Unsupported bundle version %d.", header.version));
+         }
+
+         if (header.sectionTableOffset % ALIGNMENT != 0 ||
+             header.sectionTableOffset > size ||
+             header.numSections > (size - header.sectionTableOffset) / sizeof(Section)) {
+            throw BundleException("Section table is out of bounds.");
+         }
+
+         const Section* sections = (const Section*)(data + header.sectionTableOffset);
+         const Section* framesSection = nullptr;
+
+         for (uint32_t x = 0; x < header.numSections; x++) {
+            const Section& section = sections[x];
+            if (section.offset % ALIGNMENT != 0 || section.offset > size ||
+                section.size > size - section.offset) {
+               throw BundleException(tfm::format("Section %d is out of bounds.", x));
+            }
+
+            if (section.type == STRINGS) {
+               strings = (const char*)(data + section.offset);
+               stringsSize = section.size;
+               if (stringsSize == 0 || strings[stringsSize - 1] != '\0') {
+                  throw BundleException("String table is not terminated.");
+               }
+
+            } else if (section.type == FRAMES) {
+               framesSection = &section;
+            }
+         }
+
+         if (strings == nullptr) {
+            throw BundleException("Bundle has no string table.");
+         }
+
+         for (uint32_t x = 0; x < header.numSections; x++) {
+            const Section& section = sections[x];
+            const uint8_t* sectionData = data + section.offset;
+
+            switch (section.type) {
+            case BLOCK_SET:
+               blockSets[get_string(section.name)] = read_block_set(section, sectionData);
+               break;
+
+            case BLOCK_MAP:
+               if ((uint64_t)section.params[0] * section.params[1] * sizeof(BlockId) != section.size) {
+                  throw BundleException(tfm::format("Block map '%s' has the wrong size.",
+                     get_string(section.name)));
+               }
+               blockMaps[get_string(section.name)] = &section;
+               break;
+
+            case ATLAS_PAGE:
+               if (section.params[2] < section.params[0] * 4 ||
+                   (uint64_t)section.params[2] * section.params[1] > section.size) {
+                  throw BundleException(tfm::format("Atlas page %d has the wrong size.", pages.size()));
+               }
+               pages.push_back(Page {
+                  Size<int>(section.params[0], section.params[1]),
+                  (int)section.params[2], sectionData });
+               break;
+
+            case IMAGES:
+               for (auto& record : get_records<ImageRecord>(section, sectionData)) {
+                  images.push_back(ImageEntry {
+                     get_string(record.name), (int)record.page,
+                     Rect<int>(record.x, record.y, record.width, record.height) });
+               }
+               break;
+
+            case ANIMATIONS:
+               read_animations(section, sectionData, framesSection);
+               break;
+            }
+         }
+
+         for (auto& image : images) {
+            if (image.page < 0 || image.page >= (int)pages.size() ||
+                ! Rect<int>(pages[image.page].size).contains(image.rect)) {
+               throw BundleException(tfm::format("Image '%s' is outside of its atlas page.", image.name));
+            }
+         }
+
+         for (auto& kv : blockMaps) {
+            get_block_set(get_string(kv.second->link));
+         }
+      }
+
+      string get_string(uint32_t offset) const {
+         if (offset >= stringsSize) {
+            throw BundleException("String offset is out of bounds.");
+         }
+
+         return string(strings + offset);
+      }
+
+      template<class R>
+      vector<R> get_records(const bundle_format::Section& section, const uint8_t* sectionData) const {
+         if (section.size % sizeof(R) != 0) {
+            throw BundleException(tfm::format("Section '%s' has the wrong size.", get_string(section.name)));
+         }
+
+         const R* records = (const R*)sectionData;
+         return vector<R>(records, records + section.size / sizeof(R));
+      }
+
+      shared_ptr<const BlockDataSet> read_block_set(const bundle_format::Section& section,
+                                                    const uint8_t* sectionData) const {
+         auto blockSet = make_shared<BlockDataSet>();
+
+         for (auto& record : get_records<bundle_format::BlockRecord>(section, sectionData)) {
+            try {
+               blockSet->add_block(BlockData(get_string(record.name), record.id,
+                  (record.flags & bundle_format::SOLID) != 0));
+
+            } catch (const LevelDataException& e) {
+               throw BundleException(e.what());
+            }
+         }
+
+         return blockSet;
+      }
+
+      void read_animations(const bundle_format::Section& section, const uint8_t* sectionData,
+                           const bundle_format::Section* framesSection) {
+         using namespace bundle_format;
+         vector<FrameRecord> frames;
+
+         if (framesSection != nullptr) {
+            frames = get_records<FrameRecord>(*framesSection, file->get_data() + framesSection->offset);
+         }
+
+         for (auto& record : get_records<AnimationRecord>(section, sectionData)) {
+            AnimationEntry entry;
+            entry.name = get_string(record.name);
+            entry.image = get_string(record.image);
+            entry.szFrame = Size<int>(record.frameWidth, record.frameHeight);
+            entry.looping = record.looping != 0;
+
+            if (record.numFrames == 0 || record.firstFrame > frames.size() ||
+                record.numFrames > frames.size() - record.firstFrame) {
+               throw BundleException(tfm::format("Animation '%s' has invalid frames.", entry.name));
+            }
+
+            for (uint32_t x = record.firstFrame; x < record.firstFrame + record.numFrames; x++) {
+               entry.frames.push_back(AnimationDef::Frame(frames[x].tileNum, frames[x].duration));
+            }
+
+            animations.push_back(entry);
+         }
+      }
+
+      shared_ptr<MappedFile> file;
+      const char* strings = nullptr;
+      size_t stringsSize = 0;
+
+      vector<Page> pages;
+      vector<ImageEntry> images;
+      vector<AnimationEntry> animations;
+      map<string, shared_ptr<const BlockDataSet>> blockSets;
+      map<string, const bundle_format::Section*> blockMaps;
+   };
+
+   /**
+    * BundleWriter <concrete class>
+    *
+    * Builds a bundle file, see Bundle.
+    *
+    * USAGE:
+    * - Add block sets, block maps, atlas pages, images and animations.
+    *   Images refer to atlas pages by the index returned from
+    *   add_atlas_page(), animations and block maps refer to images and
+    *   block sets by name.
+    * - Call save() to write the bundle.
+    */
+   class BundleWriter {
+   public:
+      void add_block_set(const string& name, const BlockDataSet& blockSet) {
+         PendingSection& section = add_section(bundle_format::BLOCK_SET, name);
+
+         for (size_t id = 0; id < blockSet.size(); id++) {
+            if (blockSet.has_block(id)) {
+               const BlockData& block = blockSet.get_block(id);
+               append(section.data, bundle_format::BlockRecord {
+                  (uint32_t)id, intern(block.name),
+                  block.solid ? (uint32_t)bundle_format::SOLID : 0 });
+            }
+         }
+      }
+
+      void add_block_map(const string& name, const BlockMap& blockMap,
+                         const string& blockSetName) {
+         PendingSection& section = add_section(bundle_format::BLOCK_MAP, name);
+         const Size<int>& szMap = blockMap.get_level_size();
+         const Size<int>& szBlock = blockMap.get_block_size();
+
+         section.link = intern(blockSetName);
+         section.params[0] = szMap.width;
+         section.params[1] = szMap.height;
+         section.params[2] = szBlock.width;
+         section.params[3] = szBlock.height;
+         append_bytes(section.data, blockMap.get_cells(),
+                      blockMap.get_num_cells() * sizeof(BlockId));
+      }
+
+      /**
+       * Add an atlas page of RGBA32 pixels.
+       *
+       * @param pitch The number of bytes between rows of pixels.
+       * @return The page's index, for add_image().
+       */
+      int add_atlas_page(const Size<int>& sz, const void* pixels, int pitch) {
+         PendingSection& section = add_section(bundle_format::ATLAS_PAGE, "");
+         section.params[0] = sz.width;
+         section.params[1] = sz.height;
+         section.params[2] = sz.width * 4;
+
+         for (int y = 0; y < sz.height; y++) {
+            append_bytes(section.data, (const uint8_t*)pixels + (size_t)y * pitch, sz.width * 4);
+         }
+
+         return numPages++;
+      }
+
+      void add_image(const string& name, int page, const Rect<int>& rect) {
+         imageRecords.push_back(bundle_format::ImageRecord {
+            intern(name), (uint32_t)page,
+            rect.pt.x, rect.pt.y, rect.sz.width, rect.sz.height });
+      }
+
+      void add_animation(const string& name, const string& image,
+                         const Size<int>& szFrame,
+                         const vector<AnimationDef::Frame>& frames,
+                         bool looping) {
+         animationRecords.push_back(bundle_format::AnimationRecord {
+            intern(name), intern(image), szFrame.width, szFrame.height,
+            (uint32_t)frameRecords.size(), (uint32_t)frames.size(), looping, 0 });
+
+         for (auto& frame : frames) {
+            frameRecords.push_back(bundle_format::FrameRecord { frame.tileNum, frame.duration });
+         }
+      }
+
+      /**
+       * @return The contents of the bundle file.
+       */
+      vector<uint8_t> serialize() const {
+         using namespace bundle_format;
+         vector<PendingSection> all = sections;
+
+         all.push_back(record_section(IMAGES, imageRecords));
+         all.push_back(record_section(ANIMATIONS, animationRecords));
+         all.push_back(record_section(FRAMES, frameRecords));
+
+         PendingSection stringSection;
+         stringSection.type = STRINGS;
+         stringSection.data = stringTable;
+         all.push_back(stringSection);
+
+         Header header;
+         memcpy(header.magic, MAGIC, sizeof(MAGIC));
+         header.version = VERSION;
+         header.numSections = all.size();
+         header.sectionTableOffset = align(sizeof(Header));
+
+         vector<Section> table(all.size());
+         uint64_t offset = align(header.sectionTableOffset + table.size() * sizeof(Section));
+
+         for (size_t x = 0; x < all.size(); x++) {
+            table[x] = Section {
+               all[x].type, all[x].name, all[x].link, 0, offset, all[x].data.size(),
+               {all[x].params[0], all[x].params[1], all[x].params[2], all[x].params[3]} };
+            offset = align(offset + all[x].data.size());
+         }
+
+         vector<uint8_t> output(offset, 0);
+         memcpy(output.data(), &header, sizeof(header));
+         memcpy(output.data() + header.sectionTableOffset, table.data(), table.size() * sizeof(Section));
+         for (size_t x = 0; x < all.size(); x++) {
+            if (! all[x].data.empty()) {
+               memcpy(output.data() + table[x].offset, all[x].data.data(), all[x].data.size());
+            }
+         }
+
+         return output;
+      }
+
+      /**
+       * Write the bundle to the given file.
+       *
+       * @throws BundleException if the file can't be written.
+       */
+      void save(const string& filename) const {
+         vector<uint8_t> output = serialize();
+         ofstream out(filename, ios::binary);
+
+         if (! out.write((const char*)output.data(), output.size())) {
+            throw BundleException(tfm::format("Could not write bundle '%s'.", filename));
+         }
+      }
+
+   private:
+      struct PendingSection {
+         uint32_t type = 0;
+         uint32_t name = 0;
+         uint32_t link = 0;
+         uint32_t params[4] = {0, 0, 0, 0};
+         vector<uint8_t> data;
+      };
+
+      static uint64_t align(uint64_t offset) {
+         return (offset + bundle_format::ALIGNMENT - 1) / bundle_format::ALIGNMENT * bundle_format::ALIGNMENT;
+      }
+
+      static void append_bytes(vector<uint8_t>& data, const void* bytes, size_t size) {
+         data.insert(data.end(), (const uint8_t*)bytes, (const uint8_t*)bytes + size);
+      }
+
+      template<class R>
+      static void append(vector<uint8_t>& data, const R& record) {
+         append_bytes(data, &record, sizeof(R));
+      }
+
+      template<class R>
+      PendingSection record_section(bundle_format::SectionType type, const vector<R>& records) const {
+         PendingSection section;
+         section.type = type;
+         append_bytes(section.data, records.data(), records.size() * sizeof(R));
+         return section;
+      }
+
+      PendingSection& add_section(bundle_format::SectionType type, const string& name) {
+         sections.push_back(PendingSection());
+         sections.back().type = type;
+         sections.back().name = intern(name);
+         return sections.back();
+      }
+
+      uint32_t intern(const string& str) {
+         auto iter = stringOffsets.find(str);
+         if (iter != stringOffsets.end()) {
+            return iter->second;
+         }
+
+         uint32_t offset = stringTable.size();
+         stringTable.insert(stringTable.end(), str.begin(), str.end());
+         stringTable.push_back('\0');
+         stringOffsets[str] = offset;
+         return offset;
+      }
+
+      vector<PendingSection> sections;
+      vector<bundle_format::ImageRecord> imageRecords;
+      vector<bundle_format::AnimationRecord> animationRecords;
+      vector<bundle_format::FrameRecord> frameRecords;
+      int numPages = 0;
+
+      vector<uint8_t> stringTable;
+      map<string, uint32_t> stringOffsets;
+   };
+}
@@ -5,30 +5,97 @@
  * Date: Thursday, Dec 22 2016
  */
 #pragma once
+#include <cstdint>
+#include <unordered_map>
+
 #include "geometry.h"
+#include "metrics.h"
+
+/*
+ * The batched collision kernels use the widest vector instruction set
+ * enabled by the compiler flags.  Define LOST_LEVELS_NO_SIMD to force
+ * the scalar implementation.
+ */
+#if ! defined(LOST_LEVELS_NO_SIMD)
+#  if defined(__AVX__)
+#     include <immintrin.h>
+#     define LOST_LEVELS_SIMD_AVX
+#  elif defined(__SSE2__) || defined(_M_X64)
+#     include <emmintrin.h>
+#     define LOST_LEVELS_SIMD_SSE
+#  elif defined(__ARM_NEON)
+#     include <arm_neon.h>
+#     define LOST_LEVELS_SIMD_NEON
+#  endif
+#endif
 
 namespace lost_levels { 
+   /**
+    * A structure-of-arrays container for rectangles, used as input to
+    * the batched collision kernels in Collider.
+    */
    template<class T>
-   class Collider {
+   class RectArray {
    public:
+      size_t size() const {
+         return x.size();
+      }
+
+      void clear() {
+         x.clear();
+         y.clear();
+         width.clear();
+         height.clear();
+      }
+
+      void resize(size_t n) {
+         x.resize(n);
+         y.resize(n);
+         width.resize(n);
+         height.resize(n);
+      }
+
+      void push_back(const Rect<T>& rect) {
+         x.push_back(rect.pt.x);
+         y.push_back(rect.pt.y);
+         width.push_back(rect.sz.width);
+         height.push_back(rect.sz.height);
+      }
+
+      void set(size_t idx, const Rect<T>& rect) {
+         x[idx] = rect.pt.x;
+         y[idx] = rect.pt.y;
+         width[idx] = rect.sz.width;
+         height[idx] = rect.sz.height;
+      }
+
+      Rect<T> get(size_t idx) const {
+         return Rect<T>(x[idx], y[idx], width[idx], height[idx]);
+      }
+
+      vector<T> x, y, width, height;
+   };
+
+   namespace simd {
       /**
-       * Determine the direction of collision if two rectangles
-       * overlap by calculating the Minowski sum of the two
-       * rectangles.  If the rectangles do not overlap,
-       * RectSide.NONE is returned (check for it!)
+       * Classify the collision of rectangle A with rectangle B, as
+       * described in Collider::collide().
        */
-      RectSide collide(const Rect<T>& r1, const Rect<T>& r2) {
-         Point<T> centerA = r1.center(),
-                  centerB = r2.center();
-         float w  = (r1.sz.width + r2.sz.width) / ((T) 2),
-               h  = (r1.sz.height + r2.sz.height) / ((T) 2),
-               dx = centerA.x - centerB.x,
-               dy = centerA.y - centerB.y;
-
-         if (abs(dx) <= w && abs(dy) <= h) {
-            float wy = w * dy;
-            float hx = h * dx;
-            
+      template<class T>
+      inline RectSide collide_aabb(T ax, T ay, T aw, T ah,
+                                   T bx, T by, T bw, T bh) {
+         // Half extents and center distances are kept doubled, so that
+         // every value is exact in T, including integer types.  Scaling
+         // by 2 doesn't change any comparison below.
+         T w  = aw + bw,
+           h  = ah + bh,
+           dx = (ax + ax + aw) - (bx + bx + bw),
+           dy = (ay + ay + ah) - (by + by + bh);
+
+         if ((dx < 0 ? -dx : dx) <= w && (dy < 0 ? -dy : dy) <= h) {
+            T wy = w * dy;
+            T hx = h * dx;
+
             if (wy > hx) {
                return wy > -hx ? TOP : LEFT;
             } else {
@@ -38,8 +105,159 @@ namespace lost_levels {
             return NONE;
          }
       }
-   };
 
+      /**
+       * Classify the collisions of n pairs of rectangles given as
+       * structure-of-arrays data, where pair i is A[i] and B[i].
+       * This is the scalar fallback for types other than float.
+       */
+      template<class T>
+      inline void collide_aabb(const T* ax, const T* ay, const T* aw, const T* ah,
+                               const T* bx, const T* by, const T* bw, const T* bh,
+                               RectSide* results, size_t n) {
+         for (size_t i = 0; i < n; i++) {
+            results[i] = collide_aabb<T>(ax[i], ay[i], aw[i], ah[i],
+                                         bx[i], by[i], bw[i], bh[i]);
+         }
+      }
+
+      /**
+       * Vectorized overload of collide_aabb() for float rectangles.
+       * Results are identical to the scalar kernel.
+       */
+      inline void collide_aabb(const float* ax, const float* ay, const float* aw, const float* ah,
+                               const float* bx, const float* by, const float* bw, const float* bh,
+                               RectSide* results, size_t n) {
+         size_t i = 0;
+
+#if defined(LOST_LEVELS_SIMD_AVX)
+         const __m256 half = _mm256_set1_ps(0.5f), sign = _mm256_set1_ps(-0.0f);
+         const __m256 top = _mm256_set1_ps(TOP), right = _mm256_set1_ps(RIGHT),
+                      bottom = _mm256_set1_ps(BOTTOM), left = _mm256_set1_ps(LEFT),
+                      none = _mm256_set1_ps(NONE);
+         alignas(32) int32_t lanes[8];
+
+         for (; i + 8 <= n; i += 8) {
+            __m256 Aw = _mm256_loadu_ps(aw + i), Ah = _mm256_loadu_ps(ah + i),
+                   Bw = _mm256_loadu_ps(bw + i), Bh = _mm256_loadu_ps(bh + i);
+            __m256 w = _mm256_mul_ps(_mm256_add_ps(Aw, Bw), half),
+                   h = _mm256_mul_ps(_mm256_add_ps(Ah, Bh), half);
+            __m256 dx = _mm256_sub_ps(
+                  _mm256_add_ps(_mm256_loadu_ps(ax + i), _mm256_mul_ps(Aw, half)),
+                  _mm256_add_ps(_mm256_loadu_ps(bx + i), _mm256_mul_ps(Bw, half)));
+            __m256 dy = _mm256_sub_ps(
+                  _mm256_add_ps(_mm256_loadu_ps(ay + i), _mm256_mul_ps(Ah, half)),
+                  _mm256_add_ps(_mm256_loadu_ps(by + i), _mm256_mul_ps(Bh, half)));
+
+            __m256 hit = _mm256_and_ps(
+                  _mm256_cmp_ps(_mm256_andnot_ps(sign, dx), w, _CMP_LE_OQ),
+                  _mm256_cmp_ps(_mm256_andnot_ps(sign, dy), h, _CMP_LE_OQ));
+            __m256 wy = _mm256_mul_ps(w, dy), hx = _mm256_mul_ps(h, dx);
+            __m256 gt = _mm256_cmp_ps(wy, hx, _CMP_GT_OQ),
+                   pos = _mm256_cmp_ps(wy, _mm256_xor_ps(hx, sign), _CMP_GT_OQ);
+
+            __m256 side = _mm256_blendv_ps(
+                  _mm256_blendv_ps(bottom, right, pos),
+                  _mm256_blendv_ps(left, top, pos), gt);
+            side = _mm256_blendv_ps(none, side, hit);
+
+            _mm256_store_si256((__m256i*)lanes, _mm256_cvttps_epi32(side));
+            for (int x = 0; x < 8; x++) {
+               results[i + x] = (RectSide)lanes[x];
+            }
+         }
+
+#elif defined(LOST_LEVELS_SIMD_SSE)
+         const __m128 half = _mm_set1_ps(0.5f), sign = _mm_set1_ps(-0.0f);
+         const __m128 top = _mm_set1_ps(TOP), right = _mm_set1_ps(RIGHT),
+                      bottom = _mm_set1_ps(BOTTOM), left = _mm_set1_ps(LEFT),
+                      none = _mm_set1_ps(NONE);
+         alignas(16) int32_t lanes[4];
+
+         // SSE2 has no blendv, select with and/andnot/or.
+         auto select = [](__m128 mask, __m128 a, __m128 b) {
+            return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+         };
+
+         for (; i + 4 <= n; i += 4) {
+            __m128 Aw = _mm_loadu_ps(aw + i), Ah = _mm_loadu_ps(ah + i),
+                   Bw = _mm_loadu_ps(bw + i), Bh = _mm_loadu_ps(bh + i);
+            __m128 w = _mm_mul_ps(_mm_add_ps(Aw, Bw), half),
+                   h = _mm_mul_ps(_mm_add_ps(Ah, Bh), half);
+            __m128 dx = _mm_sub_ps(
+                  _mm_add_ps(_mm_loadu_ps(ax + i), _mm_mul_ps(Aw, half)),
+                  _mm_add_ps(_mm_loadu_ps(bx + i), _mm_mul_ps(Bw, half)));
+            __m128 dy = _mm_sub_ps(
+                  _mm_add_ps(_mm_loadu_ps(ay + i), _mm_mul_ps(Ah, half)),
+                  _mm_add_ps(_mm_loadu_ps(by + i), _mm_mul_ps(Bh, half)));
+
+            __m128 hit = _mm_and_ps(
+                  _mm_cmple_ps(_mm_andnot_ps(sign, dx), w),
+                  _mm_cmple_ps(_mm_andnot_ps(sign, dy), h));
+            __m128 wy = _mm_mul_ps(w, dy), hx = _mm_mul_ps(h, dx);
+            __m128 gt = _mm_cmpgt_ps(wy, hx),
+                   pos = _mm_cmpgt_ps(wy, _mm_xor_ps(hx, sign));
+
+            __m128 side = select(gt,
+                  select(pos, top, left),
+                  select(pos, right, bottom));
+            side = select(hit, side, none);
+
+            _mm_store_si128((__m128i*)lanes, _mm_cvttps_epi32(side));
+            for (int x = 0; x < 4; x++) {
+               results[i + x] = (RectSide)lanes[x];
+            }
+         }
+
+#elif defined(LOST_LEVELS_SIMD_NEON)
+         const float32x4_t half = vdupq_n_f32(0.5f);
+         const float32x4_t top = vdupq_n_f32(TOP), right = vdupq_n_f32(RIGHT),
+                           bottom = vdupq_n_f32(BOTTOM), left = vdupq_n_f32(LEFT),
+                           none = vdupq_n_f32(NONE);
+         int32_t lanes[4];
+
+         for (; i + 4 <= n; i += 4) {
+            float32x4_t Aw = vld1q_f32(aw + i), Ah = vld1q_f32(ah + i),
+                        Bw = vld1q_f32(bw + i), Bh = vld1q_f32(bh + i);
+            float32x4_t w = vmulq_f32(vaddq_f32(Aw, Bw), half),
+                        h = vmulq_f32(vaddq_f32(Ah, Bh), half);
+            float32x4_t dx = vsubq_f32(
+                  vaddq_f32(vld1q_f32(ax + i), vmulq_f32(Aw, half)),
+                  vaddq_f32(vld1q_f32(bx + i), vmulq_f32(Bw, half)));
+            float32x4_t dy = vsubq_f32(
+                  vaddq_f32(vld1q_f32(ay + i), vmulq_f32(Ah, half)),
+                  vaddq_f32(vld1q_f32(by + i), vmulq_f32(Bh, half)));
+
+            uint32x4_t hit = vandq_u32(
+                  vcleq_f32(vabsq_f32(dx), w),
+                  vcleq_f32(vabsq_f32(dy), h));
+            float32x4_t wy = vmulq_f32(w, dy), hx = vmulq_f32(h, dx);
+            uint32x4_t gt = vcgtq_f32(wy, hx),
+                       pos = vcgtq_f32(wy, vnegq_f32(hx));
+
+            float32x4_t side = vbslq_f32(gt,
+                  vbslq_f32(pos, top, left),
+                  vbslq_f32(pos, right, bottom));
+            side = vbslq_f32(hit, side, none);
+
+            vst1q_s32(lanes, vcvtq_s32_f32(side));
+            for (int x = 0; x < 4; x++) {
+               results[i + x] = (RectSide)lanes[x];
+            }
+         }
+#endif
+
+         for (; i < n; i++) {
+            results[i] = collide_aabb<float>(ax[i], ay[i], aw[i], ah[i],
+                                             bx[i], by[i], bw[i], bh[i]);
+         }
+      }
+   }
+
+   /**
+    * The projection of a shape onto an axis, as the interval
+    * [min, max] of the dot products of its points with the axis.
+    */
    template<class T>
    class Projection {
    public:
@@ -48,10 +266,12 @@ namespace lost_levels {
       { }
 
       static Projection<T> ofPolygonOnAxis(const Polygon<T>& polygon, const Vector<T>& axis) {
-         Projection proj(0, 0);
+         const vector<Point<T>>& points = polygon.points();
+         T dp = points[0].to_vector().dot_product(axis);
+         Projection proj(dp, dp);
 
-         for (auto pt : polygon.points()) {
-            T dp = pt.to_vector().dot_product(axis);
+         for (size_t x = 1; x < points.size(); x++) {
+            dp = points[x].to_vector().dot_product(axis);
             if (dp < proj.min) {
                proj.min = dp;
             } else if (dp > proj.max) {
@@ -62,6 +282,10 @@ namespace lost_levels {
          return proj;
       }
 
+      /**
+       * Determine the distance between two projections.  The result
+       * is negative if the projections overlap.
+       */
       friend T operator-(const Projection& projA, const Projection& projB) {
          if (projA.min < projB.min) {
             return projB.min - projA.max;
@@ -70,146 +294,743 @@ namespace lost_levels {
          }
       }
 
+      /**
+       * Determine the distance one projection must be moved along
+       * the axis to no longer overlap the other.  This accounts for
+       * one projection containing the other.
+       */
+      T overlap(const Projection& rhs) const {
+         T depth = std::min(max, rhs.max) - std::max(min, rhs.min);
+
+         if ((min <= rhs.min && max >= rhs.max) ||
+             (rhs.min <= min && rhs.max >= max)) {
+            depth += std::min(abs(min - rhs.min), abs(max - rhs.max));
+         }
+
+         return depth;
+      }
+
       T min, max;
    };
    
+   /**
+    * The result of a separating axis test between two polygons.
+    *
+    * - are_intersecting: The polygons overlap now.
+    * - will_intersect: The polygons overlap once the first polygon
+    *   is moved by the given velocity.
+    * - min_trans_v: If will_intersect, the minimum translation vector
+    *   to be applied to the first polygon after it is moved, pushing it
+    *   out of the second polygon.
+    */
    template<class T>
    class CollisionResult {
    public:
-      bool will_intersect;
-      bool are_intersecting;
+      bool will_intersect = false;
+      bool are_intersecting = false;
       Vector<T> min_trans_v;
    };
 
+   /**
+    * The result of a swept collision test between a moving rectangle
+    * and an obstacle.
+    *
+    * - hit: The rectangle strikes the obstacle during the movement.
+    * - time: The fraction of the movement in [0, 1] at which they
+    *   first touch.  Zero if they were already in contact.
+    * - pt: The position of the moving rectangle at that time.
+    * - side: The side of the obstacle which was struck, or NONE if the
+    *   rectangles were already overlapping and not moving.
+    * - normal: The unit surface normal of the struck side.
+    */
+   template<class T>
+   class SweepResult {
+   public:
+      bool hit = false;
+      double time = 1.0;
+      Point<T> pt;
+      RectSide side = NONE;
+      Vector<T> normal;
+   };
+
+   template<class T>
+   class Collider {
+   public:
+      /**
+       * Determine the direction of collision if two rectangles
+       * overlap by calculating the Minowski sum of the two
+       * rectangles.  If the rectangles do not overlap,
+       * RectSide.NONE is returned (check for it!)
+       */
+      RectSide collide(const Rect<T>& r1, const Rect<T>& r2) const {
+         return simd::collide_aabb<T>(r1.pt.x, r1.pt.y, r1.sz.width, r1.sz.height,
+                                      r2.pt.x, r2.pt.y, r2.sz.width, r2.sz.height);
+      }
+
+      /**
+       * Determine the direction of collision for each pair of rectangles
+       * A[i] and B[i].  The results vector is resized to the number of
+       * pairs.  For float rectangles this uses SIMD where available.
+       */
+      void collide(const RectArray<T>& A, const RectArray<T>& B,
+                   vector<RectSide>& results) const {
+         util::assertTrue(A.size() == B.size(),
+            "Collider::collide() requires arrays of equal size.");
+
+         pairs_tested().add(A.size());
+         results.resize(A.size());
+         simd::collide_aabb(A.x.data(), A.y.data(), A.width.data(), A.height.data(),
+                            B.x.data(), B.y.data(), B.width.data(), B.height.data(),
+                            results.data(), A.size());
+      }
+
+      /**
+       * Determine the direction of collision for each pair of indices
+       * into the given rectangles, e.g. as produced by a BroadPhase.
+       * Pairs are gathered onto the stack in fixed size chunks so that
+       * the batched kernel can be used without any allocation.
+       */
+      void collide(const RectArray<T>& rects, const vector<pair<int, int>>& pairs,
+                   vector<RectSide>& results) const {
+         const size_t CHUNK = 64;
+         T ax[CHUNK], ay[CHUNK], aw[CHUNK], ah[CHUNK],
+           bx[CHUNK], by[CHUNK], bw[CHUNK], bh[CHUNK];
+
+         pairs_tested().add(pairs.size());
+         results.resize(pairs.size());
+
+         for (size_t base = 0; base < pairs.size(); base += CHUNK) {
+            size_t n = min(CHUNK, pairs.size() - base);
+
+            for (size_t x = 0; x < n; x++) {
+               int a = pairs[base + x].first, b = pairs[base + x].second;
+               ax[x] = rects.x[a]; ay[x] = rects.y[a];
+               aw[x] = rects.width[a]; ah[x] = rects.height[a];
+               bx[x] = rects.x[b]; by[x] = rects.y[b];
+               bw[x] = rects.width[b]; bh[x] = rects.height[b];
+            }
+
+            simd::collide_aabb(ax, ay, aw, ah, bx, by, bw, bh, &results[base], n);
+         }
+      }
+
+      /**
+       * Calculate the rectangle bounding a movement from one rectangle
+       * to another.  Store this in a CollisionTree or BroadPhase in place
+       * of the object's current rectangle so that fast moving objects
+       * are found by queries along their whole path.
+       */
+      Rect<T> swept_bounds(const Rect<T>& from, const Rect<T>& to) const {
+         T xmin = min(from.pt.x, to.pt.x),
+           ymin = min(from.pt.y, to.pt.y),
+           xmax = max(from.pt.x + from.sz.width, to.pt.x + to.sz.width),
+           ymax = max(from.pt.y + from.sz.height, to.pt.y + to.sz.height);
+
+         return Rect<T>(xmin, ymin, xmax - xmin, ymax - ymin);
+      }
+
+      /**
+       * Determine when a rectangle moving from one position to another
+       * first touches a static obstacle, so that fast objects do not
+       * pass through thin obstacles between ticks.
+       *
+       * The moving rectangle keeps the size of 'from' along the path.
+       * Contact is reported on touching edges as with Rect::intersects(),
+       * but not if the rectangle is moving away from the obstacle.
+       */
+      SweepResult<T> sweep(const Rect<T>& from, const Rect<T>& to,
+                           const Rect<T>& obstacle) const {
+         SweepResult<T> result;
+         result.pt = to.pt;
+
+         double vx = (double)to.pt.x - from.pt.x,
+                vy = (double)to.pt.y - from.pt.y;
+         double entryX, exitX, entryY, exitY;
+
+         if (! sweep_axis(from.pt.x, from.sz.width, obstacle.pt.x,
+                          obstacle.sz.width, vx, entryX, exitX) ||
+             ! sweep_axis(from.pt.y, from.sz.height, obstacle.pt.y,
+                          obstacle.sz.height, vy, entryY, exitY)) {
+            return result;
+         }
+
+         double entry = max(entryX, entryY),
+                exit = min(exitX, exitY);
+
+         if (entry > exit || entry > 1.0 || exit < 0.0 ||
+             (exit == 0.0 && entry < 0.0 && (vx != 0 || vy != 0))) {
+            return result;
+         }
+
+         result.hit = true;
+         result.time = max(entry, 0.0);
+         result.pt = Point<T>(from.pt.x + vx * result.time,
+                              from.pt.y + vy * result.time);
+
+         if (entryX > entryY) {
+            result.side = vx > 0 ? LEFT : RIGHT;
+            result.normal = Vector<T>(vx > 0 ? -1 : 1, 0);
+
+         } else if (entryY > entryX || vy != 0) {
+            result.side = vy > 0 ? TOP : BOTTOM;
+            result.normal = Vector<T>(0, vy > 0 ? -1 : 1);
+         }
+
+         return result;
+      }
+
+      /**
+       * Find the earliest obstacle struck by an object moving through
+       * a CollisionTree, as per sweep().  Only entries overlapping the
+       * swept bounds of the movement are tested, and the object's own
+       * entry is ignored.
+       *
+       * @param hitObject (optional) If specified non-null, the location
+       *    to store the object which was struck, if any.
+       */
+      template<class Tree, class C>
+      SweepResult<T> sweep(const Tree& tree, const C& object,
+                           const Rect<T>& from, const Rect<T>& to,
+                           C* hitObject = nullptr) const {
+         SweepResult<T> earliest;
+         earliest.pt = to.pt;
+         int tested = 0;
+
+         tree.visit_overlapping(swept_bounds(from, to), [&](const pair<C, Rect<T>>& entry) {
+            if (entry.first == object) {
+               return;
+            }
+
+            tested ++;
+            SweepResult<T> result = sweep(from, to, entry.second);
+            if (result.hit && (! earliest.hit || result.time < earliest.time)) {
+               earliest = result;
+               if (hitObject != nullptr) {
+                  *hitObject = entry.first;
+               }
+            }
+         });
+
+         pairs_tested().add(tested);
+         return earliest;
+      }
+
+      /**
+       * Determine if two convex polygons collide using the separating
+       * axis theorem, testing the cached edge normals of each polygon.
+       * No heap allocation is performed.
+       *
+       * @param A The moving polygon.
+       * @param B The polygon to test against.
+       * @param velocity (optional) The movement of A for this tick, used
+       *    to determine result.will_intersect.
+       */
+      CollisionResult<T> collide(const Polygon<T>& A, const Polygon<T>& B,
+                                 const Vector<T>& velocity = Vector<T>()) const {
+         CollisionResult<T> result;
+         result.are_intersecting = true;
+         result.will_intersect = true;
+
+         T minOverlap = numeric_limits<T>::max();
+         Vector<T> translationAxis;
+
+         for (int n = 0; n < 2; n++) {
+            const vector<Vector<T>>& normals = (n == 0 ? A : B).edge_normals();
+
+            for (const Vector<T>& axis : normals) {
+               Projection<T> projA = Projection<T>::ofPolygonOnAxis(A, axis);
+               Projection<T> projB = Projection<T>::ofPolygonOnAxis(B, axis);
+
+               if (projA - projB > 0) {
+                  result.are_intersecting = false;
+               }
+
+               T vp = velocity.dot_product(axis);
+               if (vp < 0) {
+                  projA.min += vp;
+               } else {
+                  projA.max += vp;
+               }
+
+               if (projA - projB > 0) {
+                  result.will_intersect = false;
+               }
+
+               if (! result.are_intersecting && ! result.will_intersect) {
+                  return result;
+               }
+
+               T depth = projA.overlap(projB);
+               if (depth < minOverlap) {
+                  minOverlap = depth;
+                  translationAxis = axis;
+               }
+            }
+         }
+
+         if (result.will_intersect) {
+            Vector<T> d = Vector<T>(A.center().x - B.center().x,
+                                    A.center().y - B.center().y);
+            if (d.dot_product(translationAxis) < 0) {
+               translationAxis = translationAxis * (T)-1;
+            }
+
+            result.min_trans_v = translationAxis * minOverlap;
+         }
+
+         return result;
+      }
+
+   private:
+      /**
+       * Find the interval of time during which a moving 1D segment
+       * overlaps a static one.  Returns false if they never overlap.
+       */
+      static bool sweep_axis(double a, double aLength, double b, double bLength,
+                             double v, double& entry, double& exit) {
+         if (v == 0) {
+            entry = -numeric_limits<double>::infinity();
+            exit = numeric_limits<double>::infinity();
+            return a <= b + bLength && b <= a + aLength;
+
+         } else if (v > 0) {
+            entry = (b - (a + aLength)) / v;
+            exit = ((b + bLength) - a) / v;
+
+         } else {
+            entry = ((b + bLength) - a) / v;
+            exit = (b - (a + aLength)) / v;
+         }
+
+         return true;
+      }
+
+      static Counter& pairs_tested() {
+         static Counter& counter = Metrics::global().counter("collision.pairs_tested");
+         return counter;
+      }
+   };
+
    /**
     * Divides the given fixed size cartesian plane into subdivisions to
     * optimize the targets for collision detection.
+    *
+    * Nodes and entries are kept in flat pools and linked by index, so
+    * the tree does not allocate once it has grown to its working size.
+    * clear() keeps the capacity of both pools for the next frame.
+    *
+    * USAGE:
+    * - insert() each object once with its bounding rectangle.
+    * - Call update() with the new rectangle each time an object moves.
+    *   The entry is only relinked when it no longer belongs to its node.
+    * - Call remove() when an object is destroyed.
+    *
+    * Objects are located by value with an unordered_map, so C must
+    * be hashable by H (e.g. a shared_ptr or an integer id).
     */
-   template<class T, class C>
+   template<class T, class C, class H = hash<C>>
    class CollisionTree {
    public:
       CollisionTree(const Rect<T>& rect, int level = 0,
                int maxLevel = 5, int maxObjects = 10)
-         : rect(rect), level(level), maxLevel(maxLevel), maxObjects(maxObjects)
-      { }
+         : level(level), maxLevel(maxLevel), maxObjects(maxObjects), rect(rect)
+      {
+         clear();
+      }
 
       typedef pair<C, Rect<T>> Entry;
 
       virtual ~CollisionTree()
       { }
       
-      void insert(const C& object, const Rect<T>& rect) {
-         insert({object, rect});
+      /**
+       * Insert an object into the tree with the given bounding rectangle.
+       * If the object is already in the tree, it is updated instead.
+       */
+      void insert(const C& object, const Rect<T>& objRect) {
+         auto iter = index.find(object);
+         if (iter != index.end()) {
+            update_slot(iter->second, objRect);
+            return;
+         }
+
+         int slotIdx = alloc_slot(object, objRect);
+         index[object] = slotIdx;
+         insert_slot(0, slotIdx);
+      }
+
+      /**
+       * Update the bounding rectangle of an object already in the tree.
+       *
+       * @return True if the object was found, false otherwise.
+       */
+      bool update(const C& object, const Rect<T>& objRect) {
+         auto iter = index.find(object);
+         if (iter == index.end()) {
+            return false;
+         }
+
+         update_slot(iter->second, objRect);
+         return true;
+      }
+
+      /**
+       * Remove an object from the tree.
+       *
+       * @return True if the object was found, false otherwise.
+       */
+      bool remove(const C& object) {
+         auto iter = index.find(object);
+         if (iter == index.end()) {
+            return false;
+         }
+
+         int slotIdx = iter->second;
+         index.erase(iter);
+         unlink_slot(slotIdx);
+         free_slot(slotIdx);
+         return true;
       }
 
+      /**
+       * Remove all objects and subdivisions from the tree.  Pool
+       * storage is retained to be reused by subsequent inserts.
+       */
       void clear() {
-         entries.clear();
-         quadrants.clear();
+         nodes.clear();
+         slots.clear();
+         index.clear();
+         freeSlot = -1;
+         count_growth(nodes);
+         nodes.push_back(Node(rect, level, -1));
+      }
+
+      size_t size() const {
+         return index.size();
       }
       
+      /**
+       * Return copies of the entries in the node which would contain
+       * the given rectangle and in each of its ancestors.
+       *
+       * This allocates a new vector and copies each entry on every call,
+       * prefer visit() or the scratch buffer overload in update loops.
+       */
       vector<Entry> retrieve(const Rect<T>& objRect) const {
          vector<Entry> potentials;
-         retrieve_impl(potentials, objRect);
+         visit(objRect, [&](const Entry& entry) {
+            potentials.push_back(entry);
+         });
          return potentials;
       }
 
+      /**
+       * Append pointers to the potential entries for the given rectangle
+       * to a caller-owned scratch buffer, as per retrieve().  The buffer
+       * is not cleared, and no allocation occurs once it has grown to
+       * the working size.
+       *
+       * The pointers are valid until the tree is next modified.
+       */
+      void retrieve(const Rect<T>& objRect,
+                    vector<const Entry*>& potentials) const {
+         visit(objRect, [&](const Entry& entry) {
+            potentials.push_back(&entry);
+         });
+      }
+
+      /**
+       * Append pointers to the entries whose rectangles overlap the given
+       * rectangle to a caller-owned scratch buffer, as per
+       * visit_overlapping().
+       */
+      void retrieve_overlapping(const Rect<T>& objRect,
+                                vector<const Entry*>& potentials) const {
+         visit_overlapping(objRect, [&](const Entry& entry) {
+            potentials.push_back(&entry);
+         });
+      }
+
+      /**
+       * Invoke the given visitor as visitor(const Entry&) for each of
+       * the entries that retrieve() would return, without copying them.
+       */
+      template<class F>
+      void visit(const Rect<T>& objRect, F visitor) const {
+         int visited = 0;
+         visit_impl(0, objRect, visitor, visited);
+         queries->add();
+         nodesVisited->add(visited);
+      }
+
+      /**
+       * Invoke the given visitor as visitor(const Entry&) for each entry
+       * whose rectangle overlaps the given rectangle.  Only nodes which
+       * overlap the rectangle are descended into, and entries held by
+       * ancestor nodes are filtered out unless they overlap.
+       */
+      template<class F>
+      void visit_overlapping(const Rect<T>& objRect, F visitor) const {
+         int visited = 0;
+         visit_overlapping_impl(0, objRect, visitor, visited);
+         queries->add();
+         nodesVisited->add(visited);
+      }
+
       const Rect<T>& get_rect() const {
          return rect;
       }
 
-      vector<const CollisionTree<T, C>*> get_quadrants() const {
-         vector<const CollisionTree<T, C>*> quadPointers;
-         for (int x = 0; x < quadrants.size(); x++) {
-            quadPointers.push_back(&quadrants[x]);
+      /**
+       * Invoke the given visitor as visitor(rect, level) for every
+       * node in the tree.  Parents are visited before their children.
+       */
+      template<class F>
+      void visit_nodes(F visitor) const {
+         for (const Node& node : nodes) {
+            visitor(node.rect, node.level);
          }
-         return quadPointers;
       }
 
       void debug_split() {
-         split();
+         split(0);
       }
 
       Settings json() const {
-         Settings json;
-         
-         vector<Settings> quadListJson;
-         for (auto quad : quadrants) {
-            quadListJson.push_back(quad.json());
-         }
-         json.set_object_array("quadrants", quadListJson);
-
-         vector<Settings> entryRectListJson;
-         for (auto entry : entries) {
-            entryRectListJson.push_back(entry.second.json());
-         }
-         json.set_object_array("entries", entryRectListJson);
-         json.set_object("rect", rect.json());
-
-         return json;
+         return json_impl(0);
       }
 
    protected:
-      int get_index(const Rect<T>& objRect) const {
-         int idx = -1;
+      /**
+       * A subdivision of the tree.  The four quadrants of a split node
+       * are stored consecutively in the node pool starting at
+       * firstChild, in the order given by Rect::split().
+       */
+      struct Node {
+         Node(const Rect<T>& rect, int level, int parent) :
+            rect(rect), level(level), parent(parent) { }
+
+         Rect<T> rect;
+         int level;
+         int parent;
+         int firstChild = -1;
+         int firstSlot = -1;
+         int numSlots = 0;
+      };
+
+      /**
+       * An entry in the slot pool.  Live slots form a doubly linked
+       * list per node, free slots are chained through next.
+       */
+      struct Slot {
+         Slot(const Entry& entry) : entry(entry) { }
 
-         for (int x = 0; x < quadrants.size(); x++) {
-            if (quadrants.at(x).rect.contains(objRect)) {
-               idx = x;
-               break;
+         Entry entry;
+         int node = -1;
+         int prev = -1;
+         int next = -1;
+      };
+
+      int get_index(int nodeIdx, const Rect<T>& objRect) const {
+         int firstChild = nodes[nodeIdx].firstChild;
+
+         if (firstChild != -1) {
+            for (int x = 0; x < 4; x++) {
+               if (nodes[firstChild + x].rect.contains(objRect)) {
+                  return x;
+               }
             }
          }
          
-         return idx;
+         return -1;
       }
 
-      void insert(const Entry& entry) {
-         if (quadrants.size() > 0) {
-            int idx = get_index(entry.second);
-            if (idx != -1) {
-               quadrants.at(idx).insert(entry);
-               return;
-            }
+      void insert_slot(int nodeIdx, int slotIdx) {
+         const Rect<T> objRect = slots[slotIdx].entry.second;
+
+         for (int idx = get_index(nodeIdx, objRect); idx != -1;
+              idx = get_index(nodeIdx, objRect)) {
+            nodeIdx = nodes[nodeIdx].firstChild + idx;
+         }
+
+         link_slot(nodeIdx, slotIdx);
+         if (nodes[nodeIdx].numSlots >= maxObjects &&
+             nodes[nodeIdx].level < maxLevel) {
+            split(nodeIdx);
+         }
+      }
+
+      void update_slot(int slotIdx, const Rect<T>& objRect) {
+         int nodeIdx = slots[slotIdx].node;
+         slots[slotIdx].entry.second = objRect;
+
+         if (nodes[nodeIdx].rect.contains(objRect) &&
+             get_index(nodeIdx, objRect) == -1) {
+            return;
          }
 
-         entries.push_back(entry);
-         if (entries.size() >= maxObjects && level < maxLevel) {
-            split();   
+         // Climb to the nearest node that still contains the object,
+         // then descend from there.
+         unlink_slot(slotIdx);
+         while (nodes[nodeIdx].parent != -1 &&
+                ! nodes[nodeIdx].rect.contains(objRect)) {
+            nodeIdx = nodes[nodeIdx].parent;
          }
+         insert_slot(nodeIdx, slotIdx);
       }
       
-      void retrieve_impl(vector<Entry>& potentials, const Rect<T>& objRect) const {
-         int idx = get_index(objRect);
-         if (idx != -1 && quadrants.size() > 0) {
-            quadrants.at(idx).retrieve_impl(potentials, objRect);
+      template<class F>
+      void visit_impl(int nodeIdx, const Rect<T>& objRect, F& visitor, int& visited) const {
+         visited ++;
+         int idx = get_index(nodeIdx, objRect);
+         if (idx != -1) {
+            visit_impl(nodes[nodeIdx].firstChild + idx, objRect, visitor, visited);
          }
          
-         potentials.insert(potentials.end(), entries.begin(), entries.end());
+         for (int slotIdx = nodes[nodeIdx].firstSlot; slotIdx != -1;
+              slotIdx = slots[slotIdx].next) {
+            visitor(slots[slotIdx].entry);
+         }
+      }
+
+      template<class F>
+      void visit_overlapping_impl(int nodeIdx, const Rect<T>& objRect,
+                                  F& visitor, int& visited) const {
+         const Node& node = nodes[nodeIdx];
+         visited ++;
+
+         for (int slotIdx = node.firstSlot; slotIdx != -1;
+              slotIdx = slots[slotIdx].next) {
+            if (slots[slotIdx].entry.second.overlaps(objRect)) {
+               visitor(slots[slotIdx].entry);
+            }
+         }
+
+         if (node.firstChild != -1) {
+            for (int x = 0; x < 4; x++) {
+               if (nodes[node.firstChild + x].rect.overlaps(objRect)) {
+                  visit_overlapping_impl(node.firstChild + x, objRect, visitor, visited);
+               }
+            }
+         }
       }
 
-      void split() {
-         if (quadrants.size() > 0) {
+      void split(int nodeIdx) {
+         if (nodes[nodeIdx].firstChild != -1) {
             return;
          }
 
-         vector<Rect<T>> subRects = rect.split();
-         for (auto subRect : subRects) {
-            quadrants.push_back(CollisionTree(subRect, level + 1, maxLevel, maxObjects));
+         int firstChild = nodes.size();
+         int childLevel = nodes[nodeIdx].level + 1;
+         count_growth(nodes, 4);
+         for (const Rect<T>& subRect : nodes[nodeIdx].rect.quadrants()) {
+            nodes.push_back(Node(subRect, childLevel, nodeIdx));
          }
+         nodes[nodeIdx].firstChild = firstChild;
 
-         vector<Entry> savedEntries = entries;
-         entries.clear();
+         // Relink entries which now fit in a quadrant, no copies made.
+         int slotIdx = nodes[nodeIdx].firstSlot;
+         while (slotIdx != -1) {
+            int next = slots[slotIdx].next;
+            int idx = get_index(nodeIdx, slots[slotIdx].entry.second);
+            if (idx != -1) {
+               unlink_slot(slotIdx);
+               insert_slot(firstChild + idx, slotIdx);
+            }
+            slotIdx = next;
+         }
+      }
+
+      Settings json_impl(int nodeIdx) const {
+         Settings json;
+         const Node& node = nodes[nodeIdx];
+         
+         vector<Settings> quadListJson;
+         if (node.firstChild != -1) {
+            for (int x = 0; x < 4; x++) {
+               quadListJson.push_back(json_impl(node.firstChild + x));
+            }
+         }
+         json.set_object_array("quadrants", quadListJson);
 
-         for (auto entry : savedEntries) {
-            insert(entry);
+         vector<Settings> entryRectListJson;
+         for (int slotIdx = node.firstSlot; slotIdx != -1;
+              slotIdx = slots[slotIdx].next) {
+            entryRectListJson.push_back(slots[slotIdx].entry.second.json());
          }
+         json.set_object_array("entries", entryRectListJson);
+         json.set_object("rect", node.rect.json());
+
+         return json;
       }
 
    private:
+      int alloc_slot(const C& object, const Rect<T>& objRect) {
+         if (freeSlot == -1) {
+            count_growth(slots);
+            slots.push_back(Slot(Entry(object, objRect)));
+            return slots.size() - 1;
+         }
+
+         int slotIdx = freeSlot;
+         freeSlot = slots[slotIdx].next;
+         slots[slotIdx].entry = Entry(object, objRect);
+         return slotIdx;
+      }
+
+      void free_slot(int slotIdx) {
+         // Release the object so that shared resources are not held
+         // by a dead slot.
+         slots[slotIdx].entry = Entry();
+         slots[slotIdx].next = freeSlot;
+         freeSlot = slotIdx;
+      }
+
+      void link_slot(int nodeIdx, int slotIdx) {
+         Slot& slot = slots[slotIdx];
+         Node& node = nodes[nodeIdx];
+
+         slot.node = nodeIdx;
+         slot.prev = -1;
+         slot.next = node.firstSlot;
+         if (node.firstSlot != -1) {
+            slots[node.firstSlot].prev = slotIdx;
+         }
+         node.firstSlot = slotIdx;
+         node.numSlots ++;
+      }
+
+      void unlink_slot(int slotIdx) {
+         Slot& slot = slots[slotIdx];
+         Node& node = nodes[slot.node];
+
+         if (slot.prev != -1) {
+            slots[slot.prev].next = slot.next;
+         } else {
+            node.firstSlot = slot.next;
+         }
+
+         if (slot.next != -1) {
+            slots[slot.next].prev = slot.prev;
+         }
+
+         node.numSlots --;
+         slot.node = -1;
+         slot.prev = -1;
+         slot.next = -1;
+      }
+
       int level;
       int maxLevel;
       int maxObjects;
       Rect<T> rect;
-      vector<Entry> entries;
-      vector<CollisionTree<T, C>> quadrants;
+
+      vector<Node> nodes;
+      vector<Slot> slots;
+      int freeSlot = -1;
+      unordered_map<C, int, H> index;
+
+      Counter* queries = &Metrics::global().counter("collision.tree_queries");
+      Counter* nodesVisited = &Metrics::global().counter("collision.tree_nodes_visited");
    }; 
 }
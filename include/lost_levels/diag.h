@@ -5,11 +5,31 @@
  * Date: Thursday, May 14 2015
  */
 #pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
 
+#include "lain/exception.h"
+#include "tinyformat/tinyformat.h"
+#include "lost_levels/graphics.h"
+#include "lost_levels/metrics.h"
 #include "timer.h"
 
 namespace lost_levels {
    using namespace std;
+   using namespace lain;
+
+   class DiagException : public Exception {
+      using Exception::Exception;
+   };
 
    /**
     * FrameCalculator <concrete class>
@@ -57,5 +77,448 @@ namespace lost_levels {
       T fps = 0;
       T prev_frames = 0;
    };
-}
 
+   /**
+    * Profiler <concrete class>
+    *
+    * Measures how long named zones of code take in each frame.  The
+    * Engine times its input, update, paint, display and delay phases,
+    * and games may add zones of their own.  The time spent in each zone
+    * is summed over a frame and kept for a number of recent frames, from
+    * which min, average, 99th percentile and max times are reported.
+    *
+    * USAGE:
+    * - Use the Engine's Profiler, see Engine::get_profiler().
+    * - Time a block of code by declaring a Zone at its start.  Zone
+    *   names must be string literals or otherwise outlive the program.
+    *   Resolve the name to a ZoneId once, e.g. in a static, so that
+    *   ending a zone is only an atomic add.
+    *
+    *    void update() override {
+    *       static const Profiler::ZoneId COLLISION = Profiler::get_zone_id("collision");
+    *       Profiler::Zone zone(engine.get_profiler(), COLLISION);
+    *       ...
+    *    }
+    *
+    * - Call paint_overlay() from Engine::diag_paint() to show the zone
+    *   timings and a graph of recent frame times on screen.
+    * - Call start_trace() and later save_trace() to capture every zone
+    *   timing to a Chrome trace file, which can be opened in
+    *   chrome://tracing or https://ui.perfetto.dev.
+    *
+    * NOTE:
+    * - Zones may be timed from any thread.  The frame a zone is counted
+    *   in is the one in progress when the zone ends.
+    * - When disabled, a Zone does not read the clock or lock.
+    * - Zones constructed by name look the name up each time, which
+    *   locks, so prefer ZoneIds in code that runs often.
+    * - At most MAX_ZONES distinct zone names may be used.
+    */
+   class Profiler {
+   public:
+      typedef chrono::steady_clock Clock;
+      typedef size_t ZoneId;
+
+      static const size_t MAX_ZONES = 256;
+
+      /**
+       * Timings of a zone over recent frames, in microseconds.
+       */
+      struct Stats {
+         double min = 0;
+         double avg = 0;
+         double p99 = 0;
+         double max = 0;
+      };
+
+      /**
+       * Times the enclosing scope as a zone of the given Profiler.
+       */
+      class Zone {
+      public:
+         Zone(Profiler& profiler, ZoneId id) :
+            profiler(profiler.is_enabled() ? &profiler : nullptr), id(id) {
+            if (this->profiler != nullptr) {
+               start = Clock::now();
+            }
+         }
+
+         Zone(Profiler& profiler, const char* name) :
+            profiler(profiler.is_enabled() ? &profiler : nullptr) {
+            if (this->profiler != nullptr) {
+               id = get_zone_id(name);
+               start = Clock::now();
+            }
+         }
+
+         ~Zone() {
+            if (profiler != nullptr) {
+               profiler->record(id, start, Clock::now());
+            }
+         }
+
+         Zone(const Zone&) = delete;
+         Zone& operator=(const Zone&) = delete;
+
+      private:
+         Profiler* profiler;
+         ZoneId id = 0;
+         Clock::time_point start;
+      };
+
+      /**
+       * @return The id of the zone with the given name, shared by every
+       *    Profiler.  The name must outlive the program.
+       *
+       * @throws DiagException if there are already MAX_ZONES zones.
+       */
+      static ZoneId get_zone_id(const char* name) {
+         ZoneRegistry& registry = get_registry();
+         lock_guard<mutex> lock(registry.registryMutex);
+
+         for (ZoneId id = 0; id < registry.names.size(); id++) {
+            if (registry.names[id] == name || strcmp(registry.names[id], name) == 0) {
+               return id;
+            }
+         }
+
+         if (registry.names.size() >= MAX_ZONES) {
+            throw DiagException(tfm::format("Too many profiler zones, can't add '%s'.", name));
+         }
+
+         registry.names.push_back(name);
+         return registry.names.size() - 1;
+      }
+
+      /**
+       * @param historySize The number of recent frames to keep timings
+       *    for.
+       */
+      Profiler(size_t historySize = 240) :
+         historySize(max<size_t>(1, historySize)),
+         frameHistory(this->historySize, 0),
+         epoch(Clock::now()), frameStart(epoch) { }
+
+      void set_enabled(bool enabled) {
+         this->enabled = enabled;
+      }
+
+      bool is_enabled() const {
+         return enabled;
+      }
+
+      /**
+       * Finish the current frame, recording the time since the previous
+       * call as the frame's duration.  The Engine calls this at the end
+       * of each iteration of the game loop.
+       */
+      void end_frame() {
+         if (! enabled) {
+            return;
+         }
+
+         Clock::time_point now = Clock::now();
+         lock_guard<mutex> lock(profilerMutex);
+
+         frameHistory[cursor] = micros(now - frameStart);
+         for (auto& zone : zones) {
+            zone.history[cursor] = current[zone.id].exchange(0, memory_order_relaxed);
+         }
+
+         cursor = (cursor + 1) % historySize;
+         frameCount = min(frameCount + 1, historySize);
+         frameStart = now;
+      }
+
+      /**
+       * @return The names of all zones timed so far, in the order they
+       *    were first timed.
+       */
+      vector<string> get_zone_names() const {
+         lock_guard<mutex> lock(profilerMutex);
+         vector<string> names;
+
+         for (auto& zone : zones) {
+            names.push_back(zone.name);
+         }
+
+         return names;
+      }
+
+      /**
+       * @return Timings of the given zone over recent frames.  Frames in
+       *    which the zone was not entered count as 0.
+       */
+      Stats get_stats(const string& name) const {
+         lock_guard<mutex> lock(profilerMutex);
+
+         for (auto& zone : zones) {
+            if (name == zone.name) {
+               return compute_stats(zone.history);
+            }
+         }
+
+         return Stats();
+      }
+
+      /**
+       * @return Timings of whole frames over recent frames.
+       */
+      Stats get_frame_stats() const {
+         lock_guard<mutex> lock(profilerMutex);
+         return compute_stats(frameHistory);
+      }
+
+      /**
+       * @return The duration of the last complete frame in microseconds.
+       */
+      uint32_t get_last_frame_time() const {
+         lock_guard<mutex> lock(profilerMutex);
+         return frameCount > 0 ? frameHistory[(cursor + historySize - 1) % historySize] : 0;
+      }
+
+      /**
+       * @return Recent frame durations in microseconds, oldest first.
+       */
+      vector<uint32_t> get_frame_history() const {
+         lock_guard<mutex> lock(profilerMutex);
+         vector<uint32_t> history;
+
+         for (size_t x = 0; x < frameCount; x++) {
+            history.push_back(frameHistory[(cursor + historySize - frameCount + x) % historySize]);
+         }
+
+         return history;
+      }
+
+      /**
+       * Begin recording every zone timing for a Chrome trace.
+       *
+       * @param maxEvents The most events to record.  Later zones are
+       *    not recorded, so that a forgotten trace can't exhaust memory.
+       */
+      void start_trace(size_t maxEvents = 1 << 20) {
+         lock_guard<mutex> lock(profilerMutex);
+         traceEvents.clear();
+         maxTraceEvents = maxEvents;
+         tracing = true;
+      }
+
+      void stop_trace() {
+         lock_guard<mutex> lock(profilerMutex);
+         tracing = false;
+      }
+
+      bool is_tracing() const {
+         return tracing;
+      }
+
+      /**
+       * Write the recorded trace as Chrome trace event JSON.
+       */
+      void write_trace(ostream& out) const {
+         lock_guard<mutex> lock(profilerMutex);
+
+         out << "{\"traceEvents\":[";
+         for (size_t x = 0; x < traceEvents.size(); x++) {
+            const TraceEvent& event = traceEvents[x];
+            out << (x > 0 ? ",\n" : "\n")
+                << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":0"
+                << ",\"tid\":" << event.thread
+                << ",\"ts\":" << event.start
+                << ",\"dur\":" << event.duration << "}";
+         }
+         out << "\n]}\n";
+      }
+
+      /**
+       * Write the recorded trace to the given file.
+       *
+       * @throws DiagException if the file can't be written.
+       */
+      void save_trace(const string& filename) const {
+         ofstream out(filename);
+         if (! out) {
+            throw DiagException(tfm::format("Could not open trace file '%s' for writing.", filename));
+         }
+
+         write_trace(out);
+      }
+
+      /**
+       * Draw a table of zone timings, in milliseconds, above a graph of
+       * recent frame times.  The graph is scaled so that its height is
+       * twice the given target frame time.
+       *
+       * @param renderer The renderer to draw with.
+       * @param font The font to print the table with.
+       * @param pt The top left corner of the overlay.
+       * @param drawColor The renderer's draw color, which is restored
+       *    when the overlay is done, as the engine clears with it.
+       * @param targetFrameMs The intended frame time, drawn as a line
+       *    across the graph.
+       */
+      void paint_overlay(Renderer& renderer, shared_ptr<const Font> font,
+                         const Point<int>& pt, const Color& drawColor,
+                         double targetFrameMs = 1000.0 / 60) const {
+         const int GRAPH_HEIGHT = 32;
+         const Color GRAPH_COLOR = Color(0x80, 0xff, 0x80);
+         const Color SLOW_COLOR = Color(0xff, 0x40, 0x40);
+         const Color TARGET_COLOR = Color(0xff, 0xff, 0xff);
+
+         string table = tfm::format("%-8s %6s %6s %6s", "ms", "avg", "p99", "max");
+         auto add_row = [&](const string& name, const Stats& stats) {
+            table += tfm::format("\n%-8s %6.2f %6.2f %6.2f", name.substr(0, 8),
+               stats.avg / 1000, stats.p99 / 1000, stats.max / 1000);
+         };
+
+         add_row("frame", get_frame_stats());
+         for (auto& name : get_zone_names()) {
+            add_row(name, get_stats(name));
+         }
+         renderer.print_string(pt, font, table);
+
+         int rows = 1 + count(table.begin(), table.end(), '\n');
+         Point<int> graphPt = Point<int>(pt.x, pt.y + rows * font->get_size().height + 2);
+         double targetUs = max(1.0, targetFrameMs * 1000);
+         vector<uint32_t> history = get_frame_history();
+
+         for (size_t x = 0; x < history.size(); x++) {
+            int height = min<int>(GRAPH_HEIGHT, (int)(history[x] / targetUs * GRAPH_HEIGHT / 2));
+            renderer.set_draw_color(history[x] > targetUs ? SLOW_COLOR : GRAPH_COLOR);
+            renderer.fill_rect(Rect<int>(graphPt.x + x, graphPt.y + GRAPH_HEIGHT - height, 1, height));
+         }
+
+         renderer.set_draw_color(TARGET_COLOR);
+         renderer.fill_rect(Rect<int>(graphPt.x, graphPt.y + GRAPH_HEIGHT / 2, historySize, 1));
+         renderer.set_draw_color(drawColor);
+      }
+
+   private:
+      struct ZoneData {
+         ZoneData(ZoneId id, const char* name, size_t historySize) :
+            id(id), name(name), history(historySize, 0) { }
+
+         ZoneId id;
+         const char* name;
+         vector<uint32_t> history;
+      };
+
+      struct ZoneRegistry {
+         vector<const char*> names;
+         mutex registryMutex;
+      };
+
+      static ZoneRegistry& get_registry() {
+         static ZoneRegistry registry;
+         return registry;
+      }
+
+      struct TraceEvent {
+         const char* name;
+         uint64_t start;
+         uint32_t duration;
+         int thread;
+      };
+
+      static uint32_t micros(Clock::duration duration) {
+         return chrono::duration_cast<chrono::microseconds>(duration).count();
+      }
+
+      void record(ZoneId id, Clock::time_point start, Clock::time_point end) {
+         uint32_t duration = micros(end - start);
+
+         if (! timed[id].load(memory_order_acquire)) {
+            add_zone(id);
+         }
+         current[id].fetch_add(duration, memory_order_relaxed);
+
+         if (tracing) {
+            lock_guard<mutex> lock(profilerMutex);
+            if (traceEvents.size() < maxTraceEvents) {
+               traceEvents.push_back(TraceEvent {
+                  get_zone_name(id), (uint64_t)chrono::duration_cast<chrono::microseconds>(start - epoch).count(),
+                  duration, thread_index() });
+            }
+         }
+      }
+
+      /**
+       * Start keeping history for a zone the first time it is timed.
+       */
+      void add_zone(ZoneId id) {
+         lock_guard<mutex> lock(profilerMutex);
+
+         if (! timed[id].load(memory_order_relaxed)) {
+            zones.push_back(ZoneData(id, get_zone_name(id), historySize));
+            timed[id].store(true, memory_order_release);
+         }
+      }
+
+      static const char* get_zone_name(ZoneId id) {
+         ZoneRegistry& registry = get_registry();
+         lock_guard<mutex> lock(registry.registryMutex);
+         return registry.names[id];
+      }
+
+      /**
+       * @return A small number identifying the calling thread in traces.
+       *    Must be called with the lock held.
+       */
+      int thread_index() {
+         thread::id id = this_thread::get_id();
+
+         for (size_t x = 0; x < threads.size(); x++) {
+            if (threads[x] == id) {
+               return x;
+            }
+         }
+
+         threads.push_back(id);
+         return threads.size() - 1;
+      }
+
+      Stats compute_stats(const vector<uint32_t>& history) const {
+         Stats stats;
+         if (frameCount == 0) {
+            return stats;
+         }
+
+         vector<uint32_t> samples;
+         for (size_t x = 0; x < frameCount; x++) {
+            samples.push_back(history[(cursor + historySize - frameCount + x) % historySize]);
+         }
+         sort(samples.begin(), samples.end());
+
+         double total = 0;
+         for (uint32_t sample : samples) {
+            total += sample;
+         }
+
+         stats.min = samples.front();
+         stats.max = samples.back();
+         stats.avg = total / samples.size();
+         stats.p99 = samples[min(samples.size() - 1, (samples.size() * 99) / 100)];
+         return stats;
+      }
+
+      size_t historySize;
+      vector<uint32_t> frameHistory;
+      size_t cursor = 0;
+      size_t frameCount = 0;
+      vector<ZoneData> zones;
+      array<atomic<uint32_t>, MAX_ZONES> current {};
+      array<atomic<bool>, MAX_ZONES> timed {};
+
+      Clock::time_point epoch;
+      Clock::time_point frameStart;
+      atomic<bool> enabled {true};
+
+      atomic<bool> tracing {false};
+      size_t maxTraceEvents = 0;
+      vector<TraceEvent> traceEvents;
+      vector<thread::id> threads;
+
+      mutable mutex profilerMutex;
+   };
+}
@@ -0,0 +1,227 @@
+/*
+ * draw_list: A renderer which records draw commands for later replay.
+ *
+ * Author: Lain Supe (lainproliant)
+ * Date: Wednesday, Oct 14 2026
+ */
+#pragma once
+#include <vector>
+
+#include "lost_levels/graphics.h"
+#include "lost_levels/metrics.h"
+
+namespace lost_levels {
+   using namespace std;
+
+   /**
+    * DrawList <concrete class>
+    *
+    * A Renderer which records every draw into a list of commands
+    * instead of drawing it, so that a frame can be painted on one
+    * thread and drawn on another.  See Engine::set_pipelined().
+    *
+    * USAGE:
+    * - Paint into the DrawList as you would into any Renderer.
+    * - Call replay() with the real renderer to issue the commands.
+    * - Call reset() before painting the next frame.  The command
+    *   buffer keeps its capacity, so steady state painting does not
+    *   allocate.
+    *
+    * NOTE:
+    * - Images are referenced until the list is reset, so they may be
+    *   released by the painting thread before the list is replayed.
+    * - A render_quads() call, e.g. from print_string(), is recorded as
+    *   one command, with its rects copied into arrays shared by every
+    *   such command in the list.
+    * - load_image() is not supported, as it would have to use the
+    *   real renderer from the painting thread.
+    */
+   class DrawList : public Renderer {
+   public:
+      DrawList(const Size<int>& szLogical = Size<int>()) :
+         szLogical(szLogical) { }
+
+      /**
+       * Discard all recorded commands.
+       */
+      void reset() {
+         commands.clear();
+         srcRects.clear();
+         dstRects.clear();
+      }
+
+      size_t size() const {
+         return commands.size();
+      }
+
+      /**
+       * Issue every recorded command to the given renderer, in order.
+       */
+      void replay(Renderer& target) const {
+         for (const Command& command : commands) {
+            switch (command.type) {
+            case Command::CLEAR:
+               target.clear();
+               break;
+
+            case Command::SET_DRAW_COLOR:
+               target.set_draw_color(command.color);
+               break;
+
+            case Command::SET_CLIP_RECT:
+               target.set_clip_rect(command.dst);
+               break;
+
+            case Command::CLEAR_CLIP_RECT:
+               target.clear_clip_rect();
+               break;
+
+            case Command::SET_LOGICAL_SIZE:
+               target.set_logical_size(command.dst.sz);
+               break;
+
+            case Command::SET_LAYER:
+               target.set_layer(command.layer);
+               break;
+
+            case Command::DRAW_RECT:
+               target.draw_rect(command.dst);
+               break;
+
+            case Command::FILL_RECT:
+               target.fill_rect(command.dst);
+               break;
+
+            case Command::RENDER:
+               target.render(command.image, command.src, command.dst);
+               break;
+
+            case Command::RENDER_QUADS:
+               target.render_quads(command.image, &srcRects[command.first],
+                                   &dstRects[command.first], command.count,
+                                   command.dst.pt.to_vector());
+               break;
+            }
+         }
+      }
+
+      shared_ptr<Image> load_image(const string& filename) const override {
+         throw GraphicsException("Images can't be loaded through a DrawList.");
+      }
+
+      void clear() override {
+         push(Command(Command::CLEAR));
+      }
+
+      void display() override { }
+
+      void set_draw_color(const Color& color) override {
+         Command command(Command::SET_DRAW_COLOR);
+         command.color = color;
+         push(command);
+      }
+
+      void set_clip_rect(const Rect<int>& rect) override {
+         push_rect(Command::SET_CLIP_RECT, rect);
+      }
+
+      void clear_clip_rect() override {
+         push(Command(Command::CLEAR_CLIP_RECT));
+      }
+
+      Size<int> get_logical_size() const override {
+         return szLogical;
+      }
+
+      void set_logical_size(const Size<int>& sz) override {
+         szLogical = sz;
+         push_rect(Command::SET_LOGICAL_SIZE, Rect<int>(Point<int>(), sz));
+      }
+
+      void set_layer(int layer) override {
+         Command command(Command::SET_LAYER);
+         command.layer = layer;
+         push(command);
+      }
+
+      void draw_rect(const Rect<int>& rect) override {
+         push_rect(Command::DRAW_RECT, rect);
+      }
+
+      void fill_rect(const Rect<int>& rect) override {
+         push_rect(Command::FILL_RECT, rect);
+      }
+
+      void render(shared_ptr<const Image> image,
+            const Rect<int>& srcRect,
+            const Rect<int>& dstRect) override {
+         Command command(Command::RENDER);
+         command.image = image;
+         command.src = srcRect;
+         command.dst = dstRect;
+         push(command);
+      }
+
+      /**
+       * Record the quads as one command.  The offset is kept with the
+       * command and applied when the list is replayed.
+       */
+      void render_quads(shared_ptr<const Image> image,
+            const Rect<int>* srcRectsIn, const Rect<int>* dstRectsIn,
+            size_t count, const Vector<int>& offset) override {
+         Command command(Command::RENDER_QUADS);
+         command.image = image;
+         command.dst.pt = Point<int>() + offset;
+         command.first = srcRects.size();
+         command.count = count;
+
+         count_growth(srcRects, count);
+         count_growth(dstRects, count);
+         srcRects.insert(srcRects.end(), srcRectsIn, srcRectsIn + count);
+         dstRects.insert(dstRects.end(), dstRectsIn, dstRectsIn + count);
+         push(command);
+      }
+
+      using Renderer::render;
+
+   private:
+      struct Command {
+         enum Type {
+            CLEAR,
+            SET_DRAW_COLOR,
+            SET_CLIP_RECT,
+            CLEAR_CLIP_RECT,
+            SET_LOGICAL_SIZE,
+            SET_LAYER,
+            DRAW_RECT,
+            FILL_RECT,
+            RENDER,
+            RENDER_QUADS
+         };
+
+         Command(Type type) : type(type) { }
+
+         Type type;
+         int layer = 0;
+         Color color;
+         Rect<int> src, dst;
+         shared_ptr<const Image> image;
+         size_t first = 0, count = 0;
+      };
+
+      void push(const Command& command) {
+         count_growth(commands);
+         commands.push_back(command);
+      }
+
+      void push_rect(Command::Type type, const Rect<int>& rect) {
+         Command command(type);
+         command.dst = rect;
+         push(command);
+      }
+
+      Size<int> szLogical;
+      vector<Command> commands;
+      vector<Rect<int>> srcRects, dstRects;
+   };
+}
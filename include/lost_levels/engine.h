@@ -5,13 +5,23 @@
  * Date: Sunday, Jan 25 2015
  */
 #pragma once
+#include <condition_variable>
 #include <csignal>
+#include <exception>
+#include <functional>
+#include <mutex>
 #include <stack>
+#include <thread>
 
 #include "lain/exception.h"
 #include "lain/util.h"
 #include "lost_levels/timer.h"
+#include "lost_levels/diag.h"
+#include "lost_levels/draw_list.h"
 #include "lost_levels/graphics.h"
+#include "lost_levels/jobs.h"
+#include "lost_levels/pacing.h"
+#include "lost_levels/replay.h"
 #include "lost_levels/resources.h"
 
 namespace lost_levels {
@@ -82,13 +92,41 @@ namespace lost_levels {
       /**
        * Called when the graphics update timer fires.  Use this to draw
        * the scene.
+       *
+       * Objects can be drawn between their previous and current physics
+       * states with Engine::get_interpolation_alpha(), so that the scene
+       * looks smooth when physics runs at a lower rate than graphics.
        */
       virtual void paint() = 0;
 
+      /**
+       * Called before each paint() to report what has changed since the
+       * last frame was drawn.  Call damage.invalidate() with each
+       * changed rectangle in logical coordinates, or with no rectangle
+       * if the whole frame changed.  If nothing is reported, the frame
+       * is neither painted nor displayed, so idle screens cost nothing.
+       *
+       * By default the whole frame is invalidated, so every frame is
+       * painted.  Rectangles are only painted individually when partial
+       * repaints are enabled, see Engine::set_partial_repaint().
+       */
+      virtual void report_damage(Damage& damage) {
+         damage.invalidate();
+      }
+
    protected:
       Engine& engine;
    };
 
+   /**
+    * The timers driving an Engine, which count microseconds.  Any clock
+    * can be used, e.g. SteadyClock<>, sdl2::PerformanceClock, or a
+    * synthetic clock in tests:
+    *
+    *    set_physics_timer(EngineTimer::create(SteadyClock<>(), 10000, true));
+    */
+   typedef Timer<uint64_t> EngineTimer;
+
    /**
     * Engine <abstract class>
     *
@@ -106,13 +144,13 @@ namespace lost_levels {
     *
     *       set_renderer(sdl2::create_renderer(get_window());
     *
-    *    - Set physics and graphics timers.
+    *    - Set physics and graphics timers, in microseconds.
     *
     *       // 100FPS no frame skip.
-    *       set_physics_timer(sdl2::create_timer(1000 / 10), true);
+    *       set_physics_timer(sdl2::create_performance_timer(1000000 / 100, true));
     *
     *       // 60FPS frame skip (with recovery)
-    *       set_graphics_timer(sdl2::create_timer(1000 / 60));
+    *       set_graphics_timer(sdl2::create_performance_timer(1000000 / 60));
     *
     *    - Optionally initialize any other settings, such as the
     *      renderer's logical size, default draw color, or load data
@@ -140,18 +178,275 @@ namespace lost_levels {
          return window;
       }
 
+      /**
+       * Get the renderer to draw with.  In pipelined mode, this is the
+       * DrawList being recorded for the current frame rather than the
+       * renderer passed to set_renderer().
+       */
       shared_ptr<Renderer> get_renderer() const {
-         return renderer;
+         return paintTarget != nullptr ? paintTarget : renderer;
       }
 
-      shared_ptr<Timer<uint32_t>> get_graphics_timer() const {
+      shared_ptr<EngineTimer> get_graphics_timer() const {
          return graphicsTimer;
       }
 
-      shared_ptr<Timer<uint32_t>> get_physics_timer() const {
+      shared_ptr<EngineTimer> get_physics_timer() const {
          return physicsTimer;
       }
 
+      /**
+       * Limit the number of physics updates run in one iteration of
+       * the game loop.  When more updates are due, for example after a
+       * stall, the rest are dropped and the physics timer is resynced,
+       * so that rendering is not starved while physics catches up.
+       *
+       * @param maxSteps The maximum number of physics updates per
+       *    iteration, or 0 for no limit.  There is no limit by default.
+       */
+      void set_max_catch_up_steps(unsigned int maxSteps) {
+         maxCatchUpSteps = maxSteps;
+      }
+
+      unsigned int get_max_catch_up_steps() const {
+         return maxCatchUpSteps;
+      }
+
+      /**
+       * @return The number of physics updates dropped so far because of
+       *    the catch up limit.
+       */
+      uint64_t get_dropped_steps() const {
+         return droppedSteps;
+      }
+
+      /**
+       * @return How far the current frame is between the last physics
+       *    update and the next, from 0 to 1.  Sampled once before each
+       *    paint, so it is constant during State::paint().
+       *
+       *    Rect<float> drawRect = prevRect.lerp(rect,
+       *       engine.get_interpolation_alpha());
+       */
+      double get_interpolation_alpha() const {
+         return interpolationAlpha;
+      }
+
+      /**
+       * Enable or disable the built in frame pacing performed by the
+       * default delay() implementation.  Enabled by default.
+       */
+      void set_frame_pacing(bool framePacing) {
+         this->framePacing = framePacing;
+      }
+
+      bool is_frame_pacing() const {
+         return framePacing;
+      }
+
+      const FramePacer& get_frame_pacer() const {
+         return framePacer;
+      }
+
+      /**
+       * Enable or disable pipelined mode, which takes effect when run()
+       * is called.  Disabled by default.
+       *
+       * In pipelined mode, update() and paint() run on a simulation
+       * thread, and State::paint() draws into a DrawList.  Meanwhile the
+       * main thread replays the previous frame's DrawList into the real
+       * renderer and presents it, so simulating one frame overlaps with
+       * drawing the one before.  input() and delay() still run on the
+       * main thread, while the simulation thread is idle, so states
+       * need no locking and SDL events are still polled on the main
+       * thread.
+       *
+       * NOTE:
+       * - Frames are presented one frame later than in serial mode.
+       * - State::update() and State::paint() must not use the real
+       *   renderer, directly or through an ImageLoader, e.g. by
+       *   calling ResourceManager::AsyncLoad::update().  Load resources
+       *   before run() or from input() instead.
+       */
+      void set_pipelined(bool pipelined) {
+         this->pipelined = pipelined;
+      }
+
+      bool is_pipelined() const {
+         return pipelined;
+      }
+
+      /**
+       * Enable or disable partial repaints.  Disabled by default.
+       *
+       * When enabled, the scene is drawn into a render target of the
+       * renderer's logical size which is kept between frames, and each
+       * frame only the bounds of the damage reported by
+       * State::report_damage() is cleared (with the current draw color,
+       * as with Renderer::clear()) and painted, clipped to those bounds.
+       * The target is then drawn to the screen, followed by diag_paint().
+       *
+       * NOTE:
+       * - States must still draw every object which overlaps the
+       *   damage, and should skip drawing objects which don't.
+       * - Renderers without render targets, and pipelined mode, always
+       *   paint the whole frame, though frames with no damage are still
+       *   skipped.
+       */
+      void set_partial_repaint(bool partialRepaint) {
+         this->partialRepaint = partialRepaint;
+         canvas = nullptr;
+         canvasUnsupported = false;
+      }
+
+      bool is_partial_repaint() const {
+         return partialRepaint;
+      }
+
+      /**
+       * Paint the whole of the next frame, whatever damage the current
+       * state reports, e.g. after the window is resized or render
+       * targets are reset.  This is done automatically when the state
+       * changes.
+       */
+      void invalidate() {
+         repaintAll = true;
+      }
+
+      /**
+       * @return The number of frames skipped because the current state
+       *    reported no damage.
+       */
+      uint64_t get_skipped_frames() const {
+         return skippedFrames;
+      }
+
+      /**
+       * Get the Profiler which times each phase of the game loop.  Add
+       * zones of your own to it, and draw it from diag_paint() with
+       * Profiler::paint_overlay().
+       */
+      Profiler& get_profiler() {
+         return profiler;
+      }
+
+      /**
+       * Set the number of threads the JobSystem runs jobs on, including
+       * the calling thread.  Must be called before the first call to
+       * get_jobs().  Defaults to the number of hardware threads; use 1
+       * to run every job inline on the calling thread.
+       */
+      void set_job_threads(size_t numThreads) {
+         if (jobs != nullptr) {
+            throw EngineException("The JobSystem has already been started.");
+         }
+
+         jobThreads = numThreads;
+      }
+
+      /**
+       * Get the JobSystem for fanning work out across threads, e.g. from
+       * State::update().  The worker threads are started on first use.
+       *
+       *    engine.get_jobs().parallel_for_each(0, sprites.size(), 64,
+       *       [&](size_t x) { sprites[x].update(); });
+       */
+      JobSystem& get_jobs() {
+         if (jobs == nullptr) {
+            jobs = jobThreads > 0 ? unique_ptr<JobSystem>(new JobSystem(jobThreads)) :
+                                    unique_ptr<JobSystem>(new JobSystem());
+         }
+
+         return *jobs;
+      }
+
+      /**
+       * Record the session when run() is called, see get_recording().
+       * Disabled by default.
+       *
+       * Each iteration of the game loop records the input events
+       * delivered through poll_input() and the number of physics
+       * updates run, which is enough to replay the session from the
+       * same initial state with set_replay().
+       */
+      void set_recording(bool recording) {
+         recordingEnabled = recording;
+      }
+
+      /**
+       * @return What has been recorded so far, or nullptr if recording
+       *    is disabled.  Save it with Recording::save() once run()
+       *    returns.
+       */
+      shared_ptr<const Recording> get_recording() const {
+         return recording;
+      }
+
+      /**
+       * Replay a recorded session when run() is called, instead of
+       * reading input and the clock.
+       *
+       * The physics and graphics timers are driven by a synthetic clock
+       * which advances by one physics interval for each recorded update,
+       * and delay() is not called, so the session replays as fast as
+       * the states can run it.  Input events are served from the
+       * recording by poll_input().  run() returns when the recording
+       * ends, or when the state stack is emptied.
+       *
+       * @param paint false to skip painting entirely, so that only
+       *    input() and update() are measured.
+       *
+       * NOTE:
+       * - States must be deterministic given their input and the
+       *   physics timer, e.g. seed random number generators with a
+       *   constant, and read input only through poll_input().
+       * - Replays always run serially, even in pipelined mode.
+       * - The recording's physics interval must match the physics
+       *   timer's interval.
+       */
+      void set_replay(shared_ptr<const Recording> replay, bool paint = true) {
+         this->replay = replay;
+         replayPaint = paint;
+      }
+
+      bool is_replaying() const {
+         return replay != nullptr;
+      }
+
+      /**
+       * Get the next input event into event, calling poll(&event) to
+       * read it, e.g. SDL_PollEvent.  When recording, the event is
+       * recorded, and when replaying, the next recorded event is
+       * returned instead of calling poll.  Call this from input() and
+       * nowhere else, so that replays are deterministic.
+       *
+       *    SDL_Event e;
+       *    while (engine.poll_input(e, SDL_PollEvent)) { ... }
+       *
+       * @return true if there was an event, false otherwise.
+       */
+      template<class E, class F>
+      bool poll_input(E& event, F poll) {
+         if (replay != nullptr) {
+            if (replayFrame >= replay->get_num_frames() ||
+                replayEvent >= replay->get_num_events(replayFrame)) {
+               return false;
+            }
+
+            replay->get_event(replayFrame, replayEvent++, &event, sizeof(E));
+            return true;
+         }
+
+         if (! poll(&event)) {
+            return false;
+         }
+
+         if (recording != nullptr) {
+            recording->add_event(&event, sizeof(E));
+         }
+         return true;
+      }
+
       /**
        * This method should be called by your main() function to start
        * the game loop and run your game.  It calls your initialize()
@@ -190,14 +485,42 @@ namespace lost_levels {
             util::require(renderer, "Renderer is required, call set_renderer() in your initialize() method");
             util::assertTrue(! states.empty(), "Initial state is required, call put_state() in your initialize() method");
 
+            if (replay != nullptr) {
+               start_replay();
+
+            } else if (recordingEnabled) {
+               recording = make_shared<Recording>(physicsTimer->get_interval());
+            }
+
             graphicsTimer->start();
             physicsTimer->start();
 
-            while (! states.empty()) {
-               input();
-               update();
-               paint();
-               delay();
+            if (replay != nullptr) {
+               run_replay();
+
+            } else if (pipelined) {
+               run_pipelined();
+
+            } else {
+               while (! states.empty()) {
+                  {
+                     Profiler::Zone zone(profiler, inputZone);
+                     input();
+                  }
+                  {
+                     Profiler::Zone zone(profiler, updateZone);
+                     update();
+                  }
+                  {
+                     Profiler::Zone zone(profiler, paintZone);
+                     paint();
+                  }
+                  {
+                     Profiler::Zone zone(profiler, delayZone);
+                     delay();
+                  }
+                  end_frame();
+               }
             }
 
             return 0;
@@ -221,6 +544,7 @@ namespace lost_levels {
          currentState = make_shared<T>(*this, args...);
          currentState->initialize();
          states.push(currentState);
+         invalidate();
       }
 
       /**
@@ -233,6 +557,7 @@ namespace lost_levels {
        */
       void pop_state() {
          states.pop();
+         invalidate();
 
          if (! states.empty()) {
             currentState = states.top();
@@ -285,21 +610,23 @@ namespace lost_levels {
 
       /**
        * Set the graphics timer, controlling how frequently the current
-       * scene is drawn to the screen.
+       * scene is drawn to the screen.  The timer counts microseconds,
+       * see EngineTimer.
        *
        * This must be called during the initialize() method.
        */
-      void set_graphics_timer(shared_ptr<Timer<uint32_t>> timer) {
+      void set_graphics_timer(shared_ptr<EngineTimer> timer) {
          graphicsTimer = timer;
       }
 
       /**
        * Set the graphics timer, controlling how frequently and at
-       * what scale the objects in the game are updated.
+       * what scale the objects in the game are updated.  The timer
+       * counts microseconds, see EngineTimer.
        *
        * This must be called during the initialize() method.
        */
-      void set_physics_timer(shared_ptr<Timer<uint32_t>> timer) {
+      void set_physics_timer(shared_ptr<EngineTimer> timer) {
          physicsTimer = timer;
       }
 
@@ -327,9 +654,23 @@ namespace lost_levels {
        * Overriding this method is discouraged.
        */
       virtual void update() {
+         unsigned int steps = 0;
+
          while (physicsTimer->update()) {
             currentState->update();
             diag_update();
+            steps++;
+
+            if (maxCatchUpSteps > 0 && steps >= maxCatchUpSteps) {
+               if (physicsTimer->get_wait_time() == 0) {
+                  droppedSteps += physicsTimer->resync();
+               }
+               break;
+            }
+         }
+
+         if (recording != nullptr) {
+            recording->add_steps(steps);
          }
       }
 
@@ -341,10 +682,49 @@ namespace lost_levels {
        */
       virtual void paint() {
          if (graphicsTimer->update()) {
-            get_renderer()->clear();
-            currentState->paint();
+            interpolationAlpha = physicsTimer->get_alpha();
+
+            damage.clear();
+            if (repaintAll) {
+               damage.invalidate();
+            }
+            currentState->report_damage(damage);
+
+            if (damage.is_empty()) {
+               skippedFrames ++;
+               framesSkipped.add();
+               return;
+            }
+            repaintAll = false;
+
+            shared_ptr<Renderer> target = get_renderer();
+            bool useCanvas = partialRepaint && paintTarget == nullptr && prepare_canvas();
+
+            if (useCanvas) {
+               target->set_render_target(canvas);
+            }
+
+            if (useCanvas && ! damage.is_full()) {
+               Rect<int> bounds = damage.get_bounds();
+               target->set_clip_rect(bounds);
+               target->fill_rect(bounds);
+               currentState->paint();
+               target->clear_clip_rect();
+
+            } else {
+               target->clear();
+               currentState->paint();
+            }
+
+            if (useCanvas) {
+               target->set_render_target(nullptr);
+               target->render(canvas, Rect<int>(Point<int>(), canvas->get_size()));
+            }
+
             diag_paint();
-            renderer->display();
+
+            Profiler::Zone zone(profiler, displayZone);
+            target->display();
          }
       }
 
@@ -352,7 +732,8 @@ namespace lost_levels {
        * Invoked during every update cycle.  Does nothing by default.
        *
        * Override this method to update diagnostic information to be
-       * shown on the screen, e.g. a FrameCalculator to print paint FPS.
+       * shown on the screen, e.g. a FrameCalculator to print paint FPS,
+       * or the per-frame values of Counters in Metrics::global().
        *
        * This should ideally not be used for your game's HUD or any other
        * non-diagnostic purpose.
@@ -366,30 +747,271 @@ namespace lost_levels {
        * Override this method to display diagnostic information to the
        * screen above all other objects.  This should ideally not be used
        * for your game's HUD or any other non-diagnostic printing.
+       *
+       *    void diag_paint() override {
+       *       get_profiler().paint_overlay(*get_renderer(), font, Point<int>(),
+       *                                    CLEAR_COLOR);
+       *    }
        */
       virtual void diag_paint() { }
 
       /**
-       * Invoked at the end of each game loop.  Does nothing by default.
-       *
-       * Override this method to save energy by sleeping and allowing
-       * other processes to execute.  Note that by sleeping, you are
-       * passing control to other processes which may affect the
-       * responsiveness of your game and the refresh rate of your graphics.
+       * Invoked at the end of each game loop.
        *
-       * You may want to decide whether or not sleeping should be performed
-       * programmatically by checking if the game is in the foreground or
-       * if the device is on battery power.
+       * By default, if frame pacing is enabled, this sleeps until the
+       * earlier of the physics and graphics timer deadlines using a
+       * FramePacer, which sleeps coarsely and then spins for the last
+       * slice of the wait so that deadlines are not overshot.
        *
-       * EXAMPLE:
-       *
-       *    void delay() override {
-       *       SDL_Delay(get_graphics_timer()->get_wait_time());
-       *    }
+       * Override this method to use a different strategy, for example
+       * to avoid sleeping when the renderer already waits for vsync, or
+       * to sleep longer when the game is in the background or the
+       * device is on battery power.
        */
-      virtual void delay() { }
+      virtual void delay() {
+         if (! framePacing) {
+            return;
+         }
+
+         // Take the time first, so that the deadline doesn't slip by
+         // however long it takes to read the timers.
+         FramePacer::Clock::time_point now = FramePacer::Clock::now();
+         uint64_t waitTime = min(physicsTimer->get_wait_time(),
+                                 graphicsTimer->get_wait_time());
+         if (waitTime > 0) {
+            framePacer.wait_until(now + chrono::microseconds(waitTime));
+         }
+      }
 
    private:
+      /**
+       * Runs a task on a dedicated thread each time start() is called.
+       * Exceptions thrown by the task are rethrown from wait().
+       */
+      class Worker {
+      public:
+         Worker(function<void()> task) :
+            task(task), workerThread(&Worker::run, this) { }
+
+         ~Worker() {
+            {
+               lock_guard<mutex> lock(workerMutex);
+               quit = true;
+            }
+            cv.notify_all();
+            workerThread.join();
+         }
+
+         void start() {
+            lock_guard<mutex> lock(workerMutex);
+            pending = true;
+            cv.notify_all();
+         }
+
+         void wait() {
+            unique_lock<mutex> lock(workerMutex);
+            cv.wait(lock, [this]() { return ! pending; });
+
+            if (error != nullptr) {
+               exception_ptr e = error;
+               error = nullptr;
+               rethrow_exception(e);
+            }
+         }
+
+      private:
+         void run() {
+            unique_lock<mutex> lock(workerMutex);
+
+            for (;;) {
+               cv.wait(lock, [this]() { return pending || quit; });
+               if (quit) {
+                  return;
+               }
+
+               lock.unlock();
+               try {
+                  task();
+
+               } catch (...) {
+                  lock.lock();
+                  error = current_exception();
+                  lock.unlock();
+               }
+               lock.lock();
+
+               pending = false;
+               cv.notify_all();
+            }
+         }
+
+         function<void()> task;
+         mutex workerMutex;
+         condition_variable cv;
+         bool pending = false;
+         bool quit = false;
+         exception_ptr error;
+         thread workerThread;
+      };
+
+      /**
+       * The game loop for pipelined mode, see set_pipelined().
+       */
+      void run_pipelined() {
+         shared_ptr<DrawList> drawLists[2] = {
+            make_shared<DrawList>(renderer->get_logical_size()),
+            make_shared<DrawList>(renderer->get_logical_size())
+         };
+         int back = 0;
+         bool frontReady = false;
+
+         Worker simulation([&]() {
+            drawLists[back]->reset();
+            {
+               Profiler::Zone zone(profiler, updateZone);
+               update();
+            }
+            Profiler::Zone zone(profiler, paintZone);
+            paint();
+         });
+
+         while (! states.empty()) {
+            {
+               Profiler::Zone zone(profiler, inputZone);
+               input();
+            }
+            if (states.empty()) {
+               break;
+            }
+
+            paintTarget = drawLists[back];
+            simulation.start();
+
+            if (frontReady) {
+               Profiler::Zone zone(profiler, displayZone);
+               drawLists[1 - back]->replay(*renderer);
+               renderer->display();
+               frontReady = false;
+            }
+
+            {
+               Profiler::Zone zone(profiler, simWaitZone);
+               simulation.wait();
+            }
+            paintTarget = nullptr;
+
+            if (drawLists[back]->size() > 0) {
+               back = 1 - back;
+               frontReady = true;
+            }
+
+            {
+               Profiler::Zone zone(profiler, delayZone);
+               delay();
+            }
+            end_frame();
+         }
+      }
+
+      /**
+       * Drive the timers from the replay clock, see set_replay().
+       * Relative timers follow the timers they count.
+       */
+      void start_replay() {
+         if (replay->get_physics_interval() != physicsTimer->get_interval()) {
+            throw EngineException(tfm::format(
+               "The replay was recorded with a physics interval of %d, not %d.",
+               replay->get_physics_interval(), physicsTimer->get_interval()));
+         }
+
+         replayTime = 0;
+         replayFrame = 0;
+         replayEvent = 0;
+
+         auto clock = [this]() { return replayTime; };
+         for (auto& timer : {physicsTimer, graphicsTimer}) {
+            if (! timer->is_relative()) {
+               timer->set_clock(clock);
+            }
+         }
+      }
+
+      /**
+       * The game loop for replays, see set_replay().
+       */
+      void run_replay() {
+         const uint64_t interval = physicsTimer->get_interval();
+
+         for (; replayFrame < replay->get_num_frames() && ! states.empty(); replayFrame++) {
+            replayEvent = 0;
+            {
+               Profiler::Zone zone(profiler, inputZone);
+               input();
+            }
+            if (states.empty()) {
+               break;
+            }
+
+            {
+               Profiler::Zone zone(profiler, updateZone);
+               for (uint32_t x = 0; x < replay->get_steps(replayFrame); x++) {
+                  replayTime += interval;
+                  physicsTimer->update();
+                  currentState->update();
+                  diag_update();
+               }
+            }
+
+            if (replayPaint) {
+               Profiler::Zone zone(profiler, paintZone);
+               paint();
+            }
+            end_frame();
+         }
+      }
+
+      /**
+       * Create the render target for partial repaints, or recreate it
+       * when the logical size changes, in which case the whole frame is
+       * repainted.
+       *
+       * @return false if the renderer does not support render targets.
+       */
+      bool prepare_canvas() {
+         Size<int> szLogical = renderer->get_logical_size();
+
+         if (canvasUnsupported) {
+            return false;
+
+         } else if (canvas == nullptr || canvas->get_size() != szLogical) {
+            canvas = renderer->create_render_target(szLogical);
+            if (canvas == nullptr) {
+               canvasUnsupported = true;
+               return false;
+            }
+            damage.invalidate();
+         }
+
+         return true;
+      }
+
+      /**
+       * Close the current frame of the Profiler and the global Metrics.
+       */
+      void end_frame() {
+         static Histogram& frameTimes = Metrics::global().histogram("engine.frame_time_ms", 1.0, 100);
+
+         profiler.end_frame();
+         if (profiler.is_enabled()) {
+            frameTimes.add(profiler.get_last_frame_time() / 1000.0);
+         }
+         Metrics::global().end_frame();
+
+         if (recording != nullptr) {
+            recording->end_frame();
+         }
+      }
+
       static void signal_callback(int signal) {
          tfm::format(cerr, "FATAL: Caught signal %d (%s): %s\nAborted.\n",
             signal, strsignal(signal),
@@ -397,8 +1019,8 @@ namespace lost_levels {
          exit(1);
       }
 
-      shared_ptr<Timer<uint32_t>> physicsTimer = nullptr;
-      shared_ptr<Timer<uint32_t>> graphicsTimer = nullptr;
+      shared_ptr<EngineTimer> physicsTimer = nullptr;
+      shared_ptr<EngineTimer> graphicsTimer = nullptr;
 
       shared_ptr<Window> window = nullptr;
       shared_ptr<Renderer> renderer = nullptr;
@@ -406,6 +1028,43 @@ namespace lost_levels {
       stack<shared_ptr<State>> states;
       shared_ptr<State> currentState = nullptr;
 
+      unsigned int maxCatchUpSteps = 0;
+      uint64_t droppedSteps = 0;
+      double interpolationAlpha = 0.0;
+
+      bool framePacing = true;
+      FramePacer framePacer;
+
+      bool pipelined = false;
+      shared_ptr<Renderer> paintTarget = nullptr;
+
+      Damage damage;
+      bool repaintAll = true;
+      bool partialRepaint = false;
+      shared_ptr<Image> canvas = nullptr;
+      bool canvasUnsupported = false;
+      uint64_t skippedFrames = 0;
+      Counter& framesSkipped = Metrics::global().counter("render.frames_skipped");
+
+      Profiler profiler;
+      const Profiler::ZoneId inputZone = Profiler::get_zone_id("input");
+      const Profiler::ZoneId updateZone = Profiler::get_zone_id("update");
+      const Profiler::ZoneId paintZone = Profiler::get_zone_id("paint");
+      const Profiler::ZoneId displayZone = Profiler::get_zone_id("display");
+      const Profiler::ZoneId simWaitZone = Profiler::get_zone_id("sim wait");
+      const Profiler::ZoneId delayZone = Profiler::get_zone_id("delay");
+
+      size_t jobThreads = 0;
+      unique_ptr<JobSystem> jobs = nullptr;
+
+      bool recordingEnabled = false;
+      shared_ptr<Recording> recording = nullptr;
+      shared_ptr<const Recording> replay = nullptr;
+      bool replayPaint = true;
+      uint64_t replayTime = 0;
+      size_t replayFrame = 0;
+      size_t replayEvent = 0;
+
       int returnCode = 0;
    };
 }
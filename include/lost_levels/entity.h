@@ -0,0 +1,541 @@
+/*
+ * entity: Contiguous storage for game objects and their components.
+ *
+ * Author: Lain Supe (lainproliant)
+ * Date: Wednesday, Oct 14 2026
+ */
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+
+#include "lain/exception.h"
+#include "tinyformat/tinyformat.h"
+#include "lost_levels/animation.h"
+#include "lost_levels/broadphase.h"
+#include "lost_levels/collision.h"
+#include "lost_levels/jobs.h"
+
+namespace lost_levels {
+   using namespace std;
+   using namespace lain;
+
+   class EntityException : public Exception {
+      using Exception::Exception;
+   };
+
+   /**
+    * A handle to an entity in an EntityStore.  Handles stay valid while
+    * the entity lives, however the store is reordered.  The index of a
+    * destroyed entity is reused, but with a new generation, so stale
+    * handles are detected rather than referring to the new entity.
+    *
+    * The index is unique among live entities, so it may be used as the
+    * id of the entity in a BroadPhase, see EntityStore::find().
+    */
+   struct Entity {
+      static const uint32_t NONE = 0xffffffff;
+
+      Entity() { }
+      Entity(uint32_t index, uint32_t generation) :
+         index(index), generation(generation) { }
+
+      bool is_null() const {
+         return index == NONE;
+      }
+
+      bool operator==(const Entity& rhs) const {
+         return index == rhs.index && generation == rhs.generation;
+      }
+
+      bool operator!=(const Entity& rhs) const {
+         return ! this->operator==(rhs);
+      }
+
+      struct Hash {
+         size_t operator()(const Entity& entity) const {
+            return hash<uint64_t>()(((uint64_t)entity.generation << 32) | entity.index);
+         }
+      };
+
+      uint32_t index = NONE;
+      uint32_t generation = 0;
+   };
+
+   class ComponentPoolBase {
+   public:
+      virtual ~ComponentPoolBase() { }
+
+      /**
+       * Remove the component of the given entity, if it has one.
+       */
+      virtual void remove(Entity entity) = 0;
+      virtual void clear() = 0;
+      virtual size_t size() const = 0;
+   };
+
+   /**
+    * ComponentPool <concrete class>
+    *
+    * A sparse set of components of type T, stored contiguously along
+    * with the entity each belongs to.  Lookup by entity is constant
+    * time, and iterating get_components() touches only the entities
+    * which have the component.
+    *
+    * NOTE:
+    * - Removal moves the last component into the removed one's place,
+    *   so it invalidates references to that component.
+    */
+   template<class T>
+   class ComponentPool : public ComponentPoolBase {
+   public:
+      /**
+       * Give the entity a component, replacing any it already has.
+       */
+      T& add(Entity entity, const T& component = T()) {
+         int idx = lookup(entity);
+         if (idx != -1) {
+            components[idx] = component;
+            return components[idx];
+         }
+
+         if (entity.index >= sparse.size()) {
+            sparse.resize(entity.index + 1, -1);
+         }
+
+         sparse[entity.index] = entities.size();
+         entities.push_back(entity);
+         components.push_back(component);
+         return components.back();
+      }
+
+      void remove(Entity entity) override {
+         int idx = lookup(entity);
+         if (idx == -1) {
+            return;
+         }
+
+         int last = entities.size() - 1;
+         entities[idx] = entities[last];
+         components[idx] = move(components[last]);
+         sparse[entities[idx].index] = idx;
+
+         entities.pop_back();
+         components.pop_back();
+         sparse[entity.index] = -1;
+      }
+
+      void clear() override {
+         entities.clear();
+         components.clear();
+         sparse.clear();
+      }
+
+      size_t size() const override {
+         return entities.size();
+      }
+
+      bool has(Entity entity) const {
+         return lookup(entity) != -1;
+      }
+
+      /**
+       * @return The entity's component, or nullptr if it has none.
+       */
+      T* find(Entity entity) {
+         int idx = lookup(entity);
+         return idx == -1 ? nullptr : &components[idx];
+      }
+
+      const T* find(Entity entity) const {
+         int idx = lookup(entity);
+         return idx == -1 ? nullptr : &components[idx];
+      }
+
+      /**
+       * @throws EntityException if the entity has no such component.
+       */
+      T& get(Entity entity) {
+         return components[checked_lookup(entity)];
+      }
+
+      const T& get(Entity entity) const {
+         return components[checked_lookup(entity)];
+      }
+
+      /**
+       * @return The entity of each component in get_components().
+       */
+      const vector<Entity>& get_entities() const {
+         return entities;
+      }
+
+      vector<T>& get_components() {
+         return components;
+      }
+
+      const vector<T>& get_components() const {
+         return components;
+      }
+
+      /**
+       * Call func(entity, component) for each component.
+       */
+      template<class F>
+      void for_each(F func) {
+         for (size_t x = 0; x < entities.size(); x++) {
+            func(entities[x], components[x]);
+         }
+      }
+
+   private:
+      int lookup(Entity entity) const {
+         if (entity.index >= sparse.size()) {
+            return -1;
+         }
+
+         int idx = sparse[entity.index];
+         return idx != -1 && entities[idx] == entity ? idx : -1;
+      }
+
+      int checked_lookup(Entity entity) const {
+         int idx = lookup(entity);
+         if (idx == -1) {
+            throw EntityException(tfm::format("Entity %d:%d has no component of this type.",
+               entity.index, entity.generation));
+         }
+         return idx;
+      }
+
+      vector<Entity> entities;
+      vector<T> components;
+      vector<int> sparse;
+   };
+
+   /**
+    * EntityStore <concrete class>
+    *
+    * Owns many game objects, stored as parallel arrays of the state
+    * every object has (bounds, last frame's bounds, velocity and
+    * animation), so that systems update them in tight loops over
+    * contiguous memory instead of chasing a pointer per object.  Other
+    * state is kept in ComponentPools, see components().
+    *
+    * USAGE:
+    * - Call create() for each object, keeping the returned handle, and
+    *   destroy() when the object is gone.
+    * - Call integrate() once per physics tick to move every entity by
+    *   its velocity, then update the collision structures with
+    *   update_broad_phase() and update_tree().  Pairs found by a broad
+    *   phase are of entity ids, resolve them with find().
+    * - Iterate the arrays from get_bounds(), get_velocities() etc. for
+    *   bulk work; the arrays share the order of get_entities().  Use the
+    *   per-entity accessors for individual objects.
+    * - Call set_animation_system() so that destroying an entity also
+    *   removes its animation instance, and set_broad_phase() and
+    *   set_tree() so that it is removed from the structures filled by
+    *   update_broad_phase() and update_tree().  Otherwise remove
+    *   destroyed entities from them by hand, or stale entries remain.
+    *
+    * NOTE:
+    * - destroy() moves the last entity into the destroyed one's place,
+    *   so it must not be called while iterating the arrays by index.
+    *   Collect the entities to destroy and destroy them afterwards.
+    */
+   class EntityStore {
+   public:
+      static const AnimationSystem::Id NO_ANIMATION = -1;
+
+      Entity create(const Rect<float>& bounds = Rect<float>(),
+                    const Vector<float>& velocity = Vector<float>(),
+                    AnimationSystem::Id animation = NO_ANIMATION) {
+         uint32_t index;
+         if (freeIndices.empty()) {
+            index = denseIndex.size();
+            denseIndex.push_back(-1);
+            generations.push_back(0);
+
+         } else {
+            index = freeIndices.back();
+            freeIndices.pop_back();
+         }
+
+         Entity entity(index, generations[index]);
+         denseIndex[index] = entities.size();
+         entities.push_back(entity);
+         this->bounds.push_back(bounds);
+         prevBounds.push_back(bounds);
+         velocities.push_back(velocity);
+         animations.push_back(animation);
+
+         return entity;
+      }
+
+      /**
+       * Destroy the given entity, removing its components, its
+       * animation instance, and its broad phase and tree entries.  The
+       * last entity is moved into its place, so destruction is constant
+       * time.
+       *
+       * @throws EntityException if the entity isn't alive.
+       */
+      void destroy(Entity entity) {
+         int idx = index_of(entity);
+         int last = entities.size() - 1;
+
+         if (broadPhase != nullptr) {
+            broadPhase->remove(entity.index);
+         }
+
+         if (removeFromTree) {
+            removeFromTree(entity);
+         }
+
+         if (animationSystem != nullptr && animations[idx] != NO_ANIMATION) {
+            animationSystem->remove(animations[idx]);
+         }
+
+         for (auto& pool : pools) {
+            pool.second->remove(entity);
+         }
+
+         entities[idx] = entities[last];
+         bounds[idx] = bounds[last];
+         prevBounds[idx] = prevBounds[last];
+         velocities[idx] = velocities[last];
+         animations[idx] = animations[last];
+         denseIndex[entities[idx].index] = idx;
+
+         entities.pop_back();
+         bounds.pop_back();
+         prevBounds.pop_back();
+         velocities.pop_back();
+         animations.pop_back();
+
+         denseIndex[entity.index] = -1;
+         generations[entity.index]++;
+         freeIndices.push_back(entity.index);
+      }
+
+      /**
+       * Destroy every entity.  Handles to them become stale.
+       */
+      void clear() {
+         while (! entities.empty()) {
+            destroy(entities.back());
+         }
+      }
+
+      void reserve(size_t count) {
+         entities.reserve(count);
+         bounds.reserve(count);
+         prevBounds.reserve(count);
+         velocities.reserve(count);
+         animations.reserve(count);
+      }
+
+      size_t size() const {
+         return entities.size();
+      }
+
+      bool is_alive(Entity entity) const {
+         return entity.index < denseIndex.size() &&
+                denseIndex[entity.index] != -1 &&
+                generations[entity.index] == entity.generation;
+      }
+
+      /**
+       * @return The position of the entity in the arrays.
+       * @throws EntityException if the entity isn't alive.
+       */
+      size_t index_of(Entity entity) const {
+         if (! is_alive(entity)) {
+            throw EntityException(tfm::format("Entity %d:%d is not alive.",
+               entity.index, entity.generation));
+         }
+
+         return denseIndex[entity.index];
+      }
+
+      /**
+       * @return The live entity with the given id, i.e. Entity::index,
+       *    or a null entity if there is none.
+       */
+      Entity find(int id) const {
+         if (id < 0 || (size_t)id >= denseIndex.size() || denseIndex[id] == -1) {
+            return Entity();
+         }
+
+         return entities[denseIndex[id]];
+      }
+
+      const vector<Entity>& get_entities() const {
+         return entities;
+      }
+
+      vector<Rect<float>>& get_bounds() {
+         return bounds;
+      }
+
+      const vector<Rect<float>>& get_bounds() const {
+         return bounds;
+      }
+
+      /**
+       * @return The bounds of each entity before the last integrate().
+       */
+      const vector<Rect<float>>& get_prev_bounds() const {
+         return prevBounds;
+      }
+
+      vector<Vector<float>>& get_velocities() {
+         return velocities;
+      }
+
+      const vector<Vector<float>>& get_velocities() const {
+         return velocities;
+      }
+
+      const vector<AnimationSystem::Id>& get_animations() const {
+         return animations;
+      }
+
+      Rect<float>& get_bounds(Entity entity) {
+         return bounds[index_of(entity)];
+      }
+
+      const Rect<float>& get_bounds(Entity entity) const {
+         return bounds[index_of(entity)];
+      }
+
+      const Rect<float>& get_prev_bounds(Entity entity) const {
+         return prevBounds[index_of(entity)];
+      }
+
+      Vector<float>& get_velocity(Entity entity) {
+         return velocities[index_of(entity)];
+      }
+
+      const Vector<float>& get_velocity(Entity entity) const {
+         return velocities[index_of(entity)];
+      }
+
+      AnimationSystem::Id get_animation(Entity entity) const {
+         return animations[index_of(entity)];
+      }
+
+      void set_animation(Entity entity, AnimationSystem::Id animation) {
+         animations[index_of(entity)] = animation;
+      }
+
+      /**
+       * Set the AnimationSystem which owns the entities' animation
+       * instances, so that they are removed with their entities.
+       */
+      void set_animation_system(AnimationSystem& animationSystem) {
+         this->animationSystem = &animationSystem;
+      }
+
+      /**
+       * Set the broad phase filled by update_broad_phase(), so that
+       * entities are removed from it when destroyed.  Call this again
+       * if the broad phase is replaced.
+       */
+      void set_broad_phase(BroadPhase<float>& broadPhase) {
+         this->broadPhase = &broadPhase;
+      }
+
+      /**
+       * Set the tree filled by update_tree(), so that entities are
+       * removed from it when destroyed.
+       */
+      template<class H>
+      void set_tree(CollisionTree<float, Entity, H>& tree) {
+         removeFromTree = [&tree](Entity entity) {
+            tree.remove(entity);
+         };
+      }
+
+      /**
+       * @return The pool of components of type T, created on first use.
+       */
+      template<class T>
+      ComponentPool<T>& components() {
+         unique_ptr<ComponentPoolBase>& pool = pools[type_index(typeid(T))];
+         if (pool == nullptr) {
+            pool.reset(new ComponentPool<T>());
+         }
+
+         return *static_cast<ComponentPool<T>*>(pool.get());
+      }
+
+      /**
+       * Move every entity by its velocity, keeping its previous bounds.
+       */
+      void integrate() {
+         integrate_range(0, entities.size());
+      }
+
+      /**
+       * Move every entity by its velocity, in parallel on the given
+       * job system.
+       */
+      void integrate(JobSystem& jobs, size_t grain = 1024) {
+         jobs.parallel_for(0, entities.size(), grain, [this](size_t begin, size_t end) {
+            integrate_range(begin, end);
+         });
+      }
+
+      /**
+       * Set the rect of each entity in the broad phase, by id, to the
+       * bounds it swept through in the last integrate().
+       */
+      void update_broad_phase(BroadPhase<float>& broadPhase) const {
+         for (size_t x = 0; x < entities.size(); x++) {
+            broadPhase.set(entities[x].index, swept_bounds(x));
+         }
+      }
+
+      /**
+       * Insert or update each entity in the tree with the bounds it
+       * swept through in the last integrate().
+       */
+      template<class H>
+      void update_tree(CollisionTree<float, Entity, H>& tree) const {
+         for (size_t x = 0; x < entities.size(); x++) {
+            tree.insert(entities[x], swept_bounds(x));
+         }
+      }
+
+   private:
+      void integrate_range(size_t begin, size_t end) {
+         for (size_t x = begin; x < end; x++) {
+            prevBounds[x] = bounds[x];
+            bounds[x].pt += velocities[x];
+         }
+      }
+
+      Rect<float> swept_bounds(size_t idx) const {
+         return collider.swept_bounds(prevBounds[idx], bounds[idx]);
+      }
+
+      vector<Entity> entities;
+      vector<Rect<float>> bounds;
+      vector<Rect<float>> prevBounds;
+      vector<Vector<float>> velocities;
+      vector<AnimationSystem::Id> animations;
+
+      vector<int> denseIndex;
+      vector<uint32_t> generations;
+      vector<uint32_t> freeIndices;
+
+      unordered_map<type_index, unique_ptr<ComponentPoolBase>> pools;
+      AnimationSystem* animationSystem = nullptr;
+      BroadPhase<float>* broadPhase = nullptr;
+      function<void(Entity)> removeFromTree;
+      Collider<float> collider;
+   };
+}
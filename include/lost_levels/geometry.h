@@ -7,6 +7,7 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
 #include <cfloat>
 #include <cmath>
 #include <iostream>
@@ -106,15 +107,15 @@ namespace lost_levels {
          Vector<T> nA = normalize();
          Vector<T> nB = B.normalize();
 
-         return (double)(nA.x) * (double)(nB.y) -
-                (double)(nA.y) * (double)(nB.x);
+         return (double)(nA.vx) * (double)(nB.vy) -
+                (double)(nA.vy) * (double)(nB.vx);
       }
       
       /**
        * Calculate the dot product of the given vectors.
        */
       double dot_product(const Vector<T>& B) const {
-         return inner_product({vx, vy}, 2, {B.vx, B.vy}, 0);
+         return (double)vx * (double)B.vx + (double)vy * (double)B.vy;
       }
 
       /**
@@ -224,13 +225,13 @@ namespace lost_levels {
       /**
        * Create a point at the origin of a cartesian plane.
        */
-      Point() :
+      constexpr Point() :
          x(0), y(0) { }
       
       /**
        * Create a point at the given x and y location.
        */
-      Point(T x, T y) :
+      constexpr Point(T x, T y) :
          x(x), y(y) { }
 
       /**
@@ -282,6 +283,15 @@ namespace lost_levels {
       Vector<T> to_vector() const {
          return Vector<T>(x, y);
       }
+
+      /**
+       * Interpolate between this point and another.
+       *
+       * @param alpha 0 for this point, 1 for the other one.
+       */
+      Point<T> lerp(const Point<T>& rhs, double alpha) const {
+         return Point<T>(x + (rhs.x - x) * alpha, y + (rhs.y - y) * alpha);
+      }
       
       /**
        * Convert the point to a Settings object for printing.
@@ -402,6 +412,8 @@ namespace lost_levels {
                ip->y = a.y + (t * s1.y);
             }
 
+            return true;
+
          } else {
             return false;
          }
@@ -477,10 +489,10 @@ namespace lost_levels {
    template <class T>
    class Size {
    public:
-      Size() :
+      constexpr Size() :
          width(0), height(0) { }
 
-      Size(T width, T height) :
+      constexpr Size(T width, T height) :
          width(width), height(height) { }
 
       bool operator==(const Size<T>& rhs) const {
@@ -564,14 +576,14 @@ namespace lost_levels {
    template <class T>
    class Rect {
    public:
-      Rect() :
+      constexpr Rect() :
          pt(Point<T>()), sz(Size<T>()) { }
-      Rect(const Size<T>& sz) : pt(Point<T>(0, 0)), sz(sz) { }
-      Rect(const Point<T>& pt, const Size<T>& sz) :
+      constexpr Rect(const Size<T>& sz) : pt(Point<T>(0, 0)), sz(sz) { }
+      constexpr Rect(const Point<T>& pt, const Size<T>& sz) :
          pt(pt), sz(sz) { }
-      Rect(T width, T height) :
+      constexpr Rect(T width, T height) :
          Rect(Size<T>(width, height)) { }
-      Rect(T x, T y, T width, T height) :
+      constexpr Rect(T x, T y, T width, T height) :
          Rect(Point<T>(x, y), Size<T>(width, height)) { }
 
       /**
@@ -589,30 +601,51 @@ namespace lost_levels {
          return move(pt + V);
       }
 
+      /**
+       * Interpolate between this rectangle and another, e.g. between
+       * an object's previous and current physics states for rendering.
+       *
+       * @param alpha 0 for this rectangle, 1 for the other one.
+       */
+      Rect<T> lerp(const Rect<T>& rhs, double alpha) const {
+         return Rect<T>(pt.lerp(rhs.pt, alpha),
+            Size<T>(sz.width + (rhs.sz.width - sz.width) * alpha,
+                    sz.height + (rhs.sz.height - sz.height) * alpha));
+      }
+
       /**
        * Determine if another rectangle intersects (overlaps) this
-       * rectangle.
+       * rectangle.  Rectangles which share an edge or corner are
+       * considered to intersect.
+       */
+      constexpr bool intersects(const Rect<T>& R2) const {
+         return overlaps(R2);
+      }
+
+      /**
+       * A direct axis-aligned overlap test, see intersects().
+       *
+       * NOTE:
+       * - The comparisons are combined with bitwise '&' rather than
+       *   '&&' so that no branches are taken; use this in quadtree
+       *   descent and broad phase loops.
        */
-      bool intersects(const Rect<T>& R2) const {
-         return collide_minowski(R2) != NONE;
-         /* 
-         return !
-            ((pt.x > R2.pt.x + R2.sz.width) ||
-             (pt.x + sz.width < R2.pt.x) ||
-             (pt.y > R2.pt.y + R2.sz.height) ||
-             (pt.y + sz.height < R2.pt.y));
-         */
+      constexpr bool overlaps(const Rect<T>& R2) const {
+         return (pt.x <= R2.pt.x + R2.sz.width) &
+                (R2.pt.x <= pt.x + sz.width) &
+                (pt.y <= R2.pt.y + R2.sz.height) &
+                (R2.pt.y <= pt.y + sz.height);
       }
       
       /**
        * Determine if a particular point is contained within this
        * rectangle.
        */
-      bool contains(const Point<T>& p) const {
-         return p.x >= pt.x &&
-                p.x <= pt.x + sz.width &&
-                p.y >= pt.y &&
-                p.y <= pt.y + sz.height;
+      constexpr bool contains(const Point<T>& p) const {
+         return (p.x >= pt.x) &
+                (p.x <= pt.x + sz.width) &
+                (p.y >= pt.y) &
+                (p.y <= pt.y + sz.height);
       }
 
       /**
@@ -620,11 +653,11 @@ namespace lost_levels {
        * rectangle.  R2 must be fully within this rectangle, no area
        * of it may be outside.
        */
-      bool contains(const Rect<T>& R2) const {
-         return (R2.pt.x >= pt.x &&
-                 R2.pt.y >= pt.y &&
-                (R2.sz.width + (R2.pt.x - pt.x) <= sz.width) &&
-                (R2.sz.height + (R2.pt.y - pt.y) <= sz.height));
+      constexpr bool contains(const Rect<T>& R2) const {
+         return (R2.pt.x >= pt.x) &
+                (R2.pt.y >= pt.y) &
+                (R2.sz.width + (R2.pt.x - pt.x) <= sz.width) &
+                (R2.sz.height + (R2.pt.y - pt.y) <= sz.height);
       }
 
       /**
@@ -636,7 +669,7 @@ namespace lost_levels {
             return true;
          }
 
-         for (Line<T> line : edges()) {
+         for (const Line<T>& line : edge_array()) {
             if (L.intersects(line)) {
                return true;
             }
@@ -666,18 +699,21 @@ namespace lost_levels {
        *       |
        */
       vector<Rect<T>> split() const {
-         vector<Rect<T>> subRects;
-         Size<T> newSize = Size<T>(sz.width / 2, sz.height / 2);
-         vector<Point<T>> points = {
-            Point<T>(pt),
-            Point<T>(pt.x + newSize.width, pt.y),
-            Point<T>(pt.x + newSize.width, pt.y + newSize.height),
-            Point<T>(pt.x, pt.y + newSize.height)
-         };
-         for (auto pt : points) {
-            subRects.push_back(Rect<T>(pt, newSize));
-         }
-         return subRects;
+         array<Rect<T>, 4> subRects = quadrants();
+         return vector<Rect<T>>(subRects.begin(), subRects.end());
+      }
+
+      /**
+       * An allocation free version of split(), returning the four
+       * quadrants in the same order.
+       */
+      constexpr array<Rect<T>, 4> quadrants() const {
+         return {{
+            Rect<T>(pt.x, pt.y, sz.width / 2, sz.height / 2),
+            Rect<T>(pt.x + sz.width / 2, pt.y, sz.width / 2, sz.height / 2),
+            Rect<T>(pt.x + sz.width / 2, pt.y + sz.height / 2, sz.width / 2, sz.height / 2),
+            Rect<T>(pt.x, pt.y + sz.height / 2, sz.width / 2, sz.height / 2)
+         }};
       }
       
       /**
@@ -689,12 +725,20 @@ namespace lost_levels {
        *    3  2 
        */
       vector<Point<T>> corners() const {
-         return { 
-            Point<T>(pt),
+         array<Point<T>, 4> points = corner_array();
+         return vector<Point<T>>(points.begin(), points.end());
+      }
+
+      /**
+       * An allocation free version of corners().
+       */
+      constexpr array<Point<T>, 4> corner_array() const {
+         return {{
+            Point<T>(pt.x, pt.y),
             Point<T>(pt.x + sz.width, pt.y),
             Point<T>(pt.x + sz.width, pt.y + sz.height),
             Point<T>(pt.x, pt.y + sz.height)
-         };
+         }};
       }
       
       /**
@@ -717,13 +761,21 @@ namespace lost_levels {
        *       2
        */
       vector<Line<T>> edges() const {
-         vector<Point<T>> points = corners();
-         return {
+         array<Line<T>, 4> lines = edge_array();
+         return vector<Line<T>>(lines.begin(), lines.end());
+      }
+
+      /**
+       * An allocation free version of edges().
+       */
+      array<Line<T>, 4> edge_array() const {
+         array<Point<T>, 4> points = corner_array();
+         return {{
             Line<T>(points[0], points[1]),
             Line<T>(points[1], points[2]),
             Line<T>(points[2], points[3]),
             Line<T>(points[3], points[0])
-         };
+         }};
       }
       
       /**
@@ -849,6 +901,11 @@ namespace lost_levels {
    
    /**
     * Represents a shape composed of three or more points.
+    *
+    * The edge normals and centroid are calculated once when the polygon
+    * is created, as they are needed for every collision test.  Use
+    * Polygon<float> or Polygon<double>, since the normals are unit
+    * vectors.
     */
    template<class T>
    class Polygon {
@@ -860,6 +917,8 @@ namespace lost_levels {
          pts(points)
       {
          util::assertTrue(points.size() >= 3, "Polygon must have at least three points");
+         calculate_normals();
+         calculate_centroid();
       }
       
       /**
@@ -868,6 +927,33 @@ namespace lost_levels {
       const vector<Point<T>>& points() const {
          return pts;
       }
+
+      /**
+       * Get the centroid of the polygon, the average of its points.
+       */
+      const Point<T>& center() const {
+         return centroid;
+      }
+
+      /**
+       * Move all points of the polygon by the given vector in place.
+       * The cached normals are unchanged by translation.
+       */
+      Polygon<T>& operator+=(const Vector<T>& V) {
+         for (Point<T>& pt : pts) {
+            pt += V;
+         }
+         centroid += V;
+         return *this;
+      }
+
+      /**
+       * Return a copy of the polygon moved by the given vector.
+       */
+      Polygon<T> translate(const Vector<T>& V) const {
+         Polygon<T> polygon = *this;
+         return polygon += V;
+      }
       
       /**
        * Get the edges (faces, sides) of the polygon in order
@@ -895,12 +981,12 @@ namespace lost_levels {
       }
       
       /**
-       * Get the normals of the edge vectors in order.
+       * Get the unit normals of the edge vectors in order.  Edges with
+       * zero length and edges parallel to a previous edge are omitted,
+       * as they add nothing to a separating axis test.
        */
-      vector<Vector<T>> edge_normals() const {
-         return alg::map(edge_vectors(), [](auto&& vec) {
-            return Vector<T>(vec.vx, -vec.ty).normalize();
-         });
+      const vector<Vector<T>>& edge_normals() const {
+         return normals;
       }
       
       /**
@@ -925,10 +1011,57 @@ namespace lost_levels {
       }
       
    private:
+      void calculate_normals() {
+         for (size_t x = 0; x < pts.size(); x++) {
+            const Point<T>& a = pts[x];
+            const Point<T>& b = pts[(x + 1) % pts.size()];
+            Vector<T> edge = Vector<T>(b.x - a.x, b.y - a.y);
+
+            if (edge.magnitude() == 0) {
+               continue;
+            }
+
+            Vector<T> normal = Vector<T>(edge.vy, -edge.vx).normalize();
+            bool parallel = false;
+
+            for (const Vector<T>& N : normals) {
+               if (epsilon_equal((double)N.vx * normal.vy - (double)N.vy * normal.vx, 0.0, 1e-6)) {
+                  parallel = true;
+                  break;
+               }
+            }
+
+            if (! parallel) {
+               normals.push_back(normal);
+            }
+         }
+      }
+
+      void calculate_centroid() {
+         double cx = 0, cy = 0;
+
+         for (const Point<T>& pt : pts) {
+            cx += pt.x;
+            cy += pt.y;
+         }
+
+         centroid = Point<T>(cx / pts.size(), cy / pts.size());
+      }
+
       /**
        * The constituent points of the polygon in order.
        */
       vector<Point<T>> pts;
+
+      /**
+       * The cached unit edge normals, see edge_normals().
+       */
+      vector<Vector<T>> normals;
+
+      /**
+       * The cached centroid, see center().
+       */
+      Point<T> centroid;
    };
 }
 
@@ -5,6 +5,9 @@
  * Date: Monday, Jan 26 2015
  */
 #pragma once
+#include <algorithm>
+#include <vector>
+
 #include "lain/exception.h"
 #include "lost_levels/geometry.h"
 #include "lost_levels/timer.h"
@@ -48,7 +51,12 @@ namespace lost_levels {
          return get_rect().tile_rect(szTile, tileNum);
       }
 
-   protected:
+      /**
+       * The area of the underlying texture holding this image.  This is
+       * the whole texture unless the image was packed into an atlas, so
+       * source rects passed to Renderer::render() should always be
+       * derived from it, e.g. via get_tile_rect().
+       */
       const Rect<int>& get_rect() const {
          return rect;
       }
@@ -71,17 +79,56 @@ namespace lost_levels {
          return get_image()->get_tile_rect(get_size(), c - get_start_char());
       }
 
+      /**
+       * @return The get_char_rect() of each of the 256 byte values, so
+       *    that text can be laid out without a virtual call and tile
+       *    arithmetic per character.  The table is built on first use,
+       *    and rebuilt when the start char changes.
+       */
+      virtual const vector<Rect<int>>& get_glyph_rects() const {
+         if (glyphRects.empty()) {
+            glyphRects.resize(256);
+            for (int c = 0; c < 256; c++) {
+               glyphRects[c] = get_char_rect(c);
+            }
+            glyphVersion++;
+         }
+
+         return glyphRects;
+      }
+
+      /**
+       * @return A number which changes each time the get_glyph_rects()
+       *    table is rebuilt, so that layouts made from it can tell when
+       *    they are stale.
+       */
+      uint64_t get_glyph_version() const {
+         return glyphVersion;
+      }
+
       int get_start_char() const {
          return startChar;
       }
 
       void set_start_char(int startChar) {
          this->startChar = startChar;
+         invalidate_glyph_rects();
+      }
+
+   protected:
+      /**
+       * Rebuild the get_glyph_rects() table on its next use, e.g. when
+       * get_char_rect() would return different rects.
+       */
+      void invalidate_glyph_rects() const {
+         glyphRects.clear();
       }
 
    private:
       int startChar = 0;
       Size<int> szChar;
+      mutable vector<Rect<int>> glyphRects;
+      mutable uint64_t glyphVersion = 0;
    };
 
    class ImageFont : public Font, public ResourceImpl<Resource::Type::FONT> {
@@ -106,7 +153,302 @@ namespace lost_levels {
       shared_ptr<const Image> image;
    };
 
-   class Animation : public ResourceImpl<Resource::Type::ANIMATION> {
+   /**
+    * TextRun <concrete class>
+    *
+    * A string laid out in a Font, ready to be drawn with a single call
+    * to Renderer::render().  Keep a TextRun for text which rarely
+    * changes, such as labels and HUD captions, instead of calling
+    * Renderer::print_string() each frame.
+    *
+    * USAGE:
+    * - Construct with a font and text, or call set_text() to change
+    *   the text.  set_text() does nothing if the text and the font's
+    *   glyphs are unchanged, so it may be called every frame.
+    *
+    * NOTE:
+    * - The layout is only updated by set_text() and set_font(), so
+    *   call set_text() each frame to follow changes to the font's
+    *   glyphs, e.g. its start char, or an AnimatedFont's frame.
+    */
+   class TextRun {
+   public:
+      TextRun() { }
+
+      TextRun(shared_ptr<const Font> font, const string& text = "") :
+         font(font) {
+         layout(text);
+      }
+
+      void set_text(const string& text) {
+         if (text != this->text || is_stale()) {
+            layout(text);
+         }
+      }
+
+      void set_font(shared_ptr<const Font> font) {
+         if (font != this->font) {
+            this->font = font;
+            layout(text);
+         }
+      }
+
+      const string& get_text() const {
+         return text;
+      }
+
+      shared_ptr<const Font> get_font() const {
+         return font;
+      }
+
+      /**
+       * @return The size of the laid out text.
+       */
+      const Size<int>& get_size() const {
+         return sz;
+      }
+
+      size_t get_num_glyphs() const {
+         return srcRects.size();
+      }
+
+      /**
+       * @return The source rect of each glyph in the font's image.
+       */
+      const vector<Rect<int>>& get_src_rects() const {
+         return srcRects;
+      }
+
+      /**
+       * @return The destination rect of each glyph, relative to the
+       *    top left of the text.
+       */
+      const vector<Rect<int>>& get_dst_rects() const {
+         return dstRects;
+      }
+
+   private:
+      /**
+       * @return true if the font's glyph table has been rebuilt since
+       *    the text was laid out.
+       */
+      bool is_stale() const {
+         if (font == nullptr || text.empty()) {
+            return false;
+         }
+
+         font->get_glyph_rects();
+         return font->get_glyph_version() != glyphVersion;
+      }
+
+      void layout(const string& newText) {
+         text = newText;
+         srcRects.clear();
+         dstRects.clear();
+         sz = Size<int>();
+
+         if (font == nullptr || text.empty()) {
+            return;
+         }
+
+         const vector<Rect<int>>& glyphs = font->get_glyph_rects();
+         glyphVersion = font->get_glyph_version();
+         Size<int> szChar = font->get_size();
+         int col = 0, line = 0;
+
+         for (char c : text) {
+            if (c == '\n') {
+               col = 0;
+               line ++;
+               continue;
+            }
+
+            srcRects.push_back(glyphs[(unsigned char)c]);
+            dstRects.push_back(Rect<int>(col * szChar.width, line * szChar.height,
+                                         szChar.width, szChar.height));
+            col ++;
+            sz.width = max(sz.width, col * szChar.width);
+         }
+
+         sz.height = (line + 1) * szChar.height;
+      }
+
+      shared_ptr<const Font> font;
+      string text;
+      uint64_t glyphVersion = 0;
+      Size<int> sz;
+      vector<Rect<int>> srcRects;
+      vector<Rect<int>> dstRects;
+   };
+
+   /**
+    * PatternLayer <concrete class>
+    *
+    * A tile repeated across a destination rect, such as a scrolling
+    * background, kept as the list of clipped quads which cover the rect.
+    * Draw it with Renderer::render_pattern().
+    *
+    * USAGE:
+    * - Set the tile's source rect, the destination rect, and the scroll
+    *   position.  The pattern is anchored at the top left of the
+    *   destination rect, offset by the scroll position.
+    * - The quads are rebuilt only when the layer changes.  Scrolling by
+    *   a whole tile leaves the layout as is, and changing only the
+    *   tile's position, e.g. to the current frame of an animation, only
+    *   moves the source rects.
+    */
+   class PatternLayer {
+   public:
+      PatternLayer() { }
+
+      PatternLayer(const Rect<int>& tileRect, const Rect<int>& dstRect) :
+         tileRect(tileRect), dstRect(dstRect) { }
+
+      void set_tile_rect(const Rect<int>& tileRect) {
+         if (tileRect.sz != this->tileRect.sz) {
+            layoutDirty = true;
+            phase = wrap_scroll(scrollPos, tileRect.sz);
+         }
+
+         if (tileRect != this->tileRect) {
+            srcDirty = true;
+            this->tileRect = tileRect;
+         }
+      }
+
+      void set_dst_rect(const Rect<int>& dstRect) {
+         if (dstRect != this->dstRect) {
+            layoutDirty = true;
+            this->dstRect = dstRect;
+         }
+      }
+
+      void set_scroll(const Point<int>& scrollPos) {
+         this->scrollPos = scrollPos;
+         Point<int> newPhase = wrap_scroll(scrollPos, tileRect.sz);
+
+         if (newPhase != phase) {
+            layoutDirty = true;
+            phase = newPhase;
+         }
+      }
+
+      const Rect<int>& get_tile_rect() const {
+         return tileRect;
+      }
+
+      const Rect<int>& get_dst_rect() const {
+         return dstRect;
+      }
+
+      const Point<int>& get_scroll() const {
+         return scrollPos;
+      }
+
+      size_t get_num_quads() const {
+         return get_dst_rects().size();
+      }
+
+      const vector<Rect<int>>& get_src_rects() const {
+         update();
+         return srcRects;
+      }
+
+      const vector<Rect<int>>& get_dst_rects() const {
+         update();
+         return dstRects;
+      }
+
+   private:
+      /**
+       * The part of a tile drawn in one row or column.
+       */
+      struct Span {
+         int srcOffset;
+         int dst;
+         int length;
+      };
+
+      static Point<int> wrap_scroll(const Point<int>& scrollPos, const Size<int>& szTile) {
+         if (szTile.width <= 0 || szTile.height <= 0) {
+            return Point<int>();
+         }
+
+         return Point<int>(
+            ((scrollPos.x % szTile.width) + szTile.width) % szTile.width,
+            ((scrollPos.y % szTile.height) + szTile.height) % szTile.height);
+      }
+
+      static void layout_spans(vector<Span>& spans, int dst, int length,
+                               int tileLength, int phase) {
+         spans.clear();
+         if (tileLength <= 0) {
+            return;
+         }
+
+         int origin = dst + phase - (phase > 0 ? tileLength : 0);
+         for (; origin < dst + length; origin += tileLength) {
+            int start = max(origin, dst);
+            int end = min(origin + tileLength, dst + length);
+            spans.push_back(Span {start - origin, start, end - start});
+         }
+      }
+
+      void update() const {
+         if (layoutDirty) {
+            layout_spans(columns, dstRect.pt.x, dstRect.sz.width, tileRect.sz.width, phase.x);
+            layout_spans(rows, dstRect.pt.y, dstRect.sz.height, tileRect.sz.height, phase.y);
+
+            dstRects.clear();
+            for (const Span& row : rows) {
+               for (const Span& col : columns) {
+                  dstRects.push_back(Rect<int>(col.dst, row.dst, col.length, row.length));
+               }
+            }
+
+            layoutDirty = false;
+            srcDirty = true;
+         }
+
+         if (srcDirty) {
+            srcRects.clear();
+            for (const Span& row : rows) {
+               for (const Span& col : columns) {
+                  srcRects.push_back(Rect<int>(tileRect.pt.x + col.srcOffset,
+                                               tileRect.pt.y + row.srcOffset,
+                                               col.length, row.length));
+               }
+            }
+
+            srcDirty = false;
+         }
+      }
+
+      Rect<int> tileRect;
+      Rect<int> dstRect;
+      Point<int> scrollPos;
+      Point<int> phase;
+
+      mutable bool layoutDirty = true;
+      mutable bool srcDirty = true;
+      mutable vector<Span> columns;
+      mutable vector<Span> rows;
+      mutable vector<Rect<int>> srcRects;
+      mutable vector<Rect<int>> dstRects;
+   };
+
+   /**
+    * AnimationDef <concrete class>
+    *
+    * The immutable part of an animation: its image, frame size and
+    * frame table.  A definition is shared by every sprite playing the
+    * animation, each of which keeps only a small AnimationState for
+    * its own playback.
+    *
+    * Frame durations are measured in ticks of whichever clock drives
+    * the animation, usually physics frames.
+    */
+   class AnimationDef {
    public:
       class Frame {
       public:
@@ -117,6 +459,126 @@ namespace lost_levels {
          uint32_t duration;
       };
 
+      AnimationDef(shared_ptr<const Image> image,
+         const Size<int>& szFrame, const vector<Frame>& frames,
+         bool looping = false) :
+         image(image), szFrame(szFrame), frames(frames), looping(looping) {
+
+         if (frames.size() < 1) {
+            throw GraphicsException("Animation must have at least 1 frame.");
+         }
+
+         for (auto frame : frames) {
+            frameRects.push_back(image->get_tile_rect(szFrame, frame.tileNum));
+            totalDuration += frame.duration;
+         }
+      }
+
+      shared_ptr<const Image> get_image() const {
+         return image;
+      }
+
+      const Size<int>& get_size() const {
+         return szFrame;
+      }
+
+      size_t get_num_frames() const {
+         return frames.size();
+      }
+
+      const Frame& get_frame(size_t frame) const {
+         return frames[frame];
+      }
+
+      /**
+       * The source rect for the given frame, computed at load time.
+       */
+      const Rect<int>& get_frame_rect(size_t frame) const {
+         return frameRects[frame];
+      }
+
+      uint32_t get_total_duration() const {
+         return totalDuration;
+      }
+
+      bool is_looping() const {
+         return looping;
+      }
+
+   private:
+      shared_ptr<const Image> image;
+      Size<int> szFrame;
+      vector<Frame> frames;
+      vector<Rect<int>> frameRects;
+      uint32_t totalDuration = 0;
+      bool looping;
+   };
+
+   /**
+    * AnimationState <struct>
+    *
+    * The playback state of one instance of an AnimationDef.  This is a
+    * plain value with no references to the definition, so instances
+    * can be kept in flat arrays and advanced in bulk.
+    */
+   struct AnimationState {
+      uint32_t frame = 0;
+      uint32_t elapsed = 0;
+
+      void reset() {
+         frame = 0;
+         elapsed = 0;
+      }
+
+      /**
+       * Advance playback by the given number of ticks.  Looping
+       * animations wrap around, others stop on their last frame.
+       */
+      void advance(const AnimationDef& def, uint32_t ticks = 1) {
+         uint32_t totalDuration = def.get_total_duration();
+         if (totalDuration == 0) {
+            return;
+         }
+
+         elapsed += ticks;
+         for (uint32_t duration; elapsed >= (duration = def.get_frame(frame).duration); ) {
+            if (frame + 1 < def.get_num_frames()) {
+               elapsed -= duration;
+               frame ++;
+
+            } else if (def.is_looping()) {
+               elapsed = (elapsed - duration) % totalDuration;
+               frame = 0;
+
+            } else {
+               elapsed = duration;
+               break;
+            }
+         }
+      }
+
+      /**
+       * @return true if a non-looping animation has played to the end
+       *    of its last frame.
+       */
+      bool is_complete(const AnimationDef& def) const {
+         return ! def.is_looping() &&
+            frame + 1 == def.get_num_frames() &&
+            elapsed >= def.get_frame(frame).duration;
+      }
+   };
+
+   /**
+    * An AnimationDef bundled with its own playback state, advanced by
+    * the frame count of a reference timer.
+    *
+    * Copies share the definition and the reference timer, so copying
+    * an Animation for each sprite is cheap.
+    */
+   class Animation : public ResourceImpl<Resource::Type::ANIMATION> {
+   public:
+      typedef AnimationDef::Frame Frame;
+
       static vector<Frame> parse_frames(const vector<string>& frameExprs) {
          vector<Frame> frames;
 
@@ -135,23 +597,24 @@ namespace lost_levels {
          return frames;
       }
 
-      Animation(const Animation& rhs) :
-         timer(rhs.timer->copy()), image(rhs.image),
-         szFrame(rhs.szFrame), frames(rhs.frames),
-         looping(rhs.looping), numFrames(rhs.frames.size()) { }
+      Animation(shared_ptr<const AnimationDef> def,
+         shared_ptr<const Timer<uint64_t>> timer) :
+         def(def), timer(timer) { }
 
       static shared_ptr<Animation> create(
          shared_ptr<const Image> image,
          const Size<int>& szFrame, const vector<Frame>& frames,
-         shared_ptr<const Timer<unsigned int>>& timer,
+         shared_ptr<const Timer<uint64_t>>& timer,
          bool looping = false) {
 
-         if (frames.size() < 1) {
-            throw GraphicsException("Animation must have at least 1 frame.");
-         }
+         return create(make_shared<AnimationDef>(
+            image, szFrame, frames, looping), timer);
+      }
 
-         return shared_ptr<Animation>(new Animation(
-            image, szFrame, frames, timer, looping));
+      static shared_ptr<Animation> create(
+         shared_ptr<const AnimationDef> def,
+         shared_ptr<const Timer<uint64_t>> timer) {
+         return make_shared<Animation>(def, timer);
       }
 
       shared_ptr<Animation> copy() const {
@@ -159,75 +622,67 @@ namespace lost_levels {
       }
 
       Point<int> get_frame_point() const {
-         return image->get_tile_point(szFrame, frames[currentFrame].tileNum);
+         return get_frame_rect().pt;
       }
 
-      Rect<int> get_frame_rect() const {
-         return image->get_tile_rect(szFrame, frames[currentFrame].tileNum);
+      const Rect<int>& get_frame_rect() const {
+         return def->get_frame_rect(state.frame);
       }
 
       Size<int> get_size() const {
-         return szFrame;
+         return def->get_size();
       }
 
       shared_ptr<const Image> get_image() const {
-         return image;
+         return def->get_image();
       }
 
-      bool is_complete() const {
-         if (! looping)
-            return false;
+      shared_ptr<const AnimationDef> get_def() const {
+         return def;
+      }
 
-         return currentFrame == frames.size() - 1;
+      const AnimationState& get_state() const {
+         return state;
+      }
+
+      bool is_complete() const {
+         return state.is_complete(*def);
       }
 
       void reset() {
-         currentFrame = 0;
-         timer->reset();
+         state.reset();
+         lastTick = timer->get_frames();
       }
 
       void pause() {
-         timer->pause();
+         paused = true;
       }
 
       void start() {
-         timer->set_interval(frames[currentFrame].duration);
-         timer->start();
+         lastTick = timer->get_frames();
+         paused = false;
       }
 
       void update() {
-         if (timer->update()) {
-            if (looping) {
-               currentFrame = (currentFrame + 1) % numFrames;
-
-            } else {
-               currentFrame = min<size_t>(
-                     currentFrame + 1, numFrames - 1);
-            }
+         if (! paused) {
+            uint64_t tick = timer->get_frames();
+            state.advance(*def, tick - lastTick);
+            lastTick = tick;
          }
       }
 
    private:
-      Animation(shared_ptr<const Image> image,
-         const Size<int>& szFrame, const vector<Frame>& frames,
-         shared_ptr<const Timer<unsigned int>> timer,
-         bool looping = true) :
-
-         timer(timer->relative_timer()),
-         image(image), szFrame(szFrame),
-         frames(frames), looping(looping),
-         numFrames(frames.size()) { }
-
-      shared_ptr<Timer<unsigned int>> timer;
-      shared_ptr<const Image> image;
-      Size<int> szFrame;
-      vector<Frame> frames;
-      bool looping;
-      size_t numFrames;
-
-      unsigned int currentFrame = 0;
+      shared_ptr<const AnimationDef> def;
+      shared_ptr<const Timer<uint64_t>> timer;
+      AnimationState state;
+      uint64_t lastTick = 0;
+      bool paused = true;
    };
 
+   /**
+    * A font whose characters are tiles of each frame of an animation,
+    * so that text drawn with it animates.
+    */
    class AnimatedFont : public Font, public ResourceImpl<Resource::Type::ANIMATED_FONT> {
    public:
       AnimatedFont(shared_ptr<const Animation> animation, const Size<int>& szChar) :
@@ -238,15 +693,343 @@ namespace lost_levels {
          return animation->get_image();
       }
 
+      /**
+       * @return The rect of the given character in the current frame.
+       */
+      Rect<int> get_char_rect(int c) const override {
+         Point<int> framePt = animation->get_frame_point();
+         return frameRect.tile_rect(get_size(), c - get_start_char())
+            .translate(Vector<int>(framePt.x, framePt.y));
+      }
+
+      /**
+       * @return The glyph rects of the current frame.  The table is
+       *    rebuilt when the frame changes.
+       */
+      const vector<Rect<int>>& get_glyph_rects() const override {
+         Point<int> framePt = animation->get_frame_point();
+         if (framePt != glyphFramePt) {
+            glyphFramePt = framePt;
+            invalidate_glyph_rects();
+         }
+
+         return Font::get_glyph_rects();
+      }
+
    private:
       shared_ptr<const Animation> animation;
       Rect<int> frameRect;
+      mutable Point<int> glyphFramePt;
+   };
+
+   /**
+    * AtlasPacker <concrete class>
+    *
+    * Packs rectangles into a small number of fixed size pages, for
+    * building texture atlases.  Rectangles are sorted by height and
+    * placed left to right on shelves, which wastes little space when
+    * packing sprite sheets and fonts of similar heights.
+    *
+    * USAGE:
+    * - Call pack() with the sizes of the images to be packed.  The
+    *   placement for each size is returned in the same order.
+    * - Allocate get_page_count() textures, each get_page_size() in
+    *   size, and copy each image into its placement rect.
+    *
+    * NOTE:
+    * - Sizes which do not fit in a page even by themselves are given
+    *   a page of -1 and should be loaded as standalone images.
+    */
+   class AtlasPacker {
+   public:
+      struct Placement {
+         int page = -1;
+         Rect<int> rect;
+      };
+
+      /**
+       * @param szPage The maximum size of each page.
+       * @param padding Empty pixels left between packed rectangles,
+       *    so that filtering does not bleed between neighbours.
+       */
+      AtlasPacker(const Size<int>& szPage, int padding = 1) :
+         szPage(szPage), padding(padding) { }
+
+      vector<Placement> pack(const vector<Size<int>>& sizes) {
+         vector<Placement> placements(sizes.size());
+         vector<size_t> order;
+
+         pages.clear();
+         for (size_t x = 0; x < sizes.size(); x++) {
+            if (sizes[x].width <= szPage.width && sizes[x].height <= szPage.height) {
+               order.push_back(x);
+            }
+         }
+
+         stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return sizes[a].height > sizes[b].height;
+         });
+
+         for (size_t x : order) {
+            placements[x] = place(sizes[x]);
+         }
+
+         return placements;
+      }
+
+      int get_page_count() const {
+         return pages.size();
+      }
+
+      /**
+       * The used extent of the given page, which may be smaller than
+       * the maximum page size.
+       */
+      Size<int> get_page_size(int page) const {
+         return pages[page].szUsed;
+      }
+
+   private:
+      struct Page {
+         Size<int> szUsed;
+         int shelfY = 0;
+         int shelfHeight = 0;
+         int cursorX = 0;
+      };
+
+      Placement place(const Size<int>& sz) {
+         Placement placement;
+
+         for (size_t x = 0; x < pages.size(); x++) {
+            if (place_in(pages[x], sz, placement.rect)) {
+               placement.page = x;
+               return placement;
+            }
+         }
+
+         pages.push_back(Page());
+         place_in(pages.back(), sz, placement.rect);
+         placement.page = pages.size() - 1;
+         return placement;
+      }
+
+      /**
+       * Place the size on the current shelf of the page, or on a new
+       * shelf below it.  The page is left untouched if neither fits.
+       */
+      bool place_in(Page& page, const Size<int>& sz, Rect<int>& rect) {
+         Page next = page;
+
+         if (next.cursorX + sz.width > szPage.width) {
+            next.shelfY += next.shelfHeight + padding;
+            next.shelfHeight = 0;
+            next.cursorX = 0;
+         }
+
+         if (next.shelfY + sz.height > szPage.height) {
+            return false;
+         }
+
+         page = next;
+         rect = Rect<int>(page.cursorX, page.shelfY, sz.width, sz.height);
+         page.cursorX += sz.width + padding;
+         page.shelfHeight = max(page.shelfHeight, sz.height);
+         page.szUsed.width = max(page.szUsed.width, rect.pt.x + sz.width);
+         page.szUsed.height = max(page.szUsed.height, rect.pt.y + sz.height);
+         return true;
+      }
+
+      Size<int> szPage;
+      int padding;
+      vector<Page> pages;
+   };
+
+   /**
+    * Image data which has been decoded, but not yet uploaded to the
+    * renderer.  Produced by ImageLoader::decode_image().
+    *
+    * The base class only records the filename, for loaders which do
+    * not support decoding ahead of time.
+    */
+   class DecodedImage {
+   public:
+      DecodedImage(const string& filename) : filename(filename) { }
+      virtual ~DecodedImage() { }
+
+      const string& get_filename() const {
+         return filename;
+      }
+
+   private:
+      string filename;
    };
 
    class ImageLoader {
    public:
       virtual ~ImageLoader() { }
       virtual shared_ptr<Image> load_image(const string& filename) const = 0;
+
+      /**
+       * Decode the given image file into memory.  This may be called
+       * from any thread, so that files can be decoded in the background.
+       * By default, nothing is decoded here and all of the work is left
+       * to upload_images().
+       */
+      virtual shared_ptr<DecodedImage> decode_image(const string& filename) const {
+         return make_shared<DecodedImage>(filename);
+      }
+
+      /**
+       * Create images from decoded image data.  This must be called
+       * from the rendering thread.  Implementations may pack the images
+       * into shared textures, in which case each image refers to its
+       * own sub-rect of the texture.  By default, each image is loaded
+       * individually with load_image().
+       */
+      virtual vector<shared_ptr<Image>> upload_images(
+            const vector<shared_ptr<DecodedImage>>& decodedImages) const {
+         vector<shared_ptr<Image>> images;
+
+         for (auto decodedImage : decodedImages) {
+            images.push_back(load_image(decodedImage->get_filename()));
+         }
+
+         return images;
+      }
+
+      /**
+       * Create images from a page of RGBA32 pixels in memory, i.e. bytes
+       * in R, G, B, A order, such as an atlas page from a Bundle.  The
+       * page is uploaded as one texture, and each image refers to one
+       * of the given sub-rects of it.  This must be called from the
+       * rendering thread.
+       *
+       * @param pitch The number of bytes between rows of pixels.
+       * @throws GraphicsException by default, for loaders which can only
+       *    load images from files.
+       */
+      virtual vector<shared_ptr<Image>> create_images(const Size<int>& szPage,
+            const void* pixels, int pitch, const vector<Rect<int>>& rects) const {
+         throw GraphicsException("This ImageLoader can't create images from memory.");
+      }
+
+      /**
+       * Load several images at once, see upload_images().
+       */
+      vector<shared_ptr<Image>> load_images(const vector<string>& filenames) const {
+         vector<shared_ptr<DecodedImage>> decodedImages;
+
+         for (auto filename : filenames) {
+            decodedImages.push_back(decode_image(filename));
+         }
+
+         return upload_images(decodedImages);
+      }
+   };
+
+   /**
+    * Damage <concrete class>
+    *
+    * The areas of a frame which have changed since it was last drawn,
+    * in logical coordinates, see State::report_damage().
+    *
+    * USAGE:
+    * - Call invalidate() with the old and new rectangles of each
+    *   object which moved or changed, or with no rectangle if the whole
+    *   frame changed.
+    * - Overlapping rectangles are merged.  Once there are more than
+    *   maxRects rectangles, they are merged into their bounds.
+    */
+   class Damage {
+   public:
+      Damage(size_t maxRects = 8) :
+         maxRects(max<size_t>(1, maxRects)) { }
+
+      /**
+       * Mark the whole frame as damaged.
+       */
+      void invalidate() {
+         full = true;
+         rects.clear();
+      }
+
+      void invalidate(const Rect<int>& rect) {
+         if (full || rect.sz.width <= 0 || rect.sz.height <= 0) {
+            return;
+         }
+
+         Rect<int> merged = rect;
+         for (size_t x = 0; x < rects.size();) {
+            if (touches(rects[x], merged)) {
+               merged = bounds(rects[x], merged);
+               rects.erase(rects.begin() + x);
+               x = 0;
+
+            } else {
+               x++;
+            }
+         }
+
+         rects.push_back(merged);
+         if (rects.size() > maxRects) {
+            Rect<int> all = get_bounds();
+            rects.assign(1, all);
+         }
+      }
+
+      void clear() {
+         full = false;
+         rects.clear();
+      }
+
+      bool is_empty() const {
+         return ! full && rects.empty();
+      }
+
+      bool is_full() const {
+         return full;
+      }
+
+      /**
+       * @return The damaged rectangles, which do not overlap, or none if
+       *    the whole frame is damaged.
+       */
+      const vector<Rect<int>>& get_rects() const {
+         return rects;
+      }
+
+      /**
+       * @return The bounds of all damaged rectangles.
+       */
+      Rect<int> get_bounds() const {
+         if (rects.empty()) {
+            return Rect<int>();
+         }
+
+         Rect<int> result = rects[0];
+         for (auto& rect : rects) {
+            result = bounds(result, rect);
+         }
+         return result;
+      }
+
+   private:
+      static bool touches(const Rect<int>& a, const Rect<int>& b) {
+         return a.pt.x <= b.pt.x + b.sz.width && b.pt.x <= a.pt.x + a.sz.width &&
+                a.pt.y <= b.pt.y + b.sz.height && b.pt.y <= a.pt.y + a.sz.height;
+      }
+
+      static Rect<int> bounds(const Rect<int>& a, const Rect<int>& b) {
+         int x0 = min(a.pt.x, b.pt.x), y0 = min(a.pt.y, b.pt.y),
+             x1 = max(a.pt.x + a.sz.width, b.pt.x + b.sz.width),
+             y1 = max(a.pt.y + a.sz.height, b.pt.y + b.sz.height);
+
+         return Rect<int>(x0, y0, x1 - x0, y1 - y0);
+      }
+
+      size_t maxRects;
+      bool full = false;
+      vector<Rect<int>> rects;
    };
 
    class Window {
@@ -277,6 +1060,45 @@ namespace lost_levels {
 
       virtual Size<int> get_logical_size() const = 0;
       virtual void set_logical_size(const Size<int>& sz) = 0;
+
+      /**
+       * Set the layer for subsequent image draws.  Renderers which batch
+       * draws may reorder them by layer and then by texture, so draws
+       * of different images in the same layer should not overlap.
+       * Draws are never moved across non-image operations such as
+       * draw_rect() or set_clip_rect().
+       *
+       * Does nothing by default, as immediate renderers draw in order.
+       */
+      virtual void set_layer(int layer) { }
+
+      /**
+       * Submit any draws which have been batched.  Called automatically
+       * by display(), does nothing by default.
+       */
+      virtual void flush() { }
+
+      /**
+       * Create an image which can be drawn into, see set_render_target().
+       *
+       * @return The new image, or nullptr if the renderer does not
+       *    support render targets.  This is the default.
+       */
+      virtual shared_ptr<Image> create_render_target(const Size<int>& sz) {
+         return nullptr;
+      }
+
+      /**
+       * Direct drawing into the given image until this is called again
+       * with nullptr, which directs drawing back to the screen.  The
+       * image must come from create_render_target().  Drawing into a
+       * target is in the target's pixels, not in the logical size.
+       *
+       * @param target The image to draw into, or nullptr.
+       * @param clear true to first clear the target to transparent.
+       *    The draw color is not changed.
+       */
+      virtual void set_render_target(shared_ptr<Image> target, bool clear = false) { }
       
       virtual void draw_rect(const Rect<int>& rect) = 0;
       virtual void fill_rect(const Rect<int>& rect) = 0;
@@ -298,144 +1120,76 @@ namespace lost_levels {
                dstRect);
       }
 
+      virtual void render(const AnimationDef& def,
+            const AnimationState& state, const Point<int>& pt) {
+         render(def.get_image(), def.get_frame_rect(state.frame),
+               Rect<int>(pt, def.get_size()));
+      }
+
       virtual void render(shared_ptr<const lost_levels::Image> image,
             const Point<int>& pt) {
-         render(image, Rect<int>(Point<int>(), image->get_size()),
+         render(image, image->get_rect(),
                Rect<int>(pt, image->get_size()));
       }
 
       virtual void render(shared_ptr<const lost_levels::Image> image,
             const Rect<int>& dstRect) {
-         render(image, Rect<int>(Point<int>(0, 0), image->get_size()),
-               dstRect);
+         render(image, image->get_rect(), dstRect);
       }
-      
-      virtual void render_pattern(shared_ptr<const lost_levels::Image> image,
-            const Point<int>& scrollPos,
-            const Rect<int>& srcRect,
-            const Rect<int>& dstRect) {
-         Point<int> relativePos = dstRect.pt + scrollPos.to_vector();
-         relativePos.x %= srcRect.sz.width;
-         relativePos.y %= srcRect.sz.height;
-
-         if (relativePos.x > 0) {
-            relativePos -= srcRect.sz.x_vector();
-         }
-         if (relativePos.y > 0) {
-            relativePos -= srcRect.sz.y_vector();
-         }
-         
-         Point<int> terminalPoint =
-            dstRect.pt + dstRect.sz.xy_vector() + srcRect.sz.xy_vector();
-
-         for (int y = relativePos.y;
-              y < terminalPoint.y;
-              y += srcRect.sz.height) {
-            for (int x = relativePos.x;
-                 x < terminalPoint.x;
-                 x += srcRect.sz.width) {
-               Rect<int> srcClipRect = srcRect;
-               Rect<int> dstClipRect = Rect<int>(Point<int>(x, y), srcRect.sz);
-               
-               if (dstClipRect.pt.x < dstRect.pt.x) {
-                  int xdiff = dstRect.pt.x - dstClipRect.pt.x;
-                  srcClipRect.pt.x += xdiff;
-                  srcClipRect.sz.width -= xdiff;
-                  dstClipRect.pt.x = dstRect.pt.x;
-                  dstClipRect.sz.width -= xdiff;
-               }
-
-               if (dstClipRect.pt.x + srcClipRect.sz.width > dstRect.pt.x + dstRect.sz.width) {
-                  int xdiff = (dstClipRect.pt.x + srcClipRect.sz.width) - (dstRect.pt.x + dstRect.sz.width);
-                  dstClipRect.sz.width -= xdiff;
-                  srcClipRect.sz.width -= xdiff;
-               }
-
-               if (dstClipRect.pt.y < dstRect.pt.y) {
-                  int ydiff = dstRect.pt.y - dstClipRect.pt.y;
-                  srcClipRect.pt.y += ydiff;
-                  srcClipRect.sz.height -= ydiff;
-                  dstClipRect.pt.y = dstRect.pt.y;
-                  dstClipRect.sz.height -= ydiff;
-               }
 
-               if (dstClipRect.pt.y + srcClipRect.sz.height > dstRect.pt.y + dstRect.sz.height) {
-                  int ydiff = (dstClipRect.pt.y + srcClipRect.sz.height) - (dstRect.pt.y + dstRect.sz.height);
-                  dstClipRect.sz.height -= ydiff;
-                  srcClipRect.sz.height -= ydiff;
-               }
-
-               /*
-               if (dstClipRect.pt.x < dstRect.pt.x) {
-                  srcClipRect.pt.x = srcRect.pt.x + (dstRect.pt.x - dstClipRect.pt.x);
-                  srcClipRect.sz.width = srcRect.sz.width - (dstRect.pt.x - dstClipRect.pt.x);
-                  dstClipRect.pt.x = dstRect.pt.x;
-                  dstClipRect.sz.width = srcClipRect.sz.width;
-               }
-
-               if (dstClipRect.pt.x + dstClipRect.sz.width > dstRect.pt.x + dstRect.sz.width) {
-                  dstClipRect.sz.width -= (dstRect.pt.x + dstRect.sz.width) - (dstClipRect.pt.x + dstClipRect.sz.width);
-                  srcClipRect.sz.width = dstClipRect.sz.width;
-               }
-
-               if (dstClipRect.pt.y < dstRect.pt.y) {
-                  srcClipRect.pt.y = srcRect.pt.y + (dstRect.pt.y - dstClipRect.pt.y);
-                  srcClipRect.sz.height = srcRect.sz.height - (dstRect.pt.y - dstClipRect.pt.y);
-                  dstClipRect.pt.y = dstRect.pt.y;
-                  dstClipRect.sz.height = srcClipRect.sz.height;
-               }
-
-               if (dstClipRect.pt.y + dstClipRect.sz.height > dstRect.pt.y + dstRect.sz.height) {
-                  dstClipRect.sz.height -= (dstRect.pt.y + dstRect.sz.height) - (dstClipRect.pt.y + dstClipRect.sz.height);
-                  srcClipRect.sz.height = dstClipRect.sz.height;
-               }
-               */
+      /**
+       * Draw count rects of the same image, each dst rect translated by
+       * offset.  Renderers which batch draws override this to queue
+       * every quad from one call.  By default, each quad is drawn with
+       * render().
+       */
+      virtual void render_quads(shared_ptr<const lost_levels::Image> image,
+            const Rect<int>* srcRects, const Rect<int>* dstRects,
+            size_t count, const Vector<int>& offset) {
+         for (size_t x = 0; x < count; x++) {
+            render(image, srcRects[x], dstRects[x].translate(offset));
+         }
+      }
 
-               render(image, srcClipRect, dstClipRect);
-            }
+      /**
+       * Draw a laid out TextRun with its top left at the given point.
+       */
+      void render(const TextRun& run, const Point<int>& pt) {
+         if (run.get_num_glyphs() > 0) {
+            render_quads(run.get_font()->get_image(),
+                         run.get_src_rects().data(), run.get_dst_rects().data(),
+                         run.get_num_glyphs(), pt.to_vector());
+         }
+      }
+      
+      /**
+       * Draw a PatternLayer's quads from the given image in one call to
+       * render_quads().
+       */
+      void render_pattern(shared_ptr<const lost_levels::Image> image,
+            const PatternLayer& layer) {
+         if (layer.get_num_quads() > 0) {
+            render_quads(image, layer.get_src_rects().data(),
+                         layer.get_dst_rects().data(), layer.get_num_quads(),
+                         Vector<int>());
          }
       }
 
-      /*
+      /**
+       * Repeat srcRect of the image across dstRect, offset by scrollPos.
+       * The quads are laid out by a PatternLayer kept by the renderer,
+       * so they are only rebuilt when the pattern changes.  Keep a
+       * PatternLayer of your own for each background drawn every frame.
+       */
       virtual void render_pattern(shared_ptr<const lost_levels::Image> image,
             const Point<int>& scrollPos,
             const Rect<int>& srcRect,
             const Rect<int>& dstRect) {
-
-         Point<int> relativePos = Point<int>(
-               -(scrollPos.x % srcRect.sz.width),
-               -(scrollPos.y % srcRect.sz.height)) + dstRect.pt.to_vector();
-
-         if (relativePos.x > 0) {
-            relativePos.x -= srcRect.sz.width;
-         }
-
-         if (relativePos.y > 0) {
-            relativePos.y -= srcRect.sz.height;
-         }
-
-         Point<int> terminalPoint = dstRect.pt + Vector<int>(
-               dstRect.sz.width, dstRect.sz.height);
-
-         set_clip_rect(dstRect);
-
-         for (int y = relativePos.y; y < terminalPoint.y + srcRect.sz.height; y += srcRect.sz.height) {
-            for (int x = relativePos.x; x < terminalPoint.x + srcRect.sz.width; x += srcRect.sz.width) {
-               render(image, srcRect, Rect<int>(Point<int>(x, y), srcRect.sz));
-               // LRS-DEBUG: remove this!
-               set_draw_color(Color(255, 255, 255));
-               draw_rect(Rect<int>(Point<int>(x, y), srcRect.sz));
-            }
-         }
-
-         clear_clip_rect();
-
-         // LRS-DEBUG: remove this!
-         set_draw_color(Color(0, 255, 0));
-         draw_rect(dstRect);
-         set_draw_color(Color(0, 0, 0));
+         patternLayer.set_tile_rect(srcRect);
+         patternLayer.set_dst_rect(dstRect);
+         patternLayer.set_scroll(scrollPos);
+         render_pattern(image, patternLayer);
       }
-      */
 
       virtual void render_pattern(shared_ptr<const lost_levels::Image> image,
             const Point<int>& scrollPos,
@@ -460,27 +1214,21 @@ namespace lost_levels {
          render_pattern(animation, Point<int>());
       }
 
+      /**
+       * Draw a string in the given font, one row per line.  The string
+       * is laid out into a TextRun kept by the renderer, so printing
+       * does not allocate once the run's buffers have grown.  Keep a
+       * TextRun of your own for text which rarely changes.
+       */
       virtual void print_string(const Point<int>& pt,
             shared_ptr<const Font> font, const string& str) {
-         Point<int> ptLineStart = pt;
-         int col = 0;
-
-         Size<int> sz = font->get_size();
-         for (size_t x = 0; x < str.size(); x++) {
-            switch(str[x]) {
-            case '\n':
-               ptLineStart += Vector<int>(0, sz.height);
-               col = 0;
-               break;
-
-            default:
-               render(font->get_image(),
-                  font->get_char_rect(str[x]),
-                  Rect<int>(ptLineStart + Vector<int>(sz.width * col, 0), sz));
-               col++;
-               break;
-            }
-         }
+         printRun.set_font(font);
+         printRun.set_text(str);
+         render(printRun, pt);
       }
+
+   private:
+      TextRun printRun;
+      PatternLayer patternLayer;
    };
 }
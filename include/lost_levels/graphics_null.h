@@ -0,0 +1,184 @@
+/*
+ * graphics_null: A graphics implementation which draws nothing.
+ *
+ * Author: Lain Supe (lainproliant)
+ * Date: Wednesday, Oct 14 2026
+ */
+#pragma once
+#include <memory>
+
+#include "lost_levels/graphics.h"
+
+namespace lost_levels {
+   using namespace std;
+
+   /**
+    * Window, Renderer and ImageLoader implementations with no backend,
+    * for running engine code headless, e.g. in benchmarks and tests.
+    * The renderer counts what it would have drawn, so that the cost of
+    * generating draws can be measured apart from the cost of drawing.
+    */
+   namespace null {
+      class Image : public lost_levels::Image {
+      public:
+         Image(const Rect<int>& rect) : lost_levels::Image(rect) { }
+
+         const Size<int>& get_size() const override {
+            return get_rect().sz;
+         }
+      };
+
+      /**
+       * Creates every image with the same size, without reading the
+       * file.
+       */
+      class ImageLoader : public lost_levels::ImageLoader {
+      public:
+         ImageLoader(const Size<int>& szImage) : szImage(szImage) { }
+
+         shared_ptr<lost_levels::Image> load_image(const string& filename) const override {
+            return make_shared<Image>(szImage.rect());
+         }
+
+         vector<shared_ptr<lost_levels::Image>> create_images(const Size<int>& szPage,
+               const void* pixels, int pitch, const vector<Rect<int>>& rects) const override {
+            vector<shared_ptr<lost_levels::Image>> images;
+            for (auto& rect : rects) {
+               images.push_back(make_shared<Image>(rect));
+            }
+            return images;
+         }
+
+      private:
+         Size<int> szImage;
+      };
+
+      class Window : public lost_levels::Window {
+      public:
+         Window(const Size<int>& sz) : sz(sz) { }
+
+         Size<int> get_size() const override {
+            return sz;
+         }
+
+         void set_size(const Size<int>& sz) override {
+            this->sz = sz;
+         }
+
+         bool is_fullscreen() const override {
+            return fullscreen;
+         }
+
+         void set_fullscreen(bool fullscreen = true) override {
+            this->fullscreen = fullscreen;
+         }
+
+         void set_title(const string& title) override { }
+
+      private:
+         Size<int> sz;
+         bool fullscreen = false;
+      };
+
+      class Renderer : public lost_levels::Renderer {
+      public:
+         Renderer(const Size<int>& szLogical, const Size<int>& szImage = Size<int>(16, 16)) :
+            szLogical(szLogical), loader(szImage) { }
+
+         shared_ptr<lost_levels::Image> load_image(const string& filename) const override {
+            return loader.load_image(filename);
+         }
+
+         void clear() override { }
+
+         void display() override {
+            frames++;
+         }
+
+         void set_draw_color(const Color& color) override { }
+         void set_clip_rect(const Rect<int>& rect) override { }
+         void clear_clip_rect() override { }
+
+         Size<int> get_logical_size() const override {
+            return szLogical;
+         }
+
+         void set_logical_size(const Size<int>& sz) override {
+            szLogical = sz;
+         }
+
+         void draw_rect(const Rect<int>& rect) override {
+            rects++;
+         }
+
+         void fill_rect(const Rect<int>& rect) override {
+            rects++;
+         }
+
+         void render(shared_ptr<const lost_levels::Image> image,
+               const Rect<int>& src,
+               const Rect<int>& dst) override {
+            quads++;
+            pixels += (uint64_t)dst.sz.width * dst.sz.height;
+         }
+
+         void render_quads(shared_ptr<const lost_levels::Image> image,
+               const Rect<int>* srcRects, const Rect<int>* dstRects,
+               size_t count, const Vector<int>& offset) override {
+            quads += count;
+            for (size_t x = 0; x < count; x++) {
+               pixels += (uint64_t)dstRects[x].sz.width * dstRects[x].sz.height;
+            }
+         }
+
+         using lost_levels::Renderer::render;
+
+         /**
+          * @return The number of images drawn.
+          */
+         uint64_t get_num_quads() const {
+            return quads;
+         }
+
+         /**
+          * @return The total destination area of the images drawn.
+          */
+         uint64_t get_num_pixels() const {
+            return pixels;
+         }
+
+         uint64_t get_num_rects() const {
+            return rects;
+         }
+
+         uint64_t get_num_frames() const {
+            return frames;
+         }
+
+         void reset_counts() {
+            quads = pixels = rects = frames = 0;
+         }
+
+      private:
+         Size<int> szLogical;
+         ImageLoader loader;
+         uint64_t quads = 0;
+         uint64_t pixels = 0;
+         uint64_t rects = 0;
+         uint64_t frames = 0;
+      };
+
+      inline shared_ptr<lost_levels::Window> create_window(const Size<int>& sz) {
+         return make_shared<Window>(sz);
+      }
+
+      inline shared_ptr<lost_levels::Renderer> create_renderer(const Size<int>& szLogical) {
+         return make_shared<Renderer>(szLogical);
+      }
+
+      inline shared_ptr<lost_levels::ImageLoader> create_image_loader(
+            const Size<int>& szImage = Size<int>(16, 16)) {
+         return make_shared<ImageLoader>(szImage);
+      }
+   }
+}
@@ -5,14 +5,20 @@
  * Date: Thursday, February 5th 2015
  */
 #pragma once
+#include <algorithm>
+#include <memory>
+#include <vector>
+
 #include "SDL2/SDL_image.h"
 #include "lost_levels/graphics.h"
+#include "lost_levels/metrics.h"
 
 namespace lost_levels {
    using namespace std;
 
    namespace sdl2 {
       class ImageLoader;
+      class AtlasImageLoader;
 
       inline Size<int> get_texture_size(SDL_Texture* texture) {
          Size<int> sz;
@@ -21,26 +27,47 @@ namespace lost_levels {
          return sz;
       }
 
+      /**
+       * An image backed by an SDL_Texture.  The texture is destroyed
+       * when the last image referring to it is destroyed, so images
+       * packed into one atlas texture may be freed in any order.
+       */
       class Image : public lost_levels::Image {
       public:
          Image(SDL_Texture* texture) :
-            lost_levels::Image(get_texture_size(texture).rect()), texture(texture)
+            Image(shared_ptr<SDL_Texture>(texture, SDL_DestroyTexture),
+                  sdl2::get_texture_size(texture).rect())
          { }
 
-         virtual ~Image() {
-            SDL_DestroyTexture(texture);
-         }
+         /**
+          * Create an image for a sub-rect of a shared texture.
+          */
+         Image(shared_ptr<SDL_Texture> texture, const Rect<int>& rect) :
+            lost_levels::Image(rect), texture(texture),
+            szTexture(sdl2::get_texture_size(texture.get()))
+         { }
+
+         virtual ~Image() { }
 
          const Size<int>& get_size() const override {
             return get_rect().sz;
          }
 
          SDL_Texture* get_sdl_texture() const {
-            return texture;
+            return texture.get();
+         }
+
+         /**
+          * The size of the whole underlying texture, which is larger
+          * than get_size() for images packed into an atlas.
+          */
+         const Size<int>& get_texture_size() const {
+            return szTexture;
          }
 
       private:
-         SDL_Texture* texture;
+         shared_ptr<SDL_Texture> texture;
+         Size<int> szTexture;
       };
 
       class Window : public lost_levels::Window {
@@ -96,41 +123,178 @@ namespace lost_levels {
          bool fullscreen = false;
       };
 
+      /**
+       * SDL2 Renderer.
+       *
+       * When batching is enabled, image draws are queued instead of being
+       * issued as individual SDL_RenderCopy() calls.  The queue is sorted
+       * by layer and then by texture, and each run of quads sharing a
+       * texture is submitted with one SDL_RenderGeometry() call.  The
+       * queue is flushed by display() and before any non-image operation,
+       * so images are still drawn in order with rects and clipping.
+       *
+       * NOTE:
+       * - Each queued quad holds a reference to its image until the
+       *   batch is flushed, so images may be released as soon as they
+       *   are drawn.
+       * - SDL_RenderGeometry() requires SDL 2.0.18.  With older versions
+       *   the sorted queue is drawn with SDL_RenderCopy().
+       */
       class Renderer : public lost_levels::Renderer {
          friend class ImageLoader;
+         friend class AtlasImageLoader;
 
       public:
          Renderer(SDL_Renderer* renderer) :
             renderer(renderer) { }
 
          virtual ~Renderer() {
+            // Queued images must be released while their textures are
+            // still valid.
+            quads.clear();
             SDL_DestroyRenderer(renderer);
          }
 
          void clear() override {
+            flush();
             SDL_RenderClear(renderer);
+            drawCalls.add();
          }
 
          void display() override {
+            flush();
             SDL_RenderPresent(renderer);
+            lastTexture = nullptr;
          }
          
          void draw_rect(const Rect<int>& rect) override {
+            flush();
             SDL_RenderDrawRect(renderer, (SDL_Rect*)&rect);
+            drawCalls.add();
          }
 
          void fill_rect(const Rect<int>& rect) override {
+            flush();
             SDL_RenderFillRect(renderer, (SDL_Rect*)&rect);
+            drawCalls.add();
          }
 
          void render(shared_ptr<const lost_levels::Image> imageIn,
                const Rect<int>& src,
                const Rect<int>& dst) override {
-            shared_ptr<const Image> image =
-               static_pointer_cast<const Image>(imageIn);
+            const Image* image = static_cast<const Image*>(imageIn.get());
+
+            if (batching) {
+               count_growth(quads);
+               quads.push_back(Quad(layer, quads.size(), imageIn, image->get_sdl_texture(),
+                                    image->get_texture_size(), src, dst));
+
+            } else {
+               use_texture(image->get_sdl_texture());
+               SDL_RenderCopy(renderer, image->get_sdl_texture(),
+                     (SDL_Rect*)&src, (SDL_Rect*)&dst);
+               drawCalls.add();
+            }
+         }
+
+         void render_quads(shared_ptr<const lost_levels::Image> imageIn,
+               const Rect<int>* srcRects, const Rect<int>* dstRects,
+               size_t count, const Vector<int>& offset) override {
+            const Image* image = static_cast<const Image*>(imageIn.get());
+            SDL_Texture* texture = image->get_sdl_texture();
+
+            if (batching) {
+               count_growth(quads, count);
+               for (size_t x = 0; x < count; x++) {
+                  quads.push_back(Quad(layer, quads.size(), imageIn, texture,
+                                       image->get_texture_size(), srcRects[x],
+                                       dstRects[x].translate(offset)));
+               }
+
+            } else {
+               use_texture(texture);
+               for (size_t x = 0; x < count; x++) {
+                  Rect<int> dst = dstRects[x].translate(offset);
+                  SDL_RenderCopy(renderer, texture, (SDL_Rect*)&srcRects[x], (SDL_Rect*)&dst);
+               }
+               drawCalls.add(count);
+            }
+         }
+
+         /**
+          * Enable or disable batching of image draws, see the class
+          * documentation above.  Pending draws are flushed first.
+          */
+         void set_batching(bool batching) {
+            flush();
+            this->batching = batching;
+         }
+
+         bool is_batching() const {
+            return batching;
+         }
 
-            SDL_RenderCopy(renderer, image->get_sdl_texture(),
-                  (SDL_Rect*)&src, (SDL_Rect*)&dst);
+         void set_layer(int layer) override {
+            this->layer = layer;
+         }
+
+         void flush() override {
+            if (quads.empty()) {
+               return;
+            }
+
+            sort(quads.begin(), quads.end());
+
+            for (size_t start = 0; start < quads.size(); ) {
+               size_t end = start + 1;
+               while (end < quads.size() && quads[end].texture == quads[start].texture) {
+                  end++;
+               }
+
+               submit(start, end);
+               start = end;
+            }
+
+            quads.clear();
+         }
+
+         /**
+          * @return The new render target, or nullptr if the SDL renderer
+          *    does not support render targets.
+          * @throws GraphicsException if the texture can't be created.
+          */
+         shared_ptr<lost_levels::Image> create_render_target(const Size<int>& sz) override {
+            if (! SDL_RenderTargetSupported(renderer)) {
+               return nullptr;
+            }
+
+            SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
+               SDL_TEXTUREACCESS_TARGET, sz.width, sz.height);
+
+            if (texture == nullptr) {
+               throw GraphicsException(tfm::format("Failed to create %dx%d render target: %s",
+                  sz.width, sz.height, string(SDL_GetError())));
+            }
+
+            SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+            texturesCreated.add();
+            return make_shared<Image>(shared_ptr<SDL_Texture>(texture, SDL_DestroyTexture),
+                                      Rect<int>(Point<int>(), sz));
+         }
+
+         void set_render_target(shared_ptr<lost_levels::Image> target, bool clear = false) override {
+            flush();
+            SDL_SetRenderTarget(renderer, target == nullptr ? nullptr :
+               static_cast<Image*>(target.get())->get_sdl_texture());
+
+            if (clear && target != nullptr) {
+               Uint8 r, g, b, a;
+               SDL_GetRenderDrawColor(renderer, &r, &g, &b, &a);
+               SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+               SDL_RenderClear(renderer);
+               SDL_SetRenderDrawColor(renderer, r, g, b, a);
+               drawCalls.add();
+            }
          }
 
          shared_ptr<lost_levels::Image> load_image(const string& filename) const override {
@@ -141,6 +305,7 @@ namespace lost_levels {
                   filename, string(SDL_GetError())));
             }
 
+            texturesCreated.add();
             return shared_ptr<lost_levels::Image>(new Image(texture));
          }
 
@@ -150,10 +315,12 @@ namespace lost_levels {
          }
 
          void set_clip_rect(const Rect<int>& rect) override {
+            flush();
             SDL_RenderSetClipRect(renderer, (SDL_Rect*)&rect);
          }
 
          void clear_clip_rect() override {
+            flush();
             SDL_RenderSetClipRect(renderer, nullptr);
          }
 
@@ -164,13 +331,133 @@ namespace lost_levels {
          }
 
          void set_logical_size(const Size<int>& sz) override {
+            flush();
             SDL_RenderSetLogicalSize(renderer, sz.width, sz.height);
          }
 
       private:
+         /**
+          * A queued image draw.  Quads are ordered by layer, then
+          * texture, then submission order.
+          */
+         struct Quad {
+            Quad(int layer, size_t seq, const shared_ptr<const lost_levels::Image>& image,
+                 SDL_Texture* texture, const Size<int>& szTexture,
+                 const Rect<int>& src, const Rect<int>& dst) :
+               layer(layer), seq(seq), image(image), texture(texture),
+               szTexture(szTexture), src(src), dst(dst) { }
+
+            bool operator<(const Quad& rhs) const {
+               if (layer != rhs.layer) {
+                  return layer < rhs.layer;
+               } else if (texture != rhs.texture) {
+                  return less<SDL_Texture*>()(texture, rhs.texture);
+               } else {
+                  return seq < rhs.seq;
+               }
+            }
+
+            int layer;
+            size_t seq;
+            shared_ptr<const lost_levels::Image> image;
+            SDL_Texture* texture;
+            Size<int> szTexture;
+            Rect<int> src, dst;
+         };
+
+         /**
+          * Submit the quads in [start, end), which share a texture.
+          */
+         void submit(size_t start, size_t end) {
+            use_texture(quads[start].texture);
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+            const SDL_Color white = {255, 255, 255, 255};
+            vertices.clear();
+            indices.clear();
+
+            for (size_t x = start; x < end; x++) {
+               const Quad& quad = quads[x];
+               float u0 = (float)quad.src.pt.x / quad.szTexture.width,
+                     v0 = (float)quad.src.pt.y / quad.szTexture.height,
+                     u1 = (float)(quad.src.pt.x + quad.src.sz.width) / quad.szTexture.width,
+                     v1 = (float)(quad.src.pt.y + quad.src.sz.height) / quad.szTexture.height;
+               float x0 = quad.dst.pt.x, y0 = quad.dst.pt.y,
+                     x1 = quad.dst.pt.x + quad.dst.sz.width,
+                     y1 = quad.dst.pt.y + quad.dst.sz.height;
+               int base = vertices.size();
+               count_growth(vertices, 4);
+               count_growth(indices, 6);
+
+               vertices.push_back({{x0, y0}, white, {u0, v0}});
+               vertices.push_back({{x1, y0}, white, {u1, v0}});
+               vertices.push_back({{x1, y1}, white, {u1, v1}});
+               vertices.push_back({{x0, y1}, white, {u0, v1}});
+
+               for (int idx : {0, 1, 2, 0, 2, 3}) {
+                  indices.push_back(base + idx);
+               }
+            }
+
+            SDL_RenderGeometry(renderer, quads[start].texture,
+                  vertices.data(), vertices.size(),
+                  indices.data(), indices.size());
+            drawCalls.add();
+#else
+            for (size_t x = start; x < end; x++) {
+               SDL_RenderCopy(renderer, quads[x].texture,
+                     (SDL_Rect*)&quads[x].src, (SDL_Rect*)&quads[x].dst);
+            }
+            drawCalls.add(end - start);
+#endif
+         }
+
+         void use_texture(SDL_Texture* texture) {
+            if (texture != lastTexture) {
+               textureSwitches.add();
+               lastTexture = texture;
+            }
+         }
+
          SDL_Renderer* renderer;
+         SDL_Texture* lastTexture = nullptr;
+
+         Counter& drawCalls = Metrics::global().counter("render.draw_calls");
+         Counter& textureSwitches = Metrics::global().counter("render.texture_switches");
+         Counter& texturesCreated = Metrics::global().counter("render.textures_created");
+
+         bool batching = false;
+         int layer = 0;
+         vector<Quad> quads;
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+         vector<SDL_Vertex> vertices;
+         vector<int> indices;
+#endif
       };
 
+      typedef unique_ptr<SDL_Surface, void (*)(SDL_Surface*)> SurfacePtr;
+
+      /**
+       * An image decoded into an SDL_Surface, ready to be uploaded.
+       */
+      class DecodedImage : public lost_levels::DecodedImage {
+      public:
+         DecodedImage(const string& filename, SurfacePtr surface) :
+            lost_levels::DecodedImage(filename), surface(move(surface)) { }
+
+         SDL_Surface* get_sdl_surface() const {
+            return surface.get();
+         }
+
+      private:
+         SurfacePtr surface;
+      };
+
+      /**
+       * Loads each image into its own texture.  Images are decoded with
+       * IMG_Load(), which is safe to call from worker threads, and only
+       * the texture upload happens in upload_images().
+       */
       class ImageLoader : public lost_levels::ImageLoader {
       public:
          ImageLoader(shared_ptr<Renderer> renderer) : renderer(renderer) { }
@@ -183,13 +470,159 @@ namespace lost_levels {
                   filename, string(SDL_GetError())));
             }
 
+            renderer->texturesCreated.add();
             return shared_ptr<lost_levels::Image>(new Image(texture));
          }
 
-      private:
+         shared_ptr<lost_levels::DecodedImage> decode_image(const string& filename) const override {
+            SurfacePtr surface(IMG_Load(filename.c_str()), SDL_FreeSurface);
+
+            if (surface == nullptr) {
+               throw GraphicsException(tfm::format("Failed to load image from file '%s': %s",
+                  filename, string(SDL_GetError())));
+            }
+
+            return make_shared<DecodedImage>(filename, move(surface));
+         }
+
+         vector<shared_ptr<lost_levels::Image>> upload_images(
+               const vector<shared_ptr<lost_levels::DecodedImage>>& decodedImages) const override {
+            vector<shared_ptr<lost_levels::Image>> images;
+
+            for (auto decodedImage : decodedImages) {
+               SDL_Surface* surface = get_surface(decodedImage);
+               images.push_back(make_shared<Image>(
+                  create_texture(surface, decodedImage->get_filename()),
+                  Rect<int>(0, 0, surface->w, surface->h)));
+            }
+
+            return images;
+         }
+
+         vector<shared_ptr<lost_levels::Image>> create_images(const Size<int>& szPage,
+               const void* pixels, int pitch, const vector<Rect<int>>& rects) const override {
+            SDL_Texture* rawTexture = SDL_CreateTexture(renderer->renderer,
+               SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC, szPage.width, szPage.height);
+
+            if (rawTexture == nullptr) {
+               throw GraphicsException(tfm::format("Failed to create texture for image page: %s",
+                  string(SDL_GetError())));
+            }
+
+            shared_ptr<SDL_Texture> texture(rawTexture, SDL_DestroyTexture);
+            renderer->texturesCreated.add();
+
+            if (SDL_UpdateTexture(rawTexture, nullptr, pixels, pitch) != 0) {
+               throw GraphicsException(tfm::format("Failed to upload image page: %s",
+                  string(SDL_GetError())));
+            }
+
+            SDL_SetTextureBlendMode(rawTexture, SDL_BLENDMODE_BLEND);
+
+            vector<shared_ptr<lost_levels::Image>> images;
+            for (auto& rect : rects) {
+               images.push_back(make_shared<Image>(texture, rect));
+            }
+
+            return images;
+         }
+
+      protected:
+         static SDL_Surface* get_surface(shared_ptr<lost_levels::DecodedImage> decodedImage) {
+            return static_cast<const DecodedImage*>(decodedImage.get())->get_sdl_surface();
+         }
+
+         shared_ptr<SDL_Texture> create_texture(SDL_Surface* surface, const string& name) const {
+            SDL_Texture* texture = SDL_CreateTextureFromSurface(
+               renderer->renderer, surface);
+
+            if (texture == nullptr) {
+               throw GraphicsException(tfm::format("Failed to create texture for '%s': %s",
+                  name, string(SDL_GetError())));
+            }
+
+            renderer->texturesCreated.add();
+
+            return shared_ptr<SDL_Texture>(texture, SDL_DestroyTexture);
+         }
+
          shared_ptr<Renderer> renderer;
       };
 
+      /**
+       * An ImageLoader which packs images uploaded together with
+       * upload_images() into as few atlas textures as possible, so that
+       * draws of different images can share a texture and be batched.
+       *
+       * NOTE:
+       * - Images too large for an atlas page are loaded as standalone
+       *   textures.
+       * - Choose a page size supported by the target hardware, 2048x2048
+       *   is safe almost everywhere.
+       */
+      class AtlasImageLoader : public ImageLoader {
+      public:
+         AtlasImageLoader(shared_ptr<Renderer> renderer,
+                          const Size<int>& szPage = Size<int>(2048, 2048)) :
+            ImageLoader(renderer), szPage(szPage) { }
+
+         vector<shared_ptr<lost_levels::Image>> upload_images(
+               const vector<shared_ptr<lost_levels::DecodedImage>>& decodedImages) const override {
+            vector<SDL_Surface*> surfaces;
+            vector<Size<int>> sizes;
+
+            for (auto decodedImage : decodedImages) {
+               SDL_Surface* surface = get_surface(decodedImage);
+               surfaces.push_back(surface);
+               sizes.push_back(Size<int>(surface->w, surface->h));
+            }
+
+            AtlasPacker packer(szPage);
+            vector<AtlasPacker::Placement> placements = packer.pack(sizes);
+            vector<shared_ptr<lost_levels::Image>> images(decodedImages.size());
+
+            for (int page = 0; page < packer.get_page_count(); page++) {
+               Size<int> sz = packer.get_page_size(page);
+               SurfacePtr pageSurface(SDL_CreateRGBSurfaceWithFormat(
+                  0, sz.width, sz.height, 32, SDL_PIXELFORMAT_RGBA32), SDL_FreeSurface);
+
+               if (pageSurface == nullptr) {
+                  throw GraphicsException(tfm::format("Failed to create atlas surface: %s",
+                     string(SDL_GetError())));
+               }
+
+               for (size_t x = 0; x < placements.size(); x++) {
+                  if (placements[x].page == page) {
+                     SDL_SetSurfaceBlendMode(surfaces[x], SDL_BLENDMODE_NONE);
+                     SDL_BlitSurface(surfaces[x], nullptr, pageSurface.get(),
+                                     (SDL_Rect*)&placements[x].rect);
+                  }
+               }
+
+               shared_ptr<SDL_Texture> texture = create_texture(pageSurface.get(), "atlas page");
+
+               for (size_t x = 0; x < placements.size(); x++) {
+                  if (placements[x].page == page) {
+                     images[x] = make_shared<Image>(texture, placements[x].rect);
+                  }
+               }
+            }
+
+            for (size_t x = 0; x < placements.size(); x++) {
+               if (placements[x].page == -1) {
+                  shared_ptr<SDL_Texture> texture = create_texture(
+                     surfaces[x], decodedImages[x]->get_filename());
+                  images[x] = make_shared<Image>(texture, sizes[x].rect());
+               }
+            }
+
+            return images;
+         }
+
+      private:
+         Size<int> szPage;
+      };
+
       inline shared_ptr<lost_levels::Window> create_window(
             const Size<int>& sz = Window::default_size(),
             Uint32 flags = SDL_WINDOW_SHOWN) {
@@ -239,6 +672,17 @@ namespace lost_levels {
 
          return shared_ptr<lost_levels::ImageLoader>(new ImageLoader(renderer));
       }
+
+      inline shared_ptr<lost_levels::ImageLoader> create_atlas_image_loader(
+            shared_ptr<lost_levels::Renderer> rendererIn,
+            const Size<int>& szPage = Size<int>(2048, 2048)) {
+         shared_ptr<Renderer> renderer = dynamic_pointer_cast<Renderer>(rendererIn);
+         if (renderer == nullptr) {
+            throw GraphicsException("sdl2::AtlasImageLoader requires an sdl2::Renderer");
+         }
+
+         return shared_ptr<lost_levels::ImageLoader>(new AtlasImageLoader(renderer, szPage));
+      }
    }
 }
 
@@ -0,0 +1,300 @@
+/*
+ * jobs: A work stealing job scheduler.
+ *
+ * Author: Lain Supe (lainproliant)
+ * Date: Wednesday, Oct 14 2026
+ */
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace lost_levels {
+   using namespace std;
+
+   /**
+    * JobSystem <concrete class>
+    *
+    * A pool of worker threads which execute jobs in parallel.  Each
+    * thread owns a queue of jobs, taking new work from the back of its
+    * own queue and stealing from the front of the others' when it runs
+    * dry.  A thread waiting for its jobs to finish executes queued jobs
+    * instead of blocking, so jobs may themselves call parallel_for().
+    *
+    * USAGE:
+    * - Use the Engine's JobSystem, see Engine::get_jobs().
+    * - Call parallel_for() to split a range of indices into chunks and
+    *   process the chunks in parallel.  It returns once every index
+    *   has been processed.
+    *
+    *    engine.get_jobs().parallel_for(0, sprites.size(), 64,
+    *       [&](size_t begin, size_t end) {
+    *          for (size_t x = begin; x < end; x++) {
+    *             sprites[x].update();
+    *          }
+    *       });
+    *
+    * NOTE:
+    * - With a single thread, or a range no larger than one chunk, the
+    *   function is called directly on the calling thread, with no
+    *   locking or allocation.
+    * - Chunks run concurrently, so they must not write to shared state
+    *   without synchronization.
+    * - If a chunk throws, the chunks of the same call which have not
+    *   yet started are skipped.  parallel_for() still waits for the
+    *   chunks already running, then rethrows the first exception.
+    */
+   class JobSystem {
+   public:
+      /**
+       * @param numThreads The total number of threads to run jobs on,
+       *    including the calling thread.  Defaults to the number of
+       *    hardware threads.
+       */
+      JobSystem(size_t numThreads = max(1u, thread::hardware_concurrency())) :
+         queues(max<size_t>(1, numThreads)) {
+
+         for (size_t x = 0; x < queues.size(); x++) {
+            queues[x].reset(new Queue());
+         }
+
+         for (size_t x = 1; x < queues.size(); x++) {
+            workers.push_back(thread(&JobSystem::worker_main, this, x));
+         }
+      }
+
+      ~JobSystem() {
+         {
+            lock_guard<mutex> lock(sleepMutex);
+            quit = true;
+         }
+         sleepCv.notify_all();
+
+         for (auto& worker : workers) {
+            worker.join();
+         }
+      }
+
+      JobSystem(const JobSystem&) = delete;
+      JobSystem& operator=(const JobSystem&) = delete;
+
+      /**
+       * @return The number of threads which run jobs, including the
+       *    calling thread.
+       */
+      size_t get_num_threads() const {
+         return queues.size();
+      }
+
+      /**
+       * Call func(begin, end) for consecutive chunks of at most grain
+       * indices covering [begin, end), in parallel, and wait for all
+       * of them to complete.  The first exception thrown by a chunk is
+       * rethrown once the others have finished.
+       */
+      template<class F>
+      void parallel_for(size_t begin, size_t end, size_t grain, const F& func) {
+         grain = max<size_t>(1, grain);
+
+         if (end <= begin) {
+            return;
+
+         } else if (queues.size() == 1 || end - begin <= grain) {
+            func(begin, end);
+            return;
+         }
+
+         Batch batch((end - begin + grain - 1) / grain);
+         Queue& queue = *queues[this_queue()];
+         {
+            lock_guard<mutex> lock(queue.queueMutex);
+            for (size_t x = begin; x < end; x += grain) {
+               queue.jobs.push_back(Job(&invoke<F>, &func, x, min(end, x + grain), &batch));
+            }
+         }
+
+         {
+            // Under the sleep lock, so a worker can't miss the wakeup.
+            lock_guard<mutex> lock(sleepMutex);
+            pendingJobs += batch.remaining.load();
+         }
+         sleepCv.notify_all();
+
+         while (batch.remaining.load() > 0) {
+            if (! run_one(this_queue())) {
+               this_thread::yield();
+            }
+         }
+
+         if (batch.failed.load()) {
+            rethrow_exception(batch.error);
+         }
+      }
+
+      /**
+       * Call func(x) for each index in [begin, end) in parallel, see
+       * parallel_for() above.
+       */
+      template<class F>
+      void parallel_for_each(size_t begin, size_t end, size_t grain, const F& func) {
+         parallel_for(begin, end, grain, [&func](size_t chunkBegin, size_t chunkEnd) {
+            for (size_t x = chunkBegin; x < chunkEnd; x++) {
+               func(x);
+            }
+         });
+      }
+
+   private:
+      /**
+       * The chunks of one parallel_for() call which have yet to finish,
+       * and the first exception thrown by any of them.
+       */
+      struct Batch {
+         Batch(size_t numJobs) : remaining(numJobs) { }
+
+         atomic<size_t> remaining;
+         atomic<bool> failed {false};
+         mutex errorMutex;
+         exception_ptr error;
+      };
+
+      /**
+       * A chunk of a parallel_for().  The function and batch are
+       * referenced by raw pointer, which is safe as parallel_for() waits
+       * for every chunk.
+       */
+      struct Job {
+         Job() { }
+         Job(void (*fn)(const void*, size_t, size_t), const void* func,
+             size_t begin, size_t end, Batch* batch) :
+            fn(fn), func(func), begin(begin), end(end), batch(batch) { }
+
+         void (*fn)(const void*, size_t, size_t) = nullptr;
+         const void* func = nullptr;
+         size_t begin = 0, end = 0;
+         Batch* batch = nullptr;
+      };
+
+      struct Queue {
+         mutex queueMutex;
+         deque<Job> jobs;
+      };
+
+      template<class F>
+      static void invoke(const void* func, size_t begin, size_t end) {
+         (*static_cast<const F*>(func))(begin, end);
+      }
+
+      /**
+       * The index of the calling thread's queue.  Threads which are not
+       * workers of this JobSystem share queue 0.
+       */
+      size_t this_queue() const {
+         return workerOwner() == this ? workerIndex() : 0;
+      }
+
+      static const JobSystem*& workerOwner() {
+         static thread_local const JobSystem* owner = nullptr;
+         return owner;
+      }
+
+      static size_t& workerIndex() {
+         static thread_local size_t index = 0;
+         return index;
+      }
+
+      /**
+       * Run a job from the given queue, or steal one from another.
+       *
+       * @return true if a job was run.
+       */
+      bool run_one(size_t queueIdx) {
+         Job job;
+
+         if (! pop(queueIdx, job)) {
+            bool stolen = false;
+            for (size_t x = 1; x < queues.size() && ! stolen; x++) {
+               stolen = steal((queueIdx + x) % queues.size(), job);
+            }
+
+            if (! stolen) {
+               return false;
+            }
+         }
+
+         pendingJobs --;
+         if (! job.batch->failed.load()) {
+            try {
+               job.fn(job.func, job.begin, job.end);
+
+            } catch (...) {
+               lock_guard<mutex> lock(job.batch->errorMutex);
+               if (! job.batch->failed.load()) {
+                  job.batch->error = current_exception();
+                  job.batch->failed = true;
+               }
+            }
+         }
+
+         job.batch->remaining.fetch_sub(1);
+         return true;
+      }
+
+      bool pop(size_t queueIdx, Job& job) {
+         Queue& queue = *queues[queueIdx];
+         lock_guard<mutex> lock(queue.queueMutex);
+
+         if (queue.jobs.empty()) {
+            return false;
+         }
+
+         job = queue.jobs.back();
+         queue.jobs.pop_back();
+         return true;
+      }
+
+      bool steal(size_t queueIdx, Job& job) {
+         Queue& queue = *queues[queueIdx];
+         lock_guard<mutex> lock(queue.queueMutex);
+
+         if (queue.jobs.empty()) {
+            return false;
+         }
+
+         job = queue.jobs.front();
+         queue.jobs.pop_front();
+         return true;
+      }
+
+      void worker_main(size_t queueIdx) {
+         workerOwner() = this;
+         workerIndex() = queueIdx;
+
+         for (;;) {
+            if (run_one(queueIdx)) {
+               continue;
+            }
+
+            unique_lock<mutex> lock(sleepMutex);
+            sleepCv.wait(lock, [this]() { return quit || pendingJobs.load() > 0; });
+            if (quit) {
+               return;
+            }
+         }
+      }
+
+      vector<unique_ptr<Queue>> queues;
+      vector<thread> workers;
+
+      atomic<size_t> pendingJobs {0};
+      mutex sleepMutex;
+      condition_variable sleepCv;
+      bool quit = false;
+   };
+}
@@ -5,6 +5,14 @@
  * Date: Monday, June 8 2015 (!)
  */
 #pragma once
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
 #include "resource_base.h"
 #include "lain/string.h"
 #include "tinyformat/tinyformat.h"
@@ -21,56 +29,540 @@ namespace lost_levels {
       using Exception::Exception;
    };
 
+   /**
+    * The id of a block type, as stored in each cell of a BlockMap.
+    */
+   typedef uint16_t BlockId;
+
    class BlockData {
    public:
-      BlockData(const string& name, int id) :
-         name(name), id(id) { }
+      BlockData(const string& name, int id, bool solid = false) :
+         name(name), id(id), solid(solid) { }
       
       string name;
       int id;
+      bool solid;
    };
 
+   /**
+    * BlockDataSet <concrete class>
+    *
+    * The table of block types used by BlockMaps, indexed directly by
+    * block id.  Ids should be allocated densely from 0, as the table
+    * is as long as the largest id.
+    */
    class BlockDataSet {
    public:
+      BlockDataSet() { }
+
       BlockDataSet(const vector<BlockData>& blocks) {
-         for (BlockData block : blocks) {
-            blockMap[block.id] = block;
+         for (const BlockData& block : blocks) {
+            add_block(block);
+         }
+      }
+
+      void add_block(const BlockData& block) {
+         if (block.id < 0 || block.id > numeric_limits<BlockId>::max()) {
+            throw LevelDataException(tfm::format("Block id out of range: %d", block.id));
+         }
+
+         if ((size_t)block.id >= blocks.size()) {
+            blocks.resize(block.id + 1, BlockData("", -1));
+            solidFlags.resize(block.id + 1, false);
          }
+
+         blocks[block.id] = block;
+         solidFlags[block.id] = block.solid;
+      }
+
+      inline bool has_block(int id) const {
+         return id >= 0 && (size_t)id < blocks.size() && blocks[id].id == id;
       }
 
       inline const BlockData& get_block(int id) const {
-         auto iter = blockMap.find(id);
-         if (iter == blockMap.cend()) {
+         if (! has_block(id)) {
             throw LevelDataException(tfm::format("id not found in BlockDataSet: %d", id));
          }
-         return iter->second;
+         return blocks[id];
+      }
+
+      /**
+       * @return One more than the largest id in the table.
+       */
+      size_t size() const {
+         return blocks.size();
+      }
+
+      /**
+       * @return true if the given id is a solid block.  Undefined ids
+       *    are not solid.
+       */
+      inline bool is_solid(BlockId id) const {
+         return id < solidFlags.size() && solidFlags[id];
       }
       
    private:
-      map<int, BlockData> blockMap;
+      vector<BlockData> blocks;
+      vector<uint8_t> solidFlags;
    };
 
+   /**
+    * BlockMap <concrete class>
+    *
+    * A grid of blocks making up a layer of a level.  Each cell holds
+    * only a BlockId, the names and properties of the blocks are held
+    * once in a shared BlockDataSet.
+    *
+    * USAGE:
+    * - Use visit_region() to walk the cells in a rectangle of cells,
+    *   e.g. the cells on screen, in row-major order.
+    * - Use visit_solid() or get_solid_rects() to find the solid cells
+    *   touching an object's rectangle in world coordinates, for
+    *   collision.
+    *
+    * NOTE:
+    * - A map may refer to cells held in memory it does not own, e.g. a
+    *   memory mapped Bundle.  The cells are copied the first time one
+    *   is changed with set_id().
+    */
    class BlockMap : public ResourceImpl<Resource::Type::BLOCK_MAP> {
    public:
-      BlockMap(vector<BlockData> blocks, Size<int> levelSize) :
-         blocks(blocks), levelSize(levelSize) {
-         assert(levelSize.width * levelSize.height == blocks.size());
+      /**
+       * @param blockSet The block types used in the map.
+       * @param levelSize The size of the map in cells.
+       * @param szBlock The size of each cell in world coordinates.
+       * @param fill The id to fill every cell with.
+       */
+      BlockMap(shared_ptr<const BlockDataSet> blockSet, const Size<int>& levelSize,
+               const Size<int>& szBlock, BlockId fill = 0) :
+         blockSet(blockSet), levelSize(levelSize), szBlock(szBlock),
+         ownedCells(levelSize.width * levelSize.height, fill),
+         cells(ownedCells.data()) { }
+
+      /**
+       * @param cells The id of each cell, in row-major order.
+       */
+      BlockMap(shared_ptr<const BlockDataSet> blockSet, const Size<int>& levelSize,
+               const Size<int>& szBlock, const vector<BlockId>& cells) :
+         blockSet(blockSet), levelSize(levelSize), szBlock(szBlock),
+         ownedCells(cells), cells(ownedCells.data()) {
+         if (cells.size() != (size_t)(levelSize.width * levelSize.height)) {
+            throw LevelDataException(tfm::format("BlockMap of size %dx%d given %d cells.",
+               levelSize.width, levelSize.height, cells.size()));
+         }
+      }
+
+      /**
+       * Create a map referring to cells it does not own, without copying
+       * them.
+       *
+       * @param cells The width * height ids of each cell, in row-major
+       *    order.
+       * @param cellOwner Kept alive for as long as the map refers to
+       *    the cells.  May be null if the cells outlive the map.
+       */
+      BlockMap(shared_ptr<const BlockDataSet> blockSet, const Size<int>& levelSize,
+               const Size<int>& szBlock, const BlockId* cells,
+               shared_ptr<const void> cellOwner) :
+         blockSet(blockSet), levelSize(levelSize), szBlock(szBlock),
+         cells(cells), cellOwner(cellOwner), borrowed(true) { }
+
+      BlockMap(const BlockMap& rhs) :
+         blockSet(rhs.blockSet), levelSize(rhs.levelSize), szBlock(rhs.szBlock),
+         ownedCells(rhs.ownedCells), cellOwner(rhs.cellOwner), borrowed(rhs.borrowed) {
+         cells = borrowed ? rhs.cells : ownedCells.data();
       }
 
-      const BlockData& get_block(Point<int> pt) {
-         assert(pt.x < levelSize.width);
-         assert(pt.y < levelSize.height);
+      BlockMap& operator=(const BlockMap&) = delete;
 
-         size_t offset = pt.y * levelSize.width + pt.x;
-         return blocks[offset];
+      BlockId get_id(const Point<int>& pt) const {
+         assert(contains(pt));
+         return cells[offset(pt)];
+      }
+
+      void set_id(const Point<int>& pt, BlockId id) {
+         assert(contains(pt));
+
+         if (borrowed) {
+            ownedCells.assign(cells, cells + get_num_cells());
+            cells = ownedCells.data();
+            cellOwner = nullptr;
+            borrowed = false;
+         }
+
+         ownedCells[offset(pt)] = id;
+      }
+
+      const BlockData& get_block(const Point<int>& pt) const {
+         return blockSet->get_block(get_id(pt));
+      }
+
+      bool is_solid(const Point<int>& pt) const {
+         return blockSet->is_solid(get_id(pt));
+      }
+
+      bool contains(const Point<int>& pt) const {
+         return pt.x >= 0 && pt.y >= 0 &&
+                pt.x < levelSize.width && pt.y < levelSize.height;
       }
 
       const Size<int>& get_level_size() const {
          return levelSize;
       }
 
+      const Size<int>& get_block_size() const {
+         return szBlock;
+      }
+
+      shared_ptr<const BlockDataSet> get_block_set() const {
+         return blockSet;
+      }
+
+      /**
+       * @return The id of every cell, in row-major order.
+       */
+      const BlockId* get_cells() const {
+         return cells;
+      }
+
+      size_t get_num_cells() const {
+         return (size_t)levelSize.width * levelSize.height;
+      }
+
+      /**
+       * @return The rectangle of the given cell in world coordinates.
+       */
+      Rect<float> get_block_rect(const Point<int>& pt) const {
+         return Rect<float>(pt.x * szBlock.width, pt.y * szBlock.height,
+                            szBlock.width, szBlock.height);
+      }
+
+      /**
+       * Invoke visitor(const Point<int>& pt, BlockId id) for each cell
+       * in the given rectangle of cells, clipped to the map, in
+       * row-major order.
+       */
+      template<class F>
+      void visit_region(const Rect<int>& region, F visitor) const {
+         int x0 = max(0, region.pt.x),
+             y0 = max(0, region.pt.y),
+             x1 = min(levelSize.width, region.pt.x + region.sz.width),
+             y1 = min(levelSize.height, region.pt.y + region.sz.height);
+
+         for (int y = y0; y < y1; y++) {
+            const BlockId* row = &cells[y * levelSize.width];
+            for (int x = x0; x < x1; x++) {
+               visitor(Point<int>(x, y), row[x]);
+            }
+         }
+      }
+
+      /**
+       * @return The rectangle of cells touched by the given rectangle in
+       *    world coordinates.  As with Rect::overlaps(), touching edges
+       *    count, so the result may extend past the map.
+       */
+      Rect<int> get_cell_region(const Rect<float>& rect) const {
+         int x0 = (int)floor(rect.pt.x / szBlock.width),
+             y0 = (int)floor(rect.pt.y / szBlock.height),
+             x1 = (int)floor((rect.pt.x + rect.sz.width) / szBlock.width),
+             y1 = (int)floor((rect.pt.y + rect.sz.height) / szBlock.height);
+
+         return Rect<int>(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+      }
+
+      /**
+       * Invoke visitor(const Point<int>& pt, BlockId id) for each solid
+       * cell touched by the given rectangle in world coordinates.
+       */
+      template<class F>
+      void visit_solid(const Rect<float>& rect, F visitor) const {
+         const BlockDataSet& set = *blockSet;
+
+         visit_region(get_cell_region(rect), [&](const Point<int>& pt, BlockId id) {
+            if (set.is_solid(id)) {
+               visitor(pt, id);
+            }
+         });
+      }
+
+      /**
+       * Append the world rectangle of each solid cell touched by the
+       * given rectangle to results, which is not cleared.
+       */
+      void get_solid_rects(const Rect<float>& rect, vector<Rect<float>>& results) const {
+         visit_solid(rect, [&](const Point<int>& pt, BlockId id) {
+            results.push_back(get_block_rect(pt));
+         });
+      }
+
    private:
-      vector<BlockData> blocks;
+      size_t offset(const Point<int>& pt) const {
+         return (size_t)pt.y * levelSize.width + pt.x;
+      }
+
+      shared_ptr<const BlockDataSet> blockSet;
       Size<int> levelSize;
+      Size<int> szBlock;
+
+      vector<BlockId> ownedCells;
+      const BlockId* cells;
+      shared_ptr<const void> cellOwner;
+      bool borrowed = false;
+   };
+
+   /**
+    * BlockMapRenderer <concrete class>
+    *
+    * Draws the visible part of a BlockMap from a tileset image.  The map
+    * is divided into square chunks of cells, and only chunks overlapping
+    * the viewport are drawn.  When the Renderer supports render targets,
+    * each visible chunk is drawn once into a cached texture and then
+    * drawn with a single blit per frame while its cells are unchanged.
+    *
+    * USAGE:
+    * - Construct with the map and a tileset image holding one tile of
+    *   the map's block size per block id, in the order used by
+    *   Rect::tile_rect().  Use set_tile() to draw a block id with a
+    *   different tile, or with no tile at all.
+    * - Call paint() each frame with the camera position.
+    * - Call invalidate() for each cell changed in the map, or
+    *   invalidate_all() after changing many, so that cached chunks are
+    *   redrawn.
+    *
+    * NOTE:
+    * - At most maxCachedChunks chunk textures are kept, reusing those
+    *   drawn least recently.  Size it to a few more chunks than fit in
+    *   the viewport.  Chunks beyond the limit are drawn tile by tile.
+    * - Render target contents can be lost when the graphics device is
+    *   reset (SDL_RENDER_TARGETS_RESET), call invalidate_all() then.
+    */
+   class BlockMapRenderer {
+   public:
+      BlockMapRenderer(shared_ptr<const BlockMap> map, shared_ptr<const Image> tileset,
+                       int chunkCells = 16, size_t maxCachedChunks = 64) :
+         map(map), tileset(tileset), chunkCells(max(1, chunkCells)),
+         maxCachedChunks(maxCachedChunks) {
+
+         const Size<int>& szMap = map->get_level_size();
+         numChunks = Size<int>((szMap.width + this->chunkCells - 1) / this->chunkCells,
+                               (szMap.height + this->chunkCells - 1) / this->chunkCells);
+      }
+
+      /**
+       * Draw the given block id with the given tile of the tileset, or
+       * with no tile if tileNum is -1.
+       */
+      void set_tile(BlockId id, int tileNum) {
+         if (id >= tileNums.size()) {
+            tileNums.resize(id + 1, DEFAULT_TILE);
+         }
+
+         tileNums[id] = tileNum;
+         invalidate_all();
+      }
+
+      /**
+       * Enable or disable caching chunks in render targets.  Enabled by
+       * default, and ignored by renderers without render targets.
+       */
+      void set_caching(bool caching) {
+         this->caching = caching;
+         if (! caching) {
+            cache.clear();
+            cacheIndex.clear();
+         }
+      }
+
+      /**
+       * Mark the chunk holding the given cell to be redrawn.
+       */
+      void invalidate(const Point<int>& cell) {
+         auto iter = cacheIndex.find(chunk_key(Point<int>(cell.x / chunkCells, cell.y / chunkCells)));
+         if (iter != cacheIndex.end()) {
+            cache[iter->second].dirty = true;
+         }
+      }
+
+      void invalidate_all() {
+         for (auto& entry : cache) {
+            entry.dirty = true;
+         }
+      }
+
+      /**
+       * Draw the part of the map visible in a viewport of the renderer's
+       * logical size, with the given world point at its top left.
+       */
+      void paint(Renderer& renderer, const Point<int>& camera) {
+         paint(renderer, Rect<int>(camera, renderer.get_logical_size()));
+      }
+
+      /**
+       * Draw the part of the map within the given world rectangle, at
+       * screen position (0, 0).
+       */
+      void paint(Renderer& renderer, const Rect<int>& viewport) {
+         Size<int> szChunk = get_chunk_size();
+         if (szChunk.width <= 0 || szChunk.height <= 0) {
+            return;
+         }
+
+         int cx0 = max(0, floor_div(viewport.pt.x, szChunk.width)),
+             cy0 = max(0, floor_div(viewport.pt.y, szChunk.height)),
+             cx1 = min(numChunks.width - 1, floor_div(viewport.pt.x + viewport.sz.width - 1, szChunk.width)),
+             cy1 = min(numChunks.height - 1, floor_div(viewport.pt.y + viewport.sz.height - 1, szChunk.height));
+
+         frame ++;
+         chunksDrawn = 0;
+
+         for (int cy = cy0; cy <= cy1; cy++) {
+            for (int cx = cx0; cx <= cx1; cx++) {
+               Point<int> chunk(cx, cy);
+               Point<int> dst(cx * szChunk.width - viewport.pt.x,
+                              cy * szChunk.height - viewport.pt.y);
+               CacheEntry* entry = caching ? get_cache_entry(renderer, chunk) : nullptr;
+
+               if (entry != nullptr) {
+                  renderer.render(entry->target, Rect<int>(dst, entry->target->get_size()));
+               } else {
+                  draw_chunk(renderer, chunk, dst);
+               }
+               chunksDrawn ++;
+            }
+         }
+      }
+
+      /**
+       * @return The size of a chunk in world coordinates.
+       */
+      Size<int> get_chunk_size() const {
+         const Size<int>& szBlock = map->get_block_size();
+         return Size<int>(szBlock.width * chunkCells, szBlock.height * chunkCells);
+      }
+
+      /**
+       * @return The number of chunks drawn by the last call to paint().
+       */
+      int get_chunks_drawn() const {
+         return chunksDrawn;
+      }
+
+      size_t get_cached_chunks() const {
+         return cache.size();
+      }
+
+   private:
+      enum { DEFAULT_TILE = -2 };
+
+      struct CacheEntry {
+         Point<int> chunk;
+         shared_ptr<Image> target;
+         uint64_t lastUsed = 0;
+         bool dirty = true;
+      };
+
+      static int floor_div(int a, int b) {
+         return a >= 0 ? a / b : -((-a + b - 1) / b);
+      }
+
+      int64_t chunk_key(const Point<int>& chunk) const {
+         return (int64_t)chunk.y * numChunks.width + chunk.x;
+      }
+
+      int get_tile(BlockId id) const {
+         int tileNum = id < tileNums.size() ? tileNums[id] : DEFAULT_TILE;
+         return tileNum == DEFAULT_TILE ? (int)id : tileNum;
+      }
+
+      /**
+       * Find or assign the cached texture for a chunk, redrawing it if
+       * needed.  Returns nullptr if the chunk can't be cached.
+       */
+      CacheEntry* get_cache_entry(Renderer& renderer, const Point<int>& chunk) {
+         int64_t key = chunk_key(chunk);
+         auto iter = cacheIndex.find(key);
+         CacheEntry* entry = nullptr;
+
+         if (iter != cacheIndex.end()) {
+            entry = &cache[iter->second];
+
+         } else if (cache.size() < maxCachedChunks) {
+            shared_ptr<Image> target = renderer.create_render_target(get_chunk_size());
+            if (target == nullptr) {
+               return nullptr;
+            }
+
+            cacheIndex[key] = cache.size();
+            cache.push_back(CacheEntry());
+            entry = &cache.back();
+            entry->target = target;
+
+         } else {
+            size_t lru = 0;
+            for (size_t x = 1; x < cache.size(); x++) {
+               if (cache[x].lastUsed < cache[lru].lastUsed) {
+                  lru = x;
+               }
+            }
+
+            // Every cached chunk is already on screen this frame.
+            if (cache.empty() || cache[lru].lastUsed == frame) {
+               return nullptr;
+            }
+
+            entry = &cache[lru];
+            cacheIndex.erase(chunk_key(entry->chunk));
+            cacheIndex[key] = lru;
+            entry->dirty = true;
+         }
+
+         entry->chunk = chunk;
+         entry->lastUsed = frame;
+
+         if (entry->dirty) {
+            renderer.set_render_target(entry->target, true);
+            draw_chunk(renderer, chunk, Point<int>());
+            renderer.set_render_target(nullptr);
+            entry->dirty = false;
+         }
+
+         return entry;
+      }
+
+      /**
+       * Draw each tile of a chunk with the chunk's top left at dst.
+       */
+      void draw_chunk(Renderer& renderer, const Point<int>& chunk, const Point<int>& dst) {
+         const Size<int>& szBlock = map->get_block_size();
+         Point<int> origin(chunk.x * chunkCells, chunk.y * chunkCells);
+
+         map->visit_region(Rect<int>(origin, Size<int>(chunkCells, chunkCells)),
+            [&](const Point<int>& cell, BlockId id) {
+               int tileNum = get_tile(id);
+               if (tileNum < 0) {
+                  return;
+               }
+
+               Rect<int> dstRect(dst.x + (cell.x - origin.x) * szBlock.width,
+                                 dst.y + (cell.y - origin.y) * szBlock.height,
+                                 szBlock.width, szBlock.height);
+               renderer.render(tileset, tileset->get_tile_rect(szBlock, tileNum), dstRect);
+            });
+      }
+
+      shared_ptr<const BlockMap> map;
+      shared_ptr<const Image> tileset;
+      int chunkCells;
+      size_t maxCachedChunks;
+      Size<int> numChunks;
+
+      vector<int> tileNums;
+      bool caching = true;
+
+      vector<CacheEntry> cache;
+      unordered_map<int64_t, size_t> cacheIndex;
+      uint64_t frame = 0;
+      int chunksDrawn = 0;
    };
 }
@@ -0,0 +1,359 @@
+/*
+ * metrics: Named counters and histograms for diagnostics.
+ *
+ * Author: Lain Supe (lainproliant)
+ * Date: Wednesday, Oct 14 2026
+ */
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "lain/exception.h"
+#include "tinyformat/tinyformat.h"
+
+/*
+ * Define LOST_LEVELS_NO_COUNTERS to compile Counter::add() down to
+ * nothing, for builds where even a relaxed atomic add is too much.
+ */
+
+namespace lost_levels {
+   using namespace std;
+   using namespace lain;
+
+   class MetricsException : public Exception {
+      using Exception::Exception;
+   };
+
+   /**
+    * Counter <concrete class>
+    *
+    * A named count of events, e.g. draw calls, which any thread may
+    * increment.  Besides the running total, the count over the last
+    * complete frame is kept, see Metrics::end_frame().
+    *
+    * USAGE:
+    * - Get counters from Metrics::global().counter() once and keep the
+    *   reference, as the lookup is by name.
+    * - Call add() as events happen.  In hot loops, count into a local
+    *   variable and add() it once afterwards.
+    */
+   class Counter {
+   public:
+      Counter(const string& name) :
+         name(name) { }
+
+      void add(int64_t n = 1) {
+#if ! defined(LOST_LEVELS_NO_COUNTERS)
+         total.fetch_add(n, memory_order_relaxed);
+#endif
+      }
+
+      const string& get_name() const {
+         return name;
+      }
+
+      int64_t get_total() const {
+         return total.load(memory_order_relaxed);
+      }
+
+      /**
+       * @return The count over the last complete frame.
+       */
+      int64_t get_frame_value() const {
+         return frameValue.load(memory_order_relaxed);
+      }
+
+   private:
+      friend class Metrics;
+
+      void end_frame() {
+         int64_t now = get_total();
+         frameValue.store(now - frameStart, memory_order_relaxed);
+         frameStart = now;
+      }
+
+      string name;
+      atomic<int64_t> total {0};
+      atomic<int64_t> frameValue {0};
+      int64_t frameStart = 0;
+   };
+
+   /**
+    * Histogram <concrete class>
+    *
+    * Counts values, e.g. frame times, into buckets of equal width
+    * starting at 0.  Values past the last bucket are counted in it.
+    */
+   class Histogram {
+   public:
+      Histogram(const string& name, double bucketWidth, size_t numBuckets) :
+         name(name), bucketWidth(bucketWidth), buckets(max<size_t>(1, numBuckets), 0) { }
+
+      void add(double value) {
+         size_t idx = value > 0 ? (size_t)(value / bucketWidth) : 0;
+         lock_guard<mutex> lock(histogramMutex);
+         buckets[min(idx, buckets.size() - 1)] ++;
+         count ++;
+      }
+
+      void reset() {
+         lock_guard<mutex> lock(histogramMutex);
+         fill(buckets.begin(), buckets.end(), 0);
+         count = 0;
+      }
+
+      const string& get_name() const {
+         return name;
+      }
+
+      double get_bucket_width() const {
+         return bucketWidth;
+      }
+
+      size_t get_num_buckets() const {
+         return buckets.size();
+      }
+
+      vector<uint64_t> get_buckets() const {
+         lock_guard<mutex> lock(histogramMutex);
+         return buckets;
+      }
+
+      uint64_t get_count() const {
+         lock_guard<mutex> lock(histogramMutex);
+         return count;
+      }
+
+      /**
+       * @return The upper bound of the bucket holding the given
+       *    percentile of values, e.g. 99 for the 99th percentile, or 0
+       *    if no values have been counted.
+       */
+      double get_percentile(double percentile) const {
+         lock_guard<mutex> lock(histogramMutex);
+         if (count == 0) {
+            return 0;
+         }
+
+         uint64_t rank = max<uint64_t>(1, (uint64_t)(count * percentile / 100.0 + 0.5));
+         uint64_t seen = 0;
+
+         for (size_t x = 0; x < buckets.size(); x++) {
+            seen += buckets[x];
+            if (seen >= rank) {
+               return (x + 1) * bucketWidth;
+            }
+         }
+
+         return buckets.size() * bucketWidth;
+      }
+
+   private:
+      string name;
+      double bucketWidth;
+      vector<uint64_t> buckets;
+      uint64_t count = 0;
+      mutable mutex histogramMutex;
+   };
+
+   /**
+    * Metrics <concrete class>
+    *
+    * A registry of named Counters and Histograms.  The library's own
+    * subsystems record into the global registry:
+    *
+    * - "render.draw_calls": Draw calls issued to SDL.
+    * - "render.texture_switches": Draws using a different texture than
+    *   the draw before.
+    * - "render.textures_created": Textures allocated.
+    * - "render.frames_skipped": Frames not painted because the state
+    *   reported no damage.
+    * - "collision.tree_queries": CollisionTree queries.
+    * - "collision.tree_nodes_visited": CollisionTree nodes visited by
+    *   queries.
+    * - "collision.pairs_tested": Rectangle pairs tested by Collider's
+    *   batched and swept collisions.
+    * - "resources.loaded": Resources added to a ResourceManager.
+    * - "resources.name_lookups": ResourceManager lookups by name.
+    *   Use a ResourceHandle to avoid these in hot code.
+    * - "world.regions_loaded": StreamingWorld regions made resident.
+    * - "world.regions_evicted": StreamingWorld regions evicted.
+    * - "memory.buffer_growths": Reallocations of buffers which are
+    *   reused from frame to frame, i.e. CollisionTree pools, DrawList
+    *   commands and the sdl2 Renderer's batch.  These should stop once
+    *   the buffers have grown to fit a typical frame.
+    * - "engine.frame_time_ms": Histogram of frame times.
+    *
+    * USAGE:
+    * - The Engine calls end_frame() at the end of each iteration of the
+    *   game loop.  Read Counter::get_frame_value() from diag_update()
+    *   to see per-frame counts.
+    * - Call save() to write every metric to a file as JSON, e.g. when
+    *   a game exits, to compare runs across builds.
+    */
+   class Metrics {
+   public:
+      static Metrics& global() {
+         static Metrics metrics;
+         return metrics;
+      }
+
+      /**
+       * Get the counter with the given name, creating it if it does
+       * not exist.  The reference remains valid for the life of the
+       * registry.
+       */
+      Counter& counter(const string& name) {
+         lock_guard<mutex> lock(metricsMutex);
+         auto iter = counters.find(name);
+
+         if (iter == counters.end()) {
+            iter = counters.insert({name, unique_ptr<Counter>(new Counter(name))}).first;
+         }
+
+         return *iter->second;
+      }
+
+      /**
+       * Get the histogram with the given name, creating it with the
+       * given buckets if it does not exist.
+       */
+      Histogram& histogram(const string& name, double bucketWidth = 1.0, size_t numBuckets = 100) {
+         lock_guard<mutex> lock(metricsMutex);
+         auto iter = histograms.find(name);
+
+         if (iter == histograms.end()) {
+            iter = histograms.insert({name, unique_ptr<Histogram>(
+               new Histogram(name, bucketWidth, numBuckets))}).first;
+         }
+
+         return *iter->second;
+      }
+
+      /**
+       * Finish the current frame, updating each counter's per-frame
+       * value.
+       */
+      void end_frame() {
+         lock_guard<mutex> lock(metricsMutex);
+
+         for (auto& kv : counters) {
+            kv.second->end_frame();
+         }
+
+         frameCount ++;
+      }
+
+      uint64_t get_frame_count() const {
+         lock_guard<mutex> lock(metricsMutex);
+         return frameCount;
+      }
+
+      /**
+       * @return All counters, ordered by name.
+       */
+      vector<const Counter*> get_counters() const {
+         lock_guard<mutex> lock(metricsMutex);
+         vector<const Counter*> results;
+
+         for (auto& kv : counters) {
+            results.push_back(kv.second.get());
+         }
+
+         return results;
+      }
+
+      /**
+       * @return All histograms, ordered by name.
+       */
+      vector<const Histogram*> get_histograms() const {
+         lock_guard<mutex> lock(metricsMutex);
+         vector<const Histogram*> results;
+
+         for (auto& kv : histograms) {
+            results.push_back(kv.second.get());
+         }
+
+         return results;
+      }
+
+      /**
+       * Write every metric as JSON.  Counters report their total, their
+       * value over the last frame, and their average per frame.
+       */
+      void write(ostream& out) const {
+         uint64_t frames = get_frame_count();
+
+         out << "{\n  \"frames\": " << frames << ",\n  \"counters\": {";
+         auto counterList = get_counters();
+         for (size_t x = 0; x < counterList.size(); x++) {
+            const Counter& counter = *counterList[x];
+            out << (x > 0 ? "," : "") << "\n    \"" << counter.get_name() << "\": {"
+                << "\"total\": " << counter.get_total()
+                << ", \"last_frame\": " << counter.get_frame_value()
+                << ", \"per_frame\": " << (frames > 0 ? (double)counter.get_total() / frames : 0.0)
+                << "}";
+         }
+
+         out << "\n  },\n  \"histograms\": {";
+         auto histogramList = get_histograms();
+         for (size_t x = 0; x < histogramList.size(); x++) {
+            const Histogram& histogram = *histogramList[x];
+            vector<uint64_t> buckets = histogram.get_buckets();
+
+            out << (x > 0 ? "," : "") << "\n    \"" << histogram.get_name() << "\": {"
+                << "\"bucket_width\": " << histogram.get_bucket_width()
+                << ", \"count\": " << histogram.get_count()
+                << ", \"p50\": " << histogram.get_percentile(50)
+                << ", \"p99\": " << histogram.get_percentile(99)
+                << ", \"buckets\": [";
+            for (size_t y = 0; y < buckets.size(); y++) {
+               out << (y > 0 ? ", " : "") << buckets[y];
+            }
+            out << "]}";
+         }
+
+         out << "\n  }\n}\n";
+      }
+
+      /**
+       * Write every metric to the given file as JSON.
+       *
+       * @throws MetricsException if the file can't be written.
+       */
+      void save(const string& filename) const {
+         ofstream out(filename);
+         if (! out) {
+            throw MetricsException(tfm::format("Could not open metrics file '%s' for writing.", filename));
+         }
+
+         write(out);
+      }
+
+   private:
+      map<string, unique_ptr<Counter>> counters;
+      map<string, unique_ptr<Histogram>> histograms;
+      uint64_t frameCount = 0;
+      mutable mutex metricsMutex;
+   };
+
+   /**
+    * Count in "memory.buffer_growths" if appending n elements to the
+    * given buffer will reallocate it.  Call this before appending.
+    */
+   template<class V>
+   inline void count_growth(const V& buffer, size_t n = 1) {
+      if (buffer.size() + n > buffer.capacity()) {
+         static Counter& growths = Metrics::global().counter("memory.buffer_growths");
+         growths.add();
+      }
+   }
+}
@@ -0,0 +1,123 @@
+/*
+ * pacing: Precise sleeping for frame pacing.
+ *
+ * Author: Lain Supe (lainproliant)
+ * Date: Wednesday, Oct 14 2026
+ */
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+namespace lost_levels {
+   using namespace std;
+
+   /**
+    * FramePacer <concrete class>
+    *
+    * Waits until a deadline without busy looping for the whole wait.
+    * The bulk of the wait is an OS sleep, which may overshoot by the
+    * scheduler's granularity, so the last slice of the wait is spent
+    * spinning instead.  The length of that slice adapts to the
+    * overshoot measured on previous sleeps.
+    *
+    * USAGE:
+    * - Call wait_until() with the next deadline, or wait() with the
+    *   time remaining until it.
+    * - Use get_sleep_overshoot() and get_lateness() to monitor how
+    *   well the pacer is keeping time.
+    */
+   class FramePacer {
+   public:
+      typedef chrono::steady_clock Clock;
+      typedef chrono::microseconds Duration;
+
+      /**
+       * @param minMargin The shortest slice of each wait to spin for.
+       * @param maxMargin The longest slice of each wait to spin for,
+       *    however much the OS sleep is measured to overshoot.
+       */
+      FramePacer(Duration minMargin = Duration(500),
+                 Duration maxMargin = Duration(4000)) :
+         minMargin(minMargin), maxMargin(maxMargin), margin(maxMargin) { }
+
+      /**
+       * Wait for the given duration.
+       */
+      void wait(Duration duration) {
+         wait_until(Clock::now() + duration);
+      }
+
+      /**
+       * Wait until the given deadline, or return at once if it has
+       * already passed.
+       */
+      void wait_until(Clock::time_point deadline) {
+         Clock::time_point start = Clock::now();
+         Duration sleepFor = chrono::duration_cast<Duration>(deadline - start) - margin;
+
+         if (sleepFor > Duration::zero()) {
+            this_thread::sleep_for(sleepFor);
+            Duration overshoot = chrono::duration_cast<Duration>(
+               Clock::now() - start) - sleepFor;
+            adapt(overshoot);
+         }
+
+         while (Clock::now() < deadline) {
+            this_thread::yield();
+         }
+
+         double late = chrono::duration_cast<Duration>(Clock::now() - deadline).count();
+         lateness = lateness * (1.0 - SMOOTHING) + late * SMOOTHING;
+      }
+
+      /**
+       * @return The current length of the spin slice.
+       */
+      Duration get_margin() const {
+         return margin;
+      }
+
+      /**
+       * @return A running average of how far OS sleeps have
+       *    overshot their requested time, in microseconds.
+       */
+      double get_sleep_overshoot() const {
+         return sleepOvershoot;
+      }
+
+      /**
+       * @return A running average of how far past the deadline each
+       *    wait has returned, in microseconds.
+       */
+      double get_lateness() const {
+         return lateness;
+      }
+
+   private:
+      static constexpr double SMOOTHING = 0.1;
+      static constexpr double PEAK_DECAY = 0.98;
+
+      /**
+       * Keep the spin slice a little longer than the recent peak sleep
+       * overshoot.  The peak decays slowly, so a single late wakeup
+       * lengthens the slice for a while.
+       */
+      void adapt(Duration overshoot) {
+         double value = max<double>(0, overshoot.count());
+         sleepOvershoot = sleepOvershoot * (1.0 - SMOOTHING) + value * SMOOTHING;
+         peakOvershoot = max(value, peakOvershoot * PEAK_DECAY);
+
+         margin = Duration((Duration::rep)(peakOvershoot * 1.25));
+         margin = max(minMargin, min(maxMargin, margin));
+      }
+
+      Duration minMargin;
+      Duration maxMargin;
+      Duration margin;
+
+      double sleepOvershoot = 0;
+      double peakOvershoot = 0;
+      double lateness = 0;
+   };
+}
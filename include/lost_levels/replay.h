@@ -0,0 +1,264 @@
+/*
+ * replay: Recorded input and physics steps for deterministic replay.
+ *
+ * Author: Lain Supe (lainproliant)
+ * Date: Wednesday, Oct 14 2026
+ */
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+#include "lain/exception.h"
+#include "tinyformat/tinyformat.h"
+
+namespace lost_levels {
+   using namespace std;
+   using namespace lain;
+
+   class ReplayException : public Exception {
+      using Exception::Exception;
+   };
+
+   namespace replay_format {
+      const char MAGIC[8] = {'L', 'L', 'R', 'E', 'P', 'L', 'A', 'Y'};
+      const uint64_t VERSION = 1;
+   }
+
+   /**
+    * Recording <concrete class>
+    *
+    * The input events delivered and the physics steps run in each
+    * iteration of the game loop, as recorded by an Engine.  Replaying
+    * them in order reproduces the session exactly, as long as the
+    * states are otherwise deterministic.  See Engine::set_recording()
+    * and Engine::set_replay().
+    *
+    * Events are stored as opaque fixed-size records, e.g. SDL_Events,
+    * so they must be trivially copyable, and pointers within them are
+    * meaningless on replay.
+    *
+    * The file format is a small header followed by each frame's step
+    * and event counts as variable-length integers and its events, so
+    * the common frame with one step and no input takes two bytes.
+    */
+   class Recording {
+   public:
+      Recording(uint32_t physicsInterval = 0) :
+         physicsInterval(physicsInterval) { }
+
+      static shared_ptr<Recording> load(const string& filename) {
+         ifstream in(filename, ios::binary);
+         if (! in) {
+            throw ReplayException(tfm::format("Could not open recording '%s'.", filename));
+         }
+
+         return read(in);
+      }
+
+      static shared_ptr<Recording> read(istream& in) {
+         char magic[sizeof(replay_format::MAGIC)];
+         in.read(magic, sizeof(magic));
+         if (! in || memcmp(magic, replay_format::MAGIC, sizeof(magic)) != 0) {
+            throw ReplayException("Not a recording.");
+         }
+
+         uint64_t version = read_varint(in);
+         if (version != replay_format::VERSION) {
+            throw ReplayException(tfm::format("Unsupported recording version %d.", version));
+         }
+
+         auto recording = make_shared<Recording>(read_varint(in));
+         recording->eventSize = read_varint(in);
+         uint64_t numFrames = read_varint(in);
+
+         for (uint64_t x = 0; x < numFrames; x++) {
+            Frame frame;
+            frame.steps = read_varint(in);
+            frame.numEvents = read_varint(in);
+            frame.firstEvent = recording->events.size() / max<size_t>(1, recording->eventSize);
+
+            size_t bytes = (size_t)frame.numEvents * recording->eventSize;
+            if (bytes > 0) {
+               size_t offset = recording->events.size();
+               recording->events.resize(offset + bytes);
+               in.read((char*)recording->events.data() + offset, bytes);
+               if (! in) {
+                  throw ReplayException("Recording is truncated.");
+               }
+            }
+
+            recording->totalSteps += frame.steps;
+            recording->frames.push_back(frame);
+         }
+
+         return recording;
+      }
+
+      /**
+       * Write the recording, including the frame in progress.
+       *
+       * @throws ReplayException if the file can't be written.
+       */
+      void save(const string& filename) const {
+         ofstream out(filename, ios::binary);
+         if (! out) {
+            throw ReplayException(tfm::format("Could not open recording '%s' for writing.", filename));
+         }
+
+         write(out);
+      }
+
+      void write(ostream& out) const {
+         size_t numFrames = frames.size() + (is_frame_empty() ? 0 : 1);
+
+         out.write(replay_format::MAGIC, sizeof(replay_format::MAGIC));
+         write_varint(out, replay_format::VERSION);
+         write_varint(out, physicsInterval);
+         write_varint(out, eventSize);
+         write_varint(out, numFrames);
+
+         for (size_t x = 0; x < numFrames; x++) {
+            const Frame& frame = x < frames.size() ? frames[x] : current;
+            write_varint(out, frame.steps);
+            write_varint(out, frame.numEvents);
+            if (frame.numEvents > 0) {
+               out.write((const char*)get_event(frame.firstEvent),
+                         (size_t)frame.numEvents * eventSize);
+            }
+         }
+      }
+
+      /**
+       * Add an event to the frame being recorded.  Every event must be
+       * of the same size.
+       */
+      void add_event(const void* event, size_t size) {
+         if (eventSize == 0) {
+            eventSize = size;
+
+         } else if (size != eventSize) {
+            throw ReplayException(tfm::format("Recorded events are %d bytes, not %d.",
+               eventSize, size));
+         }
+
+         const uint8_t* bytes = (const uint8_t*)event;
+         events.insert(events.end(), bytes, bytes + size);
+         current.numEvents++;
+      }
+
+      /**
+       * Add physics steps to the frame being recorded.
+       */
+      void add_steps(uint32_t steps) {
+         current.steps += steps;
+         totalSteps += steps;
+      }
+
+      /**
+       * Finish the frame being recorded, and start the next.
+       */
+      void end_frame() {
+         frames.push_back(current);
+         current = Frame();
+         current.firstEvent = eventSize > 0 ? events.size() / eventSize : 0;
+      }
+
+      /**
+       * @return The number of finished frames.
+       */
+      size_t get_num_frames() const {
+         return frames.size();
+      }
+
+      uint32_t get_steps(size_t frame) const {
+         return frames[frame].steps;
+      }
+
+      uint32_t get_num_events(size_t frame) const {
+         return frames[frame].numEvents;
+      }
+
+      /**
+       * Copy the given event of the given frame into event.
+       *
+       * @throws ReplayException if the events are not of the given size.
+       */
+      void get_event(size_t frame, size_t idx, void* event, size_t size) const {
+         if (size != eventSize) {
+            throw ReplayException(tfm::format("Recorded events are %d bytes, not %d.",
+               eventSize, size));
+         }
+
+         memcpy(event, get_event(frames[frame].firstEvent + idx), size);
+      }
+
+      uint64_t get_total_steps() const {
+         return totalSteps;
+      }
+
+      size_t get_num_events() const {
+         return eventSize > 0 ? events.size() / eventSize : 0;
+      }
+
+      size_t get_event_size() const {
+         return eventSize;
+      }
+
+      uint32_t get_physics_interval() const {
+         return physicsInterval;
+      }
+
+   private:
+      struct Frame {
+         uint32_t steps = 0;
+         uint32_t firstEvent = 0;
+         uint32_t numEvents = 0;
+      };
+
+      static void write_varint(ostream& out, uint64_t value) {
+         do {
+            uint8_t byte = value & 0x7f;
+            value >>= 7;
+            out.put(value > 0 ? byte | 0x80 : byte);
+         } while (value > 0);
+      }
+
+      static uint64_t read_varint(istream& in) {
+         uint64_t value = 0;
+
+         for (int shift = 0; shift < 64; shift += 7) {
+            int byte = in.get();
+            if (byte == EOF) {
+               throw ReplayException("Recording is truncated.");
+            }
+
+            value |= (uint64_t)(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+               return value;
+            }
+         }
+
+         throw ReplayException("Recording contains an invalid integer.");
+      }
+
+      bool is_frame_empty() const {
+         return current.steps == 0 && current.numEvents == 0;
+      }
+
+      const uint8_t* get_event(size_t idx) const {
+         return events.data() + idx * eventSize;
+      }
+
+      uint32_t physicsInterval;
+      size_t eventSize = 0;
+      vector<Frame> frames;
+      Frame current;
+      vector<uint8_t> events;
+      uint64_t totalSteps = 0;
+   };
+}
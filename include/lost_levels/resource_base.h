@@ -52,6 +52,9 @@ namespace lost_levels {
       virtual ~ResourceImpl() { }
    };
 
+   template<Resource::Type rcType>
+   const Resource::Type ResourceImpl<rcType>::RC_TYPE;
+
    inline const string& rc_type_to_string(const Resource::Type rcType) {
       static const map<Resource::Type, string> RC_TYPE_MAP = {
          {Resource::Type::AUDIO,          "Audio"},
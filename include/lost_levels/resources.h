@@ -5,8 +5,17 @@
  * Date: Monday, Feb 2 2015
  */
 #pragma once
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
 #include "lain/settings.h"
+#include "lost_levels/bundle.h"
 #include "lost_levels/graphics.h"
+#include "lost_levels/metrics.h"
 #include "lost_levels/resource_base.h"
 #include "apathy/path.hpp"
 
@@ -19,6 +28,43 @@ namespace lost_levels {
       return tfm::format("%s:%s", name, rc_type_to_string(rcType));
    }
 
+   /**
+    * ResourceHandle <concrete class>
+    *
+    * A typed reference to a resource in a ResourceManager, obtained
+    * once by name with ResourceManager::resolve().  Getting a resource
+    * by handle is an array index, with no string handling or RTTI, so
+    * handles should be preferred in spawn paths and per frame code.
+    *
+    * NOTE:
+    * - Handles are only meaningful to the ResourceManager which
+    *   issued them.  Resources are never removed, so a handle stays
+    *   valid for the lifetime of its manager.
+    */
+   template<class T>
+   class ResourceHandle {
+   public:
+      ResourceHandle() { }
+
+      bool is_valid() const {
+         return index >= 0;
+      }
+
+      bool operator==(const ResourceHandle<T>& rhs) const {
+         return index == rhs.index;
+      }
+
+      bool operator!=(const ResourceHandle<T>& rhs) const {
+         return ! this->operator==(rhs);
+      }
+
+   private:
+      friend class ResourceManager;
+      ResourceHandle(int index) : index(index) { }
+
+      int index = -1;
+   };
+
    /**
     * An object for managing and sharing resources in a game.
     *
@@ -31,11 +77,229 @@ namespace lost_levels {
     * - Load the resource manager by pointing it to one or more resource
     *   files.
     * - Use the resources, referring to them with names defined in the
-    *   resource file(s).
+    *   resource file(s).  Resolve names to a ResourceHandle once for
+    *   resources which are fetched often.
+    * - To keep painting while resources load, e.g. in a loading state,
+    *   use load_file_async() instead of load_file() and call update()
+    *   on the returned AsyncLoad once per frame.
     */
    class ResourceManager {
+   protected:
+      /**
+       * The images declared in a resource file, gathered so that they
+       * can be decoded together and uploaded in as few batches as
+       * possible.  Images with "atlas" set to false are uploaded
+       * individually, e.g. large backgrounds drawn with render_pattern().
+       */
+      struct ImageBatch {
+         vector<string> names;
+         vector<string> filenames;
+         vector<bool> atlas;
+      };
+
    public:
-      ResourceManager(shared_ptr<Timer<unsigned int>> timer,
+      typedef function<void(size_t done, size_t total)> ProgressCallback;
+
+      /**
+       * AsyncLoad <concrete class>
+       *
+       * A handle to a resource file being loaded in the background.
+       * Images are decoded on a pool of worker threads.  Everything
+       * which touches the renderer or the resource manager itself is
+       * done by update(), which must be called from the rendering
+       * thread.
+       *
+       * NOTE:
+       * - The ResourceManager must outlive this object.
+       * - Destroying the handle before it completes cancels the load
+       *   and waits for the workers to finish.  None of the file's
+       *   resources are added in this case.
+       */
+      class AsyncLoad {
+      public:
+         AsyncLoad(ResourceManager& rm, const string& filename,
+                   size_t numThreads) :
+            rm(rm), filename(filename), settings(load_settings(filename)) {
+
+            try {
+               if (settings.contains("images")) {
+                  batch = rm.collect_image_objects(fs::Path(filename).parent(),
+                                                   settings.get_object_array("images"));
+               }
+
+            } catch (const exception& e) {
+               throw ResourceException(tfm::format("Failed to load resource file '%s': %s",
+                  filename, e.what()));
+            }
+
+            decodedImages.resize(batch.filenames.size());
+            numThreads = max<size_t>(1, min(numThreads, batch.filenames.size()));
+            for (size_t x = 0; x < numThreads && ! batch.filenames.empty(); x++) {
+               workers.push_back(thread(&AsyncLoad::decode_worker, this));
+            }
+         }
+
+         ~AsyncLoad() {
+            cancelled = true;
+            join();
+         }
+
+         /**
+          * Set a callback to be invoked from update() whenever more
+          * images have been decoded.  It is invoked once more with
+          * done == total when the load completes.
+          */
+         void set_progress_callback(ProgressCallback callback) {
+            progressCallback = callback;
+         }
+
+         size_t get_total() const {
+            return batch.filenames.size();
+         }
+
+         size_t get_done() const {
+            return min(numDecoded.load(), get_total());
+         }
+
+         /**
+          * @return The fraction of images decoded, from 0 to 1.
+          */
+         float get_progress() const {
+            return complete || get_total() == 0 ? 1.0f :
+               (float)get_done() / get_total();
+         }
+
+         bool is_complete() const {
+            return complete;
+         }
+
+         /**
+          * Report progress, and once all images are decoded, upload
+          * them and add the file's resources to the ResourceManager.
+          *
+          * This method can throw ResourceException if any resource in
+          * the file failed to load.
+          *
+          * @return true if the load is complete.
+          */
+         bool update() {
+            if (complete) {
+               return true;
+            }
+
+            size_t done = get_done();
+            if (failed) {
+               join();
+               rethrow();
+            }
+
+            if (done != reportedDone && done < get_total() && progressCallback) {
+               progressCallback(done, get_total());
+            }
+            reportedDone = done;
+
+            if (done < get_total()) {
+               return false;
+            }
+
+            join();
+            try {
+               rm.upload_image_batch(batch, decodedImages);
+               decodedImages.clear();
+
+               if (settings.contains("animations")) {
+                  rm.load_animation_object_array(settings.get_object_array("animations"));
+               }
+
+            } catch (const exception& e) {
+               throw ResourceException(tfm::format("Failed to load resource file '%s': %s",
+                  filename, e.what()));
+            }
+
+            complete = true;
+            if (progressCallback) {
+               progressCallback(get_total(), get_total());
+            }
+
+            return true;
+         }
+
+         /**
+          * Block until the load is complete.
+          */
+         void wait() {
+            join();
+            update();
+         }
+
+      private:
+         static Settings load_settings(const string& filename) {
+            try {
+               return Settings::load_from_file(filename);
+
+            } catch (const exception& e) {
+               throw ResourceException(tfm::format("Failed to load resource file '%s': %s",
+                  filename, e.what()));
+            }
+         }
+
+         void decode_worker() {
+            for (size_t x = nextImage++; x < batch.filenames.size() && ! cancelled;
+                 x = nextImage++) {
+               try {
+                  decodedImages[x] = rm.imageLoader->decode_image(batch.filenames[x]);
+
+               } catch (...) {
+                  lock_guard<mutex> lock(errorMutex);
+                  if (error == nullptr) {
+                     error = current_exception();
+                  }
+                  failed = true;
+                  cancelled = true;
+               }
+
+               numDecoded ++;
+            }
+         }
+
+         void join() {
+            for (auto& worker : workers) {
+               if (worker.joinable()) {
+                  worker.join();
+               }
+            }
+         }
+
+         void rethrow() {
+            try {
+               rethrow_exception(error);
+
+            } catch (const exception& e) {
+               throw ResourceException(tfm::format("Failed to load resource file '%s': %s",
+                  filename, e.what()));
+            }
+         }
+
+         ResourceManager& rm;
+         string filename;
+         Settings settings;
+         ImageBatch batch;
+         vector<shared_ptr<DecodedImage>> decodedImages;
+         vector<thread> workers;
+
+         atomic<size_t> nextImage {0};
+         atomic<size_t> numDecoded {0};
+         atomic<bool> cancelled {false};
+         atomic<bool> failed {false};
+         mutex errorMutex;
+         exception_ptr error;
+
+         ProgressCallback progressCallback;
+         size_t reportedDone = 0;
+         bool complete = false;
+      };
+
+      ResourceManager(shared_ptr<Timer<uint64_t>> timer,
                       shared_ptr<ImageLoader> imageLoader) :
          timer(timer), imageLoader(imageLoader) { }
 
@@ -64,22 +328,198 @@ namespace lost_levels {
          }
       }
 
+      /**
+       * Load the images, animations, and block maps in the bundle file
+       * at the given location, see Bundle.  Atlas pages are uploaded
+       * directly from the mapped file, and block maps refer to their
+       * cells in it, so nothing is parsed or decoded.
+       *
+       * This method can throw ResourceException if the bundle can't be
+       * opened or its images can't be created.
+       */
+      void load_bundle(const string& filename) {
+         try {
+            load_bundle(*Bundle::open(filename));
+
+         } catch (const exception& e) {
+            throw ResourceException(tfm::format("Failed to load bundle '%s': %s",
+               filename, e.what()));
+         }
+      }
+
+      void load_bundle(const Bundle& bundle) {
+         const vector<Bundle::Page>& pages = bundle.get_pages();
+         vector<vector<const Bundle::ImageEntry*>> pageEntries(pages.size());
+
+         for (auto& entry : bundle.get_images()) {
+            pageEntries[entry.page].push_back(&entry);
+         }
+
+         for (size_t page = 0; page < pages.size(); page++) {
+            vector<Rect<int>> rects;
+            for (auto entry : pageEntries[page]) {
+               rects.push_back(entry->rect);
+            }
+
+            if (rects.empty()) {
+               continue;
+            }
+
+            vector<shared_ptr<Image>> images = imageLoader->create_images(
+               pages[page].size, pages[page].pixels, pages[page].pitch, rects);
+            for (size_t x = 0; x < images.size(); x++) {
+               put(pageEntries[page][x]->name, images[x]);
+            }
+         }
+
+         for (auto& entry : bundle.get_animations()) {
+            put(entry.name, Animation::create(make_shared<AnimationDef>(
+               get<Image>(entry.image), entry.szFrame, entry.frames, entry.looping), timer));
+         }
+
+         for (auto& name : bundle.get_block_map_names()) {
+            put(name, bundle.get_block_map(name));
+         }
+      }
+
+      /**
+       * Begin loading the resource file at the given location in the
+       * background, see AsyncLoad above.
+       *
+       * This method can throw ResourceException if the resource file
+       * itself can't be read.
+       */
+      shared_ptr<AsyncLoad> load_file_async(const string& filename,
+            size_t numThreads = max(1u, thread::hardware_concurrency())) {
+         return make_shared<AsyncLoad>(*this, filename, numThreads);
+      }
+
+      /**
+       * Find the resource with the given name and type.
+       *
+       * This method throws ResourceException if there is no such
+       * resource.
+       */
       template<class T>
-      shared_ptr<T> get(const string& name) const {
-         const string rc_name = rc_format(name, T::RC_TYPE);
-         if (resource_map.find(rc_name) == resource_map.end()) {
+      ResourceHandle<T> resolve(const string& name) const {
+         nameLookups->add();
+         auto iter = resourceIndex.find(ResourceKey(T::RC_TYPE, name));
+         if (iter == resourceIndex.end()) {
             throw ResourceException(tfm::format("No resource found with name '%s'.", name));
          }
 
-         return dynamic_pointer_cast<T>(resource_map.at(rc_name));
+         return ResourceHandle<T>(iter->second);
+      }
+
+      /**
+       * Get the resource for the given handle.
+       *
+       * NOTE:
+       * - The resource is cast statically from the type registered for
+       *   T::RC_TYPE, e.g. Image or Animation.  Use get() by name when
+       *   a specific implementation class, such as sdl2::Image, is
+       *   needed.
+       */
+      template<class T>
+      shared_ptr<T> get(const ResourceHandle<T>& handle) const {
+         if (! handle.is_valid() || handle.index >= (int)resources.size()) {
+            throw ResourceException("Invalid resource handle.");
+         }
+
+         return static_pointer_cast<T>(resources[handle.index]);
+      }
+
+      /**
+       * Get the resource with the given name.  The resource is cast
+       * dynamically, so T may be a specific implementation class such
+       * as sdl2::Image, and nullptr is returned if the resource is not
+       * a T.
+       */
+      template<class T>
+      shared_ptr<T> get(const string& name) const {
+         if (! streamed.empty()) {
+            auto iter = streamed.find(ResourceKey(T::RC_TYPE, name));
+            if (iter != streamed.end()) {
+               nameLookups->add();
+               return dynamic_pointer_cast<T>(iter->second.resource);
+            }
+         }
+
+         return dynamic_pointer_cast<T>(resources[resolve<T>(name).index]);
       }
 
       void put(const string& name, shared_ptr<Resource> resource) {
-         if (resource_map.find(name) != resource_map.end()) {
-            throw ResourceException(tfm::format("A resource is already defined with name '%s'.", name));
+         ResourceKey key = ResourceKey(resource->get_type(), name);
+         if (resourceIndex.find(key) != resourceIndex.end() ||
+             streamed.find(key) != streamed.end()) {
+            throw ResourceException(tfm::format("A resource is already defined with name '%s'.",
+               rc_format(name, resource->get_type())));
+         }
+
+         resourceIndex[key] = resources.size();
+         resources.push_back(resource);
+         resourcesLoaded->add();
+      }
+
+      /**
+       * Add a resource which may later be removed with evict(), such as
+       * a region of a StreamingWorld.  Streamed resources are found by
+       * get() by name, but can't be resolved to handles, as handles are
+       * never invalidated.
+       *
+       * @param bytes The memory held by the resource, counted in
+       *    get_streamed_bytes() while it is resident.
+       */
+      void put_streamed(const string& name, shared_ptr<Resource> resource, size_t bytes = 0) {
+         ResourceKey key = ResourceKey(resource->get_type(), name);
+         if (resourceIndex.find(key) != resourceIndex.end() ||
+             streamed.find(key) != streamed.end()) {
+            throw ResourceException(tfm::format("A resource is already defined with name '%s'.",
+               rc_format(name, resource->get_type())));
+         }
+
+         streamed[key] = StreamedResource {resource, bytes};
+         streamedBytes += bytes;
+         resourcesLoaded->add();
+      }
+
+      /**
+       * Remove a resource added with put_streamed().  Users holding the
+       * resource keep it alive until they release it.
+       *
+       * @return false if there is no such streamed resource.
+       */
+      bool evict(const string& name, Resource::Type rcType) {
+         auto iter = streamed.find(ResourceKey(rcType, name));
+         if (iter == streamed.end()) {
+            return false;
          }
 
-         resource_map[rc_format(name, resource->get_type())] = resource;
+         streamedBytes -= iter->second.bytes;
+         streamed.erase(iter);
+         return true;
+      }
+
+      /**
+       * @return true if a resource with the given name and type is
+       *    loaded, whether or not it was streamed.
+       */
+      template<class T>
+      bool is_resident(const string& name) const {
+         ResourceKey key = ResourceKey(T::RC_TYPE, name);
+         return resourceIndex.find(key) != resourceIndex.end() ||
+                streamed.find(key) != streamed.end();
+      }
+
+      size_t get_num_streamed() const {
+         return streamed.size();
+      }
+
+      /**
+       * @return The total bytes of the resident streamed resources.
+       */
+      size_t get_streamed_bytes() const {
+         return streamedBytes;
       }
 
    protected:
@@ -92,12 +532,51 @@ namespace lost_levels {
          load_file(includePath.string());
       }
 
+      ImageBatch collect_image_objects(const fs::Path& baseIn,
+                                       const vector<Settings>& obj_array) const {
+         fs::Path base = baseIn;
+         ImageBatch batch;
+
+         for (Settings obj : obj_array) {
+            batch.names.push_back(obj.get<string>("name"));
+            batch.filenames.push_back(base.relative(obj.get<string>("file")).string());
+            batch.atlas.push_back(obj.get_default<bool>("atlas", true));
+         }
+
+         return batch;
+      }
+
+      void upload_image_batch(const ImageBatch& batch,
+                              const vector<shared_ptr<DecodedImage>>& decodedImages) {
+         vector<shared_ptr<DecodedImage>> packed;
+         vector<string> packedNames;
+
+         for (size_t x = 0; x < decodedImages.size(); x++) {
+            if (batch.atlas[x]) {
+               packed.push_back(decodedImages[x]);
+               packedNames.push_back(batch.names[x]);
+
+            } else {
+               put(batch.names[x], imageLoader->upload_images({decodedImages[x]})[0]);
+            }
+         }
+
+         vector<shared_ptr<Image>> images = imageLoader->upload_images(packed);
+         for (size_t x = 0; x < images.size(); x++) {
+            put(packedNames[x], images[x]);
+         }
+      }
+
       void load_image_object_array(const fs::Path& base,
                                    const vector<Settings>& obj_array) {
+         ImageBatch batch = collect_image_objects(base, obj_array);
+         vector<shared_ptr<DecodedImage>> decodedImages;
 
-         for (Settings obj : obj_array) {
-            load_image_object(base, obj);
+         for (auto filename : batch.filenames) {
+            decodedImages.push_back(imageLoader->decode_image(filename));
          }
+
+         upload_image_batch(batch, decodedImages);
       }
 
       void load_image_object(const fs::Path& baseIn,
@@ -133,9 +612,28 @@ namespace lost_levels {
       }
 
    private:
-      shared_ptr<const Timer<unsigned int>> timer;
+      shared_ptr<const Timer<uint64_t>> timer;
       shared_ptr<ImageLoader> imageLoader;
 
-      map<string, shared_ptr<Resource>> resource_map;
+      typedef pair<Resource::Type, string> ResourceKey;
+
+      struct ResourceKeyHash {
+         size_t operator()(const ResourceKey& key) const {
+            return hash<string>()(key.second) * 31 + (size_t)key.first;
+         }
+      };
+
+      struct StreamedResource {
+         shared_ptr<Resource> resource;
+         size_t bytes;
+      };
+
+      vector<shared_ptr<Resource>> resources;
+      unordered_map<ResourceKey, int, ResourceKeyHash> resourceIndex;
+      unordered_map<ResourceKey, StreamedResource, ResourceKeyHash> streamed;
+      size_t streamedBytes = 0;
+
+      Counter* resourcesLoaded = &Metrics::global().counter("resources.loaded");
+      Counter* nameLookups = &Metrics::global().counter("resources.name_lookups");
    };
 }
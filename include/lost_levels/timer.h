@@ -9,6 +9,8 @@
 #pragma once
 #include <memory>
 #include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <functional>
 
 namespace lost_levels {
@@ -17,13 +19,70 @@ namespace lost_levels {
    template<class T>
    class RelativeTimer;
 
-   template <class T>
-   class Timer : public enable_shared_from_this<Timer<T>> {
+   /**
+    * SteadyClock <clock policy>
+    *
+    * A Timer clock reading std::chrono::steady_clock in units of the
+    * given duration, microseconds by default.
+    */
+   template<class Duration = chrono::microseconds>
+   struct SteadyClock {
+      typedef typename Duration::rep rep;
+
+      rep operator()() const {
+         return chrono::duration_cast<Duration>(
+            chrono::steady_clock::now().time_since_epoch()).count();
+      }
+
+      /**
+       * @return The number of clock ticks in one second.
+       */
+      static rep per_second() {
+         return chrono::duration_cast<Duration>(chrono::seconds(1)).count();
+      }
+   };
+
+   /**
+    * FrameClock <clock policy>
+    *
+    * A Timer clock counting the frames of another timer, for timers
+    * which fire every N physics or graphics frames.
+    */
+   template<class RefTimer>
+   struct FrameClock {
+      FrameClock(shared_ptr<const RefTimer> referenceTimer) :
+         referenceTimer(referenceTimer) { }
+
+      auto operator()() const -> decltype(declval<RefTimer>().get_frames()) {
+         return referenceTimer->get_frames();
+      }
+
+      shared_ptr<const RefTimer> referenceTimer;
+   };
+
+   /**
+    * Timer <concrete class>
+    *
+    * Fires once per interval of the given clock, optionally
+    * accumulating error so that the average rate is preserved.
+    *
+    * The clock is any callable type returning the current time as a T.
+    * By default it is a function<T(void)> chosen at runtime.  Supply a
+    * clock policy type such as SteadyClock or sdl2::PerformanceClock to
+    * resolve the clock at compile time, so that update() makes no
+    * indirect calls.
+    *
+    *    // A 144Hz timer with microsecond precision.
+    *    auto timer = Timer<uint64_t, SteadyClock<>>::create(
+    *       SteadyClock<>(), SteadyClock<>::per_second() / 144);
+    */
+   template <class T, class Clock = function<T(void)>>
+   class Timer : public enable_shared_from_this<Timer<T, Clock>> {
    public:
       typedef function<T(void)> TimeFunction;
-      static shared_ptr<Timer<T>> create(TimeFunction getTime, T interval,
+      static shared_ptr<Timer<T, Clock>> create(Clock getTime, T interval,
             bool accumulate = false) {
-         return shared_ptr<Timer<T>>(new Timer<T>(getTime, interval, accumulate));
+         return shared_ptr<Timer<T, Clock>>(new Timer<T, Clock>(getTime, interval, accumulate));
       }
 
       virtual ~Timer() { }
@@ -36,14 +95,18 @@ namespace lost_levels {
          return t1;
       }
 
+      /**
+       * @return The time until the timer is next due to fire, taking
+       *    any accumulated error into account, or 0 if it is due now.
+       */
       T get_wait_time() const {
          T tnow = getTime();
 
-         if (tnow < t0 || tnow >= t0 + interval) {
+         if (tnow < t0 || tnow >= t2) {
             return 0;
 
          } else {
-            return t0 + interval - tnow;
+            return t2 - tnow;
          }
       }
 
@@ -53,8 +116,8 @@ namespace lost_levels {
             this->shared_from_this(), frameInterval, accumulate);
       }
 
-      virtual shared_ptr<Timer<T>> copy() const {
-         return shared_ptr<Timer<T>>(new Timer(*this));
+      virtual shared_ptr<Timer<T, Clock>> copy() const {
+         return shared_ptr<Timer<T, Clock>>(new Timer(*this));
       }
 
       void pause() {
@@ -68,11 +131,70 @@ namespace lost_levels {
          frames = 0;
       }
 
+      /**
+       * Drop any backlog of missed intervals without resetting the
+       * frame count, so that the next interval starts now.  Use this
+       * after a stall when the missed frames should not be caught up.
+       *
+       * @return The number of whole intervals which were due.
+       */
+      T resync() {
+         T tnow = getTime();
+         T due = 0;
+
+         if (interval > 0 && tnow >= t0) {
+            due = (tnow - t0 + tacc) / interval;
+         }
+
+         t0 = tnow;
+         t1 = t0;
+         t2 = t0 + interval;
+         tacc = 0;
+         return due;
+      }
+
+      /**
+       * @return How far the timer is from its last firing to its next
+       *    one, from 0 to 1.  Use this to interpolate between the two
+       *    most recent physics states when rendering.
+       */
+      double get_alpha() const {
+         if (interval == 0) {
+            return 0.0;
+         }
+
+         T tnow = getTime();
+         T remaining = (tnow < t2) ? t2 - tnow : 0;
+         return 1.0 - min(1.0, (double)remaining / interval);
+      }
+
       void set_interval(const T& newInterval) {
          interval = newInterval;
          reset();
       }
 
+      T get_interval() const {
+         return interval;
+      }
+
+      /**
+       * Replace the clock the timer reads, e.g. with a synthetic clock
+       * to replay a recorded session.  The timer is reset, as times
+       * from the old and new clocks can't be compared.
+       */
+      void set_clock(Clock getTime) {
+         this->getTime = getTime;
+         reset();
+      }
+
+      /**
+       * @return true if the timer counts the frames of another timer,
+       *    see relative_timer(), rather than reading a clock.
+       */
+      virtual bool is_relative() const {
+         return false;
+      }
+
       void start() {
          T tnow = getTime();
          T tdiff = t1 - t0;
@@ -139,10 +261,11 @@ namespace lost_levels {
       }
 
    protected:
-      Timer(TimeFunction getTime, T interval, bool accumulate = false) :
+      Timer(Clock getTime, T interval, bool accumulate = false) :
          getTime(getTime), interval(interval), accumulate(accumulate) {
          t0 = 0;
          t1 = 0;
+         t2 = 0;
          tacc = 0;
          frames = 0;
          paused = true;
@@ -151,18 +274,21 @@ namespace lost_levels {
    private:
       bool paused, accumulate;
       T t0, t1, t2, tacc, interval, frames;
-      TimeFunction getTime;
+      Clock getTime;
    };
 
    template<class T>
    class RelativeTimer : public Timer<T> {
    public:
-      RelativeTimer(const shared_ptr<const Timer<T>>& referenceTimer, T interval, bool accumulate = false) :
-         Timer<T>([referenceTimer]() -> T {
-                     return referenceTimer->get_frames();
-                  }, interval, accumulate) { }
+      template<class RefTimer>
+      RelativeTimer(const shared_ptr<const RefTimer>& referenceTimer, T interval, bool accumulate = false) :
+         Timer<T>(FrameClock<RefTimer>(referenceTimer), interval, accumulate) { }
       virtual ~RelativeTimer() { }
 
+      bool is_relative() const override {
+         return true;
+      }
+
       shared_ptr<Timer<T>> copy() const override {
          return shared_ptr<Timer<T>>(new RelativeTimer(*this));
       }
@@ -15,12 +15,50 @@ namespace lost_levels {
    namespace sdl2 {
       using namespace std;
 
+      /**
+       * PerformanceClock <clock policy>
+       *
+       * A Timer clock reading SDL_GetPerformanceCounter() in
+       * microseconds, for sub-millisecond frame timing.
+       */
+      struct PerformanceClock {
+         typedef uint64_t rep;
+
+         PerformanceClock() : frequency(SDL_GetPerformanceFrequency()) { }
+
+         rep operator()() const {
+            uint64_t counter = SDL_GetPerformanceCounter();
+            return (counter / frequency) * 1000000 +
+               (counter % frequency) * 1000000 / frequency;
+         }
+
+         static rep per_second() {
+            return 1000000;
+         }
+
+         uint64_t frequency;
+      };
+
+      typedef Timer<uint64_t, PerformanceClock> PerformanceTimer;
+
+      /**
+       * Create a timer on the performance counter, for use as an
+       * EngineTimer.  Use PerformanceTimer::create() instead to resolve
+       * the clock at compile time.
+       *
+       * @param interval The timer interval in microseconds.
+       */
+      inline shared_ptr<Timer<uint64_t>> create_performance_timer(
+            uint64_t interval, bool accumulate = false) {
+         return Timer<uint64_t>::create(PerformanceClock(), interval, accumulate);
+      }
+
       inline shared_ptr<Timer<uint32_t>> create_timer(uint32_t interval, bool accumulate = false) {
          return Timer<uint32_t>::create(SDL_GetTicks, interval, accumulate);
       }
 
-      inline shared_ptr<FrameCalculator<uint32_t>> create_frame_calculator(shared_ptr<const Timer<uint32_t>> timer) {
-         return make_shared<FrameCalculator<uint32_t>>(create_timer(1000), timer);
+      inline shared_ptr<FrameCalculator<uint64_t>> create_frame_calculator(shared_ptr<const Timer<uint64_t>> timer) {
+         return make_shared<FrameCalculator<uint64_t>>(create_performance_timer(1000000), timer);
       }
    }
 }
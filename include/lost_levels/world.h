@@ -0,0 +1,596 @@
+/*
+ * world: Large levels streamed in regions around the camera.
+ *
+ * Author: Lain Supe (lainproliant)
+ * Date: Wednesday, Oct 14 2026
+ */
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "lain/exception.h"
+#include "tinyformat/tinyformat.h"
+#include "lost_levels/bundle.h"
+#include "lost_levels/level.h"
+#include "lost_levels/metrics.h"
+#include "lost_levels/resources.h"
+
+namespace lost_levels {
+   using namespace std;
+   using namespace lain;
+
+   class WorldException : public Exception {
+      using Exception::Exception;
+   };
+
+   /**
+    * @return The resource name of the given region, e.g. "region:3,4".
+    */
+   inline string region_name(const string& prefix, const Point<int>& region) {
+      return tfm::format("%s%d,%d", prefix, region.x, region.y);
+   }
+
+   /**
+    * RegionSource <abstract class>
+    *
+    * Provides the BlockMap of each region of a StreamingWorld.
+    */
+   class RegionSource {
+   public:
+      virtual ~RegionSource() { }
+
+      /**
+       * Load the given region.  This is called from the world's loader
+       * thread, so it must not touch the renderer or unsynchronized
+       * game state.
+       *
+       * @return The region's map, or nullptr if the region is empty.
+       */
+      virtual shared_ptr<BlockMap> load_region(const Point<int>& region) const = 0;
+   };
+
+   /**
+    * BundleRegionSource <concrete class>
+    *
+    * Loads regions from the block maps in a Bundle named with
+    * region_name(), e.g. "region:3,4".  Regions with no block map are
+    * empty.  The maps refer to their cells in the mapped file, so
+    * loading a region only faults in its pages, which is done on the
+    * loader thread rather than by the first frame to touch them.
+    */
+   class BundleRegionSource : public RegionSource {
+   public:
+      BundleRegionSource(shared_ptr<const Bundle> bundle, const string& prefix = "region:") :
+         bundle(bundle), prefix(prefix) { }
+
+      shared_ptr<BlockMap> load_region(const Point<int>& region) const override {
+         string name = region_name(prefix, region);
+         if (! bundle->has_block_map(name)) {
+            return nullptr;
+         }
+
+         shared_ptr<BlockMap> blockMap = bundle->get_block_map(name);
+         prefault(*blockMap);
+         return blockMap;
+      }
+
+   private:
+      enum { PAGE_SIZE = 4096 };
+
+      static void prefault(const BlockMap& blockMap) {
+         const volatile uint8_t* bytes = (const volatile uint8_t*)blockMap.get_cells();
+         size_t size = blockMap.get_num_cells() * sizeof(BlockId);
+         uint8_t sum = 0;
+
+         for (size_t x = 0; x < size; x += PAGE_SIZE) {
+            sum += bytes[x];
+         }
+
+         (void)sum;
+      }
+
+      shared_ptr<const Bundle> bundle;
+      string prefix;
+   };
+
+   /**
+    * StreamingWorld <concrete class>
+    *
+    * A level too large to keep in memory, divided into a grid of
+    * equally sized regions, each a BlockMap.  Regions near the camera
+    * are loaded in the background, and regions away from it are
+    * evicted once the resident regions exceed a memory budget.
+    *
+    * USAGE:
+    * - Call update() once per frame with the camera's view rectangle.
+    *   Regions within the preload margin of the view are requested in
+    *   order of distance from its center, and regions which finished
+    *   loading become resident.  Call wait() to block until every
+    *   requested region is resident, e.g. behind a loading screen.
+    * - Query blocks in world coordinates with get_id(), visit_solid()
+    *   and get_solid_rects().  Only resident regions are visited, so
+    *   unloaded regions cost nothing, and read as block id 0.
+    * - Use set_load_callback() and set_evict_callback() to add and
+    *   remove what belongs to a region elsewhere, e.g. its entities in
+    *   a CollisionTree or BroadPhase, or a BlockMapRenderer for it.
+    *   Draw regions with visit_resident().
+    * - Call track_residency() so that resident regions are available
+    *   by name from a ResourceManager.
+    *
+    * NOTE:
+    * - Regions wanted by the current view are never evicted, so the
+    *   budget must at least cover the regions in view and the margin.
+    * - Callbacks are invoked from update() and wait(), on the calling
+    *   thread.
+    */
+   class StreamingWorld {
+   public:
+      struct Region {
+         Point<int> index;
+         Rect<int> rect;
+         shared_ptr<BlockMap> blockMap;
+         size_t bytes;
+      };
+
+      typedef function<void(const Region&)> RegionCallback;
+
+      /**
+       * @param numRegions The size of the world in regions.
+       * @param szRegion The size of each region in cells.
+       * @param szBlock The size of each cell in world coordinates.
+       */
+      StreamingWorld(shared_ptr<RegionSource> source, const Size<int>& numRegions,
+                     const Size<int>& szRegion, const Size<int>& szBlock) :
+         source(source), numRegions(numRegions), szRegion(szRegion), szBlock(szBlock),
+         preloadMargin(max(szRegion.width * szBlock.width, szRegion.height * szBlock.height)),
+         regionsLoaded(Metrics::global().counter("world.regions_loaded")),
+         regionsEvicted(Metrics::global().counter("world.regions_evicted")) {
+
+         loader = thread(&StreamingWorld::loader_main, this);
+      }
+
+      ~StreamingWorld() {
+         {
+            lock_guard<mutex> lock(loaderMutex);
+            quit = true;
+         }
+         loaderCv.notify_all();
+         loader.join();
+      }
+
+      StreamingWorld(const StreamingWorld&) = delete;
+      StreamingWorld& operator=(const StreamingWorld&) = delete;
+
+      /**
+       * Set the bytes of block data to keep resident.  Defaults to
+       * 16MiB.
+       */
+      void set_memory_budget(size_t bytes) {
+         memoryBudget = bytes;
+      }
+
+      size_t get_memory_budget() const {
+         return memoryBudget;
+      }
+
+      /**
+       * Set how far beyond the view, in world coordinates, regions are
+       * requested.  Defaults to one region.
+       */
+      void set_preload_margin(int margin) {
+         preloadMargin = margin;
+      }
+
+      void set_load_callback(RegionCallback callback) {
+         loadCallback = callback;
+      }
+
+      void set_evict_callback(RegionCallback callback) {
+         evictCallback = callback;
+      }
+
+      /**
+       * Add each non-empty region to the given ResourceManager as a
+       * streamed BlockMap named with region_name() while it is
+       * resident.
+       */
+      void track_residency(ResourceManager& rm, const string& prefix = "region:") {
+         this->rm = &rm;
+         rmPrefix = prefix;
+      }
+
+      /**
+       * Request the regions around the given view, make loaded regions
+       * resident, and evict regions over the memory budget.
+       *
+       * @throws WorldException if a region failed to load.
+       */
+      void update(const Rect<int>& view) {
+         frame ++;
+         integrate_loads();
+
+         Rect<int> range = get_region_range(Rect<int>(
+            view.pt.x - preloadMargin, view.pt.y - preloadMargin,
+            view.sz.width + preloadMargin * 2, view.sz.height + preloadMargin * 2));
+         Point<int> center = get_region_index(Point<int>(
+            view.pt.x + view.sz.width / 2, view.pt.y + view.sz.height / 2));
+         vector<Point<int>> toLoad;
+
+         for (int y = range.pt.y; y < range.pt.y + range.sz.height; y++) {
+            for (int x = range.pt.x; x < range.pt.x + range.sz.width; x++) {
+               int key = region_key(Point<int>(x, y));
+               auto iter = resident.find(key);
+
+               if (iter != resident.end()) {
+                  iter->second.wantedFrame = frame;
+
+               } else if (pending.find(key) != pending.end()) {
+                  pending[key] = frame;
+
+               } else {
+                  toLoad.push_back(Point<int>(x, y));
+               }
+            }
+         }
+
+         stable_sort(toLoad.begin(), toLoad.end(), [&](const Point<int>& a, const Point<int>& b) {
+            return distance(a, center) < distance(b, center);
+         });
+
+         {
+            lock_guard<mutex> lock(loaderMutex);
+
+            // Drop queued requests the view has moved away from.
+            requests.erase(remove_if(requests.begin(), requests.end(), [&](const Point<int>& region) {
+               auto iter = pending.find(region_key(region));
+               if (iter->second != frame) {
+                  pending.erase(iter);
+                  return true;
+               }
+               return false;
+            }), requests.end());
+
+            for (auto& region : toLoad) {
+               requests.push_back(region);
+               pending[region_key(region)] = frame;
+            }
+         }
+         loaderCv.notify_all();
+
+         evict_over_budget();
+      }
+
+      /**
+       * Block until every requested region has loaded, then make them
+       * resident.
+       *
+       * @throws WorldException if a region failed to load.
+       */
+      void wait() {
+         {
+            unique_lock<mutex> lock(loaderMutex);
+            idleCv.wait(lock, [this]() { return requests.empty() && ! busy; });
+         }
+
+         integrate_loads();
+         evict_over_budget();
+      }
+
+      const Size<int>& get_num_regions() const {
+         return numRegions;
+      }
+
+      /**
+       * @return The size of each region in world coordinates.
+       */
+      Size<int> get_region_size() const {
+         return Size<int>(szRegion.width * szBlock.width, szRegion.height * szBlock.height);
+      }
+
+      /**
+       * @return The index of the region holding the given point in
+       *    world coordinates, which may be outside of the world.
+       */
+      Point<int> get_region_index(const Point<int>& pt) const {
+         Size<int> sz = get_region_size();
+         return Point<int>(floor_div(pt.x, sz.width), floor_div(pt.y, sz.height));
+      }
+
+      Rect<int> get_region_rect(const Point<int>& region) const {
+         Size<int> sz = get_region_size();
+         return Rect<int>(region.x * sz.width, region.y * sz.height, sz.width, sz.height);
+      }
+
+      bool is_resident(const Point<int>& region) const {
+         return contains_region(region) && resident.find(region_key(region)) != resident.end();
+      }
+
+      /**
+       * @return The given region, or nullptr if it is not resident.
+       */
+      const Region* get_region(const Point<int>& region) const {
+         if (! contains_region(region)) {
+            return nullptr;
+         }
+
+         auto iter = resident.find(region_key(region));
+         return iter == resident.end() ? nullptr : &iter->second.region;
+      }
+
+      /**
+       * @return The block id of the given cell of the world, or 0 if its
+       *    region is empty or not resident.
+       */
+      BlockId get_id(const Point<int>& cell) const {
+         Point<int> index(floor_div(cell.x, szRegion.width), floor_div(cell.y, szRegion.height));
+         const Region* region = get_region(index);
+
+         if (region == nullptr || region->blockMap == nullptr) {
+            return 0;
+         }
+
+         return region->blockMap->get_id(Point<int>(cell.x - index.x * szRegion.width,
+                                                    cell.y - index.y * szRegion.height));
+      }
+
+      /**
+       * Invoke visitor(const Region& region) for each resident,
+       * non-empty region overlapping the given world rectangle.
+       */
+      template<class F>
+      void visit_resident(const Rect<int>& rect, F visitor) const {
+         Rect<int> range = get_region_range(rect);
+
+         for (int y = range.pt.y; y < range.pt.y + range.sz.height; y++) {
+            for (int x = range.pt.x; x < range.pt.x + range.sz.width; x++) {
+               const Region* region = get_region(Point<int>(x, y));
+               if (region != nullptr && region->blockMap != nullptr) {
+                  visitor(*region);
+               }
+            }
+         }
+      }
+
+      /**
+       * Invoke visitor(const Rect<float>& blockRect, BlockId id) with the
+       * world rectangle of each solid cell of a resident region touched
+       * by the given world rectangle.
+       */
+      template<class F>
+      void visit_solid(const Rect<float>& rect, F visitor) const {
+         Rect<int> bounds((int)floor(rect.pt.x), (int)floor(rect.pt.y),
+                          (int)ceil(rect.sz.width) + 1, (int)ceil(rect.sz.height) + 1);
+
+         visit_resident(bounds, [&](const Region& region) {
+            Vector<float> origin(region.rect.pt.x, region.rect.pt.y);
+            const BlockMap& blockMap = *region.blockMap;
+
+            blockMap.visit_solid(rect.translate(Vector<float>(-origin.vx, -origin.vy)), [&](const Point<int>& pt, BlockId id) {
+               visitor(blockMap.get_block_rect(pt).translate(origin), id);
+            });
+         });
+      }
+
+      /**
+       * Append the world rectangle of each solid cell touched by the
+       * given rectangle to results, which is not cleared.
+       */
+      void get_solid_rects(const Rect<float>& rect, vector<Rect<float>>& results) const {
+         visit_solid(rect, [&](const Rect<float>& blockRect, BlockId id) {
+            results.push_back(blockRect);
+         });
+      }
+
+      size_t get_num_resident() const {
+         return resident.size();
+      }
+
+      /**
+       * @return The number of regions requested but not yet resident.
+       */
+      size_t get_num_pending() const {
+         return pending.size();
+      }
+
+      /**
+       * @return The bytes of block data held by resident regions.
+       */
+      size_t get_resident_bytes() const {
+         return residentBytes;
+      }
+
+   private:
+      struct ResidentRegion {
+         Region region;
+         uint64_t wantedFrame;
+      };
+
+      struct Load {
+         Point<int> index;
+         shared_ptr<BlockMap> blockMap;
+         string error;
+      };
+
+      static int floor_div(int a, int b) {
+         return a >= 0 ? a / b : -((-a + b - 1) / b);
+      }
+
+      static int distance(const Point<int>& a, const Point<int>& b) {
+         return abs(a.x - b.x) + abs(a.y - b.y);
+      }
+
+      bool contains_region(const Point<int>& region) const {
+         return region.x >= 0 && region.y >= 0 &&
+                region.x < numRegions.width && region.y < numRegions.height;
+      }
+
+      int region_key(const Point<int>& region) const {
+         return region.y * numRegions.width + region.x;
+      }
+
+      /**
+       * @return The regions overlapping the given world rectangle,
+       *    clipped to the world.
+       */
+      Rect<int> get_region_range(const Rect<int>& rect) const {
+         Point<int> first = get_region_index(rect.pt);
+         Point<int> last = get_region_index(Point<int>(rect.pt.x + rect.sz.width - 1,
+                                                       rect.pt.y + rect.sz.height - 1));
+         int x0 = max(0, first.x), y0 = max(0, first.y),
+             x1 = min(numRegions.width - 1, last.x), y1 = min(numRegions.height - 1, last.y);
+
+         return Rect<int>(x0, y0, max(0, x1 - x0 + 1), max(0, y1 - y0 + 1));
+      }
+
+      /**
+       * Make the completed loads resident.  Every load is integrated
+       * before the first failure is thrown, so that one bad region
+       * doesn't strand the others in the pending set.
+       */
+      void integrate_loads() {
+         vector<Load> loads;
+         string error;
+         {
+            lock_guard<mutex> lock(loaderMutex);
+            loads.swap(completed);
+         }
+
+         for (auto& load : loads) {
+            int key = region_key(load.index);
+            uint64_t wantedFrame = pending[key];
+            pending.erase(key);
+
+            if (! load.error.empty()) {
+               if (error.empty()) {
+                  error = tfm::format("Failed to load region %d,%d: %s",
+                     load.index.x, load.index.y, load.error);
+               }
+               continue;
+            }
+
+            Region region {load.index, get_region_rect(load.index), load.blockMap,
+               load.blockMap == nullptr ? 0 : load.blockMap->get_num_cells() * sizeof(BlockId)};
+
+            resident[key] = ResidentRegion {region, wantedFrame};
+            residentBytes += region.bytes;
+            regionsLoaded.add();
+
+            if (rm != nullptr && region.blockMap != nullptr) {
+               rm->put_streamed(region_name(rmPrefix, region.index), region.blockMap, region.bytes);
+            }
+
+            if (loadCallback) {
+               loadCallback(region);
+            }
+         }
+
+         if (! error.empty()) {
+            throw WorldException(error);
+         }
+      }
+
+      /**
+       * Evict the regions wanted least recently until the resident
+       * regions fit in the budget, sparing those wanted this frame.
+       */
+      void evict_over_budget() {
+         while (residentBytes > memoryBudget) {
+            auto victim = resident.end();
+
+            for (auto iter = resident.begin(); iter != resident.end(); iter++) {
+               if (iter->second.wantedFrame < frame &&
+                   (victim == resident.end() || iter->second.wantedFrame < victim->second.wantedFrame)) {
+                  victim = iter;
+               }
+            }
+
+            if (victim == resident.end()) {
+               break;
+            }
+
+            Region region = victim->second.region;
+            resident.erase(victim);
+            residentBytes -= region.bytes;
+            regionsEvicted.add();
+
+            if (rm != nullptr && region.blockMap != nullptr) {
+               rm->evict(region_name(rmPrefix, region.index), Resource::Type::BLOCK_MAP);
+            }
+
+            if (evictCallback) {
+               evictCallback(region);
+            }
+         }
+      }
+
+      void loader_main() {
+         unique_lock<mutex> lock(loaderMutex);
+
+         for (;;) {
+            loaderCv.wait(lock, [this]() { return quit || ! requests.empty(); });
+            if (quit) {
+               return;
+            }
+
+            Load load;
+            load.index = requests.front();
+            requests.pop_front();
+            busy = true;
+            lock.unlock();
+
+            try {
+               load.blockMap = source->load_region(load.index);
+               if (load.blockMap != nullptr &&
+                   (load.blockMap->get_level_size() != szRegion ||
+                    load.blockMap->get_block_size() != szBlock)) {
+                  load.error = "Region map does not match the world's region and block sizes.";
+               }
+
+            } catch (const exception& e) {
+               load.error = e.what();
+            }
+
+            lock.lock();
+            busy = false;
+            completed.push_back(load);
+            idleCv.notify_all();
+         }
+      }
+
+      shared_ptr<RegionSource> source;
+      Size<int> numRegions;
+      Size<int> szRegion;
+      Size<int> szBlock;
+
+      size_t memoryBudget = 16 * 1024 * 1024;
+      int preloadMargin;
+      RegionCallback loadCallback;
+      RegionCallback evictCallback;
+      ResourceManager* rm = nullptr;
+      string rmPrefix;
+
+      uint64_t frame = 0;
+      unordered_map<int, ResidentRegion> resident;
+      unordered_map<int, uint64_t> pending;
+      size_t residentBytes = 0;
+
+      Counter& regionsLoaded;
+      Counter& regionsEvicted;
+
+      thread loader;
+      mutex loaderMutex;
+      condition_variable loaderCv;
+      condition_variable idleCv;
+      deque<Point<int>> requests;
+      vector<Load> completed;
+      bool busy = false;
+      bool quit = false;
+   };
+}
@@ -0,0 +1,203 @@
+#include <cstdio>
+
+#include "lost_levels/bundle.h"
+#include "lost_levels/graphics_null.h"
+#include "lost_levels/resources.h"
+#include "lain/testing.h"
+
+using namespace std;
+using namespace lain;
+using namespace lain::testing;
+using namespace lost_levels;
+
+const char* BUNDLE_FILE = "bundle-test.llb";
+
+/**
+ * An image which remembers the page of pixels it was created from.
+ */
+class PixelImage : public null::Image {
+public:
+   PixelImage(const Rect<int>& rect, const uint8_t* pixels) :
+      null::Image(rect), pixels(pixels) { }
+
+   const uint8_t* pixels;
+};
+
+class PixelImageLoader : public null::ImageLoader {
+public:
+   PixelImageLoader() : null::ImageLoader(Size<int>(16, 16)) { }
+
+   vector<shared_ptr<Image>> create_images(const Size<int>& szPage,
+         const void* pixels, int pitch, const vector<Rect<int>>& rects) const override {
+      vector<shared_ptr<Image>> images;
+      for (auto& rect : rects) {
+         images.push_back(make_shared<PixelImage>(rect, (const uint8_t*)pixels));
+      }
+      return images;
+   }
+};
+
+unsigned int get_time() {
+   return 0;
+}
+
+void write_test_bundle() {
+   auto blockSet = make_shared<BlockDataSet>(vector<BlockData> {
+      BlockData("air", 0), BlockData("stone", 1, true), BlockData("water", 3)});
+   BlockMap blockMap(blockSet, Size<int>(4, 3), Size<int>(16, 16));
+   blockMap.set_id(Point<int>(1, 2), 1);
+   blockMap.set_id(Point<int>(3, 0), 3);
+
+   vector<uint8_t> pixels(32 * 16 * 4);
+   for (size_t x = 0; x < pixels.size(); x++) {
+      pixels[x] = x % 251;
+   }
+
+   BundleWriter writer;
+   writer.add_block_set("blocks", *blockSet);
+   writer.add_block_map("level-1", blockMap, "blocks");
+   int page = writer.add_atlas_page(Size<int>(32, 16), pixels.data(), 32 * 4);
+   writer.add_image("hero", page, Rect<int>(0, 0, 16, 16));
+   writer.add_image("tiles", page, Rect<int>(16, 0, 16, 16));
+   writer.add_animation("hero-walk", "hero", Size<int>(8, 8),
+      {AnimationDef::Frame(0, 5), AnimationDef::Frame(1, 5)}, true);
+   writer.save(BUNDLE_FILE);
+}
+
+int main() {
+   return TestSuite("lost_levels bundle tests")
+      .die_on_signal(SIGSEGV)
+      .test("Bundle-001: Write and open a bundle", [&]()->bool {
+         write_test_bundle();
+         shared_ptr<Bundle> bundle = Bundle::open(BUNDLE_FILE);
+
+         shared_ptr<const BlockDataSet> blockSet = bundle->get_block_set("blocks");
+         assert_true(blockSet->has_block(3));
+         assert_false(blockSet->has_block(2));
+         assert_true(blockSet->is_solid(1));
+         assert_equal(blockSet->get_block(3).name, string("water"));
+
+         shared_ptr<BlockMap> blockMap = bundle->get_block_map("level-1");
+         assert_true(blockMap->get_level_size() == Size<int>(4, 3));
+         assert_true(blockMap->get_block_size() == Size<int>(16, 16));
+         assert_true(blockMap->get_id(Point<int>(1, 2)) == 1);
+         assert_true(blockMap->get_id(Point<int>(3, 0)) == 3);
+         assert_true(blockMap->get_id(Point<int>(0, 0)) == 0);
+         assert_true(blockMap->is_solid(Point<int>(1, 2)));
+
+         const BlockId* cells = blockMap->get_cells();
+         assert_true(cells == bundle->get_block_map("level-1")->get_cells());
+
+         // Writing to a mapped block map copies its cells first.
+         blockMap->set_id(Point<int>(0, 0), 1);
+         assert_true(blockMap->get_cells() != cells);
+         assert_true(blockMap->get_id(Point<int>(0, 0)) == 1);
+         assert_true(bundle->get_block_map("level-1")->get_id(Point<int>(0, 0)) == 0);
+
+         assert_true(bundle->get_pages().size() == 1u);
+         const Bundle::Page& page = bundle->get_pages()[0];
+         assert_true(page.size == Size<int>(32, 16));
+         assert_true(page.pitch == 32 * 4);
+         assert_true(page.pixels[32 * 4 * 15 + 7] == (32 * 4 * 15 + 7) % 251);
+
+         assert_true(bundle->get_images().size() == 2u);
+         assert_equal(bundle->get_images()[1].name, string("tiles"));
+         assert_true(bundle->get_images()[1].rect == Rect<int>(16, 0, 16, 16));
+
+         assert_true(bundle->get_animations().size() == 1u);
+         const Bundle::AnimationEntry& anim = bundle->get_animations()[0];
+         assert_equal(anim.image, string("hero"));
+         assert_true(anim.looping);
+         assert_true(anim.frames.size() == 2u);
+         assert_true(anim.frames[1].tileNum == 1);
+
+         // The block map keeps the file mapped after the bundle is gone.
+         shared_ptr<BlockMap> kept = bundle->get_block_map("level-1");
+         bundle = nullptr;
+         assert_true(kept->get_id(Point<int>(3, 0)) == 3);
+
+         remove(BUNDLE_FILE);
+         return true;
+      })
+      .test("Bundle-002: Reject invalid bundles", [&]()->bool {
+         write_test_bundle();
+
+         vector<char> data;
+         {
+            ifstream in(BUNDLE_FILE, ios::binary);
+            data.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+         }
+
+         auto open_with = [&](const vector<char>& contents)->bool {
+            {
+               ofstream out(BUNDLE_FILE, ios::binary);
+               out.write(contents.data(), contents.size());
+            }
+
+            try {
+               Bundle::open(BUNDLE_FILE);
+            } catch (const BundleException& e) {
+               return false;
+            }
+            return true;
+         };
+
+         assert_true(open_with(data));
+
+         vector<char> badMagic = data;
+         badMagic[0] = 'X';
+         assert_false(open_with(badMagic));
+
+         vector<char> truncated(data.begin(), data.begin() + data.size() / 2);
+         assert_false(open_with(truncated));
+
+         vector<char> badSection = data;
+         bundle_format::Section* sections = (bundle_format::Section*)(
+            badSection.data() + ((bundle_format::Header*)badSection.data())->sectionTableOffset);
+         sections[0].size = data.size();
+         assert_false(open_with(badSection));
+
+         bool thrown = false;
+         try {
+            Bundle::open("no-such-bundle.llb");
+         } catch (const BundleException& e) {
+            thrown = true;
+         }
+         assert_true(thrown);
+
+         remove(BUNDLE_FILE);
+         return true;
+      })
+      .test("Bundle-003: Load a bundle into a ResourceManager", [&]()->bool {
+         write_test_bundle();
+         ResourceManager rm(Timer<uint64_t>::create(get_time, 1),
+                            make_shared<PixelImageLoader>());
+         rm.load_bundle(BUNDLE_FILE);
+
+         auto hero = rm.get<Image>("hero");
+         auto tiles = rm.get<Image>("tiles");
+         assert_true(tiles->get_rect() == Rect<int>(16, 0, 16, 16));
+         assert_true(static_pointer_cast<PixelImage>(hero)->pixels ==
+                     static_pointer_cast<PixelImage>(tiles)->pixels);
+
+         auto anim = rm.get<Animation>("hero-walk");
+         assert_true(anim->get_def()->get_image() == hero);
+
+         auto blockMap = rm.get<BlockMap>("level-1");
+         assert_true(blockMap->get_id(Point<int>(1, 2)) == 1);
+
+         bool thrown = false;
+         try {
+            ResourceManager rm2(Timer<uint64_t>::create(get_time, 1),
+                                make_shared<PixelImageLoader>());
+            rm2.load_bundle("no-such-bundle.llb");
+         } catch (const ResourceException& e) {
+            thrown = true;
+         }
+         assert_true(thrown);
+
+         remove(BUNDLE_FILE);
+         return true;
+      })
+      .run();
+}
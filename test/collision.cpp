@@ -0,0 +1,337 @@
+#include <cstdlib>
+
+#include "lost_levels/broadphase.h"
+#include "lost_levels/collision.h"
+#include "lain/testing.h"
+
+using namespace std;
+using namespace lain;
+using namespace lain::testing;
+using namespace lost_levels;
+
+typedef CollisionTree<float, int> IntTree;
+
+bool contains_id(const vector<IntTree::Entry>& entries, int id) {
+   for (auto entry : entries) {
+      if (entry.first == id) {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+int count_nodes(const IntTree& tree) {
+   int count = 0;
+   tree.visit_nodes([&](const Rect<float>& rect, int level) {
+      count ++;
+   });
+   return count;
+}
+
+vector<pair<int, int>> brute_force_pairs(const vector<Rect<float>>& rects) {
+   vector<pair<int, int>> pairs;
+
+   for (size_t x = 0; x < rects.size(); x++) {
+      for (size_t y = x + 1; y < rects.size(); y++) {
+         if (rects[x].intersects(rects[y])) {
+            pairs.push_back(pair<int, int>(x, y));
+         }
+      }
+   }
+
+   return pairs;
+}
+
+bool broad_phase_test(BroadPhase<float>& broadPhase, vector<Rect<float>>& rects) {
+   vector<pair<int, int>> pairs;
+
+   for (int frame = 0; frame < 3; frame++) {
+      for (size_t x = 0; x < rects.size(); x++) {
+         rects[x] = rects[x].translate(Vector<float>(rand() % 21 - 10, rand() % 21 - 10));
+         broadPhase.set(x, rects[x]);
+      }
+
+      broadPhase.find_pairs(pairs);
+      sort(pairs.begin(), pairs.end());
+
+      auto expected = brute_force_pairs(rects);
+      cout << "Frame " << frame << ": " << pairs.size() << " pairs, expected "
+           << expected.size() << endl;
+      assert_true(pairs == expected);
+   }
+
+   broadPhase.remove(0);
+   broadPhase.find_pairs(pairs);
+   for (auto p : pairs) {
+      assert_true(p.first != 0);
+   }
+
+   return true;
+}
+
+vector<Rect<float>> random_rects(int num) {
+   vector<Rect<float>> rects;
+
+   for (int x = 0; x < num; x++) {
+      rects.push_back(Rect<float>(rand() % 500 - 100, rand() % 500 - 100,
+                                  rand() % 40 + 1, rand() % 40 + 1));
+   }
+
+   return rects;
+}
+
+template<class T>
+bool batch_collide_test(const vector<Rect<T>>& rectsA, const vector<Rect<T>>& rectsB) {
+   Collider<T> collider;
+   RectArray<T> A, B;
+   vector<RectSide> results;
+   int hits = 0;
+
+   for (size_t x = 0; x < rectsA.size(); x++) {
+      A.push_back(rectsA[x]);
+      B.push_back(rectsB[x]);
+   }
+
+   collider.collide(A, B, results);
+   assert_equal(results.size(), rectsA.size());
+
+   for (size_t x = 0; x < rectsA.size(); x++) {
+      assert_true(results[x] == collider.collide(rectsA[x], rectsB[x]));
+      hits += results[x] != NONE;
+   }
+
+   vector<pair<int, int>> pairs;
+   for (size_t x = 0; x + 1 < rectsA.size(); x++) {
+      pairs.push_back(pair<int, int>(x, x + 1));
+   }
+
+   collider.collide(A, pairs, results);
+   assert_equal(results.size(), pairs.size());
+
+   for (size_t x = 0; x < pairs.size(); x++) {
+      assert_true(results[x] == collider.collide(rectsA[x], rectsA[x + 1]));
+   }
+
+   cout << rectsA.size() << " pairs, " << hits << " hits." << endl;
+   return true;
+}
+
+int main() {
+   // A fixed seed keeps the randomized tests reproducible.  Set
+   // TEST_SEED to try others.
+   const char* seedEnv = getenv("TEST_SEED");
+   unsigned int seed = seedEnv != nullptr ? strtoul(seedEnv, nullptr, 10) : 1;
+   cout << "Random seed: " << seed << endl;
+   srand(seed);
+
+   return TestSuite("lost_levels collision tests")
+      .die_on_signal(SIGSEGV)
+      .test("Collision-001: Tree insert and retrieve", [&]()->bool {
+         IntTree tree(Rect<float>(0, 0, 256, 256), 0, 5, 4);
+
+         for (int x = 0; x < 16; x++) {
+            tree.insert(x, Rect<float>(x * 16, x * 16, 8, 8));
+         }
+
+         assert_equal<size_t>(tree.size(), 16);
+         assert_true(count_nodes(tree) > 1);
+
+         auto potentials = tree.retrieve(Rect<float>(2, 2, 4, 4));
+         cout << "Potentials: " << potentials.size() << endl;
+         assert_true(contains_id(potentials, 0));
+         assert_false(contains_id(potentials, 15));
+
+         return true;
+      })
+      .test("Collision-002: Tree update relinks moving entries", [&]()->bool {
+         IntTree tree(Rect<float>(0, 0, 256, 256), 0, 5, 4);
+
+         for (int x = 0; x < 8; x++) {
+            tree.insert(x, Rect<float>(4 + x, 4, 2, 2));
+         }
+
+         int nodesBefore = count_nodes(tree);
+         assert_true(tree.update(3, Rect<float>(200, 200, 2, 2)));
+         assert_true(tree.update(4, Rect<float>(5, 5, 2, 2)));
+         assert_false(tree.update(99, Rect<float>(0, 0, 1, 1)));
+         assert_equal(count_nodes(tree), nodesBefore);
+
+         assert_true(contains_id(tree.retrieve(Rect<float>(201, 201, 1, 1)), 3));
+         assert_false(contains_id(tree.retrieve(Rect<float>(4, 4, 1, 1)), 3));
+         assert_true(contains_id(tree.retrieve(Rect<float>(4, 4, 1, 1)), 4));
+
+         return true;
+      })
+      .test("Collision-003: Tree remove and clear", [&]()->bool {
+         IntTree tree(Rect<float>(0, 0, 256, 256), 0, 5, 4);
+
+         for (int x = 0; x < 8; x++) {
+            tree.insert(x, Rect<float>(4 + x, 4, 2, 2));
+         }
+
+         assert_true(tree.remove(2));
+         assert_false(tree.remove(2));
+         assert_equal<size_t>(tree.size(), 7);
+         assert_false(contains_id(tree.retrieve(Rect<float>(4, 4, 1, 1)), 2));
+
+         tree.clear();
+         assert_equal<size_t>(tree.size(), 0);
+         assert_equal(count_nodes(tree), 1);
+         assert_true(tree.retrieve(Rect<float>(4, 4, 1, 1)).empty());
+
+         return true;
+      })
+      .test("Collision-004: Tree visitor and overlap queries", [&]()->bool {
+         IntTree tree(Rect<float>(0, 0, 256, 256), 0, 5, 4);
+
+         for (int x = 0; x < 16; x++) {
+            tree.insert(x, Rect<float>(x * 16, x * 16, 8, 8));
+         }
+
+         // Straddles the root's quadrants, so retrieve() stops at the root.
+         Rect<float> query = Rect<float>(120, 120, 16, 16);
+         vector<const IntTree::Entry*> scratch;
+
+         tree.retrieve(query, scratch);
+         assert_equal(scratch.size(), tree.retrieve(query).size());
+
+         scratch.clear();
+         tree.retrieve_overlapping(query, scratch);
+         for (auto entry : scratch) {
+            cout << "Overlapping: " << entry->first << endl;
+         }
+         assert_equal<size_t>(scratch.size(), 2);
+
+         int visited = 0;
+         tree.visit_overlapping(Rect<float>(0, 0, 256, 256), [&](const IntTree::Entry& entry) {
+            visited ++;
+         });
+         assert_equal(visited, 16);
+
+         return true;
+      })
+      .test("Collision-005: Sweep and prune broad phase", [&]()->bool {
+         SweepAndPrune<float> broadPhase;
+         vector<Rect<float>> rects = random_rects(200);
+         return broad_phase_test(broadPhase, rects);
+      })
+      .test("Collision-006: Spatial hash broad phase", [&]()->bool {
+         SpatialHash<float> broadPhase(Size<float>(16, 16), 64);
+         vector<Rect<float>> rects = random_rects(200);
+         return broad_phase_test(broadPhase, rects);
+      })
+      .test("Collision-007: Batched rectangle collision", [&]()->bool {
+         vector<Rect<float>> rectsA = random_rects(203), rectsB;
+         for (auto R : rectsA) {
+            rectsB.push_back(R.translate(Vector<float>(rand() % 41 - 20, rand() % 41 - 20)));
+         }
+         vector<Rect<int>> intRectsA, intRectsB;
+
+         // Include exact edge and corner contact.
+         rectsA.push_back(Rect<float>(0, 0, 10, 10));
+         rectsB.push_back(Rect<float>(10, 10, 10, 10));
+         rectsA.push_back(Rect<float>(0, 0, 10, 10));
+         rectsB.push_back(Rect<float>(0, 10, 10, 10));
+
+         for (size_t x = 0; x < rectsA.size(); x++) {
+            intRectsA.push_back(rectsA[x].round());
+            intRectsB.push_back(rectsB[x].round());
+         }
+
+         // Integer rectangles with odd sizes classify as their float
+         // equivalents, without truncating half extents.
+         for (int ax = 0; ax < 4; ax++) {
+            for (int aw = 1; aw < 4; aw++) {
+               for (int ah = 1; ah < 4; ah++) {
+                  for (int bw = 1; bw < 4; bw++) {
+                     assert_true(simd::collide_aabb<int>(ax, 1, aw, ah, 0, 0, bw, 2) ==
+                                 simd::collide_aabb<float>(ax, 1, aw, ah, 0, 0, bw, 2));
+                  }
+               }
+            }
+         }
+
+         return batch_collide_test(rectsA, rectsB) &&
+                batch_collide_test(intRectsA, intRectsB);
+      })
+      .test("Collision-008: Separating axis polygon collision", [&]()->bool {
+         Collider<float> collider;
+         Polygon<float> A = Rect<float>(100, 100, 10, 10).to_polygon();
+         Polygon<float> B = Rect<float>(108, 101, 10, 10).to_polygon();
+         Polygon<float> C = Rect<float>(130, 100, 10, 10).to_polygon();
+         Polygon<float> T = Polygon<float>({
+            Point<float>(105, 125), Point<float>(125, 105), Point<float>(125, 125)});
+
+         // Parallel edges of a rectangle share a normal.
+         assert_equal<size_t>(A.edge_normals().size(), 2);
+         assert_equal<size_t>(T.edge_normals().size(), 3);
+
+         auto result = collider.collide(A, B);
+         cout << "A/B MTV: " << result.min_trans_v << endl;
+         assert_true(result.are_intersecting);
+         assert_true(result.will_intersect);
+         assert_true(result.min_trans_v == Vector<float>(-2, 0));
+
+         result = collider.collide(A, C);
+         assert_false(result.are_intersecting);
+         assert_false(result.will_intersect);
+
+         result = collider.collide(A, C, Vector<float>(25, 0));
+         cout << "A/C MTV: " << result.min_trans_v << endl;
+         assert_false(result.are_intersecting);
+         assert_true(result.will_intersect);
+         assert_true(result.min_trans_v == Vector<float>(-5, 0));
+
+         // The bounding boxes overlap, but the triangle's hypotenuse
+         // separates it from A until A is moved closer.
+         A += Vector<float>(0, 9);
+         result = collider.collide(A, T);
+         assert_false(result.are_intersecting);
+         A += Vector<float>(2, 0);
+         result = collider.collide(A, T);
+         cout << "A/T MTV: " << result.min_trans_v << endl;
+         assert_true(result.are_intersecting);
+         assert_true(result.min_trans_v.magnitude() < 1.0);
+
+         return true;
+      })
+      .test("Collision-009: Swept rectangle collision", [&]()->bool {
+         Collider<float> collider;
+         Rect<float> from = Rect<float>(0, 0, 10, 10);
+         Rect<float> to = Rect<float>(100, 0, 10, 10);
+         Rect<float> wall = Rect<float>(50, -10, 2, 30);
+
+         // Too fast for a static test to see the wall at either end.
+         assert_true(collider.collide(from, wall) == NONE);
+         assert_true(collider.collide(to, wall) == NONE);
+
+         auto result = collider.sweep(from, to, wall);
+         cout << "Time of impact: " << result.time << endl;
+         assert_true(result.hit);
+         assert_true(epsilon_equal(result.time, 0.4));
+         assert_true(result.side == LEFT);
+         assert_true(result.pt == Point<float>(40, 0));
+         assert_true(result.normal == Vector<float>(-1, 0));
+
+         // Moving away from a touching obstacle is not a collision.
+         assert_false(collider.sweep(Rect<float>(40, 0, 10, 10),
+                                     Rect<float>(30, 0, 10, 10), wall).hit);
+         assert_false(collider.sweep(from, Rect<float>(0, 100, 10, 10), wall).hit);
+
+         IntTree tree(Rect<float>(-256, -256, 512, 512), 0, 5, 4);
+         tree.insert(1, wall);
+         tree.insert(2, Rect<float>(20, 0, 2, 2));
+         tree.insert(3, from);
+
+         int hitObject = -1;
+         result = collider.sweep(tree, 3, from, to, &hitObject);
+         assert_true(result.hit);
+         assert_equal(hitObject, 2);
+         assert_true(epsilon_equal(result.time, 0.1));
+         assert_true(collider.swept_bounds(from, to) == Rect<float>(0, 0, 110, 10));
+
+         return true;
+      })
+      .run();
+}
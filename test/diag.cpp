@@ -0,0 +1,183 @@
+#include <sstream>
+#include "lost_levels/collision.h"
+#include "lost_levels/diag.h"
+#include "lost_levels/draw_list.h"
+#include "lost_levels/graphics_null.h"
+#include "lain/testing.h"
+
+using namespace std;
+using namespace lain;
+using namespace lain::testing;
+using namespace lost_levels;
+
+/**
+ * Remembers the last draw color set.
+ */
+class ColorRenderer : public null::Renderer {
+public:
+   ColorRenderer() : null::Renderer(Size<int>(256, 224)) { }
+
+   void set_draw_color(const Color& color) override {
+      drawColor = color;
+   }
+
+   Color drawColor;
+};
+
+void busy_wait(chrono::microseconds duration) {
+   auto deadline = Profiler::Clock::now() + duration;
+   while (Profiler::Clock::now() < deadline) { }
+}
+
+int main() {
+   return TestSuite("lost_levels diagnostic tests")
+      .die_on_signal(SIGSEGV)
+      .test("Diag-001: Profiler zone statistics", [&]()->bool {
+         Profiler profiler(10);
+         const Profiler::ZoneId PAINT = Profiler::get_zone_id("paint");
+         assert_true(Profiler::get_zone_id(string("paint").c_str()) == PAINT);
+
+         for (int frame = 0; frame < 15; frame++) {
+            {
+               Profiler::Zone zone(profiler, "update");
+               busy_wait(chrono::microseconds(frame == 14 ? 5000 : 1000));
+            }
+            {
+               // Zones entered more than once in a frame are summed.
+               Profiler::Zone zone(profiler, "paint");
+               busy_wait(chrono::microseconds(200));
+            }
+            {
+               Profiler::Zone zone(profiler, PAINT);
+               busy_wait(chrono::microseconds(200));
+            }
+            profiler.end_frame();
+         }
+
+         vector<string> names = profiler.get_zone_names();
+         assert_equal<size_t>(names.size(), 2);
+         assert_true(names[0] == "update");
+
+         Profiler::Stats update = profiler.get_stats("update");
+         Profiler::Stats paint = profiler.get_stats("paint");
+         Profiler::Stats frame = profiler.get_frame_stats();
+         cout << "update: min " << update.min << " avg " << update.avg
+              << " p99 " << update.p99 << " max " << update.max << endl;
+
+         assert_true(update.min >= 1000 && update.min < 5000);
+         assert_true(update.max >= 5000);
+         assert_true(update.p99 == update.max);
+         assert_true(update.avg > update.min && update.avg < update.max);
+         assert_true(paint.min >= 400);
+         assert_true(frame.min >= update.min + paint.min);
+         assert_equal<size_t>(profiler.get_frame_history().size(), 10);
+         assert_true(profiler.get_stats("missing").max == 0);
+
+         return true;
+      })
+      .test("Diag-002: Profiler Chrome trace export", [&]()->bool {
+         Profiler profiler;
+
+         {
+            Profiler::Zone zone(profiler, "before");
+         }
+         profiler.start_trace(3);
+         for (int x = 0; x < 5; x++) {
+            Profiler::Zone zone(profiler, "traced");
+         }
+         profiler.stop_trace();
+         {
+            Profiler::Zone zone(profiler, "after");
+         }
+
+         ostringstream out;
+         profiler.write_trace(out);
+         string trace = out.str();
+         cout << trace;
+
+         assert_true(trace.find("{\"traceEvents\":[") == 0);
+         assert_true(trace.find("\"before\"") == string::npos);
+         assert_true(trace.find("\"after\"") == string::npos);
+
+         size_t count = 0;
+         for (size_t pos = trace.find("\"ph\":\"X\""); pos != string::npos;
+              pos = trace.find("\"ph\":\"X\"", pos + 1)) {
+            count ++;
+         }
+         assert_equal<size_t>(count, 3);
+
+         profiler.set_enabled(false);
+         {
+            Profiler::Zone zone(profiler, "disabled");
+         }
+         assert_equal<size_t>(profiler.get_zone_names().size(), 3);
+
+         // The overlay leaves the draw color as it found it.
+         ColorRenderer renderer;
+         auto font = ImageFont::create(make_shared<null::Image>(Rect<int>(0, 0, 70, 80)), Size<int>(7, 8));
+         renderer.set_draw_color(Color(1, 2, 3));
+         profiler.paint_overlay(renderer, font, Point<int>(), Color(1, 2, 3));
+         assert_true(renderer.drawColor.r == 1 && renderer.drawColor.g == 2 && renderer.drawColor.b == 3);
+         assert_true(renderer.get_num_rects() > 0);
+
+         return true;
+      })
+      .test("Diag-003: Metrics counters and histograms", [&]()->bool {
+         Metrics metrics;
+         Counter& events = metrics.counter("test.events");
+         assert_true(&events == &metrics.counter("test.events"));
+
+         events.add(3);
+         metrics.end_frame();
+         events.add(2);
+         events.add();
+         metrics.end_frame();
+         assert_equal<int64_t>(events.get_total(), 6);
+         assert_equal<int64_t>(events.get_frame_value(), 3);
+
+         Histogram& times = metrics.histogram("test.times", 2.0, 5);
+         for (double value : {0.5, 1.0, 3.0, 3.5, 5.0, 100.0}) {
+            times.add(value);
+         }
+         vector<uint64_t> buckets = times.get_buckets();
+         assert_true(buckets == vector<uint64_t>({2, 2, 1, 0, 1}));
+         assert_true(times.get_percentile(50) == 4.0);
+         assert_true(times.get_percentile(99) == 10.0);
+
+         ostringstream out;
+         metrics.write(out);
+         cout << out.str();
+         assert_true(out.str().find("\"test.events\": {\"total\": 6, \"last_frame\": 3") != string::npos);
+         assert_true(out.str().find("\"buckets\": [2, 2, 1, 0, 1]") != string::npos);
+
+         // Subsystems record into the global registry.
+         CollisionTree<float, int> tree(Rect<float>(0, 0, 256, 256), 0, 5, 4);
+         tree.insert(1, Rect<float>(4, 4, 2, 2));
+         Counter& queries = Metrics::global().counter("collision.tree_queries");
+         Counter& visited = Metrics::global().counter("collision.tree_nodes_visited");
+         int64_t queriesBefore = queries.get_total(), visitedBefore = visited.get_total();
+
+         tree.retrieve(Rect<float>(4, 4, 1, 1));
+         assert_equal<int64_t>(queries.get_total() - queriesBefore, 1);
+         assert_true(visited.get_total() > visitedBefore);
+
+         // Reused buffers only count growth until they fit a frame.
+         Counter& growths = Metrics::global().counter("memory.buffer_growths");
+         DrawList list(Size<int>(256, 224));
+         int64_t growthsBefore = growths.get_total();
+         for (int x = 0; x < 100; x++) {
+            list.fill_rect(Rect<int>(x, 0, 1, 1));
+         }
+         assert_true(growths.get_total() > growthsBefore);
+
+         growthsBefore = growths.get_total();
+         list.reset();
+         for (int x = 0; x < 100; x++) {
+            list.fill_rect(Rect<int>(x, 0, 1, 1));
+         }
+         assert_equal<int64_t>(growths.get_total(), growthsBefore);
+
+         return true;
+      })
+      .run();
+}
@@ -0,0 +1,164 @@
+#include <algorithm>
+
+#include "lost_levels/entity.h"
+#include "lost_levels/graphics_null.h"
+#include "lain/testing.h"
+
+using namespace std;
+using namespace lain;
+using namespace lain::testing;
+using namespace lost_levels;
+
+int main() {
+   return TestSuite("lost_levels entity tests")
+      .die_on_signal(SIGSEGV)
+      .test("Entity-001: Stable handles", [&]()->bool {
+         EntityStore store;
+         Entity a = store.create(Rect<float>(0, 0, 1, 1));
+         Entity b = store.create(Rect<float>(1, 0, 1, 1));
+         Entity c = store.create(Rect<float>(2, 0, 1, 1));
+         assert_equal<size_t>(store.size(), 3);
+
+         // Destroying moves the last entity, but handles still resolve.
+         store.destroy(a);
+         assert_equal<size_t>(store.size(), 2);
+         assert_false(store.is_alive(a));
+         assert_true(store.get_bounds(c) == Rect<float>(2, 0, 1, 1));
+         assert_true(store.get_bounds(b) == Rect<float>(1, 0, 1, 1));
+         assert_equal<size_t>(store.index_of(c), 0);
+
+         // The index is reused with a new generation.
+         Entity d = store.create(Rect<float>(3, 0, 1, 1));
+         assert_equal(d.index, a.index);
+         assert_true(d != a);
+         assert_true(store.find(d.index) == d);
+         assert_true(store.find(1000).is_null());
+
+         bool thrown = false;
+         try {
+            store.get_bounds(a);
+         } catch (const EntityException& e) {
+            thrown = true;
+         }
+         assert_true(thrown);
+
+         thrown = false;
+         try {
+            store.destroy(a);
+         } catch (const EntityException& e) {
+            thrown = true;
+         }
+         assert_true(thrown);
+
+         store.clear();
+         assert_equal<size_t>(store.size(), 0);
+         assert_false(store.is_alive(b));
+
+         return true;
+      })
+      .test("Entity-002: Component pools", [&]()->bool {
+         EntityStore store;
+         Entity a = store.create();
+         Entity b = store.create();
+         Entity c = store.create();
+
+         ComponentPool<int>& scores = store.components<int>();
+         scores.add(a, 10);
+         scores.add(c, 30);
+         assert_true(&store.components<int>() == &scores);
+         assert_equal<size_t>(scores.size(), 2);
+         assert_false(scores.has(b));
+         assert_true(scores.find(b) == nullptr);
+         assert_equal(scores.get(c), 30);
+
+         scores.add(c, 31);
+         assert_equal<size_t>(scores.size(), 2);
+         assert_equal(scores.get(c), 31);
+
+         store.components<string>().add(a, "hero");
+
+         // Destroying an entity removes its components.
+         store.destroy(a);
+         assert_equal<size_t>(scores.size(), 1);
+         assert_equal<size_t>(store.components<string>().size(), 0);
+         assert_true(scores.get_entities()[0] == c);
+         assert_equal(scores.get_components()[0], 31);
+
+         // A stale handle doesn't see the new entity's components.
+         Entity d = store.create();
+         scores.add(d, 40);
+         assert_false(scores.has(a));
+
+         int sum = 0;
+         scores.for_each([&](Entity entity, int& score) {
+            sum += score;
+         });
+         assert_equal(sum, 71);
+
+         bool thrown = false;
+         try {
+            scores.get(b);
+         } catch (const EntityException& e) {
+            thrown = true;
+         }
+         assert_true(thrown);
+
+         return true;
+      })
+      .test("Entity-003: Systems", [&]()->bool {
+         EntityStore store;
+         AnimationSystem animations;
+         store.set_animation_system(animations);
+
+         auto image = make_shared<null::Image>(Rect<int>(0, 0, 32, 16));
+         auto def = make_shared<const AnimationDef>(image, Size<int>(16, 16),
+            vector<AnimationDef::Frame> {AnimationDef::Frame(0, 1), AnimationDef::Frame(1, 1)}, true);
+
+         Entity a = store.create(Rect<float>(0, 0, 4, 4), Vector<float>(2, 0), animations.add(def));
+         Entity b = store.create(Rect<float>(10, 0, 4, 4), Vector<float>(-2, 0), animations.add(def));
+         Entity c = store.create(Rect<float>(50, 50, 4, 4));
+         assert_equal<size_t>(animations.size(), 2);
+         assert_true(store.get_animation(c) == EntityStore::NO_ANIMATION);
+
+         JobSystem jobs(2);
+         store.integrate(jobs, 1);
+         store.integrate();
+         assert_true(store.get_bounds(a) == Rect<float>(4, 0, 4, 4));
+         assert_true(store.get_prev_bounds(a) == Rect<float>(2, 0, 4, 4));
+         assert_true(store.get_bounds(b) == Rect<float>(6, 0, 4, 4));
+         assert_true(store.get_bounds(c) == Rect<float>(50, 50, 4, 4));
+
+         // The broad phase sees the bounds swept by the last step.
+         SweepAndPrune<float> broadPhase;
+         vector<BroadPhase<float>::Pair> pairs;
+         store.update_broad_phase(broadPhase);
+         broadPhase.find_pairs(pairs);
+         assert_equal<size_t>(pairs.size(), 1);
+         Entity first = store.find(pairs[0].first), second = store.find(pairs[0].second);
+         assert_true((first == a && second == b) || (first == b && second == a));
+
+         CollisionTree<float, Entity, Entity::Hash> tree(Rect<float>(0, 0, 64, 64));
+         store.update_tree(tree);
+         assert_equal<size_t>(tree.size(), 3);
+         int overlapping = 0;
+         tree.visit_overlapping(Rect<float>(0, 0, 20, 20), [&](const pair<Entity, Rect<float>>& entry) {
+            overlapping ++;
+         });
+         assert_equal(overlapping, 2);
+
+         // Destroying an entity removes its animation instance, and its
+         // entries in the broad phase and tree.
+         store.set_broad_phase(broadPhase);
+         store.set_tree(tree);
+         store.destroy(a);
+         assert_equal<size_t>(animations.size(), 1);
+         assert_equal<size_t>(tree.size(), 2);
+         broadPhase.find_pairs(pairs);
+         assert_true(pairs.empty());
+         store.destroy(c);
+         assert_equal<size_t>(animations.size(), 1);
+
+         return true;
+      })
+      .run();
+}
@@ -176,6 +176,28 @@ int main() {
          return true;
       })
 
+      .test("Geometry-006: Allocation free rectangle variants", [&]()->bool {
+         constexpr Rect<int> R0 = Rect<int>(0, 0, 10, 10);
+         static_assert(R0.overlaps(Rect<int>(10, 10, 5, 5)), "Touching rectangles overlap");
+         static_assert(! R0.overlaps(Rect<int>(11, 0, 5, 5)), "Separate rectangles do not overlap");
+         static_assert(R0.contains(Point<int>(10, 10)), "Corner point is contained");
+
+         auto quads = R0.quadrants();
+         auto subRects = R0.split();
+         auto corners = R0.corners();
+         auto edges = R0.edges();
+
+         for (int x = 0; x < 4; x++) {
+            cout << quads[x] << endl;
+            assert_equal(quads[x], subRects[x]);
+            assert_true(R0.contains(quads[x]));
+            assert_equal(R0.corner_array()[x], corners[x]);
+            assert_equal(R0.edge_array()[x], edges[x]);
+         }
+
+         assert_equal(quads[2], Rect<int>(5, 5, 5, 5));
+         return true;
+      })
       .run();
 }
 
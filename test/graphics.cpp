@@ -0,0 +1,367 @@
+#include "lost_levels/animation.h"
+#include "lost_levels/draw_list.h"
+#include "lost_levels/graphics.h"
+#include "lost_levels/graphics_null.h"
+#include "lain/testing.h"
+
+using namespace std;
+using namespace lain;
+using namespace lain::testing;
+using namespace lost_levels;
+
+/**
+ * A DrawList which also keeps the destination rect of each image draw.
+ */
+class RectRecorder : public DrawList {
+public:
+   void render(shared_ptr<const Image> image, const Rect<int>& srcRect,
+               const Rect<int>& dstRect) override {
+      DrawList::render(image, srcRect, dstRect);
+      srcRects.push_back(srcRect);
+      dstRects.push_back(dstRect);
+   }
+
+   void render_quads(shared_ptr<const Image> image,
+         const Rect<int>* srcRectsIn, const Rect<int>* dstRectsIn,
+         size_t count, const Vector<int>& offset) override {
+      DrawList::render_quads(image, srcRectsIn, dstRectsIn, count, offset);
+      for (size_t x = 0; x < count; x++) {
+         srcRects.push_back(srcRectsIn[x]);
+         dstRects.push_back(dstRectsIn[x].translate(offset));
+      }
+   }
+
+   using DrawList::render;
+
+   vector<Rect<int>> srcRects;
+   vector<Rect<int>> dstRects;
+};
+
+bool placements_disjoint(const vector<AtlasPacker::Placement>& placements) {
+   for (size_t x = 0; x < placements.size(); x++) {
+      for (size_t y = x + 1; y < placements.size(); y++) {
+         const Rect<int>& A = placements[x].rect;
+         const Rect<int>& B = placements[y].rect;
+
+         if (placements[x].page == placements[y].page &&
+             A.pt.x < B.pt.x + B.sz.width && B.pt.x < A.pt.x + A.sz.width &&
+             A.pt.y < B.pt.y + B.sz.height && B.pt.y < A.pt.y + A.sz.height) {
+            return false;
+         }
+      }
+   }
+
+   return true;
+}
+
+int main() {
+   return TestSuite("lost_levels graphics tests")
+      .die_on_signal(SIGSEGV)
+      .test("Graphics-001: Atlas packing", [&]()->bool {
+         AtlasPacker packer(Size<int>(256, 256));
+         vector<Size<int>> sizes = {
+            Size<int>(48, 16), Size<int>(224, 24), Size<int>(100, 100),
+            Size<int>(300, 10), Size<int>(120, 100), Size<int>(200, 200)
+         };
+
+         auto placements = packer.pack(sizes);
+         assert_equal(placements.size(), sizes.size());
+         assert_equal(packer.get_page_count(), 2);
+
+         // Too wide for any page.
+         assert_equal(placements[3].page, -1);
+
+         for (size_t x = 0; x < sizes.size(); x++) {
+            cout << x << ": page " << placements[x].page << " "
+                 << placements[x].rect << endl;
+
+            if (placements[x].page != -1) {
+               Size<int> szPage = packer.get_page_size(placements[x].page);
+               assert_true(placements[x].rect.sz == sizes[x]);
+               assert_true(placements[x].rect.pt.x + sizes[x].width <= szPage.width);
+               assert_true(placements[x].rect.pt.y + sizes[x].height <= szPage.height);
+            }
+         }
+
+         assert_true(placements_disjoint(placements));
+         return true;
+      })
+      .test("Graphics-002: Shared animation playback", [&]()->bool {
+         // An image packed into an atlas at (64, 32).
+         auto image = make_shared<null::Image>(Rect<int>(64, 32, 48, 16));
+         vector<AnimationDef::Frame> frames = {
+            AnimationDef::Frame(0, 2), AnimationDef::Frame(1, 3), AnimationDef::Frame(2, 1)
+         };
+         AnimationDef loop(image, Size<int>(16, 16), frames, true);
+         AnimationDef once(image, Size<int>(16, 16), frames, false);
+         AnimationState state;
+
+         assert_true(loop.get_frame_rect(2) == Rect<int>(96, 32, 16, 16));
+         assert_equal<uint32_t>(loop.get_total_duration(), 6);
+
+         state.advance(loop);
+         assert_equal<uint32_t>(state.frame, 0);
+         state.advance(loop);
+         assert_equal<uint32_t>(state.frame, 1);
+         state.advance(loop, 4);
+         assert_equal<uint32_t>(state.frame, 0);
+         state.advance(loop, 6 * 100 + 5);
+         assert_equal<uint32_t>(state.frame, 2);
+         assert_false(state.is_complete(loop));
+
+         state.reset();
+         state.advance(once, 5);
+         assert_equal<uint32_t>(state.frame, 2);
+         assert_false(state.is_complete(once));
+         state.advance(once, 100);
+         assert_equal<uint32_t>(state.frame, 2);
+         assert_true(state.is_complete(once));
+
+         return true;
+      })
+      .test("Graphics-003: Bulk animation system", [&]()->bool {
+         auto image = make_shared<null::Image>(Rect<int>(0, 0, 48, 16));
+         vector<AnimationDef::Frame> frames = {
+            AnimationDef::Frame(0, 2), AnimationDef::Frame(1, 3), AnimationDef::Frame(2, 1)
+         };
+         auto def = make_shared<const AnimationDef>(image, Size<int>(16, 16), frames, true);
+         AnimationSystem system;
+         AnimationState expected;
+
+         auto a = system.add(def);
+         auto b = system.add(def, false);
+         auto c = system.add(def);
+         system.remove(a);
+         assert_equal<size_t>(system.size(), 2);
+         assert_equal(system.add(def), a);
+
+         system.update(1000);
+         for (int x = 0; x < 50; x++) {
+            system.update(1001 + x);
+            expected.advance(*def);
+            assert_equal(system.get_state(c).frame, expected.frame);
+            assert_equal(system.get_state(c).elapsed, expected.elapsed);
+         }
+
+         assert_equal<uint32_t>(system.get_state(b).frame, 0);
+         assert_true(system.get_frame_rect(c) == def->get_frame_rect(expected.frame));
+
+         return true;
+      })
+      .test("Graphics-004: Draw list record and replay", [&]()->bool {
+         auto image = make_shared<null::Image>(Rect<int>(0, 0, 70, 8));
+         auto font = ImageFont::create(image, Size<int>(7, 8));
+         DrawList list(Size<int>(256, 224)), copy;
+
+         list.clear();
+         list.set_draw_color(Color(255, 0, 0));
+         list.fill_rect(Rect<int>(1, 2, 3, 4));
+         list.set_layer(1);
+         list.render(image, Point<int>(10, 10));
+         font->set_start_char('0');
+         list.print_string(Point<int>(), font, "0123\n45");
+         list.print_string(Point<int>(20, 30), font, "67");
+         assert_equal<size_t>(list.size(), 7);
+         assert_true(list.get_logical_size() == Size<int>(256, 224));
+
+         list.replay(copy);
+         assert_equal<size_t>(copy.size(), list.size());
+
+         // Text is recorded as one command per string, and replayed
+         // with its offset.
+         RectRecorder recorder;
+         list.replay(recorder);
+         assert_equal<size_t>(recorder.dstRects.size(), 9);
+         assert_true(recorder.srcRects[1] == Rect<int>(0, 0, 7, 8));
+         assert_true(recorder.dstRects[6] == Rect<int>(7, 8, 7, 8));
+         assert_true(recorder.srcRects[8] == Rect<int>(49, 0, 7, 8));
+         assert_true(recorder.dstRects[8] == Rect<int>(27, 30, 7, 8));
+
+         list.reset();
+         assert_equal<size_t>(list.size(), 0);
+
+         bool thrown = false;
+         try {
+            list.load_image("nothing.png");
+         } catch (const GraphicsException& e) {
+            thrown = true;
+         }
+         assert_true(thrown);
+
+         return true;
+      })
+      .test("Graphics-005: Damage tracking", [&]()->bool {
+         Damage damage(3);
+         assert_true(damage.is_empty());
+
+         damage.invalidate(Rect<int>(0, 0, 10, 10));
+         damage.invalidate(Rect<int>(50, 50, 10, 10));
+         assert_equal<size_t>(damage.get_rects().size(), 2);
+         assert_false(damage.is_full());
+
+         // Overlapping rects are merged.
+         damage.invalidate(Rect<int>(5, 5, 10, 10));
+         assert_equal<size_t>(damage.get_rects().size(), 2);
+         assert_true(damage.get_rects()[1] == Rect<int>(0, 0, 15, 15));
+         assert_true(damage.get_bounds() == Rect<int>(0, 0, 60, 60));
+
+         // Empty rects are ignored.
+         damage.invalidate(Rect<int>(100, 100, 0, 5));
+         assert_equal<size_t>(damage.get_rects().size(), 2);
+
+         // Past the limit, rects are merged into their bounds.
+         damage.invalidate(Rect<int>(100, 0, 5, 5));
+         damage.invalidate(Rect<int>(0, 100, 5, 5));
+         assert_equal<size_t>(damage.get_rects().size(), 1);
+         assert_true(damage.get_bounds() == Rect<int>(0, 0, 105, 105));
+
+         damage.invalidate();
+         assert_true(damage.is_full());
+         assert_true(damage.get_rects().empty());
+         damage.invalidate(Rect<int>(0, 0, 1, 1));
+         assert_true(damage.get_rects().empty());
+
+         damage.clear();
+         assert_true(damage.is_empty());
+
+         return true;
+      })
+      .test("Graphics-006: Glyph tables and text runs", [&]()->bool {
+         auto image = make_shared<null::Image>(Rect<int>(0, 0, 70, 16));
+         auto font = ImageFont::create(image, Size<int>(7, 8));
+         font->set_start_char('0');
+
+         const vector<Rect<int>>& glyphs = font->get_glyph_rects();
+         assert_equal<size_t>(glyphs.size(), 256);
+         assert_true(glyphs['0'] == font->get_char_rect('0'));
+         assert_true(glyphs['A'] == font->get_char_rect('A'));
+
+         // Changing the start char rebuilds the table.
+         font->set_start_char('1');
+         assert_true(font->get_glyph_rects()['1'] == Rect<int>(0, 0, 7, 8));
+
+         TextRun run(font, "12\n345");
+         assert_equal<size_t>(run.get_num_glyphs(), 5);
+         assert_true(run.get_size() == Size<int>(21, 16));
+         assert_true(run.get_src_rects()[2] == font->get_char_rect('3'));
+         assert_true(run.get_dst_rects()[4] == Rect<int>(14, 8, 7, 8));
+
+         RectRecorder recorder;
+         recorder.render(run, Point<int>(10, 20));
+         assert_equal<size_t>(recorder.size(), 1);
+         assert_equal<size_t>(recorder.dstRects.size(), 5);
+         assert_true(recorder.dstRects[1] == Rect<int>(17, 20, 7, 8));
+         assert_true(recorder.dstRects[2] == Rect<int>(10, 28, 7, 8));
+
+         // print_string lays out the same way.
+         recorder.print_string(Point<int>(10, 20), font, "12\n345");
+         assert_equal<size_t>(recorder.dstRects.size(), 10);
+         assert_true(vector<Rect<int>>(recorder.dstRects.begin(), recorder.dstRects.begin() + 5) ==
+                     vector<Rect<int>>(recorder.dstRects.begin() + 5, recorder.dstRects.end()));
+
+         run.set_text("");
+         assert_equal<size_t>(run.get_num_glyphs(), 0);
+         assert_true(run.get_size() == Size<int>(0, 0));
+
+         // Animated fonts draw characters from the current frame.
+         unsigned int ticks = 0;
+         shared_ptr<Timer<uint64_t>> timer = Timer<uint64_t>::create([&]() { return ticks; }, 1);
+         timer->start();
+         auto sheet = make_shared<null::Image>(Rect<int>(0, 0, 32, 16));
+         auto animation = Animation::create(make_shared<AnimationDef>(sheet, Size<int>(16, 16),
+            vector<AnimationDef::Frame> {AnimationDef::Frame(0, 1), AnimationDef::Frame(1, 1)}, true), timer);
+         AnimatedFont animatedFont(animation, Size<int>(8, 8));
+         animatedFont.set_start_char('a');
+         assert_true(animatedFont.get_char_rect('d') == Rect<int>(8, 8, 8, 8));
+
+         animation->start();
+         ticks++;
+         timer->update();
+         animation->update();
+         assert_true(animatedFont.get_char_rect('d') == Rect<int>(24, 8, 8, 8));
+         assert_true(animatedFont.get_glyph_rects()['b'] == Rect<int>(24, 0, 8, 8));
+
+         // print_string follows frame and start char changes, even when
+         // the font and text are the same as the last call.
+         auto sharedFont = make_shared<AnimatedFont>(animation, Size<int>(8, 8));
+         sharedFont->set_start_char('a');
+         RectRecorder printer;
+         printer.print_string(Point<int>(), sharedFont, "bd");
+         assert_true(printer.srcRects[0] == Rect<int>(24, 0, 8, 8));
+         assert_true(printer.srcRects[1] == Rect<int>(24, 8, 8, 8));
+
+         ticks++;
+         timer->update();
+         animation->update();
+         printer.print_string(Point<int>(), sharedFont, "bd");
+         assert_equal<size_t>(printer.srcRects.size(), 4);
+         assert_true(printer.srcRects[2] == Rect<int>(8, 0, 8, 8));
+         assert_true(printer.srcRects[3] == Rect<int>(8, 8, 8, 8));
+
+         sharedFont->set_start_char('b');
+         printer.print_string(Point<int>(), sharedFont, "bd");
+         assert_true(printer.srcRects[4] == Rect<int>(0, 0, 8, 8));
+         assert_true(printer.srcRects[5] == Rect<int>(0, 8, 8, 8));
+
+         return true;
+      })
+      .test("Graphics-007: Pattern layer tiling", [&]()->bool {
+         Rect<int> tileRect(32, 0, 16, 8);
+         Rect<int> dstRect(10, 10, 40, 20);
+         PatternLayer layer(tileRect, dstRect);
+
+         auto covers_exactly = [&]()->bool {
+            int area = 0;
+            for (size_t x = 0; x < layer.get_num_quads(); x++) {
+               const Rect<int>& src = layer.get_src_rects()[x];
+               const Rect<int>& dst = layer.get_dst_rects()[x];
+               if (src.sz != dst.sz || dst.sz.width <= 0 || dst.sz.height <= 0 ||
+                   ! dstRect.contains(dst) || ! tileRect.contains(src)) {
+                  return false;
+               }
+               area += dst.sz.width * dst.sz.height;
+            }
+            return area == dstRect.sz.width * dstRect.sz.height;
+         };
+
+         // Without scrolling, the pattern is anchored at the top left.
+         assert_equal<size_t>(layer.get_num_quads(), 9);
+         assert_true(layer.get_dst_rects()[0] == Rect<int>(10, 10, 16, 8));
+         assert_true(layer.get_src_rects()[2] == Rect<int>(32, 0, 8, 8));
+         assert_true(covers_exactly());
+
+         layer.set_scroll(Point<int>(5, -3));
+         assert_equal<size_t>(layer.get_num_quads(), 12);
+         assert_true(layer.get_dst_rects()[0] == Rect<int>(10, 10, 5, 5));
+         assert_true(layer.get_src_rects()[0] == Rect<int>(43, 3, 5, 5));
+         assert_true(covers_exactly());
+
+         // Scrolling by whole tiles doesn't change the layout.
+         vector<Rect<int>> dstRects = layer.get_dst_rects();
+         layer.set_scroll(Point<int>(5 + 16 * 3, -3 - 8 * 5));
+         assert_true(layer.get_dst_rects() == dstRects);
+
+         // Moving the tile only moves the source rects.
+         tileRect = Rect<int>(0, 8, 16, 8);
+         layer.set_tile_rect(tileRect);
+         assert_true(layer.get_dst_rects() == dstRects);
+         assert_true(layer.get_src_rects()[0] == Rect<int>(11, 11, 5, 5));
+         assert_true(covers_exactly());
+
+         auto image = make_shared<null::Image>(Rect<int>(0, 0, 64, 16));
+         RectRecorder recorder;
+         recorder.render_pattern(image, layer);
+         assert_true(recorder.dstRects == dstRects);
+
+         // The scroll/src/dst overload draws the same quads.
+         recorder.render_pattern(image, Point<int>(5, -3), tileRect, dstRect);
+         assert_true(vector<Rect<int>>(recorder.dstRects.begin() + 12, recorder.dstRects.end()) ==
+                     dstRects);
+
+         layer.set_tile_rect(Rect<int>());
+         assert_equal<size_t>(layer.get_num_quads(), 0);
+
+         return true;
+      })
+      .run();
+}
@@ -0,0 +1,113 @@
+#include <atomic>
+#include <numeric>
+#include <stdexcept>
+#include "lost_levels/jobs.h"
+#include "lain/testing.h"
+
+using namespace std;
+using namespace lain;
+using namespace lain::testing;
+using namespace lost_levels;
+
+bool parallel_sum_test(JobSystem& jobs, size_t count, size_t grain) {
+   vector<uint64_t> values(count);
+   iota(values.begin(), values.end(), 1);
+
+   atomic<uint64_t> sum(0);
+   vector<int> visits(count, 0);
+
+   jobs.parallel_for(0, count, grain, [&](size_t begin, size_t end) {
+      uint64_t partial = 0;
+      for (size_t x = begin; x < end; x++) {
+         partial += values[x];
+         visits[x] ++;
+      }
+      sum += partial;
+   });
+
+   assert_equal<uint64_t>(sum.load(), (uint64_t)count * (count + 1) / 2);
+   for (int v : visits) {
+      assert_equal(v, 1);
+   }
+
+   return true;
+}
+
+int main() {
+   return TestSuite("lost_levels job system tests")
+      .die_on_signal(SIGSEGV)
+      .test("Jobs-001: Parallel for covers each index once", [&]()->bool {
+         JobSystem jobs(4);
+         assert_equal<size_t>(jobs.get_num_threads(), 4);
+
+         for (int x = 0; x < 20; x++) {
+            parallel_sum_test(jobs, 10007, 64);
+         }
+
+         parallel_sum_test(jobs, 3, 1);
+         parallel_sum_test(jobs, 0, 16);
+         return true;
+      })
+      .test("Jobs-002: Single thread runs inline", [&]()->bool {
+         JobSystem jobs(1);
+         thread::id caller = this_thread::get_id();
+         bool inline_only = true;
+
+         jobs.parallel_for_each(0, 1000, 8, [&](size_t x) {
+            inline_only = inline_only && this_thread::get_id() == caller;
+         });
+
+         assert_true(inline_only);
+         return parallel_sum_test(jobs, 1000, 8);
+      })
+      .test("Jobs-003: Nested parallel for", [&]()->bool {
+         JobSystem jobs(3);
+         atomic<int> count(0);
+
+         jobs.parallel_for_each(0, 16, 1, [&](size_t x) {
+            jobs.parallel_for_each(0, 100, 10, [&](size_t y) {
+               count ++;
+            });
+         });
+
+         assert_equal(count.load(), 1600);
+         return true;
+      })
+      .test("Jobs-004: Exceptions are rethrown to the caller", [&]()->bool {
+         JobSystem jobs(4);
+         atomic<int> count(0);
+
+         bool thrown = false;
+         try {
+            jobs.parallel_for_each(0, 1000, 1, [&](size_t x) {
+               count ++;
+               if (x % 100 == 7) {
+                  throw runtime_error("chunk failed");
+               }
+            });
+         } catch (const runtime_error& e) {
+            thrown = true;
+         }
+         assert_true(thrown);
+         assert_true(count.load() > 0 && count.load() <= 1000);
+
+         // Exceptions thrown by nested calls reach the outer caller.
+         thrown = false;
+         try {
+            jobs.parallel_for_each(0, 8, 1, [&](size_t x) {
+               jobs.parallel_for_each(0, 100, 10, [&](size_t y) {
+                  if (x == 3 && y == 42) {
+                     throw runtime_error("nested chunk failed");
+                  }
+               });
+            });
+         } catch (const runtime_error& e) {
+            thrown = true;
+         }
+         assert_true(thrown);
+
+         // The pool is still usable afterwards.
+         return parallel_sum_test(jobs, 10007, 64);
+      })
+      .run();
+}
@@ -0,0 +1,173 @@
+#include "lost_levels/draw_list.h"
+#include "lost_levels/graphics_null.h"
+#include "lost_levels/level.h"
+#include "lain/testing.h"
+
+using namespace std;
+using namespace lain;
+using namespace lain::testing;
+using namespace lost_levels;
+
+/**
+ * Counts image draws to the screen and into render targets.
+ */
+class TargetRenderer : public DrawList {
+public:
+   TargetRenderer(const Size<int>& szLogical, bool targets) :
+      DrawList(szLogical), targets(targets) { }
+
+   shared_ptr<Image> create_render_target(const Size<int>& sz) override {
+      return targets ? make_shared<null::Image>(Rect<int>(Point<int>(), sz)) : nullptr;
+   }
+
+   void set_render_target(shared_ptr<Image> target, bool clear) override {
+      this->target = target;
+   }
+
+   void render(shared_ptr<const Image> image,
+         const Rect<int>& srcRect,
+         const Rect<int>& dstRect) override {
+      (target == nullptr ? screenDraws : targetDraws) ++;
+      DrawList::render(image, srcRect, dstRect);
+   }
+
+   using DrawList::render;
+
+   bool targets;
+   shared_ptr<Image> target;
+   int screenDraws = 0, targetDraws = 0;
+};
+
+shared_ptr<BlockDataSet> make_block_set() {
+   return make_shared<BlockDataSet>(vector<BlockData>({
+      BlockData("air", 0),
+      BlockData("brick", 1, true),
+      BlockData("flower", 3)
+   }));
+}
+
+int main() {
+   return TestSuite("lost_levels level tests")
+      .die_on_signal(SIGSEGV)
+      .test("Level-001: Block set lookup by id", [&]()->bool {
+         auto blockSet = make_block_set();
+
+         assert_true(blockSet->get_block(1).name == "brick");
+         assert_true(blockSet->is_solid(1));
+         assert_false(blockSet->is_solid(3));
+         assert_false(blockSet->has_block(2));
+         assert_false(blockSet->is_solid(200));
+         bool thrown = false;
+         try {
+            blockSet->get_block(2);
+         } catch (const LevelDataException& e) {
+            thrown = true;
+         }
+         assert_true(thrown);
+
+         thrown = false;
+         try {
+            blockSet->add_block(BlockData("huge", 70000));
+         } catch (const LevelDataException& e) {
+            thrown = true;
+         }
+         assert_true(thrown);
+
+         return true;
+      })
+      .test("Level-002: Block map regions and solid queries", [&]()->bool {
+         BlockMap map(make_block_set(), Size<int>(8, 4), Size<int>(16, 16));
+         assert_equal<size_t>(sizeof(map.get_cells()[0]), 2);
+
+         // A floor along the bottom row and one brick above it.
+         for (int x = 0; x < 8; x++) {
+            map.set_id(Point<int>(x, 3), 1);
+         }
+         map.set_id(Point<int>(5, 2), 1);
+         map.set_id(Point<int>(2, 2), 3);
+         assert_true(map.get_block(Point<int>(2, 2)).name == "flower");
+
+         vector<Point<int>> visited;
+         map.visit_region(Rect<int>(6, 1, 10, 2), [&](const Point<int>& pt, BlockId id) {
+            visited.push_back(pt);
+         });
+         assert_true(visited == vector<Point<int>>({
+            Point<int>(6, 1), Point<int>(7, 1), Point<int>(6, 2), Point<int>(7, 2)}));
+
+         // Standing on the floor between two cells, touching the brick.
+         vector<Rect<float>> solids;
+         map.get_solid_rects(Rect<float>(60, 32.5, 20, 15.5), solids);
+         for (auto R : solids) {
+            cout << "Solid: " << R << endl;
+         }
+         assert_equal<size_t>(solids.size(), 4);
+         assert_true(solids[0] == Rect<float>(80, 32, 16, 16));
+         assert_true(solids[1] == Rect<float>(48, 48, 16, 16));
+
+         solids.clear();
+         map.get_solid_rects(Rect<float>(-40, -40, 8, 8), solids);
+         assert_true(solids.empty());
+
+         bool thrown = false;
+         try {
+            BlockMap(make_block_set(), Size<int>(2, 2), Size<int>(16, 16), vector<BlockId>(3));
+         } catch (const LevelDataException& e) {
+            thrown = true;
+         }
+         assert_true(thrown);
+
+         // Borrowed cells without an owner are copied on first change.
+         const BlockId borrowedCells[] = {1, 2, 3, 4};
+         BlockMap borrowed(make_block_set(), Size<int>(2, 2), Size<int>(16, 16), borrowedCells, nullptr);
+         BlockMap copy(borrowed);
+         assert_true(copy.get_cells() == borrowedCells);
+         copy.set_id(Point<int>(1, 1), 0);
+         assert_true(copy.get_cells() != borrowedCells);
+         assert_true(copy.get_id(Point<int>(1, 1)) == 0);
+         assert_true(copy.get_id(Point<int>(1, 0)) == 2);
+         assert_true(borrowed.get_id(Point<int>(1, 1)) == 4);
+
+         return true;
+      })
+      .test("Level-003: Chunked block map rendering", [&]()->bool {
+         // 64x64 cells of 8x8 pixels, in chunks of 16x16 cells.
+         auto map = make_shared<BlockMap>(make_block_set(), Size<int>(64, 64), Size<int>(8, 8), 1);
+         auto tileset = make_shared<null::Image>(Rect<int>(0, 0, 32, 8));
+         TargetRenderer renderer(Size<int>(256, 128), true);
+
+         BlockMapRenderer layerRenderer(map, tileset, 16, 8);
+         assert_true(layerRenderer.get_chunk_size() == Size<int>(128, 128));
+
+         // A viewport offset by half a chunk overlaps 3x2 chunks.
+         layerRenderer.paint(renderer, Point<int>(64, 64));
+         assert_equal(layerRenderer.get_chunks_drawn(), 6);
+         assert_equal(renderer.screenDraws, 6);
+         assert_equal(renderer.targetDraws, 6 * 256);
+
+         // Unchanged chunks are drawn from the cache.
+         layerRenderer.paint(renderer, Point<int>(64, 64));
+         assert_equal(renderer.screenDraws, 12);
+         assert_equal(renderer.targetDraws, 6 * 256);
+
+         layerRenderer.invalidate(Point<int>(20, 20));
+         layerRenderer.paint(renderer, Point<int>(64, 64));
+         assert_equal(renderer.targetDraws, 7 * 256);
+
+         // Hidden tiles are skipped, and the viewport is clipped to the map.
+         layerRenderer.set_tile(1, -1);
+         layerRenderer.paint(renderer, Point<int>(-200, -100));
+         assert_equal(layerRenderer.get_chunks_drawn(), 1);
+         assert_equal(renderer.targetDraws, 7 * 256);
+         assert_true(layerRenderer.get_cached_chunks() <= 8);
+
+         // Without render targets, visible chunks are drawn tile by tile.
+         TargetRenderer plainRenderer(Size<int>(256, 128), false);
+         BlockMapRenderer plainLayerRenderer(map, tileset, 16, 8);
+         plainLayerRenderer.paint(plainRenderer, Point<int>(0, 0));
+         assert_equal(plainRenderer.screenDraws, 2 * 256);
+         assert_equal<size_t>(plainLayerRenderer.get_cached_chunks(), 0);
+
+         return true;
+      })
+      .run();
+}
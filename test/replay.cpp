@@ -0,0 +1,230 @@
+#include <sstream>
+
+#include "lost_levels/engine.h"
+#include "lost_levels/graphics_null.h"
+#include "lain/testing.h"
+
+using namespace std;
+using namespace lain;
+using namespace lain::testing;
+using namespace lost_levels;
+
+const uint32_t PHYSICS_INTERVAL = 10;
+const int KEY_QUIT = 0;
+
+struct TestEvent {
+   int key;
+   uint32_t time;
+};
+
+/**
+ * What a TestState saw: the key of each event it received, and the
+ * number of updates which had run when it was received.
+ */
+struct TestLog {
+   vector<pair<int, int>> keys;
+   int updates = 0;
+   int paints = 0;
+};
+
+/**
+ * Reads events from the engine, and quits when KEY_QUIT is received.
+ */
+class TestState : public State {
+public:
+   TestState(Engine& engine, TestLog* log, const uint64_t* now) :
+      State(engine), log(log), now(now) { }
+
+   void initialize() override { }
+
+   void input() override {
+      TestEvent e;
+      while (engine.poll_input(e, [&](TestEvent* e) { return poll(e); })) {
+         log->keys.push_back(make_pair(e.key, log->updates));
+         if (e.key == KEY_QUIT) {
+            engine.pop_state();
+            return;
+         }
+      }
+   }
+
+   void update() override {
+      log->updates++;
+   }
+
+   void paint() override {
+      log->paints++;
+   }
+
+private:
+   /**
+    * Delivers a key every 25ms of wall time, then quits after 400ms.
+    */
+   bool poll(TestEvent* e) {
+      if (*now < nextEvent) {
+         return false;
+      }
+
+      e->time = (uint32_t)*now;
+      e->key = *now >= 400 ? KEY_QUIT : ++lastKey;
+      nextEvent += 25;
+      return true;
+   }
+
+   TestLog* log;
+   const uint64_t* now;
+   uint64_t nextEvent = 25;
+   int lastKey = 0;
+};
+
+/**
+ * An engine whose clock advances by a fixed step whenever it would
+ * otherwise sleep.
+ */
+class TestEngine : public Engine {
+public:
+   TestEngine(TestLog& log, uint32_t delayStep) :
+      log(log), delayStep(delayStep) { }
+
+   void initialize() override {
+      auto clock = [this]() { return now; };
+      set_physics_timer(EngineTimer::create(clock, PHYSICS_INTERVAL));
+      set_graphics_timer(EngineTimer::create(clock, 5));
+      set_window(null::create_window(Size<int>(256, 224)));
+      set_renderer(null::create_renderer(Size<int>(256, 224)));
+      push_state<TestState>(&log, &now);
+   }
+
+   void delay() override {
+      now += delayStep;
+   }
+
+private:
+   TestLog& log;
+   uint32_t delayStep;
+   uint64_t now = 0;
+};
+
+int main() {
+   return TestSuite("lost_levels replay tests")
+      .die_on_signal(SIGSEGV)
+      .test("Replay-001: Recording round trip", [&]()->bool {
+         Recording recording(16);
+         TestEvent a = {1, 100}, b = {2, 200}, c;
+
+         recording.add_steps(1);
+         recording.end_frame();
+         recording.add_event(&a, sizeof(a));
+         recording.add_event(&b, sizeof(b));
+         recording.add_steps(2);
+         recording.end_frame();
+         recording.add_event(&a, sizeof(a));
+
+         // The unfinished frame is written too.
+         stringstream sb;
+         recording.write(sb);
+         auto copy = Recording::read(sb);
+
+         assert_equal<size_t>(copy->get_num_frames(), 3);
+         assert_equal<uint32_t>(copy->get_physics_interval(), 16);
+         assert_equal<size_t>(copy->get_event_size(), sizeof(TestEvent));
+         assert_equal<size_t>(copy->get_num_events(), 3);
+         assert_equal<uint64_t>(copy->get_total_steps(), 3);
+         assert_equal<uint32_t>(copy->get_steps(0), 1);
+         assert_equal<uint32_t>(copy->get_num_events(0), 0);
+         assert_equal<uint32_t>(copy->get_steps(1), 2);
+         assert_equal<uint32_t>(copy->get_num_events(1), 2);
+         assert_equal<uint32_t>(copy->get_num_events(2), 1);
+
+         copy->get_event(1, 1, &c, sizeof(c));
+         assert_equal(c.key, 2);
+         assert_equal<uint32_t>(c.time, 200);
+         copy->get_event(2, 0, &c, sizeof(c));
+         assert_equal(c.key, 1);
+
+         return true;
+      })
+      .test("Replay-002: Invalid recordings", [&]()->bool {
+         Recording recording;
+         TestEvent e = {1, 0};
+         recording.add_event(&e, sizeof(e));
+
+         bool thrown = false;
+         try {
+            recording.add_event(&e, sizeof(e) - 1);
+         } catch (const ReplayException& e) {
+            thrown = true;
+         }
+         assert_true(thrown);
+
+         stringstream sb;
+         recording.write(sb);
+         string data = sb.str();
+
+         thrown = false;
+         try {
+            stringstream truncated(data.substr(0, data.size() - 1));
+            Recording::read(truncated);
+         } catch (const ReplayException& e) {
+            thrown = true;
+         }
+         assert_true(thrown);
+
+         thrown = false;
+         try {
+            stringstream garbage("LLNOTAREPLAY");
+            Recording::read(garbage);
+         } catch (const ReplayException& e) {
+            thrown = true;
+         }
+         assert_true(thrown);
+
+         return true;
+      })
+      .test("Replay-003: Engine record and replay", [&]()->bool {
+         TestLog recorded;
+         TestEngine recorder(recorded, 3);
+         recorder.set_recording(true);
+         assert_equal(recorder.run(), 0);
+
+         auto recording = recorder.get_recording();
+         assert_true(recording != nullptr);
+         assert_true(recorded.keys.size() > 1);
+         assert_true(recorded.updates > 0);
+         assert_equal<uint64_t>(recording->get_total_steps(), recorded.updates);
+         assert_equal<size_t>(recording->get_num_events(), recorded.keys.size());
+
+         stringstream sb;
+         recording->write(sb);
+         auto loaded = Recording::read(sb);
+
+         // A different clock step would change what each frame sees,
+         // but the replay ignores the clock entirely.
+         TestLog replayed;
+         TestEngine player(replayed, 7);
+         player.set_replay(loaded);
+         assert_equal(player.run(), 0);
+         assert_true(replayed.keys == recorded.keys);
+         assert_equal(replayed.updates, recorded.updates);
+         assert_true(replayed.paints > 0);
+
+         TestLog unpainted;
+         TestEngine headless(unpainted, 7);
+         headless.set_replay(loaded, false);
+         assert_equal(headless.run(), 0);
+         assert_true(unpainted.keys == recorded.keys);
+         assert_equal(unpainted.updates, recorded.updates);
+         assert_equal(unpainted.paints, 0);
+
+         // The physics interval must match the recording's.
+         Recording mismatched(PHYSICS_INTERVAL + 1);
+         mismatched.end_frame();
+         TestLog failed;
+         TestEngine wrong(failed, 1);
+         wrong.set_replay(make_shared<Recording>(mismatched));
+         assert_equal(wrong.run(), 1);
+
+         return true;
+      })
+      .run();
+}
@@ -0,0 +1,229 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+
+#include "lost_levels/graphics_null.h"
+#include "lost_levels/resources.h"
+#include "lain/testing.h"
+
+using namespace std;
+using namespace lain;
+using namespace lain::testing;
+using namespace lost_levels;
+
+/**
+ * Another implementation of Image, which shares its resource type.
+ */
+class OtherImage : public null::Image {
+public:
+   using null::Image::Image;
+};
+
+/**
+ * Like a real ImageLoader, fails to decode files which don't exist,
+ * optionally taking some time over each one.
+ */
+class FileImageLoader : public null::ImageLoader {
+public:
+   FileImageLoader(chrono::milliseconds delay = chrono::milliseconds(0)) :
+      null::ImageLoader(Size<int>(16, 16)), delay(delay) { }
+
+   shared_ptr<DecodedImage> decode_image(const string& filename) const override {
+      this_thread::sleep_for(delay);
+      if (! ifstream(filename)) {
+         throw GraphicsException("No such image: " + filename);
+      }
+
+      numDecoded ++;
+      return null::ImageLoader::decode_image(filename);
+   }
+
+   chrono::milliseconds delay;
+   mutable atomic<int> numDecoded {0};
+};
+
+const char* RESOURCE_FILE = "resources-test.json";
+const char* IMAGE_FILE = "resources-test.png";
+
+void write_file(const string& filename, const string& content) {
+   ofstream out(filename);
+   out << content;
+}
+
+/**
+ * Write a resource file declaring the given number of images named
+ * "image-N", and an animation of the first.
+ */
+void write_resource_file(int numImages, const string& imageFile = IMAGE_FILE) {
+   string images;
+   for (int x = 0; x < numImages; x++) {
+      images += tfm::format("%s{\"name\": \"image-%d\", \"file\": \"%s\", \"atlas\": %s}",
+                            x > 0 ? ", " : "", x, imageFile, x % 2 == 0 ? "true" : "false");
+   }
+
+   write_file(IMAGE_FILE, "not really a png");
+   write_file(RESOURCE_FILE, tfm::format(
+      "{\"images\": [%s],\n"
+      " \"animations\": [{\"name\": \"spin\", \"image\": \"image-0\",\n"
+      "                   \"width\": 8, \"height\": 8, \"frames\": [\"0,1\", \"1,1\"]}]}\n",
+      images));
+}
+
+bool has_image(const ResourceManager& rm, const string& name) {
+   try {
+      rm.resolve<Image>(name);
+      return true;
+   } catch (const ResourceException& e) {
+      return false;
+   }
+}
+
+unsigned int get_time() {
+   return 0;
+}
+
+int main() {
+   return TestSuite("lost_levels resource tests")
+      .die_on_signal(SIGSEGV)
+      .test("Resources-001: Resolve and get by handle", [&]()->bool {
+         ResourceManager rm(Timer<uint64_t>::create(get_time, 1),
+                            null::create_image_loader());
+         auto fontA = ImageFont::create(nullptr, Size<int>(8, 8));
+         auto fontB = ImageFont::create(nullptr, Size<int>(4, 4));
+
+         rm.put("a", fontA);
+         rm.put("b", fontB);
+
+         ResourceHandle<ImageFont> handleA = rm.resolve<ImageFont>("a");
+         ResourceHandle<ImageFont> handleB = rm.resolve<ImageFont>("b");
+         assert_true(handleA.is_valid());
+         assert_true(handleA != handleB);
+         assert_true(handleA == rm.resolve<ImageFont>("a"));
+         assert_true(rm.get(handleA) == fontA);
+         assert_true(rm.get(handleB) == fontB);
+         assert_true(rm.get<ImageFont>("b") == fontB);
+
+         // Names are cast dynamically, so a different class sharing the
+         // resource type isn't returned.
+         rm.put("image", make_shared<null::Image>(Rect<int>(0, 0, 8, 8)));
+         assert_true(rm.get<null::Image>("image") != nullptr);
+         assert_true(rm.get<OtherImage>("image") == nullptr);
+
+         bool thrown = false;
+         try {
+            rm.resolve<Animation>("a");
+         } catch (const ResourceException& e) {
+            thrown = true;
+         }
+         assert_true(thrown);
+
+         thrown = false;
+         try {
+            rm.put("a", fontB);
+         } catch (const ResourceException& e) {
+            cout << e.what() << endl;
+            thrown = true;
+         }
+         assert_true(thrown);
+
+         thrown = false;
+         try {
+            rm.get(ResourceHandle<ImageFont>());
+         } catch (const ResourceException& e) {
+            thrown = true;
+         }
+         assert_true(thrown);
+
+         return true;
+      })
+      .test("Resources-002: Load a resource file asynchronously", [&]()->bool {
+         auto loader = make_shared<FileImageLoader>();
+         ResourceManager rm(Timer<uint64_t>::create(get_time, 1), loader);
+         write_resource_file(5);
+
+         vector<pair<size_t, size_t>> progress;
+         auto load = rm.load_file_async(RESOURCE_FILE, 2);
+         load->set_progress_callback([&](size_t done, size_t total) {
+            progress.push_back(make_pair(done, total));
+         });
+         assert_equal<size_t>(load->get_total(), 5);
+
+         while (! load->update()) {
+            assert_true(load->get_progress() >= 0.0f && load->get_progress() < 1.0f);
+            this_thread::yield();
+         }
+
+         assert_true(load->is_complete());
+         assert_true(load->get_progress() == 1.0f);
+         assert_equal<size_t>(load->get_done(), 5);
+         assert_true(progress.back() == make_pair<size_t, size_t>(5, 5));
+         assert_equal(loader->numDecoded.load(), 5);
+         for (int x = 0; x < 5; x++) {
+            assert_true(has_image(rm, tfm::format("image-%d", x)));
+         }
+         assert_true(rm.get<Animation>("spin") != nullptr);
+
+         // Further updates do nothing.
+         size_t numReports = progress.size();
+         assert_true(load->update());
+         assert_equal(progress.size(), numReports);
+
+         remove(RESOURCE_FILE);
+         remove(IMAGE_FILE);
+         return true;
+      })
+      .test("Resources-003: Report asynchronous load failures", [&]()->bool {
+         ResourceManager rm(Timer<uint64_t>::create(get_time, 1),
+                            make_shared<FileImageLoader>());
+
+         bool thrown = false;
+         try {
+            rm.load_file_async("resources-test-missing.json");
+         } catch (const ResourceException& e) {
+            thrown = true;
+         }
+         assert_true(thrown);
+
+         write_resource_file(3, "resources-test-missing.png");
+         auto load = rm.load_file_async(RESOURCE_FILE, 2);
+
+         thrown = false;
+         try {
+            load->wait();
+         } catch (const ResourceException& e) {
+            cout << e.what() << endl;
+            thrown = true;
+         }
+         assert_true(thrown);
+         assert_false(load->is_complete());
+         assert_false(has_image(rm, "image-0"));
+
+         remove(RESOURCE_FILE);
+         remove(IMAGE_FILE);
+         return true;
+      })
+      .test("Resources-004: Cancel an incomplete asynchronous load", [&]()->bool {
+         auto loader = make_shared<FileImageLoader>(chrono::milliseconds(10));
+         ResourceManager rm(Timer<uint64_t>::create(get_time, 1), loader);
+         write_resource_file(50);
+
+         auto load = rm.load_file_async(RESOURCE_FILE, 1);
+         assert_false(load->update());
+         load = nullptr;
+
+         // The workers have stopped, and nothing was added.
+         int decoded = loader->numDecoded.load();
+         assert_true(decoded < 50);
+         this_thread::sleep_for(chrono::milliseconds(30));
+         assert_equal(loader->numDecoded.load(), decoded);
+         assert_false(has_image(rm, "image-0"));
+         assert_false(has_image(rm, "image-49"));
+
+         remove(RESOURCE_FILE);
+         remove(IMAGE_FILE);
+         return true;
+      })
+      .run();
+}
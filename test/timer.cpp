@@ -1,3 +1,6 @@
+#include <cmath>
+
+#include "lost_levels/pacing.h"
 #include "lost_levels/timer_sdl2.h"
 #include "lain/testing.h"
 
@@ -31,6 +34,19 @@ double run_timer_sim(int fps, const unsigned int frames) {
    return totalErrorTime;
 }
 
+/**
+ * A clock policy advanced by hand, for deterministic tests.
+ */
+struct ManualClock {
+   ManualClock(const uint64_t* now) : now(now) { }
+
+   uint64_t operator()() const {
+      return *now;
+   }
+
+   const uint64_t* now;
+};
+
 int main() {
    srand(time(0));
 
@@ -120,6 +136,87 @@ int main() {
          
          return true; 
       })
+      .test("Timer-004: Test clock policy timers.", [&]()->bool {
+         // 60FPS in microseconds, which a millisecond timer can't represent.
+         const uint64_t interval = 1000000 / 60;
+         uint64_t now = 0;
+         auto timer = Timer<uint64_t, ManualClock>::create(ManualClock(&now), interval, true);
+         timer->start();
+
+         for (now = 0; now < 1000000; now += 1000) {
+            timer->update();
+         }
+         cout << "Manual clock frames: " << timer->get_frames() << endl;
+         assert_true(timer->get_frames() >= 59 && timer->get_frames() <= 60);
+
+         auto relative = timer->relative_timer(10);
+         relative->start();
+         for (now = 1000000; now < 2000000; now += 1000) {
+            timer->update();
+            relative->update();
+         }
+         assert_equal<uint64_t>(relative->get_frames(), 6);
+
+         auto steady = Timer<uint64_t, SteadyClock<>>::create(
+            SteadyClock<>(), SteadyClock<>::per_second() / 1000);
+         steady->start();
+         while (steady->get_frames() < 10) {
+            steady->update();
+         }
+
+         auto precise = sdl2::create_performance_timer(1000);
+         precise->start();
+         while (precise->get_frames() < 10) {
+            precise->update();
+         }
+
+         return true;
+      })
+      .test("Timer-005: Test interpolation alpha and resync.", [&]()->bool {
+         uint64_t now = 0;
+         auto timer = Timer<uint64_t, ManualClock>::create(ManualClock(&now), 100, true);
+         timer->start();
+
+         now = 25;
+         assert_false(timer->update());
+         assert_true(fabs(timer->get_alpha() - 0.25) < 1e-9);
+
+         // Stall for several intervals, then drop the backlog.
+         now = 1050;
+         assert_true(timer->update());
+         assert_equal<uint64_t>(timer->resync(), 9);
+         assert_false(timer->update());
+         assert_equal<uint64_t>(timer->get_frames(), 1);
+         assert_true(timer->get_alpha() == 0.0);
+
+         now = 1150;
+         assert_true(timer->update());
+         assert_equal<uint64_t>(timer->get_frames(), 2);
+
+         return true;
+      })
+      .test("Timer-006: Test frame pacer accuracy.", [&]()->bool {
+         FramePacer pacer;
+
+         // How late each wait returns depends on the machine's load, so
+         // only the deadline itself is checked.
+         for (int x = 0; x < 100; x++) {
+            FramePacer::Clock::time_point deadline = FramePacer::Clock::now() +
+               chrono::microseconds(1000 + rand() % 8000);
+            pacer.wait_until(deadline);
+            assert_true(FramePacer::Clock::now() >= deadline);
+         }
+
+         cout << "Sleep overshoot: " << pacer.get_sleep_overshoot() << "us, "
+              << "lateness: " << pacer.get_lateness() << "us, "
+              << "margin: " << pacer.get_margin().count() << "us" << endl;
+         assert_true(pacer.get_lateness() >= 0.0);
+         assert_true(pacer.get_sleep_overshoot() >= 0.0);
+         assert_true(pacer.get_margin() >= chrono::microseconds(500) &&
+                     pacer.get_margin() <= chrono::microseconds(4000));
+
+         return true;
+      })
       .run();
 }
 
@@ -0,0 +1,174 @@
+#include <atomic>
+
+#include "lost_levels/graphics_null.h"
+#include "lost_levels/world.h"
+#include "lain/testing.h"
+
+using namespace std;
+using namespace lain;
+using namespace lain::testing;
+using namespace lost_levels;
+
+const Size<int> REGION_SIZE = Size<int>(8, 8);
+const Size<int> BLOCK_SIZE = Size<int>(16, 16);
+const size_t REGION_BYTES = 8 * 8 * sizeof(BlockId);
+
+/**
+ * Generates regions with a solid block at their top left cell, tagged
+ * with the region's column in the cell to its right.  Regions in the
+ * given empty column are empty, and regions in the given bad column
+ * fail to load.
+ */
+class TestRegionSource : public RegionSource {
+public:
+   TestRegionSource(int emptyColumn = -1, int badColumn = -1) :
+      emptyColumn(emptyColumn), badColumn(badColumn),
+      blockSet(make_shared<BlockDataSet>(vector<BlockData> {
+         BlockData("air", 0), BlockData("stone", 1, true), BlockData("tag", 2)})) { }
+
+   shared_ptr<BlockMap> load_region(const Point<int>& region) const override {
+      loads ++;
+
+      if (region.x == badColumn) {
+         throw LevelDataException("Bad region.");
+
+      } else if (region.x == emptyColumn) {
+         return nullptr;
+      }
+
+      auto blockMap = make_shared<BlockMap>(blockSet, REGION_SIZE, BLOCK_SIZE);
+      blockMap->set_id(Point<int>(0, 0), 1);
+      blockMap->set_id(Point<int>(1, 0), 2 + region.x);
+      return blockMap;
+   }
+
+   int emptyColumn;
+   int badColumn;
+   shared_ptr<BlockDataSet> blockSet;
+   mutable atomic<int> loads {0};
+};
+
+unsigned int get_time() {
+   return 0;
+}
+
+int main() {
+   return TestSuite("lost_levels world tests")
+      .die_on_signal(SIGSEGV)
+      .test("World-001: Load regions around the view", [&]()->bool {
+         auto source = make_shared<TestRegionSource>(2);
+         StreamingWorld world(source, Size<int>(4, 4), REGION_SIZE, BLOCK_SIZE);
+         ResourceManager rm(Timer<uint64_t>::create(get_time, 1),
+                            null::create_image_loader());
+         world.track_residency(rm);
+         world.set_preload_margin(0);
+
+         int loaded = 0;
+         world.set_load_callback([&](const StreamingWorld::Region& region) {
+            loaded ++;
+         });
+
+         // Regions are 128x128, so this view spans regions (0..2, 0).
+         world.update(Rect<int>(64, 0, 256, 64));
+         world.wait();
+
+         assert_true(world.get_num_resident() == 3u);
+         assert_true(world.get_num_pending() == 0u);
+         assert_true(loaded == 3);
+         assert_true(world.is_resident(Point<int>(1, 0)));
+         assert_false(world.is_resident(Point<int>(1, 1)));
+         assert_true(world.get_resident_bytes() == 2 * REGION_BYTES);
+
+         // The empty region is resident but holds no map.
+         assert_true(world.get_region(Point<int>(2, 0))->blockMap == nullptr);
+         assert_true(world.get_region(Point<int>(3, 0)) == nullptr);
+
+         assert_true(world.get_id(Point<int>(9, 0)) == 3);
+         assert_true(world.get_id(Point<int>(8, 0)) == 1);
+         assert_true(world.get_id(Point<int>(8, 8)) == 0);
+         assert_true(world.get_region_rect(Point<int>(1, 0)) == Rect<int>(128, 0, 128, 128));
+
+         vector<Rect<float>> solids;
+         world.get_solid_rects(Rect<float>(100, 4, 40, 8), solids);
+         assert_true(solids.size() == 1u);
+         assert_true(solids[0] == Rect<float>(128, 0, 16, 16));
+
+         assert_true(rm.is_resident<BlockMap>("region:1,0"));
+         assert_false(rm.is_resident<BlockMap>("region:2,0"));
+         assert_true(rm.get<BlockMap>("region:0,0") == world.get_region(Point<int>(0, 0))->blockMap);
+         assert_true(rm.get_streamed_bytes() == 2 * REGION_BYTES);
+
+         // Regions already resident or pending are not requested again.
+         world.update(Rect<int>(64, 0, 256, 64));
+         world.wait();
+         assert_true(source->loads == 3);
+
+         return true;
+      })
+      .test("World-002: Evict regions over the budget", [&]()->bool {
+         auto source = make_shared<TestRegionSource>();
+         StreamingWorld world(source, Size<int>(8, 1), REGION_SIZE, BLOCK_SIZE);
+         ResourceManager rm(Timer<uint64_t>::create(get_time, 1),
+                            null::create_image_loader());
+         world.track_residency(rm);
+         world.set_preload_margin(0);
+         world.set_memory_budget(3 * REGION_BYTES);
+
+         vector<int> evicted;
+         world.set_evict_callback([&](const StreamingWorld::Region& region) {
+            evicted.push_back(region.index.x);
+         });
+
+         for (int x = 0; x < 6; x++) {
+            world.update(Rect<int>(x * 128, 0, 128, 128));
+            world.wait();
+         }
+
+         assert_true(world.get_num_resident() == 3u);
+         assert_true(world.get_resident_bytes() == 3 * REGION_BYTES);
+         assert_true(evicted == vector<int>({0, 1, 2}));
+         assert_true(world.is_resident(Point<int>(5, 0)));
+         assert_false(world.is_resident(Point<int>(0, 0)));
+         assert_false(rm.is_resident<BlockMap>("region:0,0"));
+         assert_true(rm.get_num_streamed() == 3u);
+
+         bool thrown = false;
+         try {
+            rm.get<BlockMap>("region:0,0");
+         } catch (const ResourceException& e) {
+            thrown = true;
+         }
+         assert_true(thrown);
+
+         // Regions in view are kept, even over budget.
+         world.set_memory_budget(0);
+         world.update(Rect<int>(5 * 128, 0, 128, 128));
+         assert_true(world.is_resident(Point<int>(5, 0)));
+         assert_true(world.get_num_resident() == 1u);
+
+         return true;
+      })
+      .test("World-003: Report regions which fail to load", [&]()->bool {
+         StreamingWorld world(make_shared<TestRegionSource>(-1, 1),
+                              Size<int>(4, 1), REGION_SIZE, BLOCK_SIZE);
+         world.set_preload_margin(0);
+         world.update(Rect<int>(0, 0, 256, 128));
+
+         bool thrown = false;
+         try {
+            world.wait();
+         } catch (const WorldException& e) {
+            cout << e.what() << endl;
+            thrown = true;
+         }
+         assert_true(thrown);
+
+         // The regions which did load are resident despite the failure.
+         assert_true(world.is_resident(Point<int>(0, 0)));
+         assert_false(world.is_resident(Point<int>(1, 0)));
+         assert_equal<size_t>(world.get_num_pending(), 0);
+
+         return true;
+      })
+      .run();
+}
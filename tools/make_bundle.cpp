@@ -0,0 +1,160 @@
+/*
+ * make_bundle: Convert a resource file into a bundle.
+ *
+ * Author: Lain Supe (lainproliant)
+ * Date: Wednesday, Oct 14 2026
+ */
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+#include "lain/settings.h"
+#include "lost_levels/bundle.h"
+#include "lost_levels/graphics_sdl2.h"
+#include "apathy/path.hpp"
+
+using namespace std;
+using namespace lain;
+using namespace lost_levels;
+namespace fs = apathy;
+
+typedef sdl2::SurfacePtr SurfacePtr;
+
+struct ImageSource {
+   string name;
+   bool atlas;
+   SurfacePtr surface;
+};
+
+SurfacePtr create_page_surface(const Size<int>& sz) {
+   SurfacePtr surface(SDL_CreateRGBSurfaceWithFormat(
+      0, sz.width, sz.height, 32, SDL_PIXELFORMAT_RGBA32), SDL_FreeSurface);
+
+   if (surface == nullptr) {
+      throw GraphicsException(tfm::format("Failed to create page surface: %s",
+         string(SDL_GetError())));
+   }
+
+   return surface;
+}
+
+void blit(SDL_Surface* src, SDL_Surface* dst, const Rect<int>& rect) {
+   SDL_Rect dstRect = {rect.pt.x, rect.pt.y, rect.sz.width, rect.sz.height};
+   SDL_SetSurfaceBlendMode(src, SDL_BLENDMODE_NONE);
+   SDL_BlitSurface(src, nullptr, dst, &dstRect);
+}
+
+vector<ImageSource> load_images(const fs::Path& baseIn, const vector<Settings>& objects) {
+   fs::Path base = baseIn;
+   vector<ImageSource> images;
+
+   for (Settings obj : objects) {
+      string filename = base.relative(obj.get<string>("file")).string();
+      SurfacePtr surface(IMG_Load(filename.c_str()), SDL_FreeSurface);
+
+      if (surface == nullptr) {
+         throw GraphicsException(tfm::format("Failed to load image from file '%s': %s",
+            filename, string(SDL_GetError())));
+      }
+
+      images.push_back(ImageSource {obj.get<string>("name"),
+         obj.get_default<bool>("atlas", true), move(surface)});
+   }
+
+   return images;
+}
+
+/**
+ * Pack the images into atlas pages the same way as AtlasImageLoader,
+ * giving images which are excluded from the atlas or too large for a
+ * page a page of their own.
+ */
+void add_images(BundleWriter& writer, const vector<ImageSource>& images,
+                const Size<int>& szPage) {
+   vector<size_t> packed;
+   vector<Size<int>> sizes;
+
+   for (size_t x = 0; x < images.size(); x++) {
+      if (images[x].atlas) {
+         packed.push_back(x);
+         sizes.push_back(Size<int>(images[x].surface->w, images[x].surface->h));
+      }
+   }
+
+   AtlasPacker packer(szPage);
+   vector<AtlasPacker::Placement> placements = packer.pack(sizes);
+
+   for (int page = 0; page < packer.get_page_count(); page++) {
+      SurfacePtr pageSurface = create_page_surface(packer.get_page_size(page));
+
+      for (size_t x = 0; x < placements.size(); x++) {
+         if (placements[x].page == page) {
+            blit(images[packed[x]].surface.get(), pageSurface.get(), placements[x].rect);
+         }
+      }
+
+      int pageIdx = writer.add_atlas_page(packer.get_page_size(page),
+         pageSurface->pixels, pageSurface->pitch);
+
+      for (size_t x = 0; x < placements.size(); x++) {
+         if (placements[x].page == page) {
+            writer.add_image(images[packed[x]].name, pageIdx, placements[x].rect);
+         }
+      }
+   }
+
+   for (size_t x = 0; x < images.size(); x++) {
+      auto iter = find(packed.begin(), packed.end(), x);
+      if (iter != packed.end() && placements[iter - packed.begin()].page != -1) {
+         continue;
+      }
+
+      Rect<int> rect(0, 0, images[x].surface->w, images[x].surface->h);
+      SurfacePtr pageSurface = create_page_surface(rect.sz);
+      blit(images[x].surface.get(), pageSurface.get(), rect);
+
+      int pageIdx = writer.add_atlas_page(rect.sz, pageSurface->pixels, pageSurface->pitch);
+      writer.add_image(images[x].name, pageIdx, rect);
+   }
+}
+
+void add_animations(BundleWriter& writer, const vector<Settings>& objects) {
+   for (Settings obj : objects) {
+      writer.add_animation(obj.get<string>("name"), obj.get<string>("image"),
+         Size<int>(obj.get<int>("width"), obj.get<int>("height")),
+         Animation::parse_frames(obj.get_array<string>("frames")),
+         obj.get_default<bool>("loop", false));
+   }
+}
+
+int main(int argc, char** argv) {
+   if (argc < 3) {
+      cerr << "usage: " << argv[0] << " <resource.json> <output.llb> [page size]" << endl;
+      return 1;
+   }
+
+   int pageDim = argc > 3 ? atoi(argv[3]) : 2048;
+
+   try {
+      Settings settings = Settings::load_from_file(argv[1]);
+      fs::Path base = fs::Path(argv[1]).parent();
+      BundleWriter writer;
+
+      if (settings.contains("images")) {
+         add_images(writer, load_images(base, settings.get_object_array("images")),
+                    Size<int>(pageDim, pageDim));
+      }
+
+      if (settings.contains("animations")) {
+         add_animations(writer, settings.get_object_array("animations"));
+      }
+
+      writer.save(argv[2]);
+
+   } catch (const exception& e) {
+      cerr << "Failed to convert '" << argv[1] << "': " << e.what() << endl;
+      return 1;
+   }
+
+   return 0;
+}